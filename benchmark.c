@@ -0,0 +1,1017 @@
+#include <signal.h>
+#include <getopt.h>
+
+#define LDB_IMPL
+#include "logdb.h"
+
+#define BENCH_NAME          "benchmark"
+#define MAX_SIZE_CLASSES    16
+#define MAX_OPEN_SIZES      16
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV
+} format_e;
+
+typedef struct {
+    size_t bytes;                 // Record length
+    size_t weight;                // Relative frequency
+} size_class_t;
+
+typedef struct {
+    const char *scenarios;        // Comma-separated list of scenarios (NULL = all)
+    size_t num_records;           // Records of the base database
+    size_class_t sizes[MAX_SIZE_CLASSES]; // Record size distribution
+    size_t num_sizes;
+    size_t max_size;              // Maximum record length
+    size_t total_weight;          // Sum of weights
+    size_t records_per_commit;
+    size_t records_per_query;
+    size_t max_threads;           // Read scaling goes from 1 to max_threads (powers of 2)
+    size_t num_ops;               // Operations per latency measurement
+    size_t open_sizes[MAX_OPEN_SIZES]; // Dat file lengths of the recovery scenario
+    size_t num_open_sizes;
+    bool fsync_off;               // Run append with fsync disabled
+    bool fsync_on;                // Run append with fsync enabled
+    format_e format;
+    const char *output;           // Output file (NULL = stdout)
+} params_t;
+
+typedef struct {
+    char scenario[32];
+    char params[96];
+    size_t num_ops;
+    size_t num_records;
+    size_t num_bytes;
+    double seconds;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} result_t;
+
+typedef struct {
+    result_t *items;
+    size_t num;
+    size_t max;
+} results_t;
+
+typedef struct {
+    uint64_t *values;             // Latencies (nanoseconds)
+    size_t num;
+    size_t max;
+} samples_t;
+
+typedef struct {
+    ldb_db_t *db;
+    const params_t *params;
+    unsigned int seed;
+    uint64_t seqnum1;
+    uint64_t seqnum2;
+    samples_t samples;
+    size_t num_records;
+    size_t num_bytes;
+    int rc;
+} args_read_t;
+
+typedef void (*scenario_fn)(const params_t *params, results_t *results);
+
+static volatile bool interrupted = false;
+static const char *bytes_suffix[] = {"B", "KB", "MB", "GB", "TB"};
+#define BYTES_SUFFIX_LEN (sizeof(bytes_suffix)/sizeof(bytes_suffix[0]))
+
+static char *data = NULL;         // Record contents (max_size random bytes)
+
+static void signal_handler(int signum)
+{
+    (void)(signum);
+    interrupted = true;
+}
+
+static uint64_t get_nanos(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void fail(const char *msg, int rc)
+{
+    fprintf(stderr, "Error: %s (%s)\n", msg, ldb_strerror(rc));
+    exit(EXIT_FAILURE);
+}
+
+static void samples_add(samples_t *samples, uint64_t value)
+{
+    if (samples->num == samples->max)
+    {
+        size_t max = (samples->max ? 2 * samples->max : 1024);
+        uint64_t *values = (uint64_t *) realloc(samples->values, max * sizeof(uint64_t));
+
+        if (values == NULL)
+            fail("out of memory", LDB_ERR_MEM);
+
+        samples->values = values;
+        samples->max = max;
+    }
+
+    samples->values[samples->num++] = value;
+}
+
+static void samples_merge(samples_t *samples, const samples_t *other)
+{
+    for (size_t i = 0; i < other->num; i++)
+        samples_add(samples, other->values[i]);
+}
+
+static void samples_free(samples_t *samples)
+{
+    free(samples->values);
+    *samples = (samples_t){0};
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+// Nearest-rank percentile (samples sorted)
+static uint64_t percentile(const samples_t *samples, double p)
+{
+    if (samples->num == 0)
+        return 0;
+
+    size_t rank = (size_t)(p * (double) samples->num + 0.999999);
+    rank = ldb_clamp(rank, 1, samples->num);
+    return samples->values[rank - 1];
+}
+
+// Appends a result computed from the samples (sorted in place)
+static void add_result(results_t *results, const char *scenario, const char *params, samples_t *samples,
+                       size_t num_records, size_t num_bytes, double seconds)
+{
+    if (results->num == results->max)
+    {
+        size_t max = (results->max ? 2 * results->max : 32);
+        result_t *items = (result_t *) realloc(results->items, max * sizeof(result_t));
+
+        if (items == NULL)
+            fail("out of memory", LDB_ERR_MEM);
+
+        results->items = items;
+        results->max = max;
+    }
+
+    qsort(samples->values, samples->num, sizeof(uint64_t), compare_uint64);
+
+    result_t *result = &results->items[results->num++];
+    *result = (result_t){0};
+    snprintf(result->scenario, sizeof(result->scenario), "%s", scenario);
+    snprintf(result->params, sizeof(result->params), "%s", params);
+    result->num_ops = samples->num;
+    result->num_records = num_records;
+    result->num_bytes = num_bytes;
+    result->seconds = seconds;
+    result->p50_ns = percentile(samples, 0.50);
+    result->p99_ns = percentile(samples, 0.99);
+    result->p999_ns = percentile(samples, 0.999);
+    result->max_ns = (samples->num ? samples->values[samples->num - 1] : 0);
+
+    fprintf(stderr, "%-14s %-28s done\n", scenario, params);
+}
+
+static void remove_db(void)
+{
+    remove(BENCH_NAME ".dat");
+    remove(BENCH_NAME ".idx");
+    remove(BENCH_NAME ".chk");
+    remove(BENCH_NAME ".tmp");
+}
+
+static size_t file_size(const char *path)
+{
+    struct stat st = {0};
+    return (stat(path, &st) == 0 ? (size_t) st.st_size : 0);
+}
+
+// Draws a record length from the size distribution
+static size_t random_size(const params_t *params, unsigned int *seed)
+{
+    size_t value = (size_t) rand_r(seed) % params->total_weight;
+
+    for (size_t i = 0; i < params->num_sizes; i++) {
+        if (value < params->sizes[i].weight)
+            return params->sizes[i].bytes;
+        value -= params->sizes[i].weight;
+    }
+
+    return params->sizes[params->num_sizes - 1].bytes;
+}
+
+// Appends num records in batches of records_per_commit.
+// Timestamps increase by 0..3 units (irregular progression).
+// Latency of each ldb_append() is added to samples (if not NULL).
+static size_t append_records(ldb_db_t *db, const params_t *params, size_t num, samples_t *samples, unsigned int *seed)
+{
+    size_t rpc = params->records_per_commit;
+    ldb_entry_t *entries = (ldb_entry_t *) calloc(rpc, sizeof(ldb_entry_t));
+    uint64_t timestamp = ldb_max(db->state.timestamp2, 1);
+    size_t num_bytes = 0;
+    size_t count = 0;
+
+    if (entries == NULL)
+        fail("out of memory", LDB_ERR_MEM);
+
+    while (count < num && !interrupted)
+    {
+        size_t len = ldb_min(rpc, num - count);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            size_t bytes = random_size(params, seed);
+
+            timestamp += (uint64_t)(rand_r(seed) % 4);
+
+            entries[i] = (ldb_entry_t){
+                .seqnum = 0,
+                .timestamp = timestamp,
+                .metadata_len = 0,
+                .metadata = NULL,
+                .data_len = (uint32_t) bytes,
+                .data = data + (params->max_size - bytes)
+            };
+
+            num_bytes += bytes;
+        }
+
+        uint64_t time0 = get_nanos();
+        int rc = ldb_append(db, entries, len, NULL);
+
+        if (samples != NULL)
+            samples_add(samples, get_nanos() - time0);
+
+        if (rc != LDB_OK)
+            fail("append failed", rc);
+
+        count += len;
+    }
+
+    free(entries);
+    return num_bytes;
+}
+
+static void open_db(ldb_db_t *db, bool check)
+{
+    int rc = ldb_open(db, "", BENCH_NAME, check);
+
+    if (rc != LDB_OK)
+        fail("error opening database", rc);
+}
+
+// Opens the base database (num_records entries), created if not found
+static void open_base(ldb_db_t *db, const params_t *params)
+{
+    unsigned int seed = 1;
+
+    open_db(db, false);
+
+    if (db->state.seqnum1 == 1 && db->state.seqnum2 == params->num_records)
+        return;
+
+    ldb_close(db);
+    remove_db();
+    open_db(db, false);
+    append_records(db, params, params->num_records, NULL, &seed);
+}
+
+static void scenario_append(const params_t *params, results_t *results)
+{
+    for (int fsync = 0; fsync < 2 && !interrupted; fsync++)
+    {
+        if ((fsync == 0 && !params->fsync_off) || (fsync == 1 && !params->fsync_on))
+            continue;
+
+        ldb_db_t db = {0};
+        samples_t samples = {0};
+        unsigned int seed = 1;
+        char str[96] = {0};
+
+        remove_db();
+        open_db(&db, false);
+        db.force_fsync = (fsync == 1);
+
+        uint64_t time0 = get_nanos();
+        size_t num_bytes = append_records(&db, params, params->num_records, &samples, &seed);
+        double seconds = (double)(get_nanos() - time0) / 1e9;
+
+        snprintf(str, sizeof(str), "fsync=%s rpc=%zu", (fsync ? "on" : "off"), params->records_per_commit);
+        add_result(results, "append", str, &samples, params->num_records, num_bytes, seconds);
+
+        samples_free(&samples);
+        ldb_close(&db);
+    }
+}
+
+static void scenario_read_seq(const params_t *params, results_t *results)
+{
+    ldb_db_t db = {0};
+    samples_t samples = {0};
+    size_t rpq = params->records_per_query;
+    ldb_entry_t *entries = (ldb_entry_t *) calloc(rpq, sizeof(ldb_entry_t));
+    size_t num_records = 0;
+    size_t num_bytes = 0;
+    char str[96] = {0};
+
+    if (entries == NULL)
+        fail("out of memory", LDB_ERR_MEM);
+
+    open_base(&db, params);
+
+    uint64_t time0 = get_nanos();
+
+    for (uint64_t seqnum = db.state.seqnum1; seqnum <= db.state.seqnum2 && !interrupted; )
+    {
+        size_t num = 0;
+        uint64_t time1 = get_nanos();
+        int rc = ldb_read(&db, seqnum, entries, rpq, &num);
+
+        samples_add(&samples, get_nanos() - time1);
+
+        if (rc != LDB_OK)
+            fail("read failed", rc);
+
+        for (size_t i = 0; i < num; i++)
+            num_bytes += entries[i].metadata_len + entries[i].data_len;
+
+        num_records += num;
+        seqnum += num;
+    }
+
+    double seconds = (double)(get_nanos() - time0) / 1e9;
+
+    snprintf(str, sizeof(str), "rpq=%zu", rpq);
+    add_result(results, "read-seq", str, &samples, num_records, num_bytes, seconds);
+
+    samples_free(&samples);
+    ldb_free_entries(entries, rpq);
+    free(entries);
+    ldb_close(&db);
+}
+
+static void * run_read_random(void *arg)
+{
+    args_read_t *args = (args_read_t *) arg;
+    size_t rpq = args->params->records_per_query;
+    ldb_entry_t *entries = (ldb_entry_t *) calloc(rpq, sizeof(ldb_entry_t));
+    uint64_t range = args->seqnum2 - args->seqnum1 + 1;
+
+    if (entries == NULL) {
+        args->rc = LDB_ERR_MEM;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < args->params->num_ops && !interrupted; i++)
+    {
+        uint64_t seqnum = args->seqnum1 + (uint64_t) rand_r(&args->seed) % range;
+        size_t num = 0;
+
+        uint64_t time0 = get_nanos();
+        args->rc = ldb_read(args->db, seqnum, entries, rpq, &num);
+        samples_add(&args->samples, get_nanos() - time0);
+
+        if (args->rc != LDB_OK)
+            break;
+
+        for (size_t j = 0; j < num; j++)
+            args->num_bytes += entries[j].metadata_len + entries[j].data_len;
+
+        args->num_records += num;
+    }
+
+    ldb_free_entries(entries, rpq);
+    free(entries);
+    return NULL;
+}
+
+static void scenario_read_random(const params_t *params, results_t *results)
+{
+    ldb_db_t db = {0};
+    pthread_t *threads = (pthread_t *) calloc(params->max_threads, sizeof(pthread_t));
+    args_read_t *args = (args_read_t *) calloc(params->max_threads, sizeof(args_read_t));
+
+    if (threads == NULL || args == NULL)
+        fail("out of memory", LDB_ERR_MEM);
+
+    open_base(&db, params);
+
+    for (size_t num_threads = 1; num_threads <= params->max_threads && !interrupted; )
+    {
+        samples_t samples = {0};
+        size_t num_records = 0;
+        size_t num_bytes = 0;
+        char str[96] = {0};
+
+        uint64_t time0 = get_nanos();
+
+        for (size_t i = 0; i < num_threads; i++) {
+            args[i] = (args_read_t){ .db = &db, .params = params, .seed = (unsigned int)(i + 1),
+                                     .seqnum1 = db.state.seqnum1, .seqnum2 = db.state.seqnum2 };
+            pthread_create(&threads[i], NULL, run_read_random, &args[i]);
+        }
+
+        for (size_t i = 0; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
+
+        double seconds = (double)(get_nanos() - time0) / 1e9;
+
+        for (size_t i = 0; i < num_threads; i++)
+        {
+            if (args[i].rc != LDB_OK)
+                fail("read failed", args[i].rc);
+
+            samples_merge(&samples, &args[i].samples);
+            samples_free(&args[i].samples);
+            num_records += args[i].num_records;
+            num_bytes += args[i].num_bytes;
+        }
+
+        snprintf(str, sizeof(str), "threads=%zu rpq=%zu", num_threads, params->records_per_query);
+        add_result(results, "read-random", str, &samples, num_records, num_bytes, seconds);
+        samples_free(&samples);
+
+        // 1, 2, 4, ..., max_threads (last step can be a non power of 2)
+        if (num_threads == params->max_threads)
+            break;
+
+        num_threads = ldb_min(2 * num_threads, params->max_threads);
+    }
+
+    free(args);
+    free(threads);
+    ldb_close(&db);
+}
+
+// Search latency measured at db sizes 1000, 10000, ... up to num_records
+static void scenario_search(const params_t *params, results_t *results)
+{
+    ldb_db_t db = {0};
+    unsigned int seed = 1;
+    size_t num_entries = 0;
+
+    remove_db();
+    open_db(&db, false);
+
+    for (size_t target = 1000; num_entries < params->num_records && !interrupted; target *= 10)
+    {
+        samples_t samples = {0};
+        char str[96] = {0};
+
+        target = ldb_min(target, params->num_records);
+        append_records(&db, params, target - num_entries, NULL, &seed);
+        num_entries = target;
+
+        uint64_t ts1 = db.state.timestamp1;
+        uint64_t range = db.state.timestamp2 - ts1 + 1;
+        uint64_t time0 = get_nanos();
+
+        for (size_t i = 0; i < params->num_ops && !interrupted; i++)
+        {
+            uint64_t ts = ts1 + ((uint64_t) rand_r(&seed) * RAND_MAX + (uint64_t) rand_r(&seed)) % range;
+            ldb_search_e mode = (i % 2 ? LDB_SEARCH_UPPER : LDB_SEARCH_LOWER);
+            uint64_t seqnum = 0;
+
+            uint64_t time1 = get_nanos();
+            int rc = ldb_search(&db, ts, mode, &seqnum);
+            samples_add(&samples, get_nanos() - time1);
+
+            if (rc != LDB_OK && rc != LDB_ERR_NOT_FOUND)
+                fail("search failed", rc);
+        }
+
+        double seconds = (double)(get_nanos() - time0) / 1e9;
+
+        snprintf(str, sizeof(str), "entries=%zu", num_entries);
+        add_result(results, "search", str, &samples, 0, 0, seconds);
+        samples_free(&samples);
+    }
+
+    ldb_close(&db);
+}
+
+// Measures one open (single sample)
+static void measure_open(results_t *results, const char *scenario, const char *str, bool check)
+{
+    ldb_db_t db = {0};
+    samples_t samples = {0};
+
+    uint64_t time0 = get_nanos();
+    open_db(&db, check);
+    uint64_t elapsed = get_nanos() - time0;
+
+    samples_add(&samples, elapsed);
+    add_result(results, scenario, str, &samples, db.state.seqnum2 - db.state.seqnum1 + 1,
+               file_size(BENCH_NAME ".dat"), (double) elapsed / 1e9);
+
+    samples_free(&samples);
+    ldb_close(&db);
+}
+
+// Open time of databases of increasing size:
+//   open         = clean close (checkpoint present)
+//   open-check   = checkpoint removed (all records verified)
+//   open-rebuild = checkpoint and index removed (index rebuilt)
+static void scenario_open(const params_t *params, results_t *results)
+{
+    unsigned int seed = 1;
+
+    for (size_t i = 0; i < params->num_open_sizes && !interrupted; i++)
+    {
+        ldb_db_t db = {0};
+        size_t avg_len = (params->max_size + sizeof(ldb_record_dat_t)) / 2;
+        char str[96] = {0};
+
+        remove_db();
+        open_db(&db, false);
+
+        // record length is random, we append until the dat file is big enough
+        while (!interrupted && file_size(BENCH_NAME ".dat") < params->open_sizes[i])
+        {
+            size_t num = (params->open_sizes[i] - file_size(BENCH_NAME ".dat")) / avg_len + params->records_per_commit;
+            append_records(&db, params, num, NULL, &seed);
+        }
+
+        ldb_close(&db);
+
+        snprintf(str, sizeof(str), "dat=%zu", params->open_sizes[i]);
+        measure_open(results, "open", str, true);
+
+        remove(BENCH_NAME ".chk");
+        measure_open(results, "open-check", str, true);
+
+        remove(BENCH_NAME ".chk");
+        remove(BENCH_NAME ".idx");
+        measure_open(results, "open-rebuild", str, true);
+    }
+}
+
+// Rollbacks removing records_per_commit entries (up to num_ops, half of the db)
+static void scenario_rollback(const params_t *params, results_t *results)
+{
+    ldb_db_t db = {0};
+    samples_t samples = {0};
+    size_t num_records = 0;
+    char str[96] = {0};
+
+    open_base(&db, params);
+
+    size_t num_ops = ldb_min(params->num_ops, params->num_records / (2 * params->records_per_commit));
+    uint64_t time0 = get_nanos();
+
+    for (size_t i = 0; i < num_ops && !interrupted; i++)
+    {
+        uint64_t time1 = get_nanos();
+        long rc = ldb_rollback(&db, db.state.seqnum2 - params->records_per_commit);
+        samples_add(&samples, get_nanos() - time1);
+
+        if (rc < 0)
+            fail("rollback failed", (int) rc);
+
+        num_records += (size_t) rc;
+    }
+
+    double seconds = (double)(get_nanos() - time0) / 1e9;
+
+    snprintf(str, sizeof(str), "entries=%zu", params->records_per_commit);
+    add_result(results, "rollback", str, &samples, num_records, 0, seconds);
+
+    samples_free(&samples);
+    ldb_close(&db);
+}
+
+// Purges removing 10% of the initial entries each time (5 times)
+static void scenario_purge(const params_t *params, results_t *results)
+{
+    ldb_db_t db = {0};
+    samples_t samples = {0};
+    size_t num_records = 0;
+    size_t step = ldb_max(params->num_records / 10, 1);
+    char str[96] = {0};
+
+    open_base(&db, params);
+
+    uint64_t time0 = get_nanos();
+
+    for (size_t i = 0; i < 5 && !interrupted && db.state.seqnum1 + step <= db.state.seqnum2; i++)
+    {
+        uint64_t time1 = get_nanos();
+        long rc = ldb_purge(&db, db.state.seqnum1 + step);
+        samples_add(&samples, get_nanos() - time1);
+
+        if (rc < 0)
+            fail("purge failed", (int) rc);
+
+        num_records += (size_t) rc;
+    }
+
+    double seconds = (double)(get_nanos() - time0) / 1e9;
+
+    snprintf(str, sizeof(str), "entries=%zu", step);
+    add_result(results, "purge", str, &samples, num_records, 0, seconds);
+
+    samples_free(&samples);
+    ldb_close(&db);
+}
+
+static const struct {
+    const char *name;
+    scenario_fn fn;
+} scenarios[] = {
+    { "append",      scenario_append },
+    { "read-seq",    scenario_read_seq },
+    { "read-random", scenario_read_random },
+    { "search",      scenario_search },
+    { "open",        scenario_open },
+    { "rollback",    scenario_rollback },
+    { "purge",       scenario_purge }
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios)/sizeof(scenarios[0]))
+
+static bool is_selected(const params_t *params, const char *name)
+{
+    if (params->scenarios == NULL)
+        return true;
+
+    size_t len = strlen(name);
+
+    for (const char *ptr = params->scenarios; ptr != NULL; ptr = strchr(ptr, ','))
+    {
+        ptr += (*ptr == ',' ? 1 : 0);
+
+        if (strncmp(ptr, name, len) == 0 && (ptr[len] == ',' || ptr[len] == 0))
+            return true;
+    }
+
+    return false;
+}
+
+static void print_results(FILE *fp, const params_t *params, const results_t *results)
+{
+    if (params->format == FORMAT_CSV)
+        fprintf(fp, "scenario,params,ops,records,bytes,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,max_us\n");
+    else if (params->format == FORMAT_JSON)
+        fprintf(fp, "{\n  \"version\": \"%s\",\n  \"records\": %zu,\n  \"results\": [\n", ldb_version(), params->num_records);
+    else
+        fprintf(fp, "%-12s %-24s %8s %10s %12s %10s %10s %10s %10s %10s\n",
+                "scenario", "params", "ops", "seconds", "ops/s", "MB/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+
+    for (size_t i = 0; i < results->num; i++)
+    {
+        const result_t *res = &results->items[i];
+        double ops_per_sec = (res->seconds > 0 ? (double) res->num_ops / res->seconds : 0);
+        double mb_per_sec = (res->seconds > 0 ? (double) res->num_bytes / res->seconds / 1e6 : 0);
+
+        if (params->format == FORMAT_CSV)
+            fprintf(fp, "%s,%s,%zu,%zu,%zu,%.6f,%.2f,%.2f,%.3f,%.3f,%.3f,%.3f\n",
+                    res->scenario, res->params, res->num_ops, res->num_records, res->num_bytes,
+                    res->seconds, ops_per_sec, mb_per_sec, (double) res->p50_ns / 1e3,
+                    (double) res->p99_ns / 1e3, (double) res->p999_ns / 1e3, (double) res->max_ns / 1e3);
+        else if (params->format == FORMAT_JSON)
+            fprintf(fp, "    { \"scenario\": \"%s\", \"params\": \"%s\", \"ops\": %zu, \"records\": %zu, "
+                    "\"bytes\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.2f, \"mb_per_sec\": %.2f, "
+                    "\"p50_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f }%s\n",
+                    res->scenario, res->params, res->num_ops, res->num_records, res->num_bytes,
+                    res->seconds, ops_per_sec, mb_per_sec, (double) res->p50_ns / 1e3,
+                    (double) res->p99_ns / 1e3, (double) res->p999_ns / 1e3, (double) res->max_ns / 1e3,
+                    (i + 1 < results->num ? "," : ""));
+        else
+            fprintf(fp, "%-12s %-24s %8zu %10.3f %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    res->scenario, res->params, res->num_ops, res->seconds, ops_per_sec, mb_per_sec,
+                    (double) res->p50_ns / 1e3, (double) res->p99_ns / 1e3,
+                    (double) res->p999_ns / 1e3, (double) res->max_ns / 1e3);
+    }
+
+    if (params->format == FORMAT_JSON)
+        fprintf(fp, "  ]\n}\n");
+}
+
+static void help(void)
+{
+    const char *msg = \
+        "usage: benchmark [OPTION]..." "\n" \
+        "\n" \
+        "Benchmark suite used to track logdb performance regressions." "\n" \
+        "Each scenario reports throughput and latency percentiles (p50, p99, p999)." "\n" \
+        "\n" \
+        "Scenarios:" "\n" \
+        "   append        Append the base db (fsync on/off)." "\n" \
+        "   read-seq      Read the whole base db sequentially." "\n" \
+        "   read-random   Random reads (1, 2, 4, ..., max threads)." "\n" \
+        "   search        Search latency versus db size (1000, 10000, ... entries)." "\n" \
+        "   open          Open time (clean, full check, index rebuild) versus dat size." "\n" \
+        "   rollback      Rollback of records-per-commit entries." "\n" \
+        "   purge         Purge of 10% of the entries." "\n" \
+        "\n" \
+        "Arguments:" "\n" \
+        "   -h, --help                          Display this help and quit." "\n" \
+        "   --scenarios                         Comma-separated list of scenarios (default=all)." "\n" \
+        "   --records                           Entries of the base db (default=100000)." "\n" \
+        "   --sizes                             Record size distribution as size[:weight],... (default=1KB)." "\n" \
+        "   --rpc, --records-per-commit         Records per commit (default=10)." "\n" \
+        "   --rpq, --records-per-query          Records per read (default=1)." "\n" \
+        "   --threads                           Maximum number of reader threads (default=4)." "\n" \
+        "   --ops                               Operations per latency measurement (default=10000)." "\n" \
+        "   --open-sizes                        Comma-separated dat sizes of the open scenario (default=100MB)." "\n" \
+        "   --fsync                             Append fsync mode: off, on, both (default=off)." "\n" \
+        "   --format                            Output format: text, json, csv (default=text)." "\n" \
+        "   --output                            Output file (default=stdout)." "\n" \
+        "\n" \
+        "Byte values accept suffixes: B, KB, MB, GB, TB." "\n" \
+        "\n" \
+        "Examples:" "\n" \
+        "   # all scenarios, mixed record sizes, json output" "\n" \
+        "   benchmark --sizes=100B:70,1KB:25,64KB:5 --format=json --output=benchmark.json" "\n" \
+        "\n" \
+        "   # recovery time at 1GB, 10GB and 100GB" "\n" \
+        "   benchmark --scenarios=open --open-sizes=1GB,10GB,100GB" "\n" \
+        "\n" \
+        "   # read scaling up to 16 threads, 100 records per read" "\n" \
+        "   benchmark --scenarios=read-random --threads=16 --rpq=100" "\n" \
+        "\n";
+
+    printf("%s", msg);
+}
+
+static size_t parse_int(const char *str, const char *arg)
+{
+    char *endptr = NULL;
+    long val = strtol(str, &endptr, 10);
+
+    if (!isdigit(*str) || errno == ERANGE || str == endptr || *endptr != 0) {
+        fprintf(stderr, "Error: argument '%s' has an invalid value (%s)\n", arg, str);
+        exit(EXIT_FAILURE);
+    }
+
+    return (size_t) val;
+}
+
+// Parses a byte value with optional suffix, sets end to the first unparsed char
+static size_t parse_bytes(const char *str, const char *arg, const char **end)
+{
+    char *endptr = NULL;
+    size_t val = (size_t) strtol(str, &endptr, 10);
+    size_t len = strspn(endptr, "KMGTB");
+
+    if (!isdigit(*str) || errno == ERANGE || str == endptr)
+        goto PARSE_BYTES_ERR;
+
+    *end = endptr + len;
+
+    if (len == 0)
+        return val;
+
+    for (size_t i = 0; i < BYTES_SUFFIX_LEN; i++) {
+        if (strlen(bytes_suffix[i]) == len && strncmp(endptr, bytes_suffix[i], len) == 0)
+            return val;
+        val *= 1000;
+    }
+
+PARSE_BYTES_ERR:
+    fprintf(stderr, "Error: argument '%s' has an invalid value (%s)\n", arg, str);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_sizes(const char *str, params_t *params)
+{
+    const char *ptr = str;
+
+    params->num_sizes = 0;
+
+    while (*ptr != 0)
+    {
+        if (params->num_sizes == MAX_SIZE_CLASSES) {
+            fprintf(stderr, "Error: too many record sizes (max=%d)\n", MAX_SIZE_CLASSES);
+            exit(EXIT_FAILURE);
+        }
+
+        size_class_t *size = &params->sizes[params->num_sizes++];
+
+        size->bytes = parse_bytes(ptr, "sizes", &ptr);
+        size->weight = 1;
+
+        if (*ptr == ':') {
+            char *endptr = NULL;
+            size->weight = (size_t) strtol(ptr + 1, &endptr, 10);
+            ptr = endptr;
+        }
+
+        if (size->bytes == 0 || size->bytes > UINT32_MAX || size->weight == 0 || (*ptr != ',' && *ptr != 0)) {
+            fprintf(stderr, "Error: argument 'sizes' has an invalid value (%s)\n", str);
+            exit(EXIT_FAILURE);
+        }
+
+        ptr += (*ptr == ',' ? 1 : 0);
+    }
+}
+
+static void parse_open_sizes(const char *str, params_t *params)
+{
+    const char *ptr = str;
+
+    params->num_open_sizes = 0;
+
+    while (*ptr != 0)
+    {
+        if (params->num_open_sizes == MAX_OPEN_SIZES) {
+            fprintf(stderr, "Error: too many open sizes (max=%d)\n", MAX_OPEN_SIZES);
+            exit(EXIT_FAILURE);
+        }
+
+        params->open_sizes[params->num_open_sizes++] = parse_bytes(ptr, "open-sizes", &ptr);
+
+        if (*ptr != ',' && *ptr != 0) {
+            fprintf(stderr, "Error: argument 'open-sizes' has an invalid value (%s)\n", str);
+            exit(EXIT_FAILURE);
+        }
+
+        ptr += (*ptr == ',' ? 1 : 0);
+    }
+}
+
+static void parse_args(int argc, char *argv[], params_t *params)
+{
+    const char* const options1 = "h" ;
+    const struct option options2[] = {
+        { "help",                     0,  NULL,  'h' },
+        { "scenarios",                1,  NULL,  301 },
+        { "records",                  1,  NULL,  302 },
+        { "sizes",                    1,  NULL,  303 },
+        { "records-per-commit",       1,  NULL,  304 },
+        { "rpc",                      1,  NULL,  304 },
+        { "records-per-query",        1,  NULL,  305 },
+        { "rpq",                      1,  NULL,  305 },
+        { "threads",                  1,  NULL,  306 },
+        { "ops",                      1,  NULL,  307 },
+        { "open-sizes",               1,  NULL,  308 },
+        { "fsync",                    1,  NULL,  309 },
+        { "format",                   1,  NULL,  310 },
+        { "output",                   1,  NULL,  311 },
+        { NULL,                       0,  NULL,   0  }
+    };
+
+    *params = (params_t){
+        .scenarios = NULL,
+        .num_records = 100000,
+        .sizes = {{ .bytes = 1000, .weight = 1 }},
+        .num_sizes = 1,
+        .records_per_commit = 10,
+        .records_per_query = 1,
+        .max_threads = 4,
+        .num_ops = 10000,
+        .open_sizes = { 100000000 },
+        .num_open_sizes = 1,
+        .fsync_off = true,
+        .fsync_on = false,
+        .format = FORMAT_TEXT,
+        .output = NULL
+    };
+
+    while (true)
+    {
+        int curropt = getopt_long(argc, argv, options1, options2, NULL);
+
+        if (curropt == -1)
+            break;
+
+        switch(curropt)
+        {
+            case '?': // invalid option
+                fprintf(stderr, "use --help option for more information\n");
+                exit(EXIT_FAILURE);
+            case 'h':
+                help();
+                exit(EXIT_SUCCESS);
+            case 301:
+                params->scenarios = optarg;
+                break;
+            case 302:
+                params->num_records = parse_int(optarg, "records");
+                break;
+            case 303:
+                parse_sizes(optarg, params);
+                break;
+            case 304:
+                params->records_per_commit = parse_int(optarg, "records-per-commit");
+                break;
+            case 305:
+                params->records_per_query = parse_int(optarg, "records-per-query");
+                break;
+            case 306:
+                params->max_threads = parse_int(optarg, "threads");
+                break;
+            case 307:
+                params->num_ops = parse_int(optarg, "ops");
+                break;
+            case 308:
+                parse_open_sizes(optarg, params);
+                break;
+            case 309:
+                params->fsync_off = (strcmp(optarg, "off") == 0 || strcmp(optarg, "both") == 0);
+                params->fsync_on = (strcmp(optarg, "on") == 0 || strcmp(optarg, "both") == 0);
+                if (!params->fsync_off && !params->fsync_on) {
+                    fprintf(stderr, "Error: argument 'fsync' has an invalid value (%s)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 310:
+                if (strcmp(optarg, "text") == 0)
+                    params->format = FORMAT_TEXT;
+                else if (strcmp(optarg, "json") == 0)
+                    params->format = FORMAT_JSON;
+                else if (strcmp(optarg, "csv") == 0)
+                    params->format = FORMAT_CSV;
+                else {
+                    fprintf(stderr, "Error: argument 'format' has an invalid value (%s)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 311:
+                params->output = optarg;
+                break;
+            default:
+                fprintf(stderr, "Unexpected error\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (params->num_records < 2 || params->records_per_commit == 0 || params->records_per_query == 0 ||
+        params->max_threads == 0 || params->num_ops == 0) {
+        fprintf(stderr, "Error: records must be greater than 1, rpc, rpq, threads and ops greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    params->max_size = 0;
+    params->total_weight = 0;
+
+    for (size_t i = 0; i < params->num_sizes; i++) {
+        params->max_size = ldb_max(params->max_size, params->sizes[i].bytes);
+        params->total_weight += params->sizes[i].weight;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    params_t params = {0};
+    results_t results = {0};
+    FILE *fp = stdout;
+
+    parse_args(argc, argv, &params);
+
+    for (const char *ptr = params.scenarios; ptr != NULL; ptr = strchr(ptr + 1, ','))
+    {
+        bool found = false;
+        ptr += (*ptr == ',' ? 1 : 0);
+
+        for (size_t i = 0; i < NUM_SCENARIOS && !found; i++) {
+            size_t len = strlen(scenarios[i].name);
+            found = (strncmp(ptr, scenarios[i].name, len) == 0 && (ptr[len] == ',' || ptr[len] == 0));
+        }
+
+        if (!found) {
+            fprintf(stderr, "Error: unknown scenario (%s)\n", ptr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (params.output != NULL && (fp = fopen(params.output, "w")) == NULL) {
+        fprintf(stderr, "Error: can not open output file (%s)\n", params.output);
+        return EXIT_FAILURE;
+    }
+
+    // random content, so that results do not depend on the data
+    if ((data = (char *) malloc(params.max_size)) == NULL)
+        fail("out of memory", LDB_ERR_MEM);
+
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < params.max_size; i++)
+        data[i] = (char) rand_r(&seed);
+
+    signal(SIGINT, signal_handler);
+
+    for (size_t i = 0; i < NUM_SCENARIOS && !interrupted; i++)
+        if (is_selected(&params, scenarios[i].name))
+            scenarios[i].fn(&params, &results);
+
+    print_results(fp, &params, &results);
+
+    if (fp != stdout)
+        fclose(fp);
+
+    remove_db();
+    free(results.items);
+    free(data);
+    return (interrupted ? EXIT_FAILURE : EXIT_SUCCESS);
+}
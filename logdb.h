@@ -71,6 +71,17 @@ SOFTWARE.
  *   etc            checksum1                       checksum2
  *                  length1                         length2
  * 
+ * The format identifies the checksum algorithm:
+ *   - LDB_FORMAT_1: crc32 (AUTODIN II polynomial), byte-at-a-time.
+ *   - LDB_FORMAT_2: crc32c (Castagnoli polynomial), hardware-accelerated 
+ *                   when available (SSE4.2, ARMv8 CRC), slice-by-8 otherwise.
+ *   - LDB_FORMAT_3: crc32c, data can be compressed (LZ4 block format).
+ *                   Record length is the stored length, and the record header
+ *                   keeps the uncompressed length (raw_len). Checksum covers
+ *                   the stored bytes. See ldb_set_compression().
+ * New databases are created using LDB_FORMAT_2. Existing LDB_FORMAT_1 
+ * databases are still supported (read and write).
+ * 
  * idx file format
  * ---------------
  * 
@@ -92,33 +103,135 @@ SOFTWARE.
  *  - idx header has fixed size
  *  - all idx records have same size
  *
- * We use the binary search method over the index records to search data by timestamp.
+ * To search data by timestamp we keep an in-memory fence table (the timestamp 
+ * of every LDB_FENCE_STEP-th record) built on open and extended on append. 
+ * A binary search over the fences narrows the range to LDB_FENCE_STEP index 
+ * records, which are searched using interpolation (bisection as fallback).
  * In all cases we rely on the system file caches to store data in memory.
+ * Optionally, the idx file can be memory-mapped (see ldb_set_mmap_idx()).
+ * 
+ * chk file format
+ * ---------------
+ * 
+ * Checkpoint used to speed up the check done on open.
+ * 
+ * @see struct ldb_checkpoint_t
+ * 
+ * Stores the last verified record (seqnum, timestamp, dat position). It is 
+ * written on close and every LDB_CHECKPOINT_LEN appended bytes, after syncing
+ * the dat and idx files. On open with check, only the records after the 
+ * checkpoint are verified. Large ranges are verified using multiple threads 
+ * (chunk boundaries are taken from the idx file). Rollback and purge remove it.
+ * 
+ * Segmented mode
+ * ---------------
+ * 
+ * Optionally, a database can be split in bounded-size segments (see 
+ * ldb_open_segmented()). Each segment is a dat/idx file pair holding a
+ * contiguous seqnum range. A manifest file (\*.seg) stores the first
+ * segment id and the first seqnum. Purge removes whole segments.
+ * 
+ * key file format
+ * ---------------
+ * 
+ * Optional secondary index (see ldb_set_key_index()).
+ * 
+ * @see struct ldb_header_key_t
+ * @see struct ldb_key_t
+ * 
+ *      header        pair1         pair2
+ * ┌──────┴──────┐┌─────┴─────┐┌─────┴─────┐...
+ *   magic number   key1          key2
+ *   format         seqnum1       seqnum2
+ *   etc
+ * 
+ * Pairs are sorted by key and seqnum. The header stores the last indexed 
+ * seqnum (pairs above it are stale, rollback only updates the header).
+ * Pairs of the entries appended later are kept in memory (hash table), and
+ * merged with the run into a new file (tmp file + rename).
+ * 
+ * Multi-log mode
+ * ---------------
+ * 
+ * Many small logs can share one append stream (see ldb_wal_open()), so that
+ * writes of all logs are sequential and fsyncs are grouped. The stream is a
+ * series of bounded-size segments (\*.wal) storing records tagged by log id,
+ * and rollback/purge markers. Each log keeps in memory the position of its
+ * entries (rebuilt on open). Segments no longer referenced by any log are
+ * removed on purge.
  * 
  * Concurrency
  * ---------------
  * 
  * Main goal: append() function not blocked.
- * File write ops are done with [dat|idx]_fp.
- * File read ops are done with [dat|idx]_fd.
+ * Appends are written with one writev (dat) and one pwrite (idx) per batch,
+ * pointing to the entries data (no copies). Other write ops (repair, rollback,
+ * purge) are done with [dat|idx]_fp.
+ * File read ops are done with [dat|idx]_fd using positional reads (pread),
+ * so readers do not share a file offset and can run in parallel.
+ * 
+ * When compiled with LDB_IO_URING (Linux), appends are submitted to an io_uring
+ * (dat write linked to its fdatasync, plus the idx write) and large dat reads 
+ * are split in chunks read in parallel (one ring per reader thread). This 
+ * allows ldb_append_async() to return before the writes complete. If io_uring 
+ * is not available at runtime, the POSIX path is used.
  * 
- * We use 2 mutex:
+ * We use 3 mutexes and 1 rwlock:
  *   - data mutex: grants data integrity ([first|last]_[seqnum|timestamp])
  *                 reduced scope (variables update)
- *   - file mutex: grants that no reads are done during destructive writes
+ *   - write mutex: serializes writers (append, append_mt leader, rollback, purge)
  *                 extended scope (function execution)
+ *   - queue mutex: guards the append_mt() requests queue
+ *                 reduced scope (enqueue, group hand-over)
+ *   - file lock:  grants that no reads are done during destructive writes
+ *                 extended scope (function execution)
+ *                 shared by readers (R), exclusive for rollback and purge (W)
  * 
  *                             File     Data
- * Thread        Function      Mutex    Mutex   Notes
+ * Thread        Function      Lock     Mutex   Notes
  * -------------------------------------------------------------------
  *               ┌ open()         -       -     Init mutexes, create FILE's used to write and fd's used to read
  *               ├ append()       -       W     dat and idx files flushed at the end. State updated after flush.
- * thread-write: ┼ rollback()     W       W     
- *               ├ purge()        W       W     
+ *               ├ append_mt()    -       W     Multiple producer threads allowed (group commit)
+ *               ├ append_async() -       W     State updated on completion (next write call)
+ * thread-write: ┼ rollback()     W       W     Waits until views are released, files truncated after W
+ *               ├ purge()        W       W     Files rebuilt before W (readers continue), W swaps them
+ *               ├ append_raw()   -       W     Encoded records written with one write, idx built from headers
+ *               ├ import()       -       W     Stream copied to dat, then indexed. State updated at the end.
+ *               ├ set_mmap_idx() W       -     Also W when append() grows the idx mapping
+ *               ├ set_cache()    -       -     Cache lock (W), also taken by append(), rollback() and purge()
+ *               ├ set_preallocation() -  -     Files extended by append() ahead of the written data
+ *               ├ set_key_index() -      -     Keys lock (W), also taken by append(), rollback() and merges
+ *               ├ set_flusher()  -       W     Starts the flusher thread, or stops it (joined with the write mutex held)
  *               └ close()        -       -     Destroy mutexes, close files
- *               ┌ stats()        R       R     
- * thread-read:  ┼ read()         R       R     
- *               └ search()       R       R     
+ *               ┌ stats()        R       -     State snapshot (seqlock)
+ *               ├ read()         R       -     Multiple reader threads allowed
+ *               ├ read_arena()   R       -     One arena per thread
+ *               ├ read_metadata() R      -     Headers and metadata only (one arena per thread)
+ *               ├ read_data_range() R    -     Data bytes read into the caller buffer
+ * threads-read: ┼ read_view()    R       W     Pins the dat file mapping (data mutex)
+ *               ├ release_view() -       W     Unpins the dat file mapping
+ *               ├ wait()         R       W     Waits on the state condition (locks released meanwhile)
+ *               ├ wait_durable() R       W     Same as wait(), also requests a sync to the flusher
+ *               ├ cursor_next()  R       R     Seeks again after rollback/purge
+ *               ├ export()       R       -     Kernel copy of the dat span (rollback and purge wait)
+ *               ├ lookup_key()   -       R     Keys lock (R), run file binary searched with pread
+ *               ├ get_metrics()  -       -     Relaxed atomic loads (metrics updated by all functions)
+ *               └ search()       R       -     
+ * 
+ * Readers do not lock the data mutex to copy the state: writers publish it
+ * (holding the data mutex) with a sequence counter that is odd meanwhile, and
+ * readers retry the copy until they see the same even value before and after
+ * it (seqlock). Without the __atomic builtins (or with LDB_NO_SEQLOCK) readers
+ * lock the data mutex instead.
+ * 
+ * The flusher thread syncs the dat file holding R (rollback and purge wait
+ * for the sync), then advances the durable seqnum and notifies the waiters
+ * (data mutex). Writers notify it with its own mutex (leaf lock).
+ * 
+ * Wal logs use the same guards. Each log is written by its own thread-write.
+ * The wal serializes the stream writes (wal write mutex) and the fsyncs: the 
+ * first waiting writer syncs the stream on behalf of the others (group commit).
  */
 
 #define LDB_VERSION_MAJOR          1
@@ -146,6 +259,16 @@ SOFTWARE.
 #define LDB_ERR_NOT_FOUND        -18
 #define LDB_ERR_TMP_FILE         -19
 #define LDB_ERR_CHECKSUM         -20
+#define LDB_ERR_OPEN_SEG         -21
+#define LDB_ERR_FMT_SEG          -22
+#define LDB_ERR_COMPRESSED       -23
+#define LDB_ERR_TIMEOUT          -24
+#define LDB_ERR_ROLLBACK         -25
+#define LDB_ERR_OPEN_WAL         -26
+#define LDB_ERR_FMT_WAL          -27
+#define LDB_ERR_STREAM           -28
+#define LDB_ERR_KEY_FILE         -29
+#define LDB_ERR_ENTRY_LEN        -30
 
 #ifdef __cplusplus
 extern "C" {
@@ -154,6 +277,12 @@ extern "C" {
 struct ldb_impl_t;
 typedef struct ldb_impl_t ldb_db_t;
 
+struct ldb_cursor_impl_t;
+typedef struct ldb_cursor_impl_t ldb_cursor_t;
+
+struct ldb_wal_impl_t;
+typedef struct ldb_wal_impl_t ldb_wal_t;
+
 typedef enum ldb_search_e {
     LDB_SEARCH_LOWER,             // Search first entry having timestamp not less than value.
     LDB_SEARCH_UPPER              // Search first entry having timestamp greater than value.
@@ -175,6 +304,19 @@ typedef struct ldb_entry_t {
     void *data;
 } ldb_entry_t;
 
+typedef void * (*ldb_malloc_fn)(size_t size);
+typedef void (*ldb_free_fn)(void *ptr);
+typedef bool (*ldb_key_fn)(const void *metadata, uint32_t metadata_len, uint64_t *key);
+
+typedef struct ldb_arena_t {
+    char *buf;                    // Current memory block
+    size_t len;                   // Bytes used in the current block
+    size_t max;                   // Length of the current block
+    bool external;                // Block supplied by the caller (not grown nor freed)
+    void *retired;                // Full blocks released on the next read (internal)
+    size_t retired_len;           // Length of the retired blocks (internal)
+} ldb_arena_t;
+
 typedef struct ldb_stats_t {
     uint64_t min_seqnum;
     uint64_t max_seqnum;
@@ -182,9 +324,48 @@ typedef struct ldb_stats_t {
     uint64_t max_timestamp;
     size_t num_entries;
     size_t data_size;
+    size_t raw_data_size;
     size_t index_size;
 } ldb_stats_t;
 
+typedef struct ldb_flush_policy_t {
+    uint32_t interval_ms;         // Max delay between an append and its sync (0 = not used)
+    size_t max_bytes;             // Sync when this many appended bytes are not synced (0 = not used)
+    size_t max_entries;           // Sync when this many appended entries are not synced (0 = not used)
+} ldb_flush_policy_t;
+
+#define LDB_METRICS_BUCKETS 24
+
+typedef struct ldb_histogram_t {
+    uint64_t count;               // Number of samples
+    uint64_t sum_ns;              // Sum of latencies (nanoseconds)
+    uint64_t max_ns;              // Maximum latency (nanoseconds)
+    uint64_t buckets[LDB_METRICS_BUCKETS]; // [0] = less than 1us, [i] = [2^(i-1), 2^i) us, last one unbounded
+} ldb_histogram_t;
+
+typedef struct ldb_metrics_t {
+    uint64_t appended_entries;    // Entries written
+    uint64_t appended_bytes;      // Bytes written to dat file (record headers included)
+    uint64_t read_entries;        // Entries returned by read functions
+    uint64_t read_bytes;          // Metadata and data bytes returned by read functions
+    uint64_t cache_hits;          // Entries served from the hot-tail cache
+    uint64_t write_calls;         // Dat and idx writes (syscalls or io_uring requests)
+    uint64_t read_calls;          // Dat and idx reads done by read functions (mapped idx excluded)
+    uint64_t fsync_calls;         // Fdatasyncs (syscalls or io_uring requests)
+    uint64_t checksum_errors;     // Checksum mismatches detected
+    uint64_t lock_files_waits;    // Contended acquisitions of the file lock
+    uint64_t lock_files_wait_ns;  // Time waiting for the file lock (nanoseconds)
+    uint64_t mutex_data_waits;    // Contended acquisitions of the data mutex
+    uint64_t mutex_data_wait_ns;  // Time waiting for the data mutex (nanoseconds)
+    uint64_t open_ns;             // Duration of the last open, recovery included (nanoseconds)
+    ldb_histogram_t append;       // Latency of append(), append_mt() and append_async()
+    ldb_histogram_t fsync;        // Latency of fdatasync syscalls (io_uring ones excluded)
+    ldb_histogram_t read;         // Latency of read() and read_view()
+    ldb_histogram_t search;       // Latency of search()
+    ldb_histogram_t rollback;     // Latency of rollback()
+    ldb_histogram_t purge;        // Latency of purge()
+} ldb_metrics_t;
+
 /**
  * Returns ldb library version.
  * @return Library version (semantic version, ex. 1.0.4).
@@ -221,6 +402,44 @@ void ldb_free_entry(ldb_entry_t *entry);
  */
 void ldb_free_entries(ldb_entry_t *entries, size_t len);
 
+/**
+ * Sets the allocator used for the memory of the entries returned by 
+ * ldb_read() and for the blocks of ldb_arena_t (default = malloc/free).
+ * 
+ * Applies to all databases. Call it before any entry or arena is allocated 
+ * (memory is released with the allocator in use when it is freed).
+ * Internal buffers of the library are not affected.
+ * 
+ * @param[in] malloc_fn Allocation function (NULL = malloc).
+ * @param[in] free_fn Deallocation function (NULL = free).
+ * @return Error code (0 = OK, LDB_ERR_ARG if only one of them is NULL).
+ */
+int ldb_set_allocator(ldb_malloc_fn malloc_fn, ldb_free_fn free_fn);
+
+/**
+ * Initializes an arena used by ldb_read_arena().
+ * 
+ * A zero-initialized arena (or buf = NULL) is pooled: blocks are allocated 
+ * (see ldb_set_allocator()) and grown as needed, and the memory is reused 
+ * by the next reads. When buf is not NULL, entries are placed into this 
+ * caller-supplied buffer, that is never grown nor freed.
+ * 
+ * @param[out] arena Arena to initialize.
+ * @param[in] buf Caller-supplied buffer (NULL = pooled arena).
+ * @param[in] len Buffer length.
+ */
+void ldb_arena_init(ldb_arena_t *arena, char *buf, size_t len);
+
+/**
+ * Deallocates the memory of a pooled arena.
+ * 
+ * Entries read using this arena are no longer valid.
+ * The arena can be reused after this call (empty pooled, or external if it was).
+ * 
+ * @param[in,out] arena Arena to dealloc (if NULL does nothing).
+ */
+void ldb_arena_free(ldb_arena_t *arena);
+
 /**
  * Allocate a new ldb_db_t (opaque) object.
  * 
@@ -241,6 +460,8 @@ void ldb_free(ldb_db_t *obj);
  * Creates database files (dat+idx) if they not exists.
  * Update index file if incomplete (not flushed + crash).
  * Rebuild index file when corrupted or not found.
+ * When check is true, only records written after the last checkpoint 
+ * ({name}.chk) are verified.
  * 
  * @param[in,out] obj Uninitialized database object.
  * @param[in] path Directory where database files are located.
@@ -251,6 +472,53 @@ void ldb_free(ldb_db_t *obj);
  */
 int ldb_open(ldb_db_t *obj, const char *path, const char *name, bool check);
 
+/**
+ * Open a database of fixed-length records.
+ * 
+ * Every record has metadata_len + data_len = record_len. There is no index 
+ * file ({name}.idx is removed if exists): record positions are computed from 
+ * the seqnum, searches binary-search the dat record headers, and appends 
+ * write only the dat file. Appending an entry of another length returns 
+ * LDB_ERR_ENTRY_LEN and the database is left unchanged. Opening a database 
+ * whose records have another length returns LDB_ERR_ENTRY_LEN.
+ * 
+ * The dat file format is unchanged, the database can be opened by ldb_open() 
+ * (the index is rebuilt). Memory-mapped index and compression are not available.
+ * 
+ * @param[in,out] obj Uninitialized database object.
+ * @param[in] path Directory where database files are located.
+ * @param[in] name Database name (chars allowed: [a-ZA-Z0-9_], max length = 32).
+ * @param[in] record_len Metadata length + data length of every record (greater than 0).
+ * @param[in] check Check database files (true|false).
+ * @return Error code (0 = OK). On error db is closed properly (ldb_close not required).
+ */
+int ldb_open_fixed(ldb_db_t *obj, const char *path, const char *name, uint32_t record_len, bool check);
+
+/**
+ * Open a segmented database.
+ * 
+ * A segmented database is a series of bounded-size segments plus a small
+ * manifest file ({path}/{name}.seg). Each segment is a regular dat/idx file 
+ * pair named {name}_{id} (id = 8-digit sequential number). A new segment is 
+ * started when the data file of the last segment reaches segment_len bytes.
+ * 
+ * All functions behave like on a regular database and are routed to the 
+ * proper segment. Purge drops whole segments and trims the first one 
+ * logically (no data is copied). Rollback removes trailing segments.
+ * 
+ * If the manifest does not exist, a new segmented database is created.
+ * Database name length is limited to LDB_NAME_MAX_LENGTH - 10 characters.
+ * Segmented and regular databases can not be converted into each other.
+ * 
+ * @param[in] obj Uninitialized database object.
+ * @param[in] path Directory where database files are located.
+ * @param[in] name Database name (chars allowed: [a-zA-Z0-9_], max length = 22).
+ * @param[in] segment_len Maximum length of the data file of each segment (greater than 0).
+ * @param[in] check Check segments data files (see ldb_open()).
+ * @return Error code (0 = OK). On error db is closed properly (ldb_close not required).
+ */
+int ldb_open_segmented(ldb_db_t *obj, const char *path, const char *name, size_t segment_len, bool check);
+
 /**
  * Close a database.
  * 
@@ -305,6 +573,84 @@ int ldb_close(ldb_db_t *obj);
  */
 int ldb_append(ldb_db_t *obj, ldb_entry_t *entries, size_t len, size_t *num);
 
+/**
+ * Append entries to the database from multiple producer threads (group commit).
+ * 
+ * Same behavior than ldb_append() but thread-safe. Requests from concurrent 
+ * callers are queued, a leader thread writes all queued requests as a single
+ * batch (seqnums assigned in queue order) followed by one flush (and one
+ * fdatasync when fsync is enabled). Then all callers in the group return.
+ * 
+ * Concurrent producers should pass seqnum = 0 to let the system assign it.
+ * The function blocks until the entries are written (durable if fsync enabled).
+ * 
+ * @param[in] obj Database to modify.
+ * @param[in,out] entries Entries to append to the database (see ldb_append()).
+ * @param[in] len Number of entries to append.
+ * @param[out] num Number of entries appended (can be NULL).
+ * @return Error code (0 = OK).
+ */
+int ldb_append_mt(ldb_db_t *obj, ldb_entry_t *entries, size_t len, size_t *num);
+
+/**
+ * Append entries to the database without waiting for the writes.
+ * 
+ * Same behavior than ldb_append() but returns once the writes (and the 
+ * fdatasync when fsync is enabled) are submitted. The entries are published
+ * (visible to readers) when the writes complete. Completion is done by the 
+ * next call to ldb_append_async(), ldb_append_wait(), or any other write 
+ * function. This allows to prepare the next batch while the previous one 
+ * is being written.
+ * 
+ * Writes are asynchronous only when compiled with LDB_IO_URING. Otherwise 
+ * (and in segmented mode) they are done before returning.
+ * 
+ * Memory pointed by entries must remain unchanged until completion.
+ * If the previous batch failed, its error is returned and no entries are appended.
+ * 
+ * @param[in] obj Database to modify.
+ * @param[in,out] entries Entries to append to the database (see ldb_append()).
+ * @param[in] len Number of entries to append.
+ * @param[out] num Number of entries submitted (can be NULL).
+ * @return Error code (0 = OK).
+ */
+int ldb_append_async(ldb_db_t *obj, ldb_entry_t *entries, size_t len, size_t *num);
+
+/**
+ * Waits until the entries submitted by ldb_append_async() are written.
+ * 
+ * The entries are published before returning (even on error, see ldb_append()).
+ * 
+ * @param[in] obj Database to use.
+ * @param[out] seqnum Last seqnum published (can be NULL).
+ * @return Error code of the submitted writes (0 = OK).
+ */
+int ldb_append_wait(ldb_db_t *obj, uint64_t *seqnum);
+
+/**
+ * Append entries already encoded in the dat file layout (replication followers).
+ * 
+ * The buffer is a sequence of records (ldb_record_dat_t followed by the metadata
+ * and data), as written by ldb_export() after the header, in the database format.
+ * Checksums are not recomputed: all headers are validated (sequence, timestamps,
+ * lengths) before writing, then the buffer is written with one write and the idx 
+ * records are built from the headers. Nothing is appended on error.
+ * 
+ * Checksum verification can be deferred (check=false). Then the records are 
+ * verified on the next open with check=true (checkpoint is not advanced).
+ *   - Segmented mode: records are appended to one segment (started before if 
+ *     the last one is full).
+ *   - Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to modify.
+ * @param[in] buf Encoded records.
+ * @param[in] len Length of buf (in bytes, whole records).
+ * @param[in] check Verify the checksum of the records before writing.
+ * @param[out] num Number of appended entries (can be NULL).
+ * @return Error code (0 = OK, LDB_ERR_FMT_DAT if the buffer ends inside a record).
+ */
+int ldb_append_raw(ldb_db_t *obj, const void *buf, size_t len, bool check, size_t *num);
+
 /**
  * Read num entries starting from seqnum (included).
  * 
@@ -323,9 +669,242 @@ int ldb_append(ldb_db_t *obj, ldb_entry_t *entries, size_t len, size_t *num);
  */
 int ldb_read(ldb_db_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num);
 
+/**
+ * Read num entries starting from seqnum (included) without copying data.
+ * 
+ * Returned entries point directly into a read-only memory map of the dat 
+ * file (zero-copy). They remain valid until ldb_release_view() is called.
+ * Returned entries can not be modified nor deallocated with ldb_free_entry().
+ * Metadata and data pointers have no alignment guarantees.
+ * Compressed records can not be viewed (LDB_ERR_COMPRESSED is returned).
+ * 
+ * While a view is held, rollback() and purge() wait until it is released.
+ * Release views before calling rollback() or purge() from the same thread.
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Initial sequence number.
+ * @param[out] entries Array of entries (min length = len). Previous content is discarded.
+ * @param[in] len Number of entries to read.
+ * @param[out] num Number of entries read (can be NULL). If num less than 'len' means 
+ *                  that last record was reached. Unused entries are signaled with 
+ *                  seqnum = 0.
+ * @return Error code (0 = OK). On success, ldb_release_view() must be called.
+ */
+int ldb_read_view(ldb_db_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num);
+
+/**
+ * Release a view obtained with ldb_read_view().
+ * 
+ * Updates entry pointers to NULL and lengths to 0.
+ * Call it once for each successful ldb_read_view() call.
+ * 
+ * @param[in] obj Database used to read the view.
+ * @param[in,out] entries Entries returned by ldb_read_view() (can be NULL).
+ * @param[in] len Number of entries.
+ */
+void ldb_release_view(ldb_db_t *obj, ldb_entry_t *entries, size_t len);
+
+/**
+ * Read num entries starting from seqnum (included) into an arena.
+ * 
+ * Same behavior than ldb_read() but the metadata and data of the entries 
+ * are placed contiguously into the arena memory (not zero-filled), instead 
+ * of one heap block per entry. The arena is reset on each call, so entries 
+ * returned by the previous call are no longer valid. Entries don't own 
+ * memory: don't dealloc them with ldb_free_entry(). Pointers are aligned 
+ * to intptr_t. Use a distinct arena per thread.
+ * 
+ * When the caller-supplied buffer of the arena is exhausted, LDB_ERR_MEM 
+ * is returned and num reports the entries read (they are valid).
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Initial sequence number.
+ * @param[out] entries Array of entries (min length = len). Previous content is discarded.
+ * @param[in] len Number of entries to read.
+ * @param[out] num Number of entries read (can be NULL). If num less than 'len' means 
+ *                  that last record was reached. Unused entries are signaled with 
+ *                  seqnum = 0.
+ * @param[in,out] arena Arena where entries are placed (see ldb_arena_init()).
+ * @return Error code (0 = OK).
+ */
+int ldb_read_arena(ldb_db_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena);
+
+/**
+ * Read the metadata of num entries starting from seqnum (included) into an arena.
+ * 
+ * Same behavior than ldb_read_arena() but data is not read: data is NULL 
+ * and data_len is the data length (uncompressed). Each record header and 
+ * its metadata are read with one read if the metadata is short. Checksums
+ * are not verified (see ldb_verify_entry()).
+ * Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Initial sequence number.
+ * @param[out] entries Array of entries (min length = len). Previous content is discarded.
+ * @param[in] len Number of entries to read.
+ * @param[out] num Number of entries read (can be NULL).
+ * @param[in,out] arena Arena where metadata is placed (see ldb_arena_init()).
+ * @return Error code (0 = OK).
+ */
+int ldb_read_metadata(ldb_db_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena);
+
+/**
+ * Read a byte range of the data of an entry into a caller buffer.
+ * 
+ * Bytes are read from the dat file straight into buf, so big entries can be
+ * read by chunks without allocating them. The checksum is verified when 
+ * the whole data is read (offset = 0 and len not less than data_len), the 
+ * metadata is read by small chunks. Partial reads are not verified (see 
+ * ldb_verify_entry()). Compressed records return LDB_ERR_COMPRESSED.
+ * Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Sequence number of the entry.
+ * @param[in] offset Offset of the first byte in the entry data.
+ * @param[out] buf Buffer where bytes are copied (min length = len).
+ * @param[in] len Maximum number of bytes to read.
+ * @return Number of bytes read (0 if offset is not less than data_len),
+ *         or error if negative (LDB_ERR_NOT_FOUND if entry not exists).
+ */
+long ldb_read_data_range(ldb_db_t *obj, uint64_t seqnum, size_t offset, void *buf, size_t len);
+
+/**
+ * Verify the checksum of an entry.
+ * 
+ * The record is streamed through the checksum by small chunks (no memory
+ * allocated whatever the entry length). Use it to verify entries read with
+ * ldb_read_metadata() or ldb_read_data_range().
+ * Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Sequence number of the entry.
+ * @return Error code (0 = OK, LDB_ERR_CHECKSUM if the record is corrupted,
+ *         LDB_ERR_NOT_FOUND if entry not exists).
+ */
+int ldb_verify_entry(ldb_db_t *obj, uint64_t seqnum);
+
+/**
+ * Waits until the entry seqnum is appended (tail-follow without polling).
+ * 
+ * Returns as soon as the last seqnum is greater or equal than seqnum (entries
+ * are published, they can be read). Waiters are woken by append, rollback 
+ * and close. If a rollback removes entries while waiting, LDB_ERR_ROLLBACK 
+ * is returned (even if seqnum was appended again); the caller must check
+ * the entries already read. Rollbacks done before this call are not reported.
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Sequence number to wait for.
+ * @param[in] timeout_ms Maximum wait in millis (0 = no wait, negative = no limit).
+ * @return Error code (0 = OK, LDB_ERR_TIMEOUT, LDB_ERR_ROLLBACK, LDB_ERR 
+ *         if the database is closed while waiting).
+ */
+int ldb_wait(ldb_db_t *obj, uint64_t seqnum, int timeout_ms);
+
+/**
+ * Starts the background flusher (or stops it if policy is NULL).
+ * 
+ * The flusher thread syncs the dat file (fdatasync) in the background and
+ * advances the durable seqnum (see ldb_durable_seqnum()), so that appends
+ * done without force_fsync never wait for the disk. A sync is started when
+ * any of the policy limits is reached (interval since the first entry not
+ * synced, bytes or entries not synced), when a thread waits in
+ * ldb_wait_durable(), or as soon as entries are appended if all the policy
+ * fields are 0. Entries appended during a sync are covered by the next one.
+ * If a sync fails the flusher stops syncing (the pages state is unknown)
+ * and ldb_wait_durable() returns LDB_ERR_WRITE_DAT.
+ *   - Segmented mode: the last segment is synced (sealed ones are synced
+ *     when the next segment is created).
+ *   - Multi-log mode: not supported (LDB_ERR), see ldb_wal_sync().
+ * 
+ * This mode is disabled by default and is not persisted.
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] policy Sync triggers (NULL = stop the flusher).
+ * @return Error code (0 = OK).
+ */
+int ldb_set_flusher(ldb_db_t *obj, const ldb_flush_policy_t *policy);
+
+/**
+ * Returns the last seqnum known to be on stable storage.
+ * 
+ * Entries up to this seqnum survive a crash of the system. It is advanced 
+ * by appends done with force_fsync, by the flusher (see ldb_set_flusher()) 
+ * and, on open, it is the last entry covered by the checkpoint. Rollback 
+ * lowers it, and it is reset to 0 when all entries are removed or when a
+ * purge rewrites the files without syncing them (no force_fsync nor flusher).
+ * 
+ * @param[in] obj Database to use.
+ * @return The durable seqnum (0 = none or invalid db).
+ */
+uint64_t ldb_durable_seqnum(ldb_db_t *obj);
+
+/**
+ * Waits until the entry seqnum is on stable storage.
+ * 
+ * Same behavior as ldb_wait(), but waits for the durable seqnum (see 
+ * ldb_durable_seqnum()). If the flusher is running, the wait requests an 
+ * immediate sync. Without flusher nor force_fsync the durable seqnum does
+ * not advance (the call times out).
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] seqnum Sequence number to wait for.
+ * @param[in] timeout_ms Maximum wait in millis (0 = no wait, negative = no limit).
+ * @return Error code (0 = OK, LDB_ERR_TIMEOUT, LDB_ERR_ROLLBACK, LDB_ERR_WRITE_DAT 
+ *         if a flusher sync failed, LDB_ERR if the database is closed while waiting).
+ */
+int ldb_wait_durable(ldb_db_t *obj, uint64_t seqnum, int timeout_ms);
+
+/**
+ * Opens a cursor to read the entries sequentially starting from seqnum.
+ * 
+ * The cursor remembers the dat position of the next entry and moves forward 
+ * by record length (index not consulted), reading the dat file in large 
+ * chunks (LDB_CURSOR_BUFFER_LEN bytes) and requesting the kernel to read 
+ * ahead the next chunk. Use it for long scans (snapshots, catch-up).
+ * 
+ * A cursor is used by one thread at a time. Close it before closing the db.
+ * 
+ * @param[in] obj Database to read.
+ * @param[out] cursor Cursor to initialize (uninitialized or closed).
+ * @param[in] seqnum First seqnum to read (0 = first entry).
+ * @return Error code (0 = OK). You must call ldb_cursor_close() at the end (even if error).
+ */
+int ldb_cursor_open(ldb_db_t *obj, ldb_cursor_t *cursor, uint64_t seqnum);
+
+/**
+ * Reads the next entries and moves the cursor forward.
+ * 
+ * Reaching the last entry is not an error (num less than len), next calls 
+ * return the entries appended meanwhile (see ldb_wait()).
+ * Purge is transparent while the next entry is not purged (otherwise 
+ * LDB_ERR_NOT_FOUND is returned). If a rollback removes entries, 
+ * LDB_ERR_ROLLBACK is returned once and the cursor is moved to the new tail
+ * when it was ahead of it.
+ * 
+ * @param[in] cursor Cursor to use.
+ * @param[out] entries Array of entries (min length = len), see ldb_read().
+ * @param[in] len Number of entries to read.
+ * @param[out] num Number of entries read (can be NULL).
+ * @return Error code (0 = OK).
+ */
+int ldb_cursor_next(ldb_cursor_t *cursor, ldb_entry_t *entries, size_t len, size_t *num);
+
+/**
+ * Closes a cursor and deallocates its buffer.
+ * 
+ * @param[in] cursor Cursor to close (if NULL does nothing).
+ */
+void ldb_cursor_close(ldb_cursor_t *cursor);
+
 /**
  * Return statistics between seqnum1 and seqnum2 (both included).
  * 
+ * data_size is the length in the dat file (physical) and raw_data_size the 
+ * uncompressed length (logical). Both are equal unless compression is used.
+ * On compressed databases, raw_data_size is computed reading the record 
+ * headers in range (cost proportional to the number of entries).
+ * On wal logs, data_size is the length of the records in the wal stream.
+ * 
  * @param[in] obj Database to use.
  * @param[in] seqnum1 First sequence number.
  * @param[in] seqnum2 Second sequence number (greater or equal than seqnum1).
@@ -337,7 +916,9 @@ int ldb_stats(ldb_db_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *st
 /**
  * Search the seqnum corresponding to the given timestamp.
  * 
- * Use the binary search algorithm over the index file.
+ * Uses the in-memory fence table to narrow the range, then an interpolation 
+ * search over the index file (falling back to bisection when timestamps are 
+ * not uniform). Usually, only one or two index pages are touched.
  * 
  * @param[in] obj Database to use.
  * @param[in] ts Timestamp to search.
@@ -347,12 +928,114 @@ int ldb_stats(ldb_db_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *st
  */
 int ldb_search(ldb_db_t *obj, uint64_t ts, ldb_search_e mode, uint64_t *seqnum);
 
+/**
+ * Enables or disables the memory-mapped index mode.
+ * 
+ * When enabled, the idx file is mapped in memory and seqnum lookups
+ * done by read(), stats(), search() and rollback() are resolved with 
+ * plain memory loads instead of read syscalls. The mapping grows when 
+ * append() adds records and is recreated after purge().
+ * 
+ * This mode is disabled by default. Call this function after ldb_open().
+ * If the mapping can not be grown, unmapped records are read from file.
+ * Databases opened with ldb_open_fixed() have no idx file (LDB_ERR).
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] enable Enable (true) or disable (false) the memory-mapped index.
+ * @return Error code (0 = OK).
+ */
+int ldb_set_mmap_idx(ldb_db_t *obj, bool enable);
+
+/**
+ * Enables or disables the compression of appended records.
+ * 
+ * Data (not metadata) of each appended record is compressed (LZ4 block 
+ * format) when it has at least LDB_COMPRESS_MIN_LEN bytes and the result 
+ * is smaller. Read functions return the uncompressed data.
+ * 
+ * Compression requires the LDB_FORMAT_3 file format. Empty databases are 
+ * converted to this format when compression is enabled (file headers are 
+ * rewritten). Non-empty databases in another format return LDB_ERR_FMT_DAT.
+ * In segmented mode, the conversion is done on the last segment if empty,
+ * otherwise compression starts on the next segment.
+ * 
+ * This mode is disabled by default and is not persisted (call this function 
+ * after each ldb_open()). Disabling it does not change the file format.
+ * Databases opened with ldb_open_fixed() return LDB_ERR.
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] enable Enable (true) or disable (false) the compression.
+ * @return Error code (0 = OK).
+ */
+int ldb_set_compression(ldb_db_t *obj, bool enable);
+
+/**
+ * Sets the memory budget of the hot-tail cache.
+ * 
+ * The cache keeps a copy of the most recently appended entries (filled by 
+ * append once written). Reads of cached entries are served from memory 
+ * (no file access, no checksum verification). The oldest entries are 
+ * evicted when the budget is exceeded. Rollback and purge update it.
+ * In segmented mode, only the last segment is cached.
+ * 
+ * This mode is disabled by default and is not persisted.
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] max_bytes Memory budget in bytes (0 = disabled, cache freed).
+ * @return Error code (0 = OK).
+ */
+int ldb_set_cache(ldb_db_t *obj, size_t max_bytes);
+
+/**
+ * Sets the preallocation of the dat and idx files.
+ * 
+ * Appends extend the files in chunks of len bytes ahead of the written 
+ * data (posix_fallocate), so that fdatasync does not commit a file length 
+ * change on every append and big files are not fragmented. The logical end
+ * of the files is tracked separately. Preallocated tails are zero-filled: 
+ * on open they are recognized as the end of the log and removed, and close
+ * and rollback trim them. A chunk of some MBs is enough.
+ *   - Segmented mode: applies to the segments (trimmed when sealed).
+ *   - Multi-log mode: not supported (LDB_ERR).
+ * 
+ * This mode is disabled by default, it is not persisted, and it is only
+ * available on Linux (LDB_ERR otherwise).
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] len Preallocation chunk in bytes (0 = disabled, tails trimmed on close).
+ * @return Error code (0 = OK).
+ */
+int ldb_set_preallocation(ldb_db_t *obj, size_t len);
+
+/**
+ * Returns a snapshot of the database metrics.
+ *
+ * Counters and histograms are cumulative since the database was opened
+ * (suitable to be exported as Prometheus counters and histograms).
+ * They are updated with relaxed atomic operations, so the snapshot is not
+ * taken at a single point in time (fields can be slightly out of sync).
+ * In segmented mode, the metrics of all segments are aggregated.
+ *
+ * Metrics are disabled when compiled with LDB_NO_METRICS (nothing is
+ * recorded). They require the GCC/Clang atomic builtins and are disabled
+ * on other compilers.
+ *
+ * @param[in] obj Database to use.
+ * @param[out] metrics Metrics snapshot (zeroed on error).
+ * @return Error code (0 = OK, LDB_ERR if metrics are disabled or the db is closed).
+ */
+int ldb_get_metrics(ldb_db_t *obj, ldb_metrics_t *metrics);
+
 /**
  * Remove all entries greater than seqnum.
  * 
  * File operations:
- *   - Index file is updated (zero'ed top-to-bottom) and flushed.
- *   - Data file is updated (zero'ed bottom-to-top) and flushed.
+ *   - Index file is truncated (first, removed entries are rebuilt from data on crash).
+ *   - Data file is truncated (synced if force_fsync is set).
+ * Truncation is a constant-time metadata update, regardless of the removed length.
+ * Zeroed tails (written by previous versions) are still recognized on open.
+ * Readers are blocked only while the state is updated, files are truncated after.
+ *   - Segmented mode: trailing segments are removed, the last one is rollbacked.
  * 
  * @param[in] obj Database to update.
  * @param[in] seqnum Sequence number from which records are removed (seqnum=0 removes all content).
@@ -364,15 +1047,20 @@ long ldb_rollback(ldb_db_t *obj, uint64_t seqnum);
  * Remove all entries less than seqnum.
  * 
  * This function is expensive because recreates the dat and idx files.
+ * Readers are not blocked meanwhile, only while the files are swapped.
  * 
  * To prevent data loss in case of outage we do:
- *   - A tmp data file is created.
+ *   - Tmp data and idx files are created (readers continue).
  *   - Preserved records are copied from dat file to tmp file.
- *   - Tmp, dat and idx are closed
+ *   - Preserved idx records are copied to the tmp idx file (positions moved).
+ *   - Readers are drained, dat and idx are closed
  *   - Idx file is removed
- *   - Tmp file is renamed to dat
- *   - Dat file is opened
- *   - Idx file is rebuilt
+ *   - Tmp files are renamed to dat and idx
+ *   - Dat and idx files are opened (old files are released after)
+ * 
+ * In segmented mode this function is cheap. Whole segments are removed, 
+ * the first remaining one is trimmed logically, and no data is copied
+ * (see ldb_open_segmented()).
  * 
  * @param[in] obj Database to update.
  * @param[in] seqnum Sequence number up to which records are removed.
@@ -380,17 +1068,196 @@ long ldb_rollback(ldb_db_t *obj, uint64_t seqnum);
  */
 long ldb_purge(ldb_db_t *obj, uint64_t seqnum);
 
-#ifdef __cplusplus
-}
-#endif
-
-#endif /* LOGDB_H */
-
-/* ------------------------------------------------------------------------- */
+/**
+ * Write the entries in range [seqnum1, seqnum2] to fd as a raw dat stream.
+ * 
+ * The stream is the dat file header followed by the records, as stored in 
+ * the dat file (they are not decoded nor checksummed). On Linux, bytes are 
+ * moved by the kernel (copy_file_range when fd is a file, sendfile otherwise)
+ * and never enter user space. Bytes are written at the current offset of fd.
+ * Appends continue meanwhile, rollback and purge wait until the export ends.
+ * 
+ * The range is clamped to the existing entries. If there are no entries in 
+ * the range, only the header is written.
+ *   - Segmented mode: all exported segments must have the same format 
+ *     (LDB_ERR_FMT_DAT otherwise, see ldb_set_compression()).
+ *   - Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to export.
+ * @param[in] seqnum1 First sequence number to export.
+ * @param[in] seqnum2 Last sequence number to export.
+ * @param[in] fd File descriptor where the stream is written (file, pipe or socket).
+ * @return Number of exported entries, or error if negative 
+ *         (LDB_ERR_STREAM if the copy fails).
+ */
+long ldb_export(ldb_db_t *obj, uint64_t seqnum1, uint64_t seqnum2, int fd);
 
-#ifdef LDB_IMPL
+/**
+ * Append the entries of a stream written by ldb_export().
+ * 
+ * The stream is copied to the dat file (by the kernel when fd is a file, see 
+ * ldb_export()), then the copied records are indexed in one pass reading 
+ * their headers. Entries are not decoded nor re-encoded. The first seqnum 
+ * of the stream must follow the last one of the database (any seqnum if 
+ * empty) and timestamps can not decrease.
+ * 
+ * The stream must have the database format. An empty database takes the 
+ * format of the stream (if compression is not enabled). 
+ * 
+ * Import is all-or-nothing: on error (torn stream, broken sequence, checksum 
+ * mismatch) copied bytes are removed and the database is unchanged.
+ *   - Segmented mode: entries are appended to the last segment (the next 
+ *     append starts a new segment if the maximum length is exceeded).
+ *   - Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] fd File descriptor read until eof (file, pipe or socket).
+ * @param[in] check Verify the checksum of the records (data is read). 
+ *            Otherwise, imported records are checked on the next open 
+ *            with check=true (checkpoint is not advanced).
+ * @return Number of imported entries, or error if negative.
+ */
+long ldb_import(ldb_db_t *obj, int fd, bool check);
 
-#include <time.h>
+/**
+ * Enables the secondary key index (or disables it if key_fn is NULL).
+ * 
+ * The key of each entry is extracted from its metadata by key_fn, that 
+ * returns false if the entry has no key (entry not indexed). Keys are 64-bit 
+ * values (hash variable-length keys and compare the metadata of the matches).
+ * The function must be the same across opens, and it is called by the 
+ * writing thread (it must not call ldb functions).
+ * 
+ * The index is persisted in the {name}.key file as a run of (key, seqnum) 
+ * pairs sorted by key. Pairs of the entries appended after the run are kept 
+ * in an in-memory hash table, and they are merged into a new run file when 
+ * they exceed a fraction of the run (and on close). On enable, the run file 
+ * is loaded and the entries not covered are indexed (all of them the first
+ * time). Rollback removes the pairs of the removed entries. Purged entries 
+ * are filtered out, and their pairs are dropped on the next merge.
+ * Disabling the index removes the file, as does a rollback done while the 
+ * index is disabled (it is rebuilt on the next enable).
+ *   - Segmented mode: one index covers all segments.
+ *   - Multi-log mode: not supported (LDB_ERR).
+ * 
+ * @param[in] obj Database to update.
+ * @param[in] key_fn Key extraction function (NULL = disable).
+ * @return Error code (0 = OK).
+ */
+int ldb_set_key_index(ldb_db_t *obj, ldb_key_fn key_fn);
+
+/**
+ * Returns the seqnums of the entries having the given key.
+ * 
+ * Matching seqnums not less than seqnum are returned in ascending order.
+ * Call it again with the last returned seqnum + 1 to get the next ones.
+ * Lookups do not scan the entries: the run file is binary searched and the
+ * tail pairs are found by hash.
+ * 
+ * @param[in] obj Database to use.
+ * @param[in] key Key to search.
+ * @param[in] seqnum Initial sequence number.
+ * @param[out] seqnums Array of seqnums (at least len items).
+ * @param[in] len Maximum number of seqnums to return.
+ * @param[out] num Number of returned seqnums (can be NULL).
+ * @return Error code (0 = OK, LDB_ERR if the index is not enabled, 
+ *         LDB_ERR_NOT_FOUND if no entry matches).
+ */
+int ldb_lookup_key(ldb_db_t *obj, uint64_t key, uint64_t seqnum, uint64_t *seqnums, size_t len, size_t *num);
+
+/**
+ * Allocates a ldb_wal_t object.
+ * 
+ * @return Allocated object or NULL if no memory.
+ */
+ldb_wal_t * ldb_wal_alloc(void);
+
+/**
+ * Deallocates a ldb_wal_t object.
+ * 
+ * @param wal Object to deallocate.
+ */
+void ldb_wal_free(ldb_wal_t *wal);
+
+/**
+ * Open a shared write-ahead log (multi-log mode).
+ * 
+ * Many logical logs, identified by id, share one append stream split in 
+ * bounded-size segment files named {name}_{id}.wal (id = 8-digit sequential 
+ * number). A new segment is started when the last one reaches segment_len 
+ * bytes. Each log has its own seqnum and timestamp space, and it is used
+ * with the regular functions (see ldb_wal_log()). Its index (timestamp and
+ * stream position of each entry) is kept in memory and rebuilt scanning the
+ * segments on open. Rollback and purge append a marker record. Segments
+ * not referenced by any log are removed on purge.
+ * 
+ * Only one descriptor per segment is used, whatever the number of logs.
+ * Concurrent appends to distinct logs are made durable by one fdatasync 
+ * (group commit) when force_fsync is set, and ldb_wal_sync() syncs all the
+ * appended entries at once.
+ * 
+ * If no segment exists, a new wal is created.
+ * A torn or corrupted tail of the last segment is truncated.
+ * 
+ * @param[in,out] wal Uninitialized wal object.
+ * @param[in] path Directory where segment files are located.
+ * @param[in] name Wal name (chars allowed: [a-zA-Z0-9_], max length = 22).
+ * @param[in] segment_len Length of the segment file starting a new segment (greater than 0).
+ * @param[in] check Verify the checksum of all records (otherwise only the last segment ones).
+ * @return Error code (0 = OK). You must call ldb_wal_close() at the end (even if error).
+ */
+int ldb_wal_open(ldb_wal_t *wal, const char *path, const char *name, size_t segment_len, bool check);
+
+/**
+ * Returns the log identified by id (created if not exists).
+ * 
+ * The log is a database object owned by the wal, valid until ldb_wal_close().
+ * Functions ldb_append(), ldb_append_mt(), ldb_append_async(), ldb_read(),
+ * ldb_read_arena(), ldb_wait(), ldb_cursor_*(), ldb_stats(), ldb_search(), 
+ * ldb_rollback(), ldb_purge() and ldb_get_metrics() are supported. 
+ * Functions ldb_read_view(), ldb_set_mmap_idx(), ldb_set_compression(),
+ * ldb_set_cache() and ldb_close() return LDB_ERR.
+ * A log without entries is not persisted.
+ * 
+ * @param[in] wal Wal to use.
+ * @param[in] id Log identifier.
+ * @return The log, or NULL on error (wal not opened or no memory).
+ */
+ldb_db_t * ldb_wal_log(ldb_wal_t *wal, uint64_t id);
+
+/**
+ * Makes durable all the entries appended to the wal logs (one fdatasync).
+ * 
+ * Calls done concurrently (or by the appends with force_fsync set) are
+ * served by the same fdatasync.
+ * 
+ * @param[in] wal Wal to sync.
+ * @return Error code (0 = OK).
+ */
+int ldb_wal_sync(ldb_wal_t *wal);
+
+/**
+ * Close a wal.
+ * 
+ * Closes its logs and segment files and releases allocated memory.
+ * No function can be called on its logs meanwhile.
+ * 
+ * @param[in,out] wal Wal to close.
+ * @return Return code (0 = OK).
+ */
+int ldb_wal_close(ldb_wal_t *wal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGDB_H */
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef LDB_IMPL
+
+#include <time.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
@@ -401,18 +1268,243 @@ long ldb_purge(ldb_db_t *obj, uint64_t seqnum);
 #include <limits.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef __linux__
+    #include <sys/sendfile.h>
+    #include <sys/syscall.h>
+    long syscall(long number, ...);  /* not declared under strict POSIX feature macros */
+#endif
+
+#ifdef LDB_IO_URING
+    #ifndef __linux__
+        #error "LDB_IO_URING requires Linux"
+    #endif
+    #include <linux/io_uring.h>
+#endif
 
 #define LDB_EXT_DAT             ".dat"
 #define LDB_EXT_IDX             ".idx"
 #define LDB_EXT_TMP             ".tmp"
+#define LDB_EXT_TMP_IDX         ".idx.tmp"
+#define LDB_EXT_SEG             ".seg"
+#define LDB_EXT_CHK             ".chk"
+#define LDB_EXT_WAL             ".wal"
+#define LDB_EXT_KEY             ".key"
+#define LDB_EXT_TMP_KEY         ".key.tmp"
 #define LDB_PATH_SEPARATOR      "/"
 #define LDB_NAME_MAX_LENGTH     32 
 #define LDB_TEXT_LEN            128  /* value multiple of 8 to preserve alignment */
 #define LDB_TEXT_DAT            "\nThis is a ldb database dat file.\nDon't edit it.\n"
 #define LDB_TEXT_IDX            "\nThis is a ldb database idx file.\nDon't edit it.\n"
+#define LDB_TEXT_SEG            "\nThis is a ldb database seg file.\nDon't edit it.\n"
+#define LDB_TEXT_WAL            "\nThis is a ldb database wal file.\nDon't edit it.\n"
+#define LDB_TEXT_KEY            "\nThis is a ldb database key file.\nDon't edit it.\n"
+#define LDB_SEG_NAME_MAX_LENGTH (LDB_NAME_MAX_LENGTH - 10)  /* room for the '_{id}' suffix */
 #define LDB_MAGIC_NUMBER        0x211ABF1A62646C00
-#define LDB_FORMAT_1            1
+#define LDB_FORMAT_1            1  /* crc32 checksum */
+#define LDB_FORMAT_2            2  /* crc32c checksum */
+#define LDB_FORMAT_3            3  /* crc32c checksum + compressed data */
+#define LDB_FORMAT_DEFAULT      LDB_FORMAT_2
+#define LDB_MMAP_IDX_MIN_LEN    (1024 * 1024)  /* minimum length of the idx mapping */
+#define LDB_MMAP_DAT_MIN_LEN    (16 * 1024 * 1024)  /* minimum length of the dat mapping */
+#define LDB_READ_BUFFER_LEN     (256 * 1024)  /* maximum length of coalesced dat reads */
+#define LDB_CURSOR_BUFFER_LEN   (1024 * 1024)  /* length of the cursor read-ahead buffer */
+#define LDB_METADATA_READ_LEN   4096  /* length of the read of a record header and metadata */
+#define LDB_ARENA_MIN_LEN       (64 * 1024)  /* minimum length of the pooled arena blocks */
+#define LDB_CHECKPOINT_LEN      (64 * 1024 * 1024)  /* dat bytes appended between checkpoints */
+#define LDB_CHECK_CHUNK_LEN     (64 * 1024 * 1024)  /* minimum dat bytes checked per thread */
+#define LDB_CHECK_MAX_THREADS   8  /* maximum number of threads checking the dat file */
+#define LDB_FENCE_STEP          1024  /* seqnums between consecutive entries of the fence table */
+#define LDB_WRITE_MAX_ENTRIES   256  /* initial length of the write buffer (grows as needed) */
+#define LDB_COMPRESS_MIN_LEN    64  /* minimum data length to try compression */
+#define LDB_LZ4_HASH_LOG        12  /* log2 of the match finder table entries */
+#define LDB_WAL_SCAN_LEN        (1024 * 1024)  /* length of the reads scanning a wal segment on open */
+#define LDB_WAL_MIN_SLOTS       64  /* minimum number of allocated slots per log */
+#define LDB_SPLICE_MAX_LEN      (1024 * 1024 * 1024)  /* maximum length of a kernel copy call */
+#define LDB_KEYS_MIN_SLOTS      64  /* minimum number of allocated tail pairs */
+#define LDB_KEYS_MERGE_MIN      (64 * 1024)  /* tail pairs triggering a merge (minimum) */
+#define LDB_KEYS_MERGE_MAX      (1024 * 1024)  /* tail pairs triggering a merge (maximum) */
+#define LDB_KEYS_SCAN_LEN       1024  /* entries read per call when indexing existing entries */
+#define LDB_CACHE_LINE_LEN      64  /* separation between fields written by distinct threads */
+#define LDB_WAL_ENTRY           1  /* wal record types */
+#define LDB_WAL_ROLLBACK        2
+#define LDB_WAL_PURGE           3
+
+#define LDB_URING_DEPTH         8  /* io_uring submission queue entries */
+#define LDB_URING_READ_CHUNK    (32 * 1024)  /* minimum length of each parallel dat read */
+
+#if !defined(LDB_NO_METRICS) && !defined(__GNUC__) && !defined(__clang__)
+    #define LDB_NO_METRICS  /* metrics use the __atomic builtins */
+#endif
+
+#if !defined(LDB_NO_SEQLOCK) && !defined(__GNUC__) && !defined(__clang__)
+    #define LDB_NO_SEQLOCK  /* state snapshots use the __atomic builtins (mutex_data otherwise) */
+#endif
+
+#ifdef IOV_MAX
+    #define LDB_IOV_MAX         IOV_MAX
+#else
+    #define LDB_IOV_MAX         1024  /* value on Linux and BSD (not exposed by POSIX headers) */
+#endif
+
+typedef struct ldb_mmap_t {
+    char *addr;                   // Mapping address
+    size_t len;                   // Mapping length
+    struct ldb_mmap_t *next;      // Next retired mapping
+} ldb_mmap_t;
+
+typedef struct ldb_append_req_t {
+    ldb_entry_t *entries;         // Entries to append
+    size_t len;                   // Number of entries to append
+    size_t num;                   // Number of entries appended
+    int ret;                      // Result code
+    bool done;                    // Request processed (guarded by mutex_queue)
+    struct ldb_append_req_t *next; // Next queued request
+} ldb_append_req_t;
+
+typedef struct ldb_record_dat_t {
+    uint64_t seqnum;
+    uint64_t timestamp;
+    uint32_t metadata_len;
+    uint32_t data_len;
+    uint32_t checksum;
+    uint32_t raw_len;             // Uncompressed data length (LDB_FORMAT_3, padding otherwise)
+} ldb_record_dat_t;
+
+typedef struct ldb_record_idx_t {
+    uint64_t seqnum;
+    uint64_t timestamp;
+    uint64_t pos;
+} ldb_record_idx_t;
+
+typedef struct ldb_cache_entry_t {
+    uint64_t seqnum;
+    uint64_t timestamp;
+    uint32_t metadata_len;
+    uint32_t data_len;
+    char *buf;                    // Metadata followed by data
+} ldb_cache_entry_t;
+
+typedef struct ldb_cache_t {
+    ldb_cache_entry_t *slots;     // Ring of cached entries (consecutive seqnums)
+    size_t max_slots;             // Allocated slots (power of 2)
+    size_t head;                  // Slot of the first cached entry
+    size_t num;                   // Number of cached entries
+    size_t bytes;                 // Memory used by cached entries (slots included)
+    size_t max_bytes;             // Memory budget (0 = disabled, updated with mutex_write)
+    uint64_t seqnum1;             // Seqnum of the first cached entry
+} ldb_cache_t;
+
+typedef struct ldb_wbuf_t {
+    ldb_record_dat_t *records_dat; // Pending dat records
+    ldb_record_idx_t *records_idx; // Pending idx records (contiguous in idx file)
+    const ldb_entry_t **entries;  // Pending entries (metadata and data not copied)
+    struct iovec *iov;            // Vectors used to write the dat file
+    char *zbuf;                   // Compressed data of pending entries
+    size_t zbuf_len;              // Used bytes in zbuf
+    size_t zbuf_max;              // Allocated bytes in zbuf
+    size_t num;                   // Number of pending entries
+    size_t max;                   // Number of allocated entries
+    size_t dat_pos;               // Dat file position of the first pending entry
+    size_t idx_pos;               // Idx file position of the first pending entry
+    size_t num_submitted;         // Number of entries submitted (see ldb_submit_entries)
+    size_t iovcnt;                // Number of vectors submitted
+    size_t dat_len;               // Number of dat bytes submitted
+    bool fsync;                   // Submitted writes are followed by a fdatasync
+    int ret;                      // Result of the submitted writes (POSIX path)
+} ldb_wbuf_t;
+
+#ifdef LDB_IO_URING
+typedef struct ldb_uring_t {
+    int fd;                       // Ring file descriptor (-1 if not available)
+    bool failed;                  // Ring unusable (a syscall failed)
+    unsigned features;            // IORING_FEAT_* flags reported by the kernel
+    unsigned sq_tail;             // Local copy of the submission queue tail
+    unsigned num_unsubmitted;     // Queued entries not consumed by the kernel
+    unsigned num_inflight;        // Queued entries not completed
+    unsigned *sq_head;
+    unsigned *sq_tail_ptr;
+    unsigned *sq_mask;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    char *sq_ptr;                 // Submission queue mapping
+    size_t sq_len;
+    char *cq_ptr;                 // Completion queue mapping (can be sq_ptr)
+    size_t cq_len;
+    size_t sqes_len;
+} ldb_uring_t;
+#endif
+
+typedef struct ldb_checkpoint_t {
+    uint64_t magic_number;
+    uint32_t format;
+    uint64_t seqnum;              // Last verified seqnum
+    uint64_t timestamp;           // Timestamp of the last verified record
+    uint64_t pos;                 // Position of the last verified record (dat file)
+    uint32_t checksum;
+} ldb_checkpoint_t;
+
+typedef struct ldb_key_t {
+    uint64_t key;
+    uint64_t seqnum;
+} ldb_key_t;
+
+typedef struct ldb_key_slot_t {
+    uint64_t key;
+    uint64_t seqnum;
+    size_t prev;                  // Previous slot of the same bucket + 1 (0 = none)
+} ldb_key_slot_t;
+
+typedef struct ldb_keys_t {
+    ldb_key_fn fn;                // Key extraction function (NULL = index disabled)
+    char *path;                   // Run filepath (path + filename)
+    int fd;                       // Run file descriptor (-1 if none)
+    size_t num_run;               // Number of pairs in the run file
+    uint64_t run_seqnum2;         // Last seqnum covered by the run (pairs above it are stale)
+    uint64_t seqnum2;             // Last indexed seqnum (run or tail)
+    ldb_key_slot_t *slots;        // Pairs of the entries after run_seqnum2 (seqnum order)
+    size_t num_slots;             // Number of tail pairs
+    size_t max_slots;             // Allocated tail pairs
+    size_t *heads;                // Last slot + 1 of each bucket (0 = empty)
+    size_t num_heads;             // Number of buckets (power of 2, 2 * max_slots)
+} ldb_keys_t;
+
+typedef struct ldb_flusher_t {
+    struct ldb_impl_t *db;        // Database synced
+    ldb_flush_policy_t policy;    // Sync triggers
+    pthread_t thread;             // Flusher thread
+    pthread_mutex_t mutex;        // Guards the variables below (leaf lock)
+    pthread_cond_t cond;          // Signaled on appends, sync requests and stop (uses mutex)
+    size_t num_entries;           // Entries published and not synced
+    size_t num_bytes;             // Dat bytes published and not synced
+    struct timespec deadline;     // Sync time of the first entry not synced (see interval_ms)
+    bool requested;               // A waiter requested a sync
+    bool stop;                    // The thread must exit
+    int ret;                      // Result of the last sync (sticky, guarded by db->mutex_data)
+} ldb_flusher_t;
+
+typedef struct ldb_record_wal_t {
+    uint64_t log_id;
+    uint64_t seqnum;              // Entry seqnum (rollback and purge markers: seqnum argument)
+    uint64_t timestamp;
+    uint32_t metadata_len;
+    uint32_t data_len;
+    uint32_t type;                // LDB_WAL_ENTRY, LDB_WAL_ROLLBACK or LDB_WAL_PURGE
+    uint32_t checksum;            // Covers the previous fields, metadata and data
+} ldb_record_wal_t;
+
+typedef struct ldb_wal_slot_t {
+    uint64_t timestamp;           // Entry timestamp
+    uint64_t pos;                 // Stream position of the record
+    size_t len;                   // Record length (header included)
+} ldb_wal_slot_t;
 
 typedef struct ldb_impl_t
 {
@@ -421,28 +1513,112 @@ typedef struct ldb_impl_t
     char *path;                   // Directory where files are located
     char *dat_path;               // Data filepath (path + filename)
     char *idx_path;               // Index filepath (path + filename)
+    char *chk_path;               // Checkpoint filepath (path + filename)
     uint32_t format;              // File format
+    uint32_t fixed_len;           // Metadata + data length of every record (0 = variable, no idx file otherwise)
+
+    // Segmented mode
+    char *seg_path;               // Manifest filepath (unchanged, NULL in regular mode)
+    struct ldb_impl_t **segs;     // Segments ordered by seqnum (guarded by lock_files and mutex_data)
+    size_t num_segs;              // Number of segments
+    size_t seg_max_len;           // Data file length starting a new segment
+    uint64_t seg_first_id;        // Id of the first segment
+    uint64_t seg_seqnum1;         // First seqnum (logical trim of the first segment)
+    ldb_state_t seg_state;        // Write state of the last segment (thread-write)
+    struct ldb_impl_t *seg_owner; // Segmented db owning this segment (unchanged, NULL if not a segment)
+
+    // Multi-log mode
+    struct ldb_wal_impl_t *wal;   // Wal containing the log (unchanged, NULL if not a log)
+    uint64_t wal_id;              // Log identifier (unchanged)
+    ldb_wal_slot_t *wal_slots;    // Slots of the entries, seqnum1 at wal_first (guarded by lock_files)
+    size_t wal_first;             // Slot of the first entry
+    size_t wal_max;               // Allocated slots
+    ldb_record_wal_t *wal_records; // Pending records (thread-write, see wbuf.entries)
+    ldb_state_t wal_wstate;       // State covering the records written to the stream (thread-write)
+    uint64_t wal_pos1;            // Stream position of the first record (UINT64_MAX if none, guarded by mutex_data)
 
     // Thread-write variables
     FILE *dat_fp;                 // Data file pointer (used to write)
     FILE *idx_fp;                 // Index file pointer (used to write)
+    int dat_wfd;                  // Data file descriptor (used to append, dup of dat_fp sharing its offset)
+    size_t dat_wpos;              // Current offset of dat_wfd
+    ldb_wbuf_t wbuf;              // Entries appended but not written yet
+    ldb_state_t wstate;           // State submitted by ldb_append_async() (published on completion)
+    bool wpending;                // An ldb_append_async() batch is not completed
+#ifdef LDB_IO_URING
+    ldb_uring_t *uring;           // Ring used to write (NULL if not created yet)
+#endif
     size_t dat_end;               // Last position on data file
     bool force_fsync;             // Force fsync after flush
-    char padding[64];             // Padding to avoid destructive interference between threads
+    bool compress;                // Compress appended data (see ldb_set_compression)
+    size_t prealloc_len;          // Preallocation chunk of the dat and idx files (0 = disabled)
+    size_t dat_alloc;             // Dat file length including the preallocated tail (0 = unknown)
+    size_t idx_alloc;             // Idx file length including the preallocated tail (0 = unknown)
+    ldb_cache_t cache;            // Recently appended entries (guarded by lock_cache)
+    ldb_keys_t keys;              // Secondary key index (guarded by lock_keys, modified by writers)
+    ldb_checkpoint_t chk;         // Last checkpoint (zeroed if none)
+    bool chk_valid;               // All records were verified (checkpoint can advance)
+    ldb_append_req_t *queue_head; // First pending append_mt() request (guarded by mutex_queue)
+    ldb_append_req_t *queue_tail; // Last pending append_mt() request (guarded by mutex_queue)
+    bool queue_leader;            // A thread is writing a group of requests (guarded by mutex_queue)
+    ldb_flusher_t *flusher;       // Background flusher (NULL if not running, set under mutex_write and mutex_data)
+    size_t flush_bytes;           // Dat bytes written and not notified to the flusher
+    char padding_write[LDB_CACHE_LINE_LEN]; // Avoids destructive interference with the readers
 
     // Thread-read variables
     int dat_fd;                   // Data file descriptor (used to read)
     int idx_fd;                   // Index file descriptor (used to read)
+    char *idx_map;                // Index file memory map (NULL if not mapped)
+    size_t idx_map_len;           // Index file memory map length
+    bool mmap_idx;                // Index file memory-mapped mode enabled
+    char *dat_map;                // Data file memory map used by views (NULL if not mapped)
+    size_t dat_map_len;           // Data file memory map length
+    ldb_mmap_t *dat_map_old;      // Retired data file maps still referenced by views
+    size_t num_views;             // Number of views not released (guarded by mutex_data)
+    char padding_read[LDB_CACHE_LINE_LEN];  // Avoids destructive interference with the state
 
     // Shared data (accessed by both threads)
-    ldb_state_t state;            // First and last seqnums and timestamps
+    uint64_t state_seq;           // Seqlock of state (odd while publishing, see ldb_load_state)
+    ldb_state_t state;            // First and last seqnums and timestamps (see ldb_publish_state)
+    char padding_state[LDB_CACHE_LINE_LEN]; // State cache line not shared with the next fields
+    uint64_t *fences;             // Timestamp of seqnum1 + i * LDB_FENCE_STEP (guarded by mutex_data)
+    size_t num_fences;            // Number of fences (guarded by mutex_data)
+    size_t max_fences;            // Allocated fences (guarded by mutex_data)
+    uint64_t rollback_id;         // Incremented when a rollback removes entries (guarded by mutex_data)
+    uint64_t purge_id;            // Incremented when a purge moves or removes records (guarded by mutex_data)
+    uint64_t durable_seqnum;      // Last seqnum on stable storage (guarded by mutex_data)
+    size_t num_waiters;           // Threads blocked in ldb_wait() or ldb_wait_durable() (guarded by mutex_data)
+    bool closing;                 // Close in progress, waiters must return (guarded by mutex_data)
+    ldb_metrics_t metrics;        // Counters and histograms (relaxed atomics, see ldb_get_metrics)
 
     // Guards
     pthread_mutex_t mutex_data;   // Prevents race condition on state values
-    pthread_mutex_t mutex_files;  // Preserve coherence between shared variable and file contents
+    pthread_rwlock_t lock_files;  // Preserve coherence between shared variable and file contents
+    pthread_cond_t cond_views;    // Signaled when all views are released (uses mutex_data)
+    pthread_cond_t cond_state;    // Signaled when state changes or waiters leave (uses mutex_data)
+    pthread_rwlock_t lock_cache;  // Guards the hot-tail cache (shared by readers)
+    pthread_rwlock_t lock_keys;   // Guards the key index (shared by lookups)
+    pthread_mutex_t mutex_write;  // Serializes writers (append, rollback, purge)
+    pthread_mutex_t mutex_queue;  // Guards the append_mt() requests queue
+    pthread_cond_t cond_queue;    // Signaled when a group of requests is written (uses mutex_queue)
 
 } ldb_impl_t;
 
+typedef struct ldb_cursor_impl_t
+{
+    ldb_impl_t *db;               // Database (NULL if not opened)
+    ldb_impl_t *file;             // Database or segment containing the next entry (NULL = seek required)
+    uint64_t seqnum;              // Next seqnum to read (0 = first entry)
+    size_t pos;                   // Dat position of the next entry (in file)
+    uint64_t file_seqnum2;        // Last seqnum of file when positioned
+    uint64_t rollback_id;         // Value of db->rollback_id when positioned
+    uint64_t purge_id;            // Value of db->purge_id when positioned
+    char *buf;                    // Read-ahead buffer (LDB_CURSOR_BUFFER_LEN bytes)
+    size_t buf_pos;               // File position of buf[0]
+    size_t buf_end;               // File position after the last byte in buf
+    uint64_t buf_seqnum2;         // Published seqnum when buf was filled (later records can be partial)
+} ldb_cursor_impl_t;
+
 typedef struct ldb_header_dat_t {
     uint64_t magic_number;
     uint32_t format;
@@ -455,19 +1631,117 @@ typedef struct ldb_header_idx_t {
     char text[LDB_TEXT_LEN];
 } ldb_header_idx_t;
 
-typedef struct ldb_record_dat_t {
-    uint64_t seqnum;
-    uint64_t timestamp;
-    uint32_t metadata_len;
-    uint32_t data_len;
+typedef struct ldb_header_seg_t {
+    uint64_t magic_number;
+    uint32_t format;
+    char text[LDB_TEXT_LEN];
+    uint64_t first_id;
+    uint64_t seqnum1;
     uint32_t checksum;
-} ldb_record_dat_t;
+} ldb_header_seg_t;
 
-typedef struct ldb_record_idx_t {
-    uint64_t seqnum;
-    uint64_t timestamp;
-    uint64_t pos;
-} ldb_record_idx_t;
+typedef struct ldb_header_key_t {
+    uint64_t magic_number;
+    uint32_t format;
+    char text[LDB_TEXT_LEN];
+    uint64_t seqnum2;             // Last indexed seqnum
+    uint64_t num;                 // Number of pairs
+    uint32_t checksum;
+} ldb_header_key_t;
+
+typedef struct ldb_header_wal_t {
+    uint64_t magic_number;
+    uint32_t format;
+    char text[LDB_TEXT_LEN];
+    uint64_t pos;                 // Stream position of the first record
+    uint32_t checksum;
+} ldb_header_wal_t;
+
+typedef struct ldb_wal_seg_t {
+    uint64_t pos;                 // Stream position of the first record
+    int fd;                       // Segment file descriptor (read and write)
+} ldb_wal_seg_t;
+
+typedef struct ldb_wal_impl_t
+{
+    char *name;                   // Wal name
+    char *path;                   // Directory where files are located
+    size_t seg_max_len;           // Segment length starting a new segment
+    uint64_t seg_first_id;        // Id of the first segment (guarded by lock_segs)
+    ldb_wal_seg_t *segs;          // Segments ordered by position (guarded by lock_segs)
+    size_t num_segs;              // Number of segments (guarded by lock_segs)
+    uint64_t end_pos;             // Stream position after the last record (guarded by mutex_write)
+    uint64_t written_pos;         // Value of end_pos readable by syncers (guarded by mutex_sync)
+    uint64_t synced_pos;          // Stream position made durable (guarded by mutex_sync)
+    bool syncing;                 // A thread is syncing on behalf of the others (guarded by mutex_sync)
+    struct ldb_impl_t **logs;     // Logs ordered by id (guarded by mutex_logs)
+    size_t num_logs;              // Number of logs
+    size_t max_logs;              // Allocated logs
+
+    pthread_mutex_t mutex_logs;   // Guards the logs array
+    pthread_mutex_t mutex_write;  // Serializes writes to the stream (append, markers, new segments)
+    pthread_rwlock_t lock_segs;   // Shared by readers and syncers, exclusive when the segments array changes
+    pthread_mutex_t mutex_sync;   // Guards the group commit variables
+    pthread_cond_t cond_sync;     // Signaled when a sync ends (uses mutex_sync)
+} ldb_wal_impl_t;
+
+// Segmented mode functions (defined at the end)
+static int ldb_seg_close(ldb_impl_t *obj);
+static int ldb_seg_append_entries(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entries, size_t len, size_t *num);
+static int ldb_seg_commit(ldb_impl_t *obj, ldb_state_t *state);
+static int ldb_seg_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, bool view, ldb_arena_t *arena);
+static void ldb_seg_release_view(ldb_impl_t *obj, ldb_entry_t *entries, size_t len);
+static int ldb_seg_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats);
+static int ldb_seg_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum);
+static long ldb_seg_rollback(ldb_impl_t *obj, uint64_t seqnum);
+static long ldb_seg_purge(ldb_impl_t *obj, uint64_t seqnum);
+static long ldb_seg_export(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, int fd);
+static long ldb_seg_import(ldb_impl_t *obj, int fd, bool check);
+static int ldb_seg_append_raw(ldb_impl_t *obj, ldb_state_t *state, const char *buf, size_t len, bool check, size_t *num);
+static int ldb_seg_set_mmap_idx(ldb_impl_t *obj, bool enable);
+static int ldb_seg_set_compression(ldb_impl_t *obj, bool enable);
+static int ldb_seg_set_cache(ldb_impl_t *obj, size_t max_bytes);
+static int ldb_seg_set_preallocation(ldb_impl_t *obj, size_t len);
+static size_t ldb_seg_find(ldb_impl_t *obj, uint64_t seqnum);
+
+// Multi-log mode functions (defined at the end)
+static int ldb_wal_append_entries(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entries, size_t len, size_t *num);
+static int ldb_wal_commit(ldb_impl_t *obj, ldb_state_t *state);
+static int ldb_wal_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena);
+static int ldb_wal_read_slots(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena);
+static int ldb_wal_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats);
+static int ldb_wal_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum);
+static long ldb_wal_rollback(ldb_impl_t *obj, uint64_t seqnum);
+static long ldb_wal_purge(ldb_impl_t *obj, uint64_t seqnum);
+
+// Writes a checkpoint covering the records in state (defined before ldb_open_file_dat)
+static int ldb_write_checkpoint(ldb_impl_t *obj, ldb_state_t *state);
+
+// Completes the pending ldb_append_async() batch (defined before ldb_append)
+static int ldb_complete(ldb_impl_t *obj);
+
+// Removes the preallocated tails of the files (defined before ldb_submit_entries)
+static int ldb_trim_files(ldb_impl_t *obj);
+
+// Flusher functions (defined before ldb_wait)
+static uint64_t ldb_count_appended(const ldb_state_t *prev, const ldb_state_t *state);
+static void ldb_flusher_notify(ldb_impl_t *obj, uint64_t num, ldb_impl_t *file);
+static void ldb_flusher_stop(ldb_impl_t *obj);
+
+// Removes the cached entries greater than seqnum (defined before ldb_append_record_idx)
+static void ldb_cache_truncate(ldb_cache_t *cache, uint64_t seqnum);
+
+// Key index functions (defined before the segmented mode functions)
+static void ldb_keys_fill(ldb_impl_t *obj);
+static void ldb_keys_fill_raw(ldb_impl_t *obj, const char *raw, size_t len);
+static void ldb_keys_import(ldb_impl_t *obj, uint64_t seqnum);
+static void ldb_keys_truncate(ldb_impl_t *obj, uint64_t seqnum);
+static int ldb_keys_merge(ldb_impl_t *obj);
+static void ldb_keys_free(ldb_keys_t *keys);
+
+#ifdef LDB_IO_URING
+static void ldb_uring_free(ldb_uring_t *ring);
+#endif
 
 #if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_LLVM_COMPILER) 
     #define LDB_INLINE     __attribute__((const)) __attribute__((always_inline)) inline
@@ -475,6 +1749,20 @@ typedef struct ldb_record_idx_t {
     #define LDB_INLINE     /**/
 #endif
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define LDB_CRC32C_SSE42
+    #include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+    #define LDB_CRC32C_ARMV8
+    #include <arm_acle.h>
+    #include <sys/auxv.h>
+    #ifndef HWCAP_CRC32
+        #define HWCAP_CRC32 (1 << 7)
+    #endif
+#endif
+
 #if defined __has_attribute
     #if __has_attribute(__fallthrough__)
         # define fallthrough   __attribute__((__fallthrough__))
@@ -548,6 +1836,142 @@ uint32_t ldb_crc32(const char *bytes, size_t len, uint32_t checksum)
     return ~checksum;
 }
 
+/* crc32c reversed Castagnoli polynomial */
+#define LDB_CRC32C_POLY      0x82F63B78
+
+// slice-by-8 tables (initialized once, see ldb_crc32c_init())
+static uint32_t ldb_crc32c_tab[8][256];
+
+typedef uint32_t (*ldb_crc_func_t)(const char *bytes, size_t len, uint32_t checksum);
+
+static ldb_crc_func_t ldb_crc32c_func = NULL;
+static pthread_once_t ldb_crc32c_once = PTHREAD_ONCE_INIT;
+
+// Portable crc32c using the slice-by-8 algorithm.
+static uint32_t ldb_crc32c_sw(const char *bytes, size_t len, uint32_t checksum)
+{
+    const unsigned char *ptr = (const unsigned char *) bytes;
+    uint32_t crc = ~checksum;
+
+    for (; len > 0 && ((uintptr_t) ptr & 7) != 0; len--, ptr++)
+        crc = (crc >> 8) ^ ldb_crc32c_tab[0][(crc ^ *ptr) & 0xff];
+
+    for (; len >= 8; len -= 8, ptr += 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 | (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24);
+        uint32_t hi = ((uint32_t) ptr[4] | (uint32_t) ptr[5] << 8 | (uint32_t) ptr[6] << 16 | (uint32_t) ptr[7] << 24);
+
+        crc = ldb_crc32c_tab[7][lo & 0xff] ^ ldb_crc32c_tab[6][(lo >> 8) & 0xff] ^
+              ldb_crc32c_tab[5][(lo >> 16) & 0xff] ^ ldb_crc32c_tab[4][lo >> 24] ^
+              ldb_crc32c_tab[3][hi & 0xff] ^ ldb_crc32c_tab[2][(hi >> 8) & 0xff] ^
+              ldb_crc32c_tab[1][(hi >> 16) & 0xff] ^ ldb_crc32c_tab[0][hi >> 24];
+    }
+
+    for (; len > 0; len--, ptr++)
+        crc = (crc >> 8) ^ ldb_crc32c_tab[0][(crc ^ *ptr) & 0xff];
+
+    return ~crc;
+}
+
+#ifdef LDB_CRC32C_SSE42
+// crc32c using the SSE4.2 crc32 instruction.
+__attribute__((target("sse4.2")))
+static uint32_t ldb_crc32c_sse42(const char *bytes, size_t len, uint32_t checksum)
+{
+    uint64_t crc = (uint32_t) ~checksum;
+    uint64_t word = 0;
+
+    for (; len >= 8; len -= 8, bytes += 8) {
+        memcpy(&word, bytes, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+
+    uint32_t crc32 = (uint32_t) crc;
+
+    for (; len > 0; len--, bytes++)
+        crc32 = _mm_crc32_u8(crc32, (unsigned char) *bytes);
+
+    return ~crc32;
+}
+#endif
+
+#ifdef LDB_CRC32C_ARMV8
+// crc32c using the ARMv8 crc32c instructions.
+__attribute__((target("+crc")))
+static uint32_t ldb_crc32c_armv8(const char *bytes, size_t len, uint32_t checksum)
+{
+    uint32_t crc = ~checksum;
+    uint64_t word = 0;
+
+    for (; len >= 8; len -= 8, bytes += 8) {
+        memcpy(&word, bytes, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+
+    for (; len > 0; len--, bytes++)
+        crc = __crc32cb(crc, (uint8_t) *bytes);
+
+    return ~crc;
+}
+#endif
+
+// Builds slice-by-8 tables and selects the crc32c implementation.
+static void ldb_crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (LDB_CRC32C_POLY & (0 - (crc & 1)));
+        ldb_crc32c_tab[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            ldb_crc32c_tab[k][i] = (ldb_crc32c_tab[k-1][i] >> 8) ^ ldb_crc32c_tab[0][ldb_crc32c_tab[k-1][i] & 0xff];
+
+    ldb_crc32c_func = ldb_crc32c_sw;
+
+#ifdef LDB_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+        ldb_crc32c_func = ldb_crc32c_sse42;
+#endif
+
+#ifdef LDB_CRC32C_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+        ldb_crc32c_func = ldb_crc32c_armv8;
+#endif
+}
+
+/**
+ * Computes the crc32c (Castagnoli) checksum.
+ * 
+ * Uses hardware instructions when available (chosen at runtime),
+ * otherwise uses the slice-by-8 algorithm.
+ * 
+ * @param bytes Bytes to digest.
+ * @param len Bytes length.
+ * @param checksum Previous checksum value (0 on startup).
+ * @return Checksum value updated.
+ */
+uint32_t ldb_crc32c(const char *bytes, size_t len, uint32_t checksum)
+{
+    if (bytes == NULL || len == 0)
+        return checksum;
+
+    pthread_once(&ldb_crc32c_once, ldb_crc32c_init);
+
+    return ldb_crc32c_func(bytes, len, checksum);
+}
+
+// Computes the checksum corresponding to the file format.
+static uint32_t ldb_checksum(uint32_t format, const char *bytes, size_t len, uint32_t checksum)
+{
+    if (format == LDB_FORMAT_1)
+        return ldb_crc32(bytes, len, checksum);
+    else
+        return ldb_crc32c(bytes, len, checksum);
+}
+
 const char * ldb_strerror(int errnum)
 {
     if (errnum > 0)
@@ -576,6 +2000,16 @@ const char * ldb_strerror(int errnum)
         case LDB_ERR_NOT_FOUND: return "No results";
         case LDB_ERR_TMP_FILE: return "Error creating temp file";
         case LDB_ERR_CHECKSUM: return "Checksum mismatch";
+        case LDB_ERR_OPEN_SEG: return "Cannot open seg file";
+        case LDB_ERR_FMT_SEG: return "Invalid seg file";
+        case LDB_ERR_COMPRESSED: return "Compressed record";
+        case LDB_ERR_TIMEOUT: return "Timeout expired";
+        case LDB_ERR_ROLLBACK: return "Entries rolled back";
+        case LDB_ERR_OPEN_WAL: return "Cannot open wal file";
+        case LDB_ERR_FMT_WAL: return "Invalid wal file";
+        case LDB_ERR_STREAM: return "Error copying stream";
+        case LDB_ERR_KEY_FILE: return "Error accessing key file";
+        case LDB_ERR_ENTRY_LEN: return "Invalid record length";
         default: return "Unknown error";
     }
 }
@@ -590,93 +2024,399 @@ static uint64_t ldb_get_millis(void)
     return (uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 
-LDB_INLINE
-static size_t ldb_min(size_t a, size_t b) {
-    return (a < b ? a : b);
-}
+#ifndef LDB_NO_METRICS
 
-LDB_INLINE
-static uint64_t ldb_max(uint64_t a, uint64_t b) {
-    return (a > b ? a : b);
-}
+// Returns the monotonic time in nanoseconds
+static uint64_t ldb_get_nanos(void)
+{
+    struct timespec  ts = {0};
 
-LDB_INLINE
-static uint64_t ldb_clamp(uint64_t val, uint64_t lo, uint64_t hi) {
-    return (val < lo ? lo : (hi < val ? hi : val));
-}
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
 
-LDB_INLINE
-static bool ldb_is_valid_db(ldb_impl_t *obj) {
-    return (obj &&
-            obj->dat_fp && !feof(obj->dat_fp) && !ferror(obj->dat_fp) &&
-            obj->idx_fp && !feof(obj->idx_fp) && !ferror(obj->idx_fp) &&
-            obj->dat_fd > STDERR_FILENO && 
-            obj->idx_fd > STDERR_FILENO);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
 }
 
-static void ldb_reset_state(ldb_state_t *state) {
-    if (state) {
-        state->seqnum1 = 0;
-        state->timestamp1 = 0;
-        state->seqnum2 = 0;
-        state->timestamp2 = 0;
-    }
+// Metrics updated by obj (segments update the metrics of the segmented db)
+static ldb_metrics_t * ldb_metrics_of(ldb_impl_t *obj) {
+    return (obj->seg_owner ? &obj->seg_owner->metrics : &obj->metrics);
 }
 
-static int ldb_close_files(ldb_impl_t *obj)
-{
-    if (!obj)
-        return LDB_OK;
-
-    int ret = LDB_OK;
+#define LDB_METRIC_ADD(obj, field, val) \
+    __atomic_fetch_add(&ldb_metrics_of(obj)->field, (uint64_t)(val), __ATOMIC_RELAXED)
 
-    if (obj->idx_fp != NULL && fclose(obj->idx_fp) != 0)
-        ret = LDB_ERR_WRITE_IDX;
+// Adds a latency sample to a histogram
+static void ldb_histogram_add(ldb_histogram_t *hist, uint64_t nanos)
+{
+    uint64_t micros = nanos / 1000;
+    size_t i = (micros == 0 ? 0 : (size_t)(64 - __builtin_clzll(micros)));
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
 
-    if (obj->idx_fd > STDERR_FILENO && close(obj->idx_fd) == -1)
-        ret = LDB_ERR_WRITE_IDX;
+    if (i >= LDB_METRICS_BUCKETS)
+        i = LDB_METRICS_BUCKETS - 1;
 
-    if (obj->dat_fp != NULL && fclose(obj->dat_fp) != 0)
-        ret = LDB_ERR_WRITE_DAT;
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum_ns, nanos, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[i], 1, __ATOMIC_RELAXED);
 
-    if (obj->dat_fd > STDERR_FILENO && close(obj->dat_fd) == -1)
-        ret = LDB_ERR_WRITE_DAT;
+    while (max < nanos && !__atomic_compare_exchange_n(&hist->max_ns, &max, nanos, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
 
-    obj->dat_fp = NULL;
-    obj->idx_fp = NULL;
-    obj->dat_fd = -1;
-    obj->idx_fd = -1;
-    obj->dat_end = 0;
+// Records the latency of a public function started at time0 and returns ret.
+// Calls done by the segmented db on its segments are not recorded.
+static long ldb_metrics_op(ldb_impl_t *obj, ldb_histogram_t *hist, uint64_t time0, long ret)
+{
+    if (obj->seg_owner == NULL)
+        ldb_histogram_add(hist, ldb_get_nanos() - time0);
 
     return ret;
 }
 
-#define LDB_FREE(ptr) do { free(ptr); ptr = NULL; } while(0)
-
-int ldb_close(ldb_impl_t *obj)
+// Counts the entries returned by a read function
+static void ldb_metrics_read(ldb_impl_t *obj, const ldb_entry_t *entries, size_t num)
 {
-    if (obj == NULL)
-        return LDB_OK;
+    uint64_t bytes = 0;
 
-    int ret = ldb_close_files(obj);
+    for (size_t i = 0; i < num; i++)
+        bytes += (uint64_t) entries[i].metadata_len + entries[i].data_len;
 
-    ldb_reset_state(&obj->state);
+    LDB_METRIC_ADD(obj, read_entries, num);
+    LDB_METRIC_ADD(obj, read_bytes, bytes);
+}
+
+// Locks the data mutex (waiting time recorded only if contended)
+static void ldb_lock_data(ldb_impl_t *obj)
+{
+    if (pthread_mutex_trylock(&obj->mutex_data) == 0)
+        return;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_mutex_lock(&obj->mutex_data);
+
+    LDB_METRIC_ADD(obj, mutex_data_waits, 1);
+    LDB_METRIC_ADD(obj, mutex_data_wait_ns, ldb_get_nanos() - time0);
+}
+
+// Locks the file lock in shared mode (waiting time recorded only if contended)
+static void ldb_rdlock_files(ldb_impl_t *obj)
+{
+    if (pthread_rwlock_tryrdlock(&obj->lock_files) == 0)
+        return;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_rwlock_rdlock(&obj->lock_files);
+
+    LDB_METRIC_ADD(obj, lock_files_waits, 1);
+    LDB_METRIC_ADD(obj, lock_files_wait_ns, ldb_get_nanos() - time0);
+}
+
+// Locks the file lock in exclusive mode (waiting time recorded only if contended)
+static void ldb_wrlock_files(ldb_impl_t *obj)
+{
+    if (pthread_rwlock_trywrlock(&obj->lock_files) == 0)
+        return;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_rwlock_wrlock(&obj->lock_files);
+
+    LDB_METRIC_ADD(obj, lock_files_waits, 1);
+    LDB_METRIC_ADD(obj, lock_files_wait_ns, ldb_get_nanos() - time0);
+}
+
+#else
+
+#define ldb_get_nanos()                         ((uint64_t) 0)
+#define LDB_METRIC_ADD(obj, field, val)         ((void) 0)
+#define ldb_metrics_op(obj, hist, time0, ret)   ((void)(time0), (ret))
+#define ldb_metrics_read(obj, entries, num)     ((void) 0)
+#define ldb_lock_data(obj)                      pthread_mutex_lock(&(obj)->mutex_data)
+#define ldb_rdlock_files(obj)                   pthread_rwlock_rdlock(&(obj)->lock_files)
+#define ldb_wrlock_files(obj)                   pthread_rwlock_wrlock(&(obj)->lock_files)
+
+#endif
+
+// Flushes the file data to disk (counted and timed)
+static int ldb_fdatasync(ldb_impl_t *obj, int fd)
+{
+#ifdef LDB_NO_METRICS
+    (void) obj;
+    return fdatasync(fd);
+#else
+    uint64_t time0 = ldb_get_nanos();
+    int rc = fdatasync(fd);
+
+    LDB_METRIC_ADD(obj, fsync_calls, 1);
+    ldb_histogram_add(&ldb_metrics_of(obj)->fsync, ldb_get_nanos() - time0);
+
+    return rc;
+#endif
+}
+
+LDB_INLINE
+static size_t ldb_min(size_t a, size_t b) {
+    return (a < b ? a : b);
+}
+
+LDB_INLINE
+static uint64_t ldb_max(uint64_t a, uint64_t b) {
+    return (a > b ? a : b);
+}
+
+LDB_INLINE
+static uint64_t ldb_clamp(uint64_t val, uint64_t lo, uint64_t hi) {
+    return (val < lo ? lo : (hi < val ? hi : val));
+}
+
+LDB_INLINE
+static bool ldb_is_valid_format(uint32_t format) {
+    return (format == LDB_FORMAT_1 || format == LDB_FORMAT_2 || format == LDB_FORMAT_3);
+}
+
+LDB_INLINE
+static bool ldb_is_valid_db(ldb_impl_t *obj) {
+    if (obj && obj->seg_path)
+        return (obj->num_segs > 0);
+    if (obj && obj->wal)
+        return true;  // wal logs exist only while the wal is open
+    if (obj && obj->fixed_len != 0)
+        return (obj->dat_fp && !feof(obj->dat_fp) && !ferror(obj->dat_fp) &&
+                obj->dat_fd > STDERR_FILENO);
+    return (obj &&
+            obj->dat_fp && !feof(obj->dat_fp) && !ferror(obj->dat_fp) &&
+            obj->idx_fp && !feof(obj->idx_fp) && !ferror(obj->idx_fp) &&
+            obj->dat_fd > STDERR_FILENO && 
+            obj->idx_fd > STDERR_FILENO);
+}
+
+static void ldb_reset_state(ldb_state_t *state) {
+    if (state) {
+        state->seqnum1 = 0;
+        state->timestamp1 = 0;
+        state->seqnum2 = 0;
+        state->timestamp2 = 0;
+    }
+}
+
+// Copies the published state without locking (seqlock, retried while a writer
+// is publishing). Caller holds lock_files or mutex_write, otherwise the state
+// is only modified by ldb_publish_state().
+static void ldb_load_state(ldb_impl_t *obj, ldb_state_t *state)
+{
+#ifdef LDB_NO_SEQLOCK
+    ldb_lock_data(obj);
+    *state = obj->state;
+    pthread_mutex_unlock(&obj->mutex_data);
+#else
+    uint64_t seq1 = 0;
+    uint64_t seq2 = 0;
+
+    // acquire loads, the second sequence read can not move before them
+    do {
+        seq1 = __atomic_load_n(&obj->state_seq, __ATOMIC_ACQUIRE);
+        state->seqnum1 = __atomic_load_n(&obj->state.seqnum1, __ATOMIC_ACQUIRE);
+        state->timestamp1 = __atomic_load_n(&obj->state.timestamp1, __ATOMIC_ACQUIRE);
+        state->seqnum2 = __atomic_load_n(&obj->state.seqnum2, __ATOMIC_ACQUIRE);
+        state->timestamp2 = __atomic_load_n(&obj->state.timestamp2, __ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&obj->state_seq, __ATOMIC_RELAXED);
+    } while ((seq1 & 1) != 0 || seq1 != seq2);
+#endif
+}
+
+// Publishes a new state (called with mutex_data locked).
+static void ldb_publish_state(ldb_impl_t *obj, const ldb_state_t *state)
+{
+#ifdef LDB_NO_SEQLOCK
+    obj->state = *state;
+#else
+    uint64_t seq = obj->state_seq;
+
+    // release stores, a reader seeing a new value also sees the odd sequence
+    __atomic_store_n(&obj->state_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&obj->state.seqnum1, state->seqnum1, __ATOMIC_RELEASE);
+    __atomic_store_n(&obj->state.timestamp1, state->timestamp1, __ATOMIC_RELEASE);
+    __atomic_store_n(&obj->state.seqnum2, state->seqnum2, __ATOMIC_RELEASE);
+    __atomic_store_n(&obj->state.timestamp2, state->timestamp2, __ATOMIC_RELEASE);
+    __atomic_store_n(&obj->state_seq, seq + 2, __ATOMIC_RELEASE);
+#endif
+}
+
+// Unmap retired dat maps (and current map if all = true).
+// Caller must assure that there are no views.
+static void ldb_unmap_dat(ldb_impl_t *obj, bool all)
+{
+    assert(obj);
+
+    while (obj->dat_map_old != NULL) {
+        ldb_mmap_t *next = obj->dat_map_old->next;
+        munmap(obj->dat_map_old->addr, obj->dat_map_old->len);
+        free(obj->dat_map_old);
+        obj->dat_map_old = next;
+    }
+
+    if (all && obj->dat_map != NULL) {
+        munmap(obj->dat_map, obj->dat_map_len);
+        obj->dat_map = NULL;
+        obj->dat_map_len = 0;
+    }
+}
+
+static int ldb_close_files(ldb_impl_t *obj)
+{
+    if (!obj)
+        return LDB_OK;
+
+    int ret = LDB_OK;
+
+    if (obj->idx_map != NULL)
+        munmap(obj->idx_map, obj->idx_map_len);
+
+    obj->idx_map = NULL;
+    obj->idx_map_len = 0;
+
+    ldb_unmap_dat(obj, true);
+
+    if (obj->idx_fp != NULL && fclose(obj->idx_fp) != 0)
+        ret = LDB_ERR_WRITE_IDX;
+
+    if (obj->idx_fd > STDERR_FILENO && close(obj->idx_fd) == -1)
+        ret = LDB_ERR_WRITE_IDX;
+
+    if (obj->dat_fp != NULL && fclose(obj->dat_fp) != 0)
+        ret = LDB_ERR_WRITE_DAT;
+
+    if (obj->dat_fd > STDERR_FILENO && close(obj->dat_fd) == -1)
+        ret = LDB_ERR_WRITE_DAT;
+
+    if (obj->dat_wfd > STDERR_FILENO && close(obj->dat_wfd) == -1)
+        ret = LDB_ERR_WRITE_DAT;
+
+    obj->dat_fp = NULL;
+    obj->idx_fp = NULL;
+    obj->dat_fd = -1;
+    obj->idx_fd = -1;
+    obj->dat_wfd = -1;
+    obj->dat_wpos = 0;
+    obj->wbuf.num = 0;
+    obj->wbuf.num_submitted = 0;
+    obj->wpending = false;
+    obj->dat_end = 0;
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+
+    return ret;
+}
+
+#define LDB_FREE(ptr) do { free(ptr); ptr = NULL; } while(0)
+
+int ldb_close(ldb_impl_t *obj)
+{
+    if (obj == NULL)
+        return LDB_OK;
+
+    // logs are closed by ldb_wal_close()
+    if (obj->wal != NULL)
+        return LDB_ERR;
+
+    // waiters leave before the guards are destroyed
+    if (obj->name) {
+        ldb_lock_data(obj);
+        obj->closing = true;
+        pthread_cond_broadcast(&obj->cond_state);
+        while (obj->num_waiters > 0)
+            pthread_cond_wait(&obj->cond_state, &obj->mutex_data);
+        pthread_mutex_unlock(&obj->mutex_data);
+    }
+
+    // the checkpoint syncs the remaining entries
+    ldb_flusher_stop(obj);
+
+    int ret = (obj->dat_fp ? ldb_complete(obj) : LDB_OK);
+    int rc = LDB_OK;
+
+    if (obj->dat_fp && ret == LDB_OK)
+        ret = ldb_trim_files(obj);
+
+    // clean close, next open only checks records appended after this point
+    if (obj->dat_fp && obj->chk_path && (rc = ldb_write_checkpoint(obj, &obj->state)) != LDB_OK)
+        ret = (ret == LDB_OK ? rc : ret);
+
+    // next enable loads the run without indexing entries
+    if (obj->keys.fn && (rc = ldb_keys_merge(obj)) != LDB_OK)
+        ret = (ret == LDB_OK ? rc : ret);
+
+    rc = ldb_close_files(obj);
+
+    ret = (ret == LDB_OK ? rc : ret);
+    rc = ldb_seg_close(obj);
+    ret = (ret == LDB_OK ? rc : ret);
+
+    ldb_reset_state(&obj->state);
+    ldb_cache_truncate(&obj->cache, 0);
+    LDB_FREE(obj->cache.slots);
+    obj->cache = (ldb_cache_t){0};
+    ldb_keys_free(&obj->keys);
 
     if (obj->name) {
         pthread_mutex_destroy(&obj->mutex_data);
-        pthread_mutex_destroy(&obj->mutex_files);
+        pthread_rwlock_destroy(&obj->lock_files);
+        pthread_cond_destroy(&obj->cond_views);
+        pthread_cond_destroy(&obj->cond_state);
+        pthread_rwlock_destroy(&obj->lock_cache);
+        pthread_rwlock_destroy(&obj->lock_keys);
+        pthread_mutex_destroy(&obj->mutex_write);
+        pthread_mutex_destroy(&obj->mutex_queue);
+        pthread_cond_destroy(&obj->cond_queue);
     }
 
     LDB_FREE(obj->name);
     LDB_FREE(obj->path);
     LDB_FREE(obj->dat_path);
     LDB_FREE(obj->idx_path);
+    LDB_FREE(obj->chk_path);
+    LDB_FREE(obj->fences);
+    LDB_FREE(obj->wbuf.records_dat);
+    LDB_FREE(obj->wbuf.records_idx);
+    LDB_FREE(obj->wbuf.entries);
+    LDB_FREE(obj->wbuf.iov);
+    LDB_FREE(obj->wbuf.zbuf);
+    LDB_FREE(obj->wal_slots);
+    LDB_FREE(obj->wal_records);
+    obj->wbuf.max = 0;
+    obj->wbuf.zbuf_len = 0;
+    obj->wbuf.zbuf_max = 0;
+#ifdef LDB_IO_URING
+    ldb_uring_free(obj->uring);
+    LDB_FREE(obj->uring);
+#endif
+    obj->num_fences = 0;
+    obj->max_fences = 0;
+    obj->wal_first = 0;
+    obj->wal_max = 0;
 
     return ret;
 }
 
 #undef LDB_FREE
 
+// allocator of the entries memory (see ldb_set_allocator)
+static ldb_malloc_fn ldb_malloc_func = malloc;
+static ldb_free_fn ldb_free_func = free;
+
+int ldb_set_allocator(ldb_malloc_fn malloc_fn, ldb_free_fn free_fn)
+{
+    if ((malloc_fn == NULL) != (free_fn == NULL))
+        return LDB_ERR_ARG;
+
+    ldb_malloc_func = (malloc_fn ? malloc_fn : malloc);
+    ldb_free_func = (free_fn ? free_fn : free);
+
+    return LDB_OK;
+}
+
 // only deallocs memory, does not modify seqnum nor timestamp
 void ldb_free_entry(ldb_entry_t *entry)
 {
@@ -684,7 +2424,8 @@ void ldb_free_entry(ldb_entry_t *entry)
         return;
     
     // ldb_alloc_entry() does only 1 mem allocation
-    free(entry->metadata);
+    if (entry->metadata != NULL)
+        ldb_free_func(entry->metadata);
 
     entry->metadata = NULL;
     entry->data = NULL;
@@ -709,7 +2450,7 @@ static size_t ldb_allocated_size(size_t size) {
 }
 
 // try to reuse previous allocated memory
-// otherwise, free existent memory and does only 1 memory allocation
+// otherwise, free existent memory and does only 1 memory allocation (not zero-filled)
 // both returned pointer are aligned to generic type intptr_t
 // returns false on error (allocation error)
 static bool ldb_alloc_entry(ldb_entry_t *entry, uint32_t metadata_len, uint32_t data_len)
@@ -733,7 +2474,7 @@ static bool ldb_alloc_entry(ldb_entry_t *entry, uint32_t metadata_len, uint32_t
     }
     else {
         ldb_free_entry(entry);
-        ptr = (char *) calloc((len1 + len2)/sizeof(intptr_t), sizeof(intptr_t));
+        ptr = (char *) ldb_malloc_func(len1 + len2);
         if (ptr == NULL)
             return false;
     }
@@ -746,6 +2487,164 @@ static bool ldb_alloc_entry(ldb_entry_t *entry, uint32_t metadata_len, uint32_t
     return true;
 }
 
+// header of the pooled arena blocks (data follows)
+typedef struct ldb_arena_block_t {
+    struct ldb_arena_block_t *next;
+    size_t len;
+} ldb_arena_block_t;
+
+void ldb_arena_init(ldb_arena_t *arena, char *buf, size_t len)
+{
+    if (arena == NULL)
+        return;
+
+    *arena = (ldb_arena_t){0};
+
+    if (buf != NULL) {
+        arena->buf = buf;
+        arena->max = len;
+        arena->external = true;
+    }
+}
+
+// Deallocs the retired blocks
+static void ldb_arena_release(ldb_arena_t *arena)
+{
+    ldb_arena_block_t *block = (ldb_arena_block_t *) arena->retired;
+
+    while (block != NULL) {
+        ldb_arena_block_t *next = block->next;
+        ldb_free_func(block);
+        block = next;
+    }
+
+    arena->retired = NULL;
+    arena->retired_len = 0;
+}
+
+void ldb_arena_free(ldb_arena_t *arena)
+{
+    if (arena == NULL)
+        return;
+
+    ldb_arena_release(arena);
+
+    if (arena->external) {
+        arena->len = 0;
+        return;
+    }
+
+    if (arena->buf != NULL)
+        ldb_free_func((ldb_arena_block_t *) arena->buf - 1);
+
+    *arena = (ldb_arena_t){0};
+}
+
+// Replaces the current block by a new one of max bytes.
+// The current block is retired if used (its entries remain valid until the next reset).
+// Returns false if the arena is external or on allocation error.
+static bool ldb_arena_grow(ldb_arena_t *arena, size_t max)
+{
+    if (arena->external)
+        return false;
+
+    ldb_arena_block_t *block = (ldb_arena_block_t *) ldb_malloc_func(sizeof(ldb_arena_block_t) + max);
+
+    if (block == NULL)
+        return false;
+
+    block->next = NULL;
+    block->len = max;
+
+    if (arena->buf != NULL)
+    {
+        ldb_arena_block_t *current = (ldb_arena_block_t *) arena->buf - 1;
+
+        if (arena->len == 0) {
+            ldb_free_func(current);
+        }
+        else {
+            current->next = (ldb_arena_block_t *) arena->retired;
+            arena->retired = current;
+            arena->retired_len += current->len;
+        }
+    }
+
+    arena->buf = (char *)(block + 1);
+    arena->max = max;
+    arena->len = 0;
+
+    return true;
+}
+
+// Discards the entries of the previous read.
+// Retired blocks are merged into one, so that next batches are contiguous.
+static void ldb_arena_reset(ldb_arena_t *arena)
+{
+    size_t total = arena->max + arena->retired_len;
+    bool merge = (arena->retired != NULL);
+
+    ldb_arena_release(arena);
+    arena->len = 0;
+
+    if (merge)
+        ldb_arena_grow(arena, total);
+}
+
+// Ensures (if possible) that len bytes can be allocated from the current block
+static void ldb_arena_reserve(ldb_arena_t *arena, size_t len)
+{
+    if (arena->buf != NULL && arena->len + len <= arena->max)
+        return;
+
+    ldb_arena_grow(arena, ldb_max(ldb_max(2 * arena->max, len), LDB_ARENA_MIN_LEN));
+}
+
+// Allocates len bytes aligned to intptr_t, returns NULL if exhausted
+static char * ldb_arena_alloc(ldb_arena_t *arena, size_t len)
+{
+    size_t pad = 0;
+
+    if (arena->buf != NULL) {
+        size_t rem = (uintptr_t)(arena->buf + arena->len) % sizeof(intptr_t);
+        pad = (rem == 0 ? 0 : sizeof(intptr_t) - rem);
+    }
+
+    if (arena->buf == NULL || arena->len + pad + len > arena->max)
+    {
+        if (!ldb_arena_grow(arena, ldb_max(ldb_max(2 * arena->max, len), LDB_ARENA_MIN_LEN)))
+            return NULL;
+
+        pad = 0;
+    }
+
+    char *ptr = arena->buf + arena->len + pad;
+    arena->len += pad + len;
+
+    return ptr;
+}
+
+// Allocates the entry memory from the arena (same layout than ldb_alloc_entry),
+// or calls ldb_alloc_entry() when arena is NULL.
+static bool ldb_alloc_entry_from(ldb_entry_t *entry, uint32_t metadata_len, uint32_t data_len, ldb_arena_t *arena)
+{
+    if (arena == NULL)
+        return ldb_alloc_entry(entry, metadata_len, data_len);
+
+    size_t len1 = ldb_allocated_size(metadata_len);
+    char *ptr = NULL;
+
+    if (len1 + data_len > 0 && (ptr = ldb_arena_alloc(arena, len1 + data_len)) == NULL)
+        return false;
+
+    entry->metadata = (metadata_len ? ptr : NULL);
+    entry->metadata_len = metadata_len;
+    entry->data = (data_len ? ptr + len1 : NULL);
+    entry->data_len = data_len;
+
+    return true;
+}
+
 static bool ldb_is_valid_path(const char *path)
 {
     struct stat statbuf = {0};
@@ -798,7 +2697,7 @@ static char * ldb_create_filename(const char *path, const char *name, const char
     return filepath;
 }
 
-static bool ldb_create_file_dat(const char *path)
+static bool ldb_create_file_dat(const char *path, uint32_t format)
 {
     assert(path);
 
@@ -813,7 +2712,7 @@ static bool ldb_create_file_dat(const char *path)
 
     ldb_header_dat_t header = {
         .magic_number = LDB_MAGIC_NUMBER,
-        .format = LDB_FORMAT_1,
+        .format = format,
         .text = {0}
     };
 
@@ -828,7 +2727,7 @@ static bool ldb_create_file_dat(const char *path)
     return ret;
 }
 
-static bool ldb_create_file_idx(const char *path)
+static bool ldb_create_file_idx(const char *path, uint32_t format)
 {
     assert(path);
 
@@ -843,7 +2742,7 @@ static bool ldb_create_file_idx(const char *path)
 
     ldb_header_idx_t header = {
         .magic_number = LDB_MAGIC_NUMBER,
-        .format = LDB_FORMAT_1,
+        .format = format,
         .text = {0}
     };
 
@@ -858,82 +2757,43 @@ static bool ldb_create_file_idx(const char *path)
     return ret;
 }
 
-// Returns file size preserving current file position
+// Returns file size (file offset not moved, see dat_wfd)
 // Returns 0 on error
 static size_t ldb_get_file_size(FILE *fp)
 {
-    if (fp == NULL)
-        return 0;
-
-    long pos = ftell(fp);
-    if (pos < 0)
-        return 0;
+    struct stat st;
 
-    if (fseek(fp, 0, SEEK_END) != 0)
+    if (fp == NULL)
         return 0;
 
-    long len = ftell(fp);
-
-    if (fseek(fp, pos, SEEK_SET) != 0)
+    if (fflush(fp) != 0 || fstat(fileno(fp), &st) != 0)
         return 0;
 
-    return (size_t)(len < 0 ? 0 : len);
+    return (size_t) st.st_size;
 }
 
-// Set zero's from pos until the end of the file.
-// Does not update file if already zeroized.
-// Preserve current file position.
+// Removes file content from pos until the end of the file.
+// Does not update file if already truncated.
+// Flushes pending writes and sets file position to pos.
 // On error return false, otherwise returns true.
-static bool ldb_zeroize(FILE *fp, size_t pos)
+static bool ldb_truncate(FILE *fp, size_t pos)
 {
     assert(fp);
     assert(!feof(fp));
     assert(!ferror(fp));
 
-    char c = 0;
-    bool ret = false;
-    size_t cur_pos = pos;
-    size_t max_pos = ldb_get_file_size(fp);
-    const char buf[BUFSIZ] = {0};
-
-    if (max_pos < pos)
-        goto LDB_ZEROIZE_END;
-
-    if (fseek(fp, (long) pos, SEEK_SET) != 0)
-        goto LDB_ZEROIZE_END;
-
-    for (cur_pos = pos; cur_pos < max_pos; cur_pos++)
-    {
-        if (fread(&c, 1, 1, fp) != 1)
-            goto LDB_ZEROIZE_END;
-
-        if (c == 0)
-            continue;
-
-        if (fseek(fp, -1, SEEK_CUR) != 0)
-            goto LDB_ZEROIZE_END;
-
-        break;
-    }
-
-    // case already zeroized
-    if (c == 0) {
-        ret = true;
-        goto LDB_ZEROIZE_END;
-    }
+    if (fflush(fp) != 0)
+        return false;
 
-    for (; cur_pos < max_pos; cur_pos += sizeof(buf))
-        if (fwrite(buf, ldb_min(max_pos - cur_pos, sizeof(buf)), 1, fp) != 1)
-            goto LDB_ZEROIZE_END;
+    size_t len = ldb_get_file_size(fp);
 
-    fflush(fp);
+    if (len < pos)
+        return false;
 
-    ret = true;
+    if (len > pos && ftruncate(fileno(fp), (off_t) pos) != 0)
+        return false;
 
-LDB_ZEROIZE_END:
-    fseek(fp, (long) pos, SEEK_SET);
-    assert(!feof(fp) && !ferror(fp));
-    return ret;
+    return (fseek(fp, (long) pos, SEEK_SET) == 0);
 }
 
 // Copy file1 content in range [pos0,pos1] to file2 at pos2.
@@ -1003,1248 +2863,8695 @@ static size_t ldb_get_pos_idx(ldb_state_t *state, uint64_t seqnum)
     return sizeof(ldb_header_idx_t) + diff * sizeof(ldb_record_idx_t);
 }
 
-static uint32_t ldb_checksum_record(ldb_record_dat_t *record)
+// returns the position in the dat for a given seqnum (fixed-length records)
+static size_t ldb_get_pos_fixed(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum)
 {
-    uint32_t checksum = 0;
-    
-    checksum = ldb_crc32((const char *) &record->seqnum, sizeof(record->seqnum), checksum);
-    checksum = ldb_crc32((const char *) &record->timestamp, sizeof(record->timestamp), checksum);
-    checksum = ldb_crc32((const char *) &record->metadata_len, sizeof(record->metadata_len), checksum);
-    checksum = ldb_crc32((const char *) &record->data_len, sizeof(record->data_len), checksum);
-
-    // required calls to complete the checksum
-    // call checksum = crc32(metadata, checksum)
-    // call checksum = crc32(data, checksum)
+    assert(obj);
+    assert(state);
+    assert(state->seqnum1 <= seqnum);
+
+    size_t diff = (state->seqnum1 == 0 ? 0 : seqnum - state->seqnum1);
+    return sizeof(ldb_header_dat_t) + diff * (sizeof(ldb_record_dat_t) + obj->fixed_len);
+}
+
+static uint32_t ldb_checksum_record(const ldb_record_dat_t *record, uint32_t format)
+{
+    uint32_t checksum = 0;
+    
+    checksum = ldb_checksum(format, (const char *) &record->seqnum, sizeof(record->seqnum), checksum);
+    checksum = ldb_checksum(format, (const char *) &record->timestamp, sizeof(record->timestamp), checksum);
+    checksum = ldb_checksum(format, (const char *) &record->metadata_len, sizeof(record->metadata_len), checksum);
+    checksum = ldb_checksum(format, (const char *) &record->data_len, sizeof(record->data_len), checksum);
+
+    if (format == LDB_FORMAT_3)
+        checksum = ldb_checksum(format, (const char *) &record->raw_len, sizeof(record->raw_len), checksum);
+
+    // required calls to complete the checksum
+    // call checksum = checksum(format, metadata, checksum)
+    // call checksum = checksum(format, data, checksum)
 
     return checksum;
 }
 
-static uint32_t ldb_checksum_entry(ldb_entry_t *entry)
+static uint32_t ldb_checksum_entry(const ldb_entry_t *entry, uint32_t format)
 {
     uint32_t checksum = 0;
     
-    checksum = ldb_crc32((const char *) &entry->seqnum, sizeof(entry->seqnum), checksum);
-    checksum = ldb_crc32((const char *) &entry->timestamp, sizeof(entry->timestamp), checksum);
-    checksum = ldb_crc32((const char *) &entry->metadata_len, sizeof(entry->metadata_len), checksum);
-    checksum = ldb_crc32((const char *) &entry->data_len, sizeof(entry->data_len), checksum);
+    checksum = ldb_checksum(format, (const char *) &entry->seqnum, sizeof(entry->seqnum), checksum);
+    checksum = ldb_checksum(format, (const char *) &entry->timestamp, sizeof(entry->timestamp), checksum);
+    checksum = ldb_checksum(format, (const char *) &entry->metadata_len, sizeof(entry->metadata_len), checksum);
+    checksum = ldb_checksum(format, (const char *) &entry->data_len, sizeof(entry->data_len), checksum);
+
+    // uncompressed record (raw_len = data_len)
+    if (format == LDB_FORMAT_3)
+        checksum = ldb_checksum(format, (const char *) &entry->data_len, sizeof(entry->data_len), checksum);
 
     if (entry->metadata_len && entry->metadata)
-        checksum = ldb_crc32(entry->metadata, entry->metadata_len, checksum);
+        checksum = ldb_checksum(format, entry->metadata, entry->metadata_len, checksum);
 
     if (entry->data_len && entry->data)
-        checksum = ldb_crc32(entry->data, entry->data_len, checksum);
+        checksum = ldb_checksum(format, entry->data, entry->data_len, checksum);
 
     return checksum;
 }
 
-// append data entry at position obj->dat_end
-// updates obj->dat_end value
-// function accessed only by thread-write
-static int ldb_append_entry_dat(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entry)
+// Uncompressed data length of a record
+static uint32_t ldb_raw_len(const ldb_record_dat_t *record, uint32_t format) {
+    return (format == LDB_FORMAT_3 ? record->raw_len : record->data_len);
+}
+
+static uint32_t ldb_read32(const unsigned char *ptr) {
+    uint32_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+// Writes a LZ4 length extension (value already reduced by 15)
+static unsigned char * ldb_lz4_write_len(unsigned char *op, size_t len)
 {
-    assert(obj);
-    assert(state);
-    assert(entry);
-    assert(obj->dat_fp);
-    assert(!feof(obj->dat_fp));
-    assert(!ferror(obj->dat_fp));
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
 
-    if (entry->metadata_len != 0 && entry->metadata == NULL)
-        return LDB_ERR_ENTRY_METADATA;
+    *op++ = (unsigned char) len;
+    return op;
+}
 
-    if (entry->data_len != 0 && entry->data == NULL)
-        return LDB_ERR_ENTRY_DATA;
+/**
+ * Compresses bytes using the LZ4 block format (greedy, single pass).
+ * 
+ * Output can be decompressed by any LZ4 block decoder.
+ * 
+ * @param src Bytes to compress.
+ * @param len Number of bytes to compress.
+ * @param dst Destination buffer.
+ * @param dst_len Length of the destination buffer.
+ * @return Compressed length, or 0 if it does not fit in dst.
+ */
+static size_t ldb_lz4_compress(const char *src, size_t len, char *dst, size_t dst_len)
+{
+    uint32_t table[1 << LDB_LZ4_HASH_LOG];
+    unsigned hash_log = 8;
+    const unsigned char *base = (const unsigned char *) src;
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base;
+    const unsigned char *end = base + len;
+    unsigned char *op = (unsigned char *) dst;
+    unsigned char *oend = op + dst_len;
+    size_t misses = 0;
+
+    // smaller table for small inputs (less initialization cost)
+    while (hash_log < LDB_LZ4_HASH_LOG && ((size_t) 1 << hash_log) < len)
+        hash_log++;
+
+    memset(table, 0x00, sizeof(uint32_t) << hash_log);
+
+    // last match must start 12 bytes before the end, last 5 bytes are literals
+    while (len >= 13 && ip < end - 12)
+    {
+        uint32_t seq = ldb_read32(ip);
+        uint32_t h = (seq * 2654435761U) >> (32 - hash_log);
+        const unsigned char *ref = base + table[h];
 
-    if (state->seqnum2 != 0 && entry->seqnum != state->seqnum2 + 1)
-        return LDB_ERR_ENTRY_SEQNUM;
+        table[h] = (uint32_t)(ip - base);
 
-    if (entry->timestamp < state->timestamp2)
-        return LDB_ERR_ENTRY_TIMESTAMP;
+        if (ref >= ip || ip - ref > 65535 || ldb_read32(ref) != seq) {
+            ip += 1 + (misses++ >> 6);  // skip faster on incompressible data
+            continue;
+        }
 
-    ldb_record_dat_t record = {
-        .seqnum = entry->seqnum,
-        .timestamp = entry->timestamp,
-        .metadata_len = entry->metadata_len,
-        .data_len = entry->data_len,
-        .checksum = ldb_checksum_entry(entry)
-    };
+        misses = 0;
 
-    if (fseek(obj->dat_fp, (long) obj->dat_end, SEEK_SET) != 0)
-        return LDB_ERR_WRITE_DAT;
+        while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
 
-    if (fwrite(&record, sizeof(ldb_record_dat_t), 1, obj->dat_fp) != 1)
-        return LDB_ERR_WRITE_DAT;
+        const unsigned char *mp = ip + 4;
+        const unsigned char *rp = ref + 4;
 
-    if (record.metadata_len)
-        if (fwrite(entry->metadata, 1, record.metadata_len, obj->dat_fp) != record.metadata_len)
-            return LDB_ERR_WRITE_DAT;
+        while (mp < end - 5 && *mp == *rp) {
+            mp++;
+            rp++;
+        }
 
-    if (record.data_len)
-        if (fwrite(entry->data, 1, record.data_len, obj->dat_fp) != record.data_len)
-            return LDB_ERR_WRITE_DAT;
+        size_t lit_len = (size_t)(ip - anchor);
+        size_t match_len = (size_t)(mp - ip) - 4;
 
-    if (state->seqnum1 == 0) {
-        state->seqnum1 = entry->seqnum;
-        state->timestamp1 = entry->timestamp;
-    }
+        if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1)
+            return 0;
 
-    state->seqnum2 = entry->seqnum;
-    state->timestamp2 = entry->timestamp;
+        unsigned char *token = op++;
+        *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
 
-    long pos = ftell(obj->dat_fp);
-    if (pos < 0)
-        return LDB_ERR_READ_DAT;
+        if (lit_len >= 15)
+            op = ldb_lz4_write_len(op, lit_len - 15);
 
-    obj->dat_end = (size_t) pos;
+        memcpy(op, anchor, lit_len);
+        op += lit_len;
 
-    return LDB_OK;
-}
+        *op++ = (unsigned char)((ip - ref) & 0xFF);
+        *op++ = (unsigned char)((ip - ref) >> 8);
 
-static int ldb_append_record_idx(ldb_impl_t *obj, ldb_state_t *state, ldb_record_idx_t *record)
-{
-    assert(obj);
-    assert(state);
-    assert(record);
-    assert(obj->idx_fp);
-    assert(!feof(obj->idx_fp));
-    assert(!ferror(obj->idx_fp));
+        *token |= (unsigned char)(match_len < 15 ? match_len : 15);
 
-    if (record->seqnum != state->seqnum2) {
-        return LDB_ERR;
+        if (match_len >= 15)
+            op = ldb_lz4_write_len(op, match_len - 15);
+
+        ip = anchor = mp;
     }
 
-    size_t pos = ldb_get_pos_idx(state, record->seqnum);
+    size_t lit_len = (size_t)(end - anchor);
 
-    if (fseek(obj->idx_fp, (long) pos, SEEK_SET) != 0)
-        return LDB_ERR_READ_IDX;
+    if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len)
+        return 0;
 
-    if (fwrite(record, sizeof(ldb_record_idx_t), 1, obj->idx_fp) != 1)
-        return LDB_ERR_WRITE_IDX;
+    *op++ = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
 
-    return LDB_OK;
+    if (lit_len >= 15)
+        op = ldb_lz4_write_len(op, lit_len - 15);
+
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return (size_t)(op - (unsigned char *) dst);
 }
 
-// Read data record at pos.
-// Let file positioned at the end of record if checksum not verified, 
-// or at the data end if checksum verified
-static int ldb_read_record_dat(int fd, size_t pos, ldb_record_dat_t *record, bool verify_checksum)
+// Reads a LZ4 length extension. Returns false if src is exhausted.
+static bool ldb_lz4_read_len(const unsigned char **ip, const unsigned char *iend, size_t *len)
 {
-    assert(record);
-    assert(fd > STDERR_FILENO);
+    unsigned char byte = 255;
 
-    if (lseek(fd, (off_t) pos, SEEK_SET) != (off_t) pos)
-        return LDB_ERR_READ_DAT;
+    while (byte == 255) {
+        if (*ip >= iend)
+            return false;
+        byte = *(*ip)++;
+        *len += byte;
+    }
 
-    ssize_t rc = read(fd, record, sizeof(ldb_record_dat_t));
+    return true;
+}
 
-    if (rc == -1)
-        return LDB_ERR_READ_DAT;
+/**
+ * Decompresses a LZ4 block.
+ * 
+ * Malformed input is detected (no out-of-bounds accesses).
+ * 
+ * @param src Compressed bytes.
+ * @param len Number of compressed bytes.
+ * @param dst Destination buffer.
+ * @param dst_len Decompressed length (exact).
+ * @return true on success, false if input is malformed.
+ */
+static bool ldb_lz4_decompress(const char *src, size_t len, char *dst, size_t dst_len)
+{
+    const unsigned char *ip = (const unsigned char *) src;
+    const unsigned char *iend = ip + len;
+    unsigned char *op = (unsigned char *) dst;
+    unsigned char *oend = op + dst_len;
 
-    if (rc != sizeof(ldb_record_dat_t))
-        return LDB_ERR_FMT_DAT;
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+        size_t lit_len = token >> 4;
 
-    if (!verify_checksum || record->seqnum == 0)
-        return LDB_OK;
+        if (lit_len == 15 && !ldb_lz4_read_len(&ip, iend, &lit_len))
+            return false;
 
-    uint32_t checksum = ldb_checksum_record(record);
-    size_t len = record->metadata_len + record->data_len;
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+            return false;
 
-    if (len > 0)
-    {
-        char buf[BUFSIZ] = {0};
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
 
-        pos += sizeof(ldb_record_dat_t);
+        // last sequence has no match
+        if (ip == iend)
+            break;
 
-        for (size_t i = pos; i < pos + len; i += sizeof(buf))
-        {
-            size_t num_bytes = ldb_min(pos + len - i, sizeof(buf));
+        if (iend - ip < 2)
+            return false;
 
-            rc = read(fd, buf, num_bytes);
+        size_t offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        size_t match_len = token & 15;
 
-            if (rc == -1)
-                return LDB_ERR_READ_DAT;
-            
-            if (rc != (ssize_t) num_bytes)
-                return LDB_ERR_FMT_DAT;
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *) dst))
+            return false;
 
-            checksum = ldb_crc32(buf, num_bytes, checksum);
+        if (match_len == 15 && !ldb_lz4_read_len(&ip, iend, &match_len))
+            return false;
+
+        match_len += 4;
+
+        if (match_len > (size_t)(oend - op))
+            return false;
+
+        const unsigned char *ref = op - offset;
+
+        // overlapping copy (repeats the last offset bytes)
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        }
+        else {
+            while (match_len-- > 0)
+                *op++ = *ref++;
         }
     }
 
-    if (checksum != record->checksum)
-        return LDB_ERR_CHECKSUM;
+    return (op == oend);
+}
 
-    return LDB_OK;
+// Memory accounted to a cached entry
+static size_t ldb_cache_entry_len(uint32_t metadata_len, uint32_t data_len) {
+    return sizeof(ldb_cache_entry_t) + metadata_len + data_len;
 }
 
-static int ldb_read_entry_dat(int fd, size_t pos, ldb_entry_t *entry)
+// Removes the first cached entry
+static void ldb_cache_pop(ldb_cache_t *cache)
 {
-    assert(entry);
-    assert(fd > STDERR_FILENO);
+    ldb_cache_entry_t *slot = &cache->slots[cache->head];
 
-    int ret = 0;
-    ssize_t rc = 0;
-    ldb_record_dat_t record = {0};
+    cache->bytes -= ldb_cache_entry_len(slot->metadata_len, slot->data_len);
+    free(slot->buf);
+    *slot = (ldb_cache_entry_t){0};
 
-    if ((ret = ldb_read_record_dat(fd, pos, &record, false)) != LDB_OK)
-        return ret;
+    cache->head = (cache->head + 1) & (cache->max_slots - 1);
+    cache->seqnum1++;
+    cache->num--;
+}
 
-    if (!ldb_alloc_entry(entry, record.metadata_len, record.data_len))
-        return LDB_ERR_MEM;
+// Removes the cached entries less than seqnum (purge)
+static void ldb_cache_trim(ldb_cache_t *cache, uint64_t seqnum)
+{
+    while (cache->num > 0 && cache->seqnum1 < seqnum)
+        ldb_cache_pop(cache);
+}
 
-    if (record.metadata_len)
+static void ldb_cache_truncate(ldb_cache_t *cache, uint64_t seqnum)
+{
+    while (cache->num > 0 && cache->seqnum1 + cache->num - 1 > seqnum)
     {
-        assert(entry->metadata != NULL);
-        rc = read(fd, entry->metadata, record.metadata_len);
-        if (rc == -1)
-            return LDB_ERR_READ_DAT;
-        if (rc != (ssize_t) record.metadata_len)
-            return LDB_ERR_FMT_DAT;
-    }
+        size_t i = (cache->head + cache->num - 1) & (cache->max_slots - 1);
+        ldb_cache_entry_t *slot = &cache->slots[i];
 
-    if (record.data_len)
-    {
-        assert(entry->data != NULL);
-        rc = read(fd, entry->data, record.data_len);
-        if (rc == -1)
-            return LDB_ERR_READ_DAT;
-        if (rc != (ssize_t) record.data_len)
-            return LDB_ERR_FMT_DAT;
+        cache->bytes -= ldb_cache_entry_len(slot->metadata_len, slot->data_len);
+        free(slot->buf);
+        *slot = (ldb_cache_entry_t){0};
+        cache->num--;
     }
+}
 
-    entry->seqnum = record.seqnum;
-    entry->timestamp = record.timestamp;
+// Doubles the number of slots (ring is linearized). Returns false on memory error.
+static bool ldb_cache_grow(ldb_cache_t *cache)
+{
+    size_t len = (cache->max_slots ? 2 * cache->max_slots : 64);
+    ldb_cache_entry_t *slots = (ldb_cache_entry_t *) calloc(len, sizeof(ldb_cache_entry_t));
 
-    if (record.checksum != ldb_checksum_entry(entry))
-        return LDB_ERR_CHECKSUM;
+    if (slots == NULL)
+        return false;
 
-    return LDB_OK;
+    for (size_t i = 0; i < cache->num; i++)
+        slots[i] = cache->slots[(cache->head + i) & (cache->max_slots - 1)];
+
+    free(cache->slots);
+    cache->slots = slots;
+    cache->max_slots = len;
+    cache->head = 0;
+
+    return true;
 }
 
-static int ldb_read_record_idx(int fd, ldb_state_t *state, uint64_t seqnum, ldb_record_idx_t *record)
+// Appends an entry copy to the cache (cache locked). Takes ownership of buf.
+// Cached seqnums are kept consecutive (cache restarted otherwise).
+static void ldb_cache_push(ldb_cache_t *cache, const ldb_record_dat_t *record, uint32_t data_len, char *buf)
 {
-    assert(state);
-    assert(record);
-    assert(fd > STDERR_FILENO);
-
-    if (state->seqnum1 == 0 || seqnum < state->seqnum1 || state->seqnum2 < seqnum)
-        return LDB_ERR;
+    size_t len = ldb_cache_entry_len(record->metadata_len, data_len);
 
-    if (seqnum == state->seqnum1) {
-        record->seqnum = state->seqnum1;
-        record->timestamp = state->timestamp1;
-        record->pos = sizeof(ldb_header_dat_t);
-        return LDB_OK;
-    }
+    if (cache->num > 0 && cache->seqnum1 + cache->num != record->seqnum)
+        ldb_cache_trim(cache, UINT64_MAX);
 
-    size_t pos = ldb_get_pos_idx(state, seqnum);
+    while (cache->num > 0 && cache->bytes + len > cache->max_bytes)
+        ldb_cache_pop(cache);
 
-    if (lseek(fd, (off_t) pos, SEEK_SET) != (off_t) pos)
-        return LDB_ERR_READ_IDX;
+    if (len > cache->max_bytes || (cache->num == cache->max_slots && !ldb_cache_grow(cache))) {
+        ldb_cache_trim(cache, UINT64_MAX);
+        free(buf);
+        return;
+    }
 
-    if (read(fd, record, sizeof(ldb_record_idx_t)) != sizeof(ldb_record_idx_t))
-        return LDB_ERR_READ_IDX;
+    if (cache->num == 0)
+        cache->seqnum1 = record->seqnum;
 
-    if (record->seqnum != seqnum)
-        return LDB_ERR;
+    cache->slots[(cache->head + cache->num) & (cache->max_slots - 1)] = (ldb_cache_entry_t){
+        .seqnum = record->seqnum,
+        .timestamp = record->timestamp,
+        .metadata_len = record->metadata_len,
+        .data_len = data_len,
+        .buf = buf
+    };
 
-    return LDB_OK;
+    cache->bytes += len;
+    cache->num++;
 }
 
-#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_FILE_DAT_END; } while(0)
-
-/**
- * pre-conditions:
- *   - obj->dat_fp == NULL
- *   - obj->dat_fd == -1
- *   - obj->idx_fp == NULL
- *   - obj->idx_fd == -1
- *
- * post-conditions (OK)
- *   - obj->dat_fp = set
- *   - obj->dat_fd = set
- *   - obj->format = set
- *   - obj->first_seqnum = set (0 if no data)
- *   - obj->first_timestamp = set
- * 
- * post-conditions (KO)
- *   - dat files closed
- */
-static int ldb_open_file_dat(ldb_impl_t *obj, bool check)
+// Copies the written entries to the cache.
+// function accessed only by thread-write
+static void ldb_cache_fill(ldb_impl_t *obj)
 {
-    assert(obj);
-    assert(obj->dat_fp == NULL);
-    assert(obj->idx_fp == NULL);
-    assert(obj->dat_fd == -1);
-    assert(obj->idx_fd == -1);
+    ldb_wbuf_t *wbuf = &obj->wbuf;
 
-    int ret = LDB_OK;
-    ldb_header_dat_t header = {0};
-    ldb_record_dat_t record = {0};
-    size_t pos = 0;
-    size_t len = 0;
+    if (obj->cache.max_bytes == 0 || wbuf->num_submitted == 0)
+        return;
 
-    ldb_reset_state(&obj->state);
-    obj->dat_end = sizeof(ldb_header_dat_t);
+    pthread_rwlock_wrlock(&obj->lock_cache);
 
-    obj->dat_fp = fopen(obj->dat_path, "r+");
+    for (size_t i = 0; i < wbuf->num_submitted; i++)
+    {
+        const ldb_entry_t *entry = wbuf->entries[i];
+        const ldb_record_dat_t *record = &wbuf->records_dat[i];
+        char *buf = (char *) malloc(ldb_max((size_t) record->metadata_len + entry->data_len, 1));
 
-    if (obj->dat_fp == NULL)
-        return LDB_ERR_OPEN_DAT;
+        // cache restarted on memory error (seqnums kept consecutive)
+        if (buf == NULL) {
+            ldb_cache_trim(&obj->cache, UINT64_MAX);
+            continue;
+        }
 
-    if ((obj->dat_fd = open(obj->dat_path, O_RDONLY)) == -1)
-        return LDB_ERR_OPEN_DAT;
+        if (record->metadata_len)
+            memcpy(buf, entry->metadata, record->metadata_len);
 
-    assert(obj->dat_fd > STDERR_FILENO);
+        if (entry->data_len)
+            memcpy(buf + record->metadata_len, entry->data, entry->data_len);
 
-    len = ldb_get_file_size(obj->dat_fp);
+        ldb_cache_push(&obj->cache, record, entry->data_len, buf);
+    }
 
-    if (fseek(obj->dat_fp, 0, SEEK_END) == -1)
-        exit_function(LDB_ERR_OPEN_DAT);
+    pthread_rwlock_unlock(&obj->lock_cache);
+}
 
-    if (lseek(obj->dat_fd, 0, SEEK_SET) != 0)
-        exit_function(LDB_ERR_OPEN_DAT);
+// Copies the records written by ldb_append_raw() to the cache.
+// function accessed only by thread-write
+static void ldb_cache_fill_raw(ldb_impl_t *obj, const char *raw, size_t len)
+{
+    ldb_record_dat_t record = {0};
 
-    if (read(obj->dat_fd, &header, sizeof(ldb_header_dat_t)) != sizeof(ldb_header_dat_t))
-        exit_function(LDB_ERR_FMT_DAT);
+    if (obj->cache.max_bytes == 0)
+        return;
 
-    pos += sizeof(ldb_header_dat_t);
+    pthread_rwlock_wrlock(&obj->lock_cache);
 
-    if (header.magic_number != LDB_MAGIC_NUMBER) 
-        exit_function(LDB_ERR_FMT_DAT);
+    for (size_t off = 0; off < len; off += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len)
+    {
+        memcpy(&record, raw + off, sizeof(ldb_record_dat_t));
 
-    if (header.format != LDB_FORMAT_1)
-        exit_function(LDB_ERR_FMT_DAT);
+        size_t payload_len = (size_t) record.metadata_len + record.data_len;
+        char *buf = NULL;
 
-    obj->format = header.format;
+        // compressed records are not cached (cache restarted)
+        if (ldb_raw_len(&record, obj->format) != record.data_len || (buf = (char *) malloc(ldb_max(payload_len, 1))) == NULL) {
+            ldb_cache_trim(&obj->cache, UINT64_MAX);
+            continue;
+        }
 
-    if (pos == len)
-        return LDB_OK;
+        memcpy(buf, raw + off + sizeof(ldb_record_dat_t), payload_len);
+        ldb_cache_push(&obj->cache, &record, record.data_len, buf);
+    }
 
-    if (pos + sizeof(ldb_record_dat_t) > len)
-        goto LDB_OPEN_FILE_DAT_ZEROIZE;
+    pthread_rwlock_unlock(&obj->lock_cache);
+}
 
-    // read first entry
-    ret = ldb_read_record_dat(obj->dat_fd, pos, &record, true);
+// Reads the entries [seqnum1, seqnum2] from the cache.
+// Returns LDB_ERR_NOT_FOUND if any of them is not cached.
+static int ldb_cache_read(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_entry_t *entries, size_t *num, ldb_arena_t *arena)
+{
+    ldb_cache_t *cache = &obj->cache;
+    int ret = LDB_OK;
 
-    if (ret == LDB_ERR_FMT_DAT)
-        goto LDB_OPEN_FILE_DAT_ZEROIZE;
+    pthread_rwlock_rdlock(&obj->lock_cache);
 
-    if (ret != LDB_OK)
-        exit_function(ret);
+    if (cache->num == 0 || seqnum1 < cache->seqnum1 || seqnum2 >= cache->seqnum1 + cache->num) {
+        pthread_rwlock_unlock(&obj->lock_cache);
+        return LDB_ERR_NOT_FOUND;
+    }
 
-    if (record.seqnum == 0)
-        goto LDB_OPEN_FILE_DAT_ZEROIZE;
+    for (uint64_t seqnum = seqnum1; seqnum <= seqnum2; seqnum++)
+    {
+        const ldb_cache_entry_t *slot = &cache->slots[(cache->head + (seqnum - cache->seqnum1)) & (cache->max_slots - 1)];
+        ldb_entry_t *entry = entries + (seqnum - seqnum1);
 
-    pos += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+        if (!ldb_alloc_entry_from(entry, slot->metadata_len, slot->data_len, arena)) {
+            ret = LDB_ERR_MEM;
+            break;
+        }
+
+        if (slot->metadata_len)
+            memcpy(entry->metadata, slot->buf, slot->metadata_len);
+
+        if (slot->data_len)
+            memcpy(entry->data, slot->buf + slot->metadata_len, slot->data_len);
+
+        entry->seqnum = slot->seqnum;
+        entry->timestamp = slot->timestamp;
+        (*num)++;
+    }
+
+    pthread_rwlock_unlock(&obj->lock_cache);
+    LDB_METRIC_ADD(obj, cache_hits, *num);
+    return ret;
+}
+
+static int ldb_append_record_idx(ldb_impl_t *obj, ldb_state_t *state, ldb_record_idx_t *record)
+{
+    assert(obj);
+    assert(state);
+    assert(record);
+    assert(obj->idx_fp);
+    assert(!feof(obj->idx_fp));
+    assert(!ferror(obj->idx_fp));
+
+    if (record->seqnum != state->seqnum2) {
+        return LDB_ERR;
+    }
+
+    size_t pos = ldb_get_pos_idx(state, record->seqnum);
+
+    if (fseek(obj->idx_fp, (long) pos, SEEK_SET) != 0)
+        return LDB_ERR_READ_IDX;
+
+    if (fwrite(record, sizeof(ldb_record_idx_t), 1, obj->idx_fp) != 1)
+        return LDB_ERR_WRITE_IDX;
+
+    return LDB_OK;
+}
+
+// Positional read (file offset not modified).
+// Retries on interruption and on partial reads.
+// Returns the number of bytes read (less than len if eof reached), or -1 on error.
+static ssize_t ldb_pread(int fd, void *buf, size_t len, size_t pos)
+{
+    assert(fd > STDERR_FILENO);
+
+    size_t num = 0;
+
+    while (num < len)
+    {
+        ssize_t rc = pread(fd, (char *) buf + num, len - num, (off_t)(pos + num));
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        if (rc == -1)
+            return -1;
+
+        if (rc == 0)
+            break;
+
+        num += (size_t) rc;
+    }
+
+    return (ssize_t) num;
+}
+
+// Positional write (file offset not modified).
+// Retries on interruption and on partial writes.
+// Returns true on success, false otherwise.
+static bool ldb_pwrite(int fd, const void *buf, size_t len, size_t pos)
+{
+    size_t num = 0;
+
+    while (num < len)
+    {
+        ssize_t rc = pwrite(fd, (const char *) buf + num, len - num, (off_t)(pos + num));
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        if (rc <= 0)
+            return false;
+
+        num += (size_t) rc;
+    }
+
+    return true;
+}
+
+// Skips num bytes of the vectors (iov is modified).
+// Returns the first vector not fully skipped and updates iovcnt.
+static struct iovec * ldb_iov_advance(struct iovec *iov, size_t *iovcnt, size_t num)
+{
+    while (*iovcnt > 0 && num >= iov->iov_len) {
+        num -= iov->iov_len;
+        iov++;
+        (*iovcnt)--;
+    }
+
+    if (*iovcnt > 0 && num > 0) {
+        iov->iov_base = (char *) iov->iov_base + num;
+        iov->iov_len -= num;
+    }
+
+    return iov;
+}
+
+// Gathered write at the current file offset.
+// Retries on interruption and on partial writes (iov is modified).
+// Returns true on success, false otherwise.
+static bool ldb_writev(int fd, struct iovec *iov, size_t iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t rc = writev(fd, iov, (int) ldb_min(iovcnt, LDB_IOV_MAX));
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        if (rc <= 0)
+            return false;
+
+        iov = ldb_iov_advance(iov, &iovcnt, (size_t) rc);
+    }
+
+    return true;
+}
+
+// Sequential read (file offset moved).
+// Retries on interruption and on partial reads (pipes, sockets).
+// Returns the number of bytes read (less than len if eof reached), or -1 on error.
+static ssize_t ldb_read_fd(int fd, void *buf, size_t len)
+{
+    size_t num = 0;
+
+    while (num < len)
+    {
+        ssize_t rc = read(fd, (char *) buf + num, len - num);
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        if (rc == -1)
+            return -1;
+
+        if (rc == 0)
+            break;
+
+        num += (size_t) rc;
+    }
+
+    return (ssize_t) num;
+}
+
+// Copies up to len bytes from fd_in to fd_out. Positions are used (and advanced) 
+// when provided, file offsets otherwise. On Linux the bytes do not enter user 
+// space: copy_file_range between files, sendfile from a file to any fd (only if
+// pos_out is NULL). When the kernel refuses the copy (pipe input, different 
+// filesystems, old kernel), the bytes are moved through a buffer.
+// Returns the number of bytes copied (less than len if eof reached), or -1 on error.
+static ssize_t ldb_splice(int fd_in, size_t *pos_in, int fd_out, size_t *pos_out, size_t len)
+{
+    enum { LDB_SPLICE_COPY_RANGE, LDB_SPLICE_SENDFILE, LDB_SPLICE_BUFFER } mode = LDB_SPLICE_COPY_RANGE;
+    char *buf = NULL;
+    size_t num = 0;
+
+#ifndef __linux__
+    mode = LDB_SPLICE_BUFFER;
+#endif
+
+    while (num < len)
+    {
+        size_t chunk = ldb_min(len - num, (size_t) LDB_SPLICE_MAX_LEN);
+        ssize_t rc = -1;
+
+#ifdef __linux__
+        if (mode == LDB_SPLICE_COPY_RANGE)
+        {
+#ifdef __NR_copy_file_range
+            int64_t off_in = (pos_in ? (int64_t) *pos_in : 0);
+            int64_t off_out = (pos_out ? (int64_t) *pos_out : 0);
+
+            rc = (ssize_t) syscall(__NR_copy_file_range, fd_in, (pos_in ? &off_in : NULL), 
+                                   fd_out, (pos_out ? &off_out : NULL), chunk, 0u);
+#else
+            errno = ENOSYS;
+#endif
+        }
+        else if (mode == LDB_SPLICE_SENDFILE)
+        {
+            off_t off_in = (pos_in ? (off_t) *pos_in : 0);
+
+            rc = sendfile(fd_out, fd_in, (pos_in ? &off_in : NULL), chunk);
+        }
+        else
+#endif
+        {
+            chunk = ldb_min(chunk, (size_t) LDB_READ_BUFFER_LEN);
+
+            if (buf == NULL && (buf = (char *) malloc(LDB_READ_BUFFER_LEN)) == NULL)
+                return -1;
+
+            if (pos_in)
+                rc = pread(fd_in, buf, chunk, (off_t) *pos_in);
+            else
+                rc = read(fd_in, buf, chunk);
+
+            if (rc > 0)
+            {
+                struct iovec iov = { .iov_base = buf, .iov_len = (size_t) rc };
+
+                if (pos_out ? !ldb_pwrite(fd_out, buf, (size_t) rc, *pos_out) : !ldb_writev(fd_out, &iov, 1)) {
+                    free(buf);
+                    return -1;
+                }
+            }
+        }
+
+        if (rc == -1 && errno == EINTR)
+            continue;
+
+        // kernel copy not supported for these descriptors
+        if (rc == -1 && mode != LDB_SPLICE_BUFFER && 
+            (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+            mode = (mode == LDB_SPLICE_COPY_RANGE && pos_out == NULL ? LDB_SPLICE_SENDFILE : LDB_SPLICE_BUFFER);
+            continue;
+        }
+
+        if (rc == -1) {
+            free(buf);
+            return -1;
+        }
+
+        if (rc == 0)
+            break;
+
+        num += (size_t) rc;
+
+        if (pos_in)
+            *pos_in += (size_t) rc;
+
+        if (pos_out)
+            *pos_out += (size_t) rc;
+    }
+
+    free(buf);
+    return (ssize_t) num;
+}
+
+#ifdef LDB_IO_URING
+
+// Minimal io_uring wrapper using raw syscalls (liburing not required).
+
+static void ldb_uring_free(ldb_uring_t *ring)
+{
+    if (ring == NULL)
+        return;
+
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_len);
+
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+
+    if (ring->sq_ptr != NULL)
+        munmap(ring->sq_ptr, ring->sq_len);
+
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(ldb_uring_t));
+    ring->fd = -1;
+}
+
+static void * ldb_uring_mmap(int fd, size_t len, off_t offset)
+{
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    return (ptr == MAP_FAILED ? NULL : ptr);
+}
+
+// Creates a ring with LDB_URING_DEPTH entries.
+// Returns false if io_uring is not available (ring->fd = -1).
+static bool ldb_uring_init(ldb_uring_t *ring)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(ldb_uring_t));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, LDB_URING_DEPTH, &params);
+
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_len = ring->cq_len = (size_t) ldb_max(ring->sq_len, ring->cq_len);
+
+    ring->sq_ptr = (char *) ldb_uring_mmap(ring->fd, ring->sq_len, IORING_OFF_SQ_RING);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else
+        ring->cq_ptr = (char *) ldb_uring_mmap(ring->fd, ring->cq_len, IORING_OFF_CQ_RING);
+
+    ring->sqes = (struct io_uring_sqe *) ldb_uring_mmap(ring->fd, ring->sqes_len, IORING_OFF_SQES);
+
+    if (!ring->sq_ptr || !ring->cq_ptr || !ring->sqes) {
+        ldb_uring_free(ring);
+        return false;
+    }
+
+    ring->sq_head = (unsigned *)(ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail_ptr = (unsigned *)(ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(ring->sq_ptr + params.sq_off.ring_mask);
+    ring->cq_head = (unsigned *)(ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(ring->cq_ptr + params.cq_off.cqes);
+    ring->sq_tail = *ring->sq_tail_ptr;
+    ring->features = params.features;
+
+    // submission entries are used in order (identity array)
+    unsigned *sq_array = (unsigned *)(ring->sq_ptr + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        sq_array[i] = i;
+
+    return true;
+}
+
+// Queues an operation (user_data identifies the result in ldb_uring_wait).
+// Returns the submission entry to complete, or NULL if the queue is full.
+static struct io_uring_sqe * ldb_uring_queue(ldb_uring_t *ring, uint8_t opcode, int fd, 
+                                             const void *addr, size_t len, size_t pos, uint64_t user_data)
+{
+    assert(user_data < LDB_URING_DEPTH);
+
+    if (ring->num_inflight >= LDB_URING_DEPTH)
+        return NULL;
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_tail & *ring->sq_mask];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t) addr;
+    sqe->len = (uint32_t) len;
+    sqe->off = (uint64_t) pos;
+    sqe->user_data = user_data;
+
+    ring->sq_tail++;
+    ring->num_unsubmitted++;
+    ring->num_inflight++;
+
+    return sqe;
+}
+
+// Submits the queued operations and waits for min_complete completions.
+static bool ldb_uring_enter(ldb_uring_t *ring, unsigned min_complete)
+{
+    __atomic_store_n(ring->sq_tail_ptr, ring->sq_tail, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+        long rc = syscall(__NR_io_uring_enter, ring->fd, ring->num_unsubmitted, min_complete, 
+                          (min_complete > 0 ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+
+        if (rc == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+            continue;
+
+        // ring is not used anymore (queued operations are discarded)
+        if (rc == -1) {
+            ring->failed = true;
+            ring->num_unsubmitted = 0;
+            ring->num_inflight = 0;
+            return false;
+        }
+
+        ring->num_unsubmitted -= (unsigned) rc;
+        return true;
+    }
+}
+
+// Waits for all queued operations. Results are stored in res[user_data].
+static bool ldb_uring_wait(ldb_uring_t *ring, int32_t *res)
+{
+    while (ring->num_inflight > 0)
+    {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail && ring->num_inflight > 0; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            res[cqe->user_data] = cqe->res;
+            ring->num_inflight--;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (ring->num_inflight > 0 && !ldb_uring_enter(ring, 1))
+            return false;
+    }
+
+    return true;
+}
+
+static pthread_key_t ldb_uring_key;
+static pthread_once_t ldb_uring_once = PTHREAD_ONCE_INIT;
+
+static void ldb_uring_destroy(void *ring)
+{
+    ldb_uring_free((ldb_uring_t *) ring);
+    free(ring);
+}
+
+static void ldb_uring_key_init(void)
+{
+    pthread_key_create(&ldb_uring_key, ldb_uring_destroy);
+}
+
+// Returns the ring of the calling thread used to read (created on first call).
+// Returns NULL if io_uring is not available.
+static ldb_uring_t * ldb_uring_get(void)
+{
+    pthread_once(&ldb_uring_once, ldb_uring_key_init);
+
+    ldb_uring_t *ring = (ldb_uring_t *) pthread_getspecific(ldb_uring_key);
+
+    if (ring == NULL)
+    {
+        if ((ring = (ldb_uring_t *) malloc(sizeof(ldb_uring_t))) == NULL)
+            return NULL;
+
+        // on failure the ring is kept to avoid retrying on each read
+        ldb_uring_init(ring);
+
+        if (pthread_setspecific(ldb_uring_key, ring) != 0) {
+            ldb_uring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    return (ring->fd < 0 || ring->failed ? NULL : ring);
+}
+
+// Starts the writes of the pending entries using the writer ring.
+// The dat write uses (and advances) the file offset, shared with dat_fp.
+// The fdatasync is linked to the dat write (done after it).
+// Returns false if io_uring is not available (nothing submitted).
+static bool ldb_uring_submit_entries(ldb_impl_t *obj, bool fsync)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    ldb_uring_t *ring = obj->uring;
+
+    if (ring == NULL)
+    {
+        if ((ring = (ldb_uring_t *) malloc(sizeof(ldb_uring_t))) == NULL)
+            return false;
+
+        ldb_uring_init(ring);
+        obj->uring = ring;
+    }
+
+    if (ring->fd < 0 || ring->failed)
+        return false;
+
+    // batches exceeding the kernel limit are written with several writev
+    if (wbuf->iovcnt > LDB_IOV_MAX || !(ring->features & IORING_FEAT_RW_CUR_POS))
+        return false;
+
+    assert(ring->num_inflight == 0);
+
+    if (wbuf->num_submitted > 0)
+    {
+        struct io_uring_sqe *sqe = ldb_uring_queue(ring, IORING_OP_WRITEV, obj->dat_wfd, wbuf->iov, wbuf->iovcnt, (size_t) -1, 0);
+
+        if (fsync)
+            sqe->flags |= IOSQE_IO_LINK;
+    }
+
+    if (fsync) {
+        struct io_uring_sqe *sqe = ldb_uring_queue(ring, IORING_OP_FSYNC, obj->dat_wfd, NULL, 0, 0, 1);
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        LDB_METRIC_ADD(obj, fsync_calls, 1);
+    }
+
+    if (wbuf->num_submitted > 0 && obj->fixed_len == 0)
+        ldb_uring_queue(ring, IORING_OP_WRITE, fileno(obj->idx_fp), wbuf->records_idx, 
+                        wbuf->num_submitted * sizeof(ldb_record_idx_t), wbuf->idx_pos, 2);
+
+    // on error, completion is reported by ldb_wait_entries
+    ldb_uring_enter(ring, 0);
+
+    return true;
+}
+
+// Waits the writes submitted by ldb_uring_submit_entries().
+// Partial writes are completed synchronously.
+static int ldb_uring_wait_entries(ldb_impl_t *obj)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    int32_t res[LDB_URING_DEPTH] = {0};
+    size_t idx_len = (obj->fixed_len == 0 ? wbuf->num_submitted * sizeof(ldb_record_idx_t) : 0);
+    int ret = LDB_OK;
+
+    if (!ldb_uring_wait(obj->uring, res))
+        return LDB_ERR_WRITE_DAT;
+
+    if (wbuf->num_submitted > 0 && res[0] < 0) {
+        errno = -res[0];
+        ret = LDB_ERR_WRITE_DAT;
+    }
+    else if (wbuf->num_submitted > 0 && (size_t) res[0] < wbuf->dat_len)
+    {
+        size_t iovcnt = wbuf->iovcnt;
+        struct iovec *iov = ldb_iov_advance(wbuf->iov, &iovcnt, (size_t) res[0]);
+
+        // file offset was advanced by the written bytes
+        if (!ldb_writev(obj->dat_wfd, iov, iovcnt))
+            ret = LDB_ERR_WRITE_DAT;
+
+        // linked fdatasync was canceled
+        if (ret == LDB_OK && wbuf->fsync && ldb_fdatasync(obj, obj->dat_wfd) == -1)
+            ret = LDB_ERR_WRITE_DAT;
+    }
+    else if (wbuf->fsync && res[1] < 0) {
+        errno = -res[1];
+        ret = LDB_ERR_WRITE_DAT;
+    }
+
+    if (idx_len > 0 && res[2] < 0) {
+        errno = -res[2];
+        ret = (ret == LDB_OK ? LDB_ERR_WRITE_IDX : ret);
+    }
+    else if (idx_len > 0 && (size_t) res[2] < idx_len && 
+             !ldb_pwrite(fileno(obj->idx_fp), (char *) wbuf->records_idx + res[2], idx_len - (size_t) res[2], wbuf->idx_pos + (size_t) res[2]))
+        ret = (ret == LDB_OK ? LDB_ERR_WRITE_IDX : ret);
+
+    return ret;
+}
+
+// Positional read split in chunks read in parallel (see ldb_pread()).
+// Small reads, or reads when io_uring is not available, are done with pread.
+static ssize_t ldb_pread_dat(int fd, void *buf, size_t len, size_t pos)
+{
+    ldb_uring_t *ring = (len >= 2 * LDB_URING_READ_CHUNK ? ldb_uring_get() : NULL);
+
+    if (ring == NULL)
+        return ldb_pread(fd, buf, len, pos);
+
+    int32_t res[LDB_URING_DEPTH] = {0};
+    size_t num = ldb_min(len / LDB_URING_READ_CHUNK, LDB_URING_DEPTH);
+    size_t chunk_len = (len + num - 1) / num;
+
+    for (size_t i = 0; i < num; i++) {
+        size_t offset = i * chunk_len;
+        ldb_uring_queue(ring, IORING_OP_READ, fd, (char *) buf + offset, ldb_min(chunk_len, len - offset), pos + offset, i);
+    }
+
+    if (!ldb_uring_enter(ring, 0) || !ldb_uring_wait(ring, res))
+        return -1;
+
+    // first chunk not fully read (eof, error or partial read)
+    for (size_t i = 0; i < num; i++)
+    {
+        size_t offset = i * chunk_len;
+
+        if (res[i] >= 0 && (size_t) res[i] == ldb_min(chunk_len, len - offset))
+            continue;
+
+        offset += (res[i] > 0 ? (size_t) res[i] : 0);
+
+        ssize_t rc = ldb_pread(fd, (char *) buf + offset, len - offset, pos + offset);
+
+        return (rc == -1 ? -1 : (ssize_t)(offset + (size_t) rc));
+    }
+
+    return (ssize_t) len;
+}
+
+#else
+
+#define ldb_pread_dat ldb_pread
+
+#endif
+
+// Extends the file in chunks of obj->prealloc_len bytes when the write [pos, end)
+// exceeds the preallocated length (zero-filled tail, see ldb_open_file_idx).
+// On error, writes extend the file as usual.
+// function accessed only by thread-write
+static void ldb_preallocate(ldb_impl_t *obj, int fd, size_t *alloc, size_t pos, size_t end)
+{
+    size_t chunk = obj->prealloc_len;
+
+    if (chunk == 0 || end <= *alloc || end <= pos)
+        return;
+
+    size_t len = (end / chunk + 1) * chunk;
+    size_t off = ldb_max(pos, *alloc);
+
+#ifdef __linux__
+    if (posix_fallocate(fd, (off_t) off, (off_t)(len - off)) == 0)
+        *alloc = len;
+#else
+    (void) fd;
+    (void) off;
+    (void) len;
+#endif
+}
+
+// Removes the preallocated tails (files truncated to their logical end).
+// function accessed only by thread-write
+static int ldb_trim_files(ldb_impl_t *obj)
+{
+    size_t idx_end = sizeof(ldb_header_idx_t);
+
+    if (obj->dat_alloc == 0 && obj->idx_alloc == 0)
+        return LDB_OK;
+
+    if (obj->state.seqnum1 != 0)
+        idx_end = ldb_get_pos_idx(&obj->state, obj->state.seqnum2) + sizeof(ldb_record_idx_t);
+
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+
+    if (obj->fixed_len == 0 && !ldb_truncate(obj->idx_fp, idx_end))
+        return LDB_ERR_WRITE_IDX;
+
+    if (!ldb_truncate(obj->dat_fp, obj->dat_end))
+        return LDB_ERR_WRITE_DAT;
+
+    return LDB_OK;
+}
+
+// Starts the writes of pending entries (1 writev on dat file per LDB_IOV_MAX 
+// vectors, 1 write on idx file, plus a fdatasync if fsync is set). Data is 
+// written straight from the entries (no intermediate copies). With io_uring 
+// the writes are submitted and completed by ldb_wait_entries(). Otherwise 
+// they are done here.
+// function accessed only by thread-write
+static void ldb_submit_entries(ldb_impl_t *obj, bool fsync)
+{
+    assert(obj);
+    assert(obj->dat_wfd > STDERR_FILENO);
+
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+
+    wbuf->num_submitted = wbuf->num;
+    wbuf->iovcnt = 0;
+    wbuf->dat_len = 0;
+    wbuf->fsync = fsync;
+    wbuf->ret = LDB_OK;
+    wbuf->num = 0;
+
+    for (size_t i = 0, zpos = 0; i < wbuf->num_submitted; i++)
+    {
+        const ldb_entry_t *entry = wbuf->entries[i];
+        const ldb_record_dat_t *record = &wbuf->records_dat[i];
+        void *data = entry->data;
+
+        // compressed data stored in zbuf (in append order)
+        if (record->data_len != entry->data_len) {
+            data = wbuf->zbuf + zpos;
+            zpos += record->data_len;
+        }
+
+        wbuf->iov[wbuf->iovcnt++] = (struct iovec){ .iov_base = &wbuf->records_dat[i], .iov_len = sizeof(ldb_record_dat_t) };
+
+        if (record->metadata_len)
+            wbuf->iov[wbuf->iovcnt++] = (struct iovec){ .iov_base = entry->metadata, .iov_len = record->metadata_len };
+
+        if (record->data_len)
+            wbuf->iov[wbuf->iovcnt++] = (struct iovec){ .iov_base = data, .iov_len = record->data_len };
+
+        wbuf->dat_len += sizeof(ldb_record_dat_t) + record->metadata_len + record->data_len;
+    }
+
+    if (wbuf->num_submitted > 0)
+    {
+        // 1 writev per LDB_IOV_MAX vectors, plus the idx write (if any)
+        LDB_METRIC_ADD(obj, write_calls, (obj->fixed_len == 0 ? 1 : 0) + (wbuf->iovcnt + LDB_IOV_MAX - 1) / LDB_IOV_MAX);
+
+        ldb_preallocate(obj, obj->dat_wfd, &obj->dat_alloc, wbuf->dat_pos, wbuf->dat_pos + wbuf->dat_len);
+
+        if (obj->fixed_len == 0)
+            ldb_preallocate(obj, fileno(obj->idx_fp), &obj->idx_alloc, wbuf->idx_pos, wbuf->idx_pos + wbuf->num_submitted * sizeof(ldb_record_idx_t));
+    }
+
+    // offset unknown after open, rollback, purge or an error
+    if (wbuf->num_submitted > 0 && obj->dat_wpos != wbuf->dat_pos)
+    {
+        if (lseek(obj->dat_wfd, (off_t) wbuf->dat_pos, SEEK_SET) == -1) {
+            wbuf->ret = LDB_ERR_WRITE_DAT;
+            return;
+        }
+
+        obj->dat_wpos = wbuf->dat_pos;
+    }
+
+    // once completed, the offset is the end of the batch (discarded on error)
+    obj->dat_wpos = wbuf->dat_pos + wbuf->dat_len;
+
+#ifdef LDB_IO_URING
+    if (ldb_uring_submit_entries(obj, fsync))
+        return;
+#endif
+
+    if (wbuf->num_submitted > 0)
+    {
+        if (!ldb_writev(obj->dat_wfd, wbuf->iov, wbuf->iovcnt)) {
+            wbuf->ret = LDB_ERR_WRITE_DAT;
+            return;
+        }
+
+        if (obj->fixed_len == 0 && 
+            !ldb_pwrite(fileno(obj->idx_fp), wbuf->records_idx, wbuf->num_submitted * sizeof(ldb_record_idx_t), wbuf->idx_pos)) {
+            wbuf->ret = LDB_ERR_WRITE_IDX;
+            return;
+        }
+    }
+
+    if (fsync && ldb_fdatasync(obj, obj->dat_wfd) == -1)
+        wbuf->ret = LDB_ERR_WRITE_DAT;
+}
+
+// Removes the submitted entries after a write error.
+// Files are truncated to the first submitted entry (idx first, on crash it is rebuilt from dat).
+// function accessed only by thread-write
+static int ldb_discard_entries(ldb_impl_t *obj, int ret)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+
+    obj->dat_end = wbuf->dat_pos;
+    obj->dat_wpos = SIZE_MAX;
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+
+    if (obj->idx_fp && !ldb_truncate(obj->idx_fp, wbuf->idx_pos))
+        return LDB_ERR_WRITE_IDX;
+
+    if (!ldb_truncate(obj->dat_fp, wbuf->dat_pos))
+        return LDB_ERR_WRITE_DAT;
+
+    return ret;
+}
+
+// Waits the writes started by ldb_submit_entries().
+// On error the submitted entries are discarded.
+// function accessed only by thread-write
+static int ldb_wait_entries(ldb_impl_t *obj)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    int ret = wbuf->ret;
+
+#ifdef LDB_IO_URING
+    if (obj->uring != NULL && obj->uring->num_inflight > 0)
+        ret = ldb_uring_wait_entries(obj);
+#endif
+
+    if (ret == LDB_OK) {
+        ldb_cache_fill(obj);
+        ldb_keys_fill(obj);
+        LDB_METRIC_ADD(obj, appended_entries, wbuf->num_submitted);
+        LDB_METRIC_ADD(obj, appended_bytes, wbuf->dat_len);
+        obj->flush_bytes += wbuf->dat_len;
+    }
+    else if (wbuf->num_submitted > 0)
+        ret = ldb_discard_entries(obj, ret);
+
+    wbuf->num_submitted = 0;
+    wbuf->ret = LDB_OK;
+
+    return ret;
+}
+
+// Grows the write buffer to hold num entries.
+// On error the buffer is not modified and returns false.
+// function accessed only by thread-write
+static bool ldb_reserve_entries(ldb_wbuf_t *wbuf, size_t num)
+{
+    if (num <= wbuf->max)
+        return true;
+
+    size_t max = ldb_max(num, (wbuf->max == 0 ? LDB_WRITE_MAX_ENTRIES : 2 * wbuf->max));
+    ldb_record_dat_t *records_dat = (ldb_record_dat_t *) realloc(wbuf->records_dat, max * sizeof(ldb_record_dat_t));
+
+    if (records_dat == NULL)
+        return false;
+
+    wbuf->records_dat = records_dat;
+
+    ldb_record_idx_t *records_idx = (ldb_record_idx_t *) realloc(wbuf->records_idx, max * sizeof(ldb_record_idx_t));
+
+    if (records_idx == NULL)
+        return false;
+
+    wbuf->records_idx = records_idx;
+
+    const ldb_entry_t **entries = (const ldb_entry_t **) realloc((void *) wbuf->entries, max * sizeof(ldb_entry_t *));
+
+    if (entries == NULL)
+        return false;
+
+    wbuf->entries = entries;
+
+    struct iovec *iov = (struct iovec *) realloc(wbuf->iov, 3 * max * sizeof(struct iovec));
+
+    if (iov == NULL)
+        return false;
+
+    wbuf->iov = iov;
+    wbuf->max = max;
+
+    return true;
+}
+
+// Compresses the entry data into wbuf->zbuf (kept uncompressed if not smaller).
+// Updates the record length and checksum.
+// function accessed only by thread-write
+static void ldb_compress_entry(ldb_impl_t *obj, const ldb_entry_t *entry, ldb_record_dat_t *record)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    size_t max_len = entry->data_len - 1;
+
+    // on memory error data is stored uncompressed
+    if (wbuf->zbuf_len + max_len > wbuf->zbuf_max)
+    {
+        size_t len = ldb_max(wbuf->zbuf_len + max_len, 2 * wbuf->zbuf_max);
+        char *zbuf = (char *) realloc(wbuf->zbuf, len);
+
+        if (zbuf == NULL)
+            return;
+
+        wbuf->zbuf = zbuf;
+        wbuf->zbuf_max = len;
+    }
+
+    char *zdata = wbuf->zbuf + wbuf->zbuf_len;
+    size_t zlen = ldb_lz4_compress((const char *) entry->data, entry->data_len, zdata, max_len);
+
+    if (zlen == 0)
+        return;
+
+    wbuf->zbuf_len += zlen;
+
+    record->data_len = (uint32_t) zlen;
+    record->checksum = ldb_checksum_record(record, obj->format);
+    record->checksum = ldb_checksum(obj->format, (const char *) entry->metadata, entry->metadata_len, record->checksum);
+    record->checksum = ldb_checksum(obj->format, zdata, zlen, record->checksum);
+}
+
+// append data entry at position obj->dat_end (entry is queued, see ldb_submit_entries)
+// updates obj->dat_end value
+// entry content must remain unchanged until pending entries are written
+// function accessed only by thread-write
+static int ldb_append_entry_dat(ldb_impl_t *obj, ldb_state_t *state, const ldb_entry_t *entry)
+{
+    assert(obj);
+    assert(state);
+    assert(entry);
+    assert(obj->dat_fp);
+
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+
+    if (entry->metadata_len != 0 && entry->metadata == NULL)
+        return LDB_ERR_ENTRY_METADATA;
+
+    if (entry->data_len != 0 && entry->data == NULL)
+        return LDB_ERR_ENTRY_DATA;
+
+    if (obj->fixed_len != 0 && (uint64_t) entry->metadata_len + entry->data_len != obj->fixed_len)
+        return LDB_ERR_ENTRY_LEN;
+
+    if (state->seqnum2 != 0 && entry->seqnum != state->seqnum2 + 1)
+        return LDB_ERR_ENTRY_SEQNUM;
+
+    if (entry->timestamp < state->timestamp2)
+        return LDB_ERR_ENTRY_TIMESTAMP;
+
+    // the whole batch is written at commit
+    if (!ldb_reserve_entries(wbuf, wbuf->num + 1))
+        return LDB_ERR_MEM;
+
+    if (state->seqnum1 == 0) {
+        state->seqnum1 = entry->seqnum;
+        state->timestamp1 = entry->timestamp;
+    }
+
+    state->seqnum2 = entry->seqnum;
+    state->timestamp2 = entry->timestamp;
+
+    if (wbuf->num == 0) {
+        wbuf->dat_pos = obj->dat_end;
+        wbuf->idx_pos = ldb_get_pos_idx(state, entry->seqnum);
+        wbuf->zbuf_len = 0;
+    }
+
+    ldb_record_dat_t *record = &wbuf->records_dat[wbuf->num];
+
+    *record = (ldb_record_dat_t){
+        .seqnum = entry->seqnum,
+        .timestamp = entry->timestamp,
+        .metadata_len = entry->metadata_len,
+        .data_len = entry->data_len,
+        .checksum = ldb_checksum_entry(entry, obj->format),
+        .raw_len = entry->data_len
+    };
+
+    if (obj->compress && obj->format == LDB_FORMAT_3 && entry->data_len >= LDB_COMPRESS_MIN_LEN)
+        ldb_compress_entry(obj, entry, record);
+
+    wbuf->records_idx[wbuf->num] = (ldb_record_idx_t){
+        .seqnum = entry->seqnum,
+        .timestamp = entry->timestamp,
+        .pos = obj->dat_end
+    };
+
+    wbuf->entries[wbuf->num++] = entry;
+
+    obj->dat_end += sizeof(ldb_record_dat_t) + record->metadata_len + record->data_len;
+
+    return LDB_OK;
+}
+
+// Read data record at pos.
+// File offset is not modified (positional reads).
+// Adds the dat bytes [pos, pos + len) to the checksum (read in small chunks).
+static int ldb_checksum_dat(ldb_impl_t *obj, size_t pos, size_t len, uint32_t *checksum)
+{
+    char buf[BUFSIZ] = {0};
+
+    for (size_t i = pos; i < pos + len; i += sizeof(buf))
+    {
+        size_t num_bytes = ldb_min(pos + len - i, sizeof(buf));
+
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        ssize_t rc = ldb_pread(obj->dat_fd, buf, num_bytes, i);
+
+        if (rc == -1)
+            return LDB_ERR_READ_DAT;
+        
+        if (rc != (ssize_t) num_bytes)
+            return LDB_ERR_FMT_DAT;
+
+        *checksum = ldb_checksum(obj->format, buf, num_bytes, *checksum);
+    }
+
+    return LDB_OK;
+}
+
+static int ldb_read_record_dat(ldb_impl_t *obj, size_t pos, ldb_record_dat_t *record, bool verify_checksum)
+{
+    assert(obj);
+    assert(record);
+    assert(obj->dat_fd > STDERR_FILENO);
+
+    int fd = obj->dat_fd;
+
+    LDB_METRIC_ADD(obj, read_calls, 1);
+    ssize_t rc = ldb_pread(fd, record, sizeof(ldb_record_dat_t), pos);
+
+    if (rc == -1)
+        return LDB_ERR_READ_DAT;
+
+    if (rc != sizeof(ldb_record_dat_t))
+        return LDB_ERR_FMT_DAT;
+
+    if (!verify_checksum || record->seqnum == 0)
+        return LDB_OK;
+
+    uint32_t checksum = ldb_checksum_record(record, obj->format);
+    int ret = ldb_checksum_dat(obj, pos + sizeof(ldb_record_dat_t), (size_t) record->metadata_len + record->data_len, &checksum);
+
+    if (ret != LDB_OK)
+        return ret;
+
+    if (checksum != record->checksum) {
+        LDB_METRIC_ADD(obj, checksum_errors, 1);
+        return LDB_ERR_CHECKSUM;
+    }
+
+    return LDB_OK;
+}
+
+// Reads a compressed record (header already read) into entry.
+static int ldb_read_entry_compressed(ldb_impl_t *obj, size_t pos, const ldb_record_dat_t *record, ldb_entry_t *entry, ldb_arena_t *arena)
+{
+    size_t len = record->metadata_len + record->data_len;
+    char *buf = (char *) malloc(len);
+    int ret = LDB_OK;
+
+    if (buf == NULL)
+        return LDB_ERR_MEM;
+
+    LDB_METRIC_ADD(obj, read_calls, 1);
+    ssize_t rc = ldb_pread(obj->dat_fd, buf, len, pos + sizeof(ldb_record_dat_t));
+    uint32_t checksum = ldb_checksum_record(record, obj->format);
+
+    if (rc == -1)
+        ret = LDB_ERR_READ_DAT;
+    else if (rc != (ssize_t) len)
+        ret = LDB_ERR_FMT_DAT;
+    else if (record->checksum != ldb_checksum(obj->format, buf, len, checksum)) {
+        LDB_METRIC_ADD(obj, checksum_errors, 1);
+        ret = LDB_ERR_CHECKSUM;
+    }
+    else if (!ldb_alloc_entry_from(entry, record->metadata_len, record->raw_len, arena))
+        ret = LDB_ERR_MEM;
+    else if (!ldb_lz4_decompress(buf + record->metadata_len, record->data_len, (char *) entry->data, record->raw_len))
+        ret = LDB_ERR_FMT_DAT;
+
+    if (ret == LDB_OK) {
+        if (record->metadata_len)
+            memcpy(entry->metadata, buf, record->metadata_len);
+        entry->seqnum = record->seqnum;
+        entry->timestamp = record->timestamp;
+    }
+
+    free(buf);
+    return ret;
+}
+
+// Reads the record at pos into entry (memory allocated from arena if not NULL)
+static int ldb_read_entry_dat(ldb_impl_t *obj, size_t pos, ldb_entry_t *entry, ldb_arena_t *arena)
+{
+    assert(obj);
+    assert(entry);
+    assert(obj->dat_fd > STDERR_FILENO);
+
+    int fd = obj->dat_fd;
+
+    int ret = 0;
+    ssize_t rc = 0;
+    ldb_record_dat_t record = {0};
+
+    if ((ret = ldb_read_record_dat(obj, pos, &record, false)) != LDB_OK)
+        return ret;
+
+    // compressed data is verified and decompressed from a temporary buffer
+    if (ldb_raw_len(&record, obj->format) != record.data_len)
+        return ldb_read_entry_compressed(obj, pos, &record, entry, arena);
+
+    if (!ldb_alloc_entry_from(entry, record.metadata_len, record.data_len, arena))
+        return LDB_ERR_MEM;
+
+    if (record.metadata_len)
+    {
+        assert(entry->metadata != NULL);
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        rc = ldb_pread(fd, entry->metadata, record.metadata_len, pos + sizeof(ldb_record_dat_t));
+        if (rc == -1)
+            return LDB_ERR_READ_DAT;
+        if (rc != (ssize_t) record.metadata_len)
+            return LDB_ERR_FMT_DAT;
+    }
+
+    if (record.data_len)
+    {
+        assert(entry->data != NULL);
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        rc = ldb_pread(fd, entry->data, record.data_len, pos + sizeof(ldb_record_dat_t) + record.metadata_len);
+        if (rc == -1)
+            return LDB_ERR_READ_DAT;
+        if (rc != (ssize_t) record.data_len)
+            return LDB_ERR_FMT_DAT;
+    }
+
+    entry->seqnum = record.seqnum;
+    entry->timestamp = record.timestamp;
+
+    if (record.checksum != ldb_checksum_entry(entry, obj->format)) {
+        LDB_METRIC_ADD(obj, checksum_errors, 1);
+        return LDB_ERR_CHECKSUM;
+    }
+
+    return LDB_OK;
+}
+
+// Maps (read-only) a file covering at least len bytes, returns NULL on error (sets map_len).
+static char * ldb_mmap_file(int fd, size_t len, size_t min_len, size_t *map_len)
+{
+    assert(fd > STDERR_FILENO);
+    assert(map_len);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t aux_len = ldb_max(2 * len, min_len);
+
+    if (page_size > 0 && aux_len % (size_t) page_size != 0)
+        aux_len += (size_t) page_size - aux_len % (size_t) page_size;
+
+    void *addr = mmap(NULL, aux_len, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    *map_len = aux_len;
+
+    return (char *) addr;
+}
+
+// Maps the idx file with a length that covers at least len bytes.
+// Mapped length exceeds the file length to allow appends without remapping.
+// Caller must assure exclusive access (no readers).
+// On error the previous mapping is preserved and returns false.
+static bool ldb_remap_idx(ldb_impl_t *obj, size_t len)
+{
+    assert(obj);
+    assert(obj->idx_fd > STDERR_FILENO);
+
+    size_t map_len = 0;
+    char *addr = ldb_mmap_file(obj->idx_fd, len, LDB_MMAP_IDX_MIN_LEN, &map_len);
+
+    if (addr == NULL)
+        return false;
+
+    if (obj->idx_map != NULL)
+        munmap(obj->idx_map, obj->idx_map_len);
+
+    obj->idx_map = addr;
+    obj->idx_map_len = map_len;
+
+    return true;
+}
+
+// Pins the dat mapping, ensuring that it covers at least len bytes.
+// When the mapping is grown, the previous one is retired (still valid
+// for existing views) and released when all views are released.
+// Returns the mapping address, or NULL on error.
+static char * ldb_pin_dat(ldb_impl_t *obj, size_t len)
+{
+    assert(obj);
+    assert(obj->dat_fd > STDERR_FILENO);
+
+    char *ret = NULL;
+
+    ldb_lock_data(obj);
+
+    if (obj->dat_map == NULL || obj->dat_map_len < len)
+    {
+        size_t map_len = 0;
+        char *addr = ldb_mmap_file(obj->dat_fd, len, LDB_MMAP_DAT_MIN_LEN, &map_len);
+
+        if (addr == NULL)
+            goto LDB_PIN_DAT_END;
+
+        if (obj->dat_map != NULL && obj->num_views == 0) {
+            munmap(obj->dat_map, obj->dat_map_len);
+        }
+        else if (obj->dat_map != NULL) {
+            ldb_mmap_t *old = (ldb_mmap_t *) calloc(1, sizeof(ldb_mmap_t));
+            if (old == NULL) {
+                munmap(addr, map_len);
+                goto LDB_PIN_DAT_END;
+            }
+            old->addr = obj->dat_map;
+            old->len = obj->dat_map_len;
+            old->next = obj->dat_map_old;
+            obj->dat_map_old = old;
+        }
+
+        obj->dat_map = addr;
+        obj->dat_map_len = map_len;
+    }
+
+    obj->num_views++;
+    ret = obj->dat_map;
+
+LDB_PIN_DAT_END:
+    pthread_mutex_unlock(&obj->mutex_data);
+    return ret;
+}
+
+// Unpins the dat mapping.
+static void ldb_unpin_dat(ldb_impl_t *obj)
+{
+    assert(obj);
+
+    ldb_lock_data(obj);
+
+    if (obj->num_views > 0)
+        obj->num_views--;
+
+    if (obj->num_views == 0) {
+        ldb_unmap_dat(obj, false);
+        pthread_cond_broadcast(&obj->cond_views);
+    }
+
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+// Waits until all views are released.
+// Caller must hold the file lock in exclusive mode (no new views).
+static void ldb_wait_views(ldb_impl_t *obj)
+{
+    assert(obj);
+
+    ldb_lock_data(obj);
+
+    while (obj->num_views > 0)
+        pthread_cond_wait(&obj->cond_views, &obj->mutex_data);
+
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+// Read len consecutive entries located in the dat range [pos, end) starting at seqnum.
+// Records are fetched with large reads (up to LDB_READ_BUFFER_LEN bytes) and split in
+// user space. Records that don't fit in the buffer are read directly into the entry.
+// Entries memory is allocated from arena if not NULL.
+// Updates num with the number of entries read.
+static int ldb_read_entries_dat(ldb_impl_t *obj, size_t pos, size_t end, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
+{
+    assert(obj);
+    assert(entries);
+    assert(num);
+    assert(pos <= end);
+
+    int ret = LDB_OK;
+    size_t buf_len = ldb_min(end - pos, LDB_READ_BUFFER_LEN);
+    size_t buf_pos = pos;   // file position of buf[0]
+    size_t buf_end = pos;   // file position after the last byte in buf
+    ldb_record_dat_t record = {0};
+
+    char *buf = (char *) malloc(ldb_max(buf_len, sizeof(ldb_record_dat_t)));
+    if (buf == NULL)
+        return LDB_ERR_MEM;
+
+    for (size_t i = 0; i < len; i++, seqnum++)
+    {
+        ldb_entry_t *entry = entries + i;
+
+        // refill buffer if record header is not available
+        if (pos < buf_pos || pos + sizeof(ldb_record_dat_t) > buf_end)
+        {
+            LDB_METRIC_ADD(obj, read_calls, 1);
+            ssize_t rc = ldb_pread_dat(obj->dat_fd, buf, ldb_min(end - pos, buf_len), pos);
+
+            if (rc == -1) {
+                ret = LDB_ERR_READ_DAT;
+                break;
+            }
+
+            buf_pos = pos;
+            buf_end = pos + (size_t) rc;
+
+            if (pos + sizeof(ldb_record_dat_t) > buf_end) {
+                ret = LDB_ERR_FMT_DAT;
+                break;
+            }
+        }
+
+        memcpy(&record, buf + (pos - buf_pos), sizeof(ldb_record_dat_t));
+
+        if (record.seqnum != seqnum) {
+            ret = LDB_ERR;
+            break;
+        }
+
+        size_t rec_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+        if (pos + rec_len > end) {
+            ret = LDB_ERR_FMT_DAT;
+            break;
+        }
+
+        // case big record (read directly into entry)
+        if (rec_len > buf_len)
+        {
+            if ((ret = ldb_read_entry_dat(obj, pos, entry, arena)) != LDB_OK)
+                break;
+
+            pos += rec_len;
+            (*num)++;
+            continue;
+        }
+
+        // case record partially buffered
+        if (pos + rec_len > buf_end)
+        {
+            LDB_METRIC_ADD(obj, read_calls, 1);
+            ssize_t rc = ldb_pread_dat(obj->dat_fd, buf, ldb_min(end - pos, buf_len), pos);
+
+            if (rc == -1) {
+                ret = LDB_ERR_READ_DAT;
+                break;
+            }
+
+            buf_pos = pos;
+            buf_end = pos + (size_t) rc;
+
+            if (pos + rec_len > buf_end) {
+                ret = LDB_ERR_FMT_DAT;
+                break;
+            }
+        }
+
+        const char *ptr = buf + (pos - buf_pos) + sizeof(ldb_record_dat_t);
+        uint32_t raw_len = ldb_raw_len(&record, obj->format);
+        uint32_t checksum = ldb_checksum_record(&record, obj->format);
+
+        if (record.checksum != ldb_checksum(obj->format, ptr, record.metadata_len + record.data_len, checksum)) {
+            LDB_METRIC_ADD(obj, checksum_errors, 1);
+            ret = LDB_ERR_CHECKSUM;
+            break;
+        }
+
+        if (!ldb_alloc_entry_from(entry, record.metadata_len, raw_len, arena)) {
+            ret = LDB_ERR_MEM;
+            break;
+        }
+
+        if (record.metadata_len)
+            memcpy(entry->metadata, ptr, record.metadata_len);
+
+        if (raw_len != record.data_len && !ldb_lz4_decompress(ptr + record.metadata_len, record.data_len, (char *) entry->data, raw_len)) {
+            ret = LDB_ERR_FMT_DAT;
+            break;
+        }
+
+        if (raw_len == record.data_len && record.data_len)
+            memcpy(entry->data, ptr + record.metadata_len, record.data_len);
+
+        entry->seqnum = record.seqnum;
+        entry->timestamp = record.timestamp;
+
+        pos += rec_len;
+        (*num)++;
+    }
+
+    free(buf);
+    return ret;
+}
+
+static int ldb_read_record_idx(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum, ldb_record_idx_t *record)
+{
+    assert(obj);
+    assert(state);
+    assert(record);
+    assert(obj->idx_fd > STDERR_FILENO || obj->fixed_len != 0);
+
+    if (state->seqnum1 == 0 || seqnum < state->seqnum1 || state->seqnum2 < seqnum)
+        return LDB_ERR;
+
+    if (seqnum == state->seqnum1) {
+        record->seqnum = state->seqnum1;
+        record->timestamp = state->timestamp1;
+        record->pos = sizeof(ldb_header_dat_t);
+        return LDB_OK;
+    }
+
+    if (seqnum == state->seqnum2 && obj->fixed_len != 0) {
+        record->seqnum = state->seqnum2;
+        record->timestamp = state->timestamp2;
+        record->pos = ldb_get_pos_fixed(obj, state, seqnum);
+        return LDB_OK;
+    }
+
+    // fixed-length records, the dat record header starts with seqnum and timestamp
+    if (obj->fixed_len != 0)
+    {
+        record->pos = ldb_get_pos_fixed(obj, state, seqnum);
+
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        if (ldb_pread(obj->dat_fd, record, 2 * sizeof(uint64_t), record->pos) != 2 * sizeof(uint64_t))
+            return LDB_ERR_READ_DAT;
+
+        return (record->seqnum == seqnum ? LDB_OK : LDB_ERR);
+    }
+
+    size_t pos = ldb_get_pos_idx(state, seqnum);
+
+    if (obj->idx_map != NULL && pos + sizeof(ldb_record_idx_t) <= obj->idx_map_len)
+        memcpy(record, obj->idx_map + pos, sizeof(ldb_record_idx_t));
+    else {
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        if (ldb_pread(obj->idx_fd, record, sizeof(ldb_record_idx_t), pos) != sizeof(ldb_record_idx_t))
+            return LDB_ERR_READ_IDX;
+    }
+
+    if (record->seqnum != seqnum)
+        return LDB_ERR;
+
+    return LDB_OK;
+}
+
+// Adds the timestamp of seqnum to the fence table if it is the next fence.
+// On memory error the table stops growing (search remains correct).
+static void ldb_add_fence(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum, uint64_t timestamp)
+{
+    ldb_lock_data(obj);
+
+    if (seqnum != seqnum1 + obj->num_fences * LDB_FENCE_STEP)
+        goto LDB_ADD_FENCE_END;
+
+    if (obj->num_fences == obj->max_fences)
+    {
+        size_t max_fences = (obj->max_fences == 0 ? 64 : 2 * obj->max_fences);
+        uint64_t *fences = (uint64_t *) realloc(obj->fences, max_fences * sizeof(uint64_t));
+
+        if (fences == NULL)
+            goto LDB_ADD_FENCE_END;
+
+        obj->fences = fences;
+        obj->max_fences = max_fences;
+    }
+
+    obj->fences[obj->num_fences++] = timestamp;
+
+LDB_ADD_FENCE_END:
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+// Removes fences not covered by the current state (rollback)
+static void ldb_trim_fences(ldb_impl_t *obj)
+{
+    size_t num = 0;
+
+    if (obj->state.seqnum1 != 0)
+        num = (size_t)((obj->state.seqnum2 - obj->state.seqnum1) / LDB_FENCE_STEP) + 1;
+
+    ldb_lock_data(obj);
+    obj->num_fences = ldb_min(obj->num_fences, num);
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+// Builds the fence table reading the idx file (strided reads)
+static void ldb_build_fences(ldb_impl_t *obj)
+{
+    ldb_record_idx_t record = {0};
+
+    ldb_lock_data(obj);
+    obj->num_fences = 0;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    for (uint64_t sn = obj->state.seqnum1; sn != 0 && sn <= obj->state.seqnum2; sn += LDB_FENCE_STEP)
+    {
+        if (ldb_read_record_idx(obj, &obj->state, sn, &record) != LDB_OK)
+            break;
+
+        ldb_add_fence(obj, obj->state.seqnum1, sn, record.timestamp);
+    }
+}
+
+static uint32_t ldb_checksum_chk(ldb_checkpoint_t *chk)
+{
+    uint32_t checksum = 0;
+
+    checksum = ldb_crc32c((const char *) &chk->seqnum, sizeof(chk->seqnum), checksum);
+    checksum = ldb_crc32c((const char *) &chk->timestamp, sizeof(chk->timestamp), checksum);
+    checksum = ldb_crc32c((const char *) &chk->pos, sizeof(chk->pos), checksum);
+
+    return checksum;
+}
+
+// Loads the checkpoint file (obj->chk zeroed if not exist or invalid)
+static void ldb_read_checkpoint(ldb_impl_t *obj)
+{
+    FILE *fp = fopen(obj->chk_path, "r");
+    size_t rc = 0;
+
+    memset(&obj->chk, 0x00, sizeof(ldb_checkpoint_t));
+
+    if (fp == NULL)
+        return;
+
+    rc = fread(&obj->chk, sizeof(ldb_checkpoint_t), 1, fp);
+    fclose(fp);
+
+    if (rc != 1 ||
+        obj->chk.magic_number != LDB_MAGIC_NUMBER ||
+        !ldb_is_valid_format(obj->chk.format) ||
+        obj->chk.checksum != ldb_checksum_chk(&obj->chk))
+        memset(&obj->chk, 0x00, sizeof(ldb_checkpoint_t));
+}
+
+// Removes the checkpoint file (called before modifying verified records)
+static void ldb_remove_checkpoint(ldb_impl_t *obj)
+{
+    if (obj->chk_path)
+        remove(obj->chk_path);
+
+    memset(&obj->chk, 0x00, sizeof(ldb_checkpoint_t));
+}
+
+// Writes a checkpoint covering all records in state.
+// Dat and idx files are synced first, so covered records survive a crash.
+// The checkpoint file itself is not synced, losing it only means a full check.
+static int ldb_write_checkpoint(ldb_impl_t *obj, ldb_state_t *state)
+{
+    ldb_record_idx_t record = {0};
+    ldb_checkpoint_t chk = {0};
+    FILE *fp = NULL;
+
+    if (!obj->chk_valid || state->seqnum1 == 0 || obj->chk.seqnum == state->seqnum2)
+        return LDB_OK;
+
+    if (fflush(obj->dat_fp) != 0)
+        return LDB_ERR_WRITE_DAT;
+
+    if (obj->idx_fp && fflush(obj->idx_fp) != 0)
+        return LDB_ERR_WRITE_IDX;
+
+    if (ldb_read_record_idx(obj, state, state->seqnum2, &record) != LDB_OK)
+        return LDB_ERR_READ_IDX;
+
+    if (ldb_fdatasync(obj, fileno(obj->dat_fp)) == -1)
+        return LDB_ERR_WRITE_DAT;
+
+    if (obj->idx_fp && ldb_fdatasync(obj, fileno(obj->idx_fp)) == -1)
+        return LDB_ERR_WRITE_IDX;
+
+    chk.magic_number = LDB_MAGIC_NUMBER;
+    chk.format = obj->format;
+    chk.seqnum = record.seqnum;
+    chk.timestamp = record.timestamp;
+    chk.pos = record.pos;
+    chk.checksum = ldb_checksum_chk(&chk);
+
+    if ((fp = fopen(obj->chk_path, "w")) == NULL)
+        return LDB_OK;
+
+    if (fwrite(&chk, sizeof(ldb_checkpoint_t), 1, fp) == 1 && fclose(fp) == 0)
+        obj->chk = chk;
+    else
+        remove(obj->chk_path);
+
+    return LDB_OK;
+}
+
+typedef struct ldb_check_chunk_t {
+    ldb_impl_t *obj;              // Database
+    size_t pos;                   // Position of the first record
+    size_t end;                   // Position where the next chunk starts
+    size_t len;                   // Dat file length
+    uint64_t seqnum;              // Expected seqnum of the first record
+    uint64_t timestamp1;          // Timestamp of the first record
+    uint64_t seqnum2;             // Last verified seqnum (0 if none)
+    uint64_t timestamp2;          // Timestamp of the last verified record
+    size_t stop;                  // Position where the check stopped
+    bool truncate;                // Invalid record found at stop (remove data from there)
+    int ret;                      // Result code
+} ldb_check_chunk_t;
+
+// Verifies the dat records of a chunk (thread function).
+// Same rules than a sequential check, except the timestamp of the first 
+// record, which is compared against the previous chunk by the caller.
+static void * ldb_check_chunk_dat(void *arg)
+{
+    ldb_check_chunk_t *chunk = (ldb_check_chunk_t *) arg;
+    ldb_record_dat_t record = {0};
+    uint64_t seqnum = chunk->seqnum;
+    size_t pos = chunk->pos;
+    int ret = LDB_OK;
+
+    chunk->seqnum2 = 0;
+    chunk->truncate = false;
+    chunk->ret = LDB_OK;
+
+    while (pos < chunk->end && pos + sizeof(ldb_record_dat_t) <= chunk->len)
+    {
+        ret = ldb_read_record_dat(chunk->obj, pos, &record, true);
+
+        if (ret == LDB_ERR_FMT_DAT) {
+            chunk->truncate = true;
+            break;
+        }
+
+        if (ret != LDB_OK) {
+            chunk->ret = ret;
+            break;
+        }
+
+        // case record removed (rollback)
+        if (record.seqnum == 0) {
+            chunk->truncate = true;
+            break;
+        }
+
+        if (record.seqnum != seqnum || (chunk->seqnum2 != 0 && record.timestamp < chunk->timestamp2)) {
+            chunk->ret = LDB_ERR_FMT_DAT;
+            break;
+        }
+
+        if (chunk->obj->fixed_len != 0 && (uint64_t) record.metadata_len + record.data_len != chunk->obj->fixed_len) {
+            chunk->ret = LDB_ERR_ENTRY_LEN;
+            break;
+        }
+
+        if (chunk->seqnum2 == 0)
+            chunk->timestamp1 = record.timestamp;
+
+        pos += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+        chunk->seqnum2 = record.seqnum;
+        chunk->timestamp2 = record.timestamp;
+        seqnum++;
+    }
+
+    chunk->stop = pos;
+    return NULL;
+}
+
+// Splits the dat file range [pos, len) in up to num chunks of similar 
+// number of records. Chunk boundaries are taken from the idx file (computed
+// for fixed-length records) and validated against the dat file; on mismatch
+// we use fewer chunks.
+// Returns the number of chunks.
+static size_t ldb_check_split_dat(ldb_impl_t *obj, size_t pos, size_t len, ldb_check_chunk_t *chunks, size_t num)
+{
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record_dat = {0};
+    struct stat st = {0};
+    uint64_t seqnum = obj->state.seqnum2 + 1;
+    uint64_t count = 0;
+    size_t ret = 1;
+    int fd = -1;
+
+    chunks[0] = (ldb_check_chunk_t){ .obj = obj, .pos = pos, .end = len, .len = len, .seqnum = seqnum };
+
+    if (num <= 1)
+        return 1;
+
+    if (obj->fixed_len != 0)
+        count = (len - pos) / (sizeof(ldb_record_dat_t) + obj->fixed_len);
+    else if ((fd = open(obj->idx_path, O_RDONLY)) == -1)
+        return 1;
+    else if (fstat(fd, &st) == 0 && (size_t) st.st_size >= ldb_get_pos_idx(&obj->state, seqnum))
+        count = ((size_t) st.st_size - ldb_get_pos_idx(&obj->state, seqnum)) / sizeof(ldb_record_idx_t);
+
+    for (size_t i = 1; i < num && count >= num; i++)
+    {
+        uint64_t target = seqnum + i * count / num;
+
+        if (obj->fixed_len != 0) {
+            record_idx.pos = pos + (target - seqnum) * (sizeof(ldb_record_dat_t) + obj->fixed_len);
+            if (ldb_read_record_dat(obj, record_idx.pos, &record_dat, false) != LDB_OK)
+                break;
+            record_idx.seqnum = record_dat.seqnum;
+            record_idx.timestamp = record_dat.timestamp;
+        }
+        else if (ldb_pread(fd, &record_idx, sizeof(ldb_record_idx_t), ldb_get_pos_idx(&obj->state, target)) != sizeof(ldb_record_idx_t))
+            break;
+
+        if (record_idx.seqnum != target || record_idx.pos <= chunks[ret - 1].pos || record_idx.pos + sizeof(ldb_record_dat_t) > len)
+            break;
+
+        if (ldb_read_record_dat(obj, record_idx.pos, &record_dat, false) != LDB_OK)
+            break;
+
+        if (record_dat.seqnum != record_idx.seqnum || record_dat.timestamp != record_idx.timestamp)
+            break;
+
+        chunks[ret - 1].end = record_idx.pos;
+        chunks[ret] = (ldb_check_chunk_t){ .obj = obj, .pos = record_idx.pos, .end = len, .len = len, .seqnum = target };
+        ret++;
+    }
+
+    if (fd != -1)
+        close(fd);
+
+    return ret;
+}
+
+// Returns the number of threads used to check len bytes of the dat file
+static size_t ldb_check_num_threads(size_t len)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t ret = len / LDB_CHECK_CHUNK_LEN;
+
+    ret = ldb_min(ret, (num_cpus > 0 ? (size_t) num_cpus : 1));
+    ret = ldb_min(ret, LDB_CHECK_MAX_THREADS);
+
+    return ldb_max(ret, 1);
+}
+
+// Verifies dat records from pos (first record after obj->state.seqnum2) 
+// until the end of file using up to num_threads threads.
+// Updates obj->state last seqnum and timestamp, and removes trailing 
+// invalid records (incomplete or rolled back).
+// Results are identical to a sequential check.
+static int ldb_check_dat(ldb_impl_t *obj, size_t pos, size_t len, size_t num_threads)
+{
+    ldb_check_chunk_t chunks[LDB_CHECK_MAX_THREADS];
+    pthread_t threads[LDB_CHECK_MAX_THREADS];
+    bool started[LDB_CHECK_MAX_THREADS] = {0};
+    size_t num = ldb_check_split_dat(obj, pos, len, chunks, ldb_min(num_threads, LDB_CHECK_MAX_THREADS));
+
+    for (size_t i = 1; i < num; i++)
+        started[i] = (pthread_create(&threads[i], NULL, ldb_check_chunk_dat, &chunks[i]) == 0);
+
+    ldb_check_chunk_dat(&chunks[0]);
+
+    for (size_t i = 1; i < num; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            ldb_check_chunk_dat(&chunks[i]);
+    }
+
+    // combine results in file order
+    for (size_t i = 0; i < num; i++)
+    {
+        ldb_check_chunk_t *chunk = &chunks[i];
+
+        if (chunk->seqnum2 != 0)
+        {
+            if (chunk->timestamp1 < obj->state.timestamp2)
+                return LDB_ERR_FMT_DAT;
+
+            obj->state.seqnum2 = chunk->seqnum2;
+            obj->state.timestamp2 = chunk->timestamp2;
+        }
+
+        if (chunk->ret != LDB_OK)
+            return chunk->ret;
+
+        if (chunk->truncate)
+            return (ldb_truncate(obj->dat_fp, chunk->stop) ? LDB_OK : LDB_ERR_WRITE_DAT);
+
+        // case chunk boundary not matching (checks remaining data sequentially)
+        if (i + 1 < num && chunk->stop != chunks[i + 1].pos)
+        {
+            chunks[i + 1] = (ldb_check_chunk_t){ .obj = obj, .pos = chunk->stop, .end = len, .len = len, .seqnum = obj->state.seqnum2 + 1 };
+            ldb_check_chunk_dat(&chunks[i + 1]);
+            num = i + 2;
+        }
+    }
+
+    return LDB_OK;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_FILE_DAT_END; } while(0)
+
+/**
+ * pre-conditions:
+ *   - obj->dat_fp == NULL
+ *   - obj->dat_fd == -1
+ *   - obj->idx_fp == NULL
+ *   - obj->idx_fd == -1
+ *
+ * post-conditions (OK)
+ *   - obj->dat_fp = set
+ *   - obj->dat_fd = set
+ *   - obj->format = set
+ *   - obj->first_seqnum = set (0 if no data)
+ *   - obj->first_timestamp = set
+ * 
+ * post-conditions (KO)
+ *   - dat files closed
+ */
+static int ldb_open_file_dat(ldb_impl_t *obj, bool check)
+{
+    assert(obj);
+    assert(obj->dat_fp == NULL);
+    assert(obj->idx_fp == NULL);
+    assert(obj->dat_fd == -1);
+    assert(obj->idx_fd == -1);
+
+    int ret = LDB_OK;
+    ldb_header_dat_t header = {0};
+    ldb_record_dat_t record = {0};
+    size_t pos = 0;
+    size_t len = 0;
+
+    ldb_reset_state(&obj->state);
+    obj->dat_end = sizeof(ldb_header_dat_t);
+
+    obj->dat_fp = fopen(obj->dat_path, "r+");
+
+    if (obj->dat_fp == NULL)
+        return LDB_ERR_OPEN_DAT;
+
+    if ((obj->dat_fd = open(obj->dat_path, O_RDONLY)) == -1)
+        return LDB_ERR_OPEN_DAT;
+
+    // shares the file offset of dat_fp (appends move the stream to the end)
+    if ((obj->dat_wfd = dup(fileno(obj->dat_fp))) == -1)
+        return LDB_ERR_OPEN_DAT;
+
+    obj->dat_wpos = SIZE_MAX;
+
+    assert(obj->dat_fd > STDERR_FILENO);
+
+    len = ldb_get_file_size(obj->dat_fp);
+
+    if (fseek(obj->dat_fp, 0, SEEK_END) == -1)
+        exit_function(LDB_ERR_OPEN_DAT);
+
+    if (ldb_pread(obj->dat_fd, &header, sizeof(ldb_header_dat_t), 0) != sizeof(ldb_header_dat_t))
+        exit_function(LDB_ERR_FMT_DAT);
+
+    pos += sizeof(ldb_header_dat_t);
+
+    if (header.magic_number != LDB_MAGIC_NUMBER) 
+        exit_function(LDB_ERR_FMT_DAT);
+
+    if (!ldb_is_valid_format(header.format))
+        exit_function(LDB_ERR_FMT_DAT);
+
+    obj->format = header.format;
+
+    if (pos == len)
+        return LDB_OK;
+
+    if (pos + sizeof(ldb_record_dat_t) > len)
+        goto LDB_OPEN_FILE_DAT_TRUNCATE;
+
+    // read first entry
+    ret = ldb_read_record_dat(obj, pos, &record, true);
+
+    if (ret == LDB_ERR_FMT_DAT)
+        goto LDB_OPEN_FILE_DAT_TRUNCATE;
+
+    if (ret != LDB_OK)
+        exit_function(ret);
+
+    if (record.seqnum == 0)
+        goto LDB_OPEN_FILE_DAT_TRUNCATE;
+
+    // not a fixed-length log (or another record length), nothing is modified
+    if (obj->fixed_len != 0 && (uint64_t) record.metadata_len + record.data_len != obj->fixed_len)
+        exit_function(LDB_ERR_ENTRY_LEN);
+
+    pos += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+    obj->state.seqnum1 = record.seqnum;
+    obj->state.timestamp1 = record.timestamp;
+
+    if (!check)
+        return LDB_OK;
+
+    obj->state.seqnum2 = record.seqnum;
+    obj->state.timestamp2 = record.timestamp;
+
+    // resume from the checkpoint (previous records were verified)
+    if (obj->chk.seqnum > obj->state.seqnum1 && obj->chk.pos >= pos &&
+        (obj->fixed_len == 0 || obj->chk.pos == pos + (obj->chk.seqnum - obj->state.seqnum1 - 1) * (pos - sizeof(ldb_header_dat_t))) &&
+        ldb_read_record_dat(obj, obj->chk.pos, &record, true) == LDB_OK &&
+        record.seqnum == obj->chk.seqnum && record.timestamp == obj->chk.timestamp)
+    {
+        pos = obj->chk.pos + sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+        obj->state.seqnum2 = record.seqnum;
+        obj->state.timestamp2 = record.timestamp;
+    }
+    else
+        memset(&obj->chk, 0x00, sizeof(ldb_checkpoint_t));
+
+    if ((ret = ldb_check_dat(obj, pos, len, ldb_check_num_threads(len - pos))) != LDB_OK)
+        exit_function(ret);
+
+    return LDB_OK;
+
+LDB_OPEN_FILE_DAT_TRUNCATE:
+    if (!ldb_truncate(obj->dat_fp, pos))
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    return LDB_OK;
+
+LDB_OPEN_FILE_DAT_END:
+    ldb_close_files(obj);
+    ldb_reset_state(&obj->state);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_FILE_IDX_END; } while(0)
+
+/**
+ * pre-conditions:
+ *   - obj->dat_fp = set
+ *   - obj->dat_fd = set
+ *   - obj->idx_fp == NULL
+ *   - obj->idx_fd == -1
+ *   - obj->first_seqnum = set (0 if no data)
+ *   - obj->first_timestamp = set
+ *   - obj->format = set
+ *
+ * post-conditions (OK)
+ *   - obj->dat_fp = set
+ *   - obj->dat_fd = set
+ *   - obj->idx_fp = set
+ *   - obj->dat_fd = set
+ *   - obj->first_seqnum = set (0 if no data)
+ *   - obj->first_timestamp = set
+ *   - obj->last_seqnum = set (0 if no data)
+ *   - obj->last_timestamp = set
+ *   - obj->dat_end = set
+ * 
+ * post-conditions (KO)
+ *   - idx files closed
+ */
+static int ldb_open_file_idx(ldb_impl_t *obj, bool check)
+{
+    assert(obj);
+    assert(obj->idx_fp == NULL);
+    assert(obj->idx_fd == -1);
+    assert(obj->dat_fp != NULL);
+    assert(obj->dat_fd > STDERR_FILENO);
+    assert(!ferror(obj->dat_fp) && !feof(obj->dat_fp));
+
+    int ret = LDB_OK;
+    ldb_header_idx_t header = {0};
+    ldb_record_idx_t record_0 = {0};
+    ldb_record_idx_t record_n = {0};
+    ldb_record_dat_t record_dat = {0};
+    size_t pos = 0;
+    size_t len = 0;
+
+    obj->idx_fp = fopen(obj->idx_path, "r+");
+
+    if (obj->idx_fp == NULL)
+        return LDB_ERR_OPEN_IDX;
+
+    if ((obj->idx_fd = open(obj->idx_path, O_RDONLY)) == -1)
+        return LDB_ERR_OPEN_IDX;
+
+    assert(obj->idx_fd > STDERR_FILENO);
+
+    len = ldb_get_file_size(obj->idx_fp);
+
+    if (fseek(obj->idx_fp, 0, SEEK_END) == -1)
+        exit_function(LDB_ERR_OPEN_IDX);
+
+    if (ldb_pread(obj->idx_fd, &header, sizeof(ldb_header_idx_t), 0) != sizeof(ldb_header_idx_t))
+        exit_function(LDB_ERR_FMT_IDX);
+
+    pos += sizeof(ldb_header_idx_t);
+
+    if (header.magic_number != LDB_MAGIC_NUMBER)
+        exit_function(LDB_ERR_FMT_IDX);
+
+    if (!ldb_is_valid_format(header.format))
+        exit_function(LDB_ERR_FMT_IDX);
+
+    if (header.format != obj->format)
+        exit_function(LDB_ERR_FMT_IDX);
+
+    if (pos + sizeof(ldb_record_idx_t) <= len)
+    {
+        // read first entry
+        if (ldb_pread(obj->idx_fd, &record_0, sizeof(ldb_record_idx_t), pos) != sizeof(ldb_record_idx_t)) 
+            exit_function(LDB_ERR_READ_IDX);
+
+        pos += sizeof(ldb_record_idx_t);
+
+        if (record_0.seqnum != obj->state.seqnum1)
+            exit_function(LDB_ERR_FMT_IDX);
+
+        if (record_0.timestamp != obj->state.timestamp1)
+            exit_function(LDB_ERR_FMT_IDX);
+
+        if (record_0.seqnum != 0 && record_0.pos != sizeof(ldb_header_dat_t))
+            exit_function(LDB_ERR_FMT_IDX);
+    }
+
+    record_n = record_0;
+
+    // read last record distinct than 0
+    if (record_0.seqnum == 0)
+    {
+        // do nothing
+    }
+    else if (check)
+    {
+        ldb_record_idx_t aux = {0};
+        size_t chk_pos = ldb_get_pos_idx(&obj->state, ldb_max(obj->chk.seqnum, obj->state.seqnum1));
+
+        // records up to the checkpoint were verified
+        if (obj->chk.seqnum > record_0.seqnum && chk_pos + sizeof(ldb_record_idx_t) <= len &&
+            ldb_pread(obj->idx_fd, &aux, sizeof(ldb_record_idx_t), chk_pos) == sizeof(ldb_record_idx_t) &&
+            aux.seqnum == obj->chk.seqnum && aux.timestamp == obj->chk.timestamp && aux.pos == obj->chk.pos)
+        {
+            record_n = aux;
+            pos = chk_pos + sizeof(ldb_record_idx_t);
+        }
+
+        while (pos + sizeof(ldb_record_idx_t) <= len)
+        {
+            if (ldb_pread(obj->idx_fd, &aux, sizeof(ldb_record_idx_t), pos) != sizeof(ldb_record_idx_t)) 
+                exit_function(LDB_ERR_READ_IDX);
+
+            if (aux.seqnum == 0)
+                break;
+
+            pos += sizeof(ldb_record_idx_t);
+
+            if (aux.seqnum != record_n.seqnum + 1 || aux.timestamp < record_n.timestamp || aux.pos < record_n.pos + sizeof(ldb_record_dat_t))
+                exit_function(LDB_ERR_FMT_IDX);
+
+            // checksum already verified by ldb_open_file_dat()
+            if (ldb_read_record_dat(obj, aux.pos, &record_dat, false) != LDB_OK)
+                exit_function(LDB_ERR_FMT_IDX);
+
+            if (aux.seqnum != record_dat.seqnum || aux.timestamp != record_dat.timestamp)
+                exit_function(LDB_ERR_FMT_IDX);
+
+            record_n = aux;
+        }
+    }
+    else
+    {
+        // search last valid position
+        long rem = ((long) len - (long) sizeof(ldb_header_idx_t)) % (int) sizeof(ldb_record_idx_t);
+        size_t lo = 0;
+        size_t hi = (len - sizeof(ldb_header_idx_t)) / sizeof(ldb_record_idx_t);
+
+        pos = len - (size_t)(rem);
+
+        // skip a zero-filled tail (preallocated) by bisection
+        if (hi > 1 && ldb_pread(obj->idx_fd, &record_n, sizeof(ldb_record_idx_t), pos - sizeof(ldb_record_idx_t)) == sizeof(ldb_record_idx_t) && record_n.seqnum == 0)
+        {
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+
+                if (ldb_pread(obj->idx_fd, &record_n, sizeof(ldb_record_idx_t), sizeof(ldb_header_idx_t) + mid * sizeof(ldb_record_idx_t)) != sizeof(ldb_record_idx_t)) 
+                    exit_function(LDB_ERR_READ_IDX);
+
+                if (record_n.seqnum == 0)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+
+            pos = sizeof(ldb_header_idx_t) + ldb_max(lo, 1) * sizeof(ldb_record_idx_t);
+        }
+
+        // move backwards until last record distinct than 0 (not rolled back)
+        while (pos > sizeof(ldb_header_idx_t))
+        {
+            size_t new_pos = pos - sizeof(ldb_record_idx_t);
+
+            if (ldb_pread(obj->idx_fd, &record_n, sizeof(ldb_record_idx_t), new_pos) != sizeof(ldb_record_idx_t)) 
+                exit_function(LDB_ERR_READ_IDX);
+
+            if (record_n.seqnum != 0)
+                break;
+
+            pos -= sizeof(ldb_record_idx_t);
+        }
+    }
+
+    // at this point pos is just after the last record distinct than 0
+    if (!ldb_truncate(obj->idx_fp, pos))
+        exit_function(LDB_ERR_WRITE_IDX);
+
+    // case idx with no records
+    if (record_0.seqnum == 0)
+    {
+        // adding first dat record (if any)
+        if (obj->state.seqnum1 != 0)
+        {
+            record_0.seqnum = obj->state.seqnum1;
+            record_0.timestamp = obj->state.timestamp1;
+            record_0.pos = sizeof(ldb_header_dat_t);
+
+            obj->state.seqnum2 = obj->state.seqnum1;
+            obj->state.timestamp2 = obj->state.timestamp1;
+
+            if ((ret = ldb_append_record_idx(obj, &obj->state, &record_0)) != LDB_OK)
+                exit_function(ret);
+
+            record_n = record_0;
+        }
+    }
+    else
+    {
+        // check record_n content
+        size_t diff = record_n.seqnum - record_0.seqnum;
+
+        if (record_n.seqnum < record_0.seqnum || record_n.timestamp < record_0.timestamp)
+            exit_function(LDB_ERR_FMT_IDX);
+
+        if (pos != sizeof(ldb_header_idx_t) + (diff + 1) * sizeof(ldb_record_idx_t))
+            exit_function(LDB_ERR_FMT_IDX);
+
+        if (record_n.pos < sizeof(ldb_header_dat_t) + diff * sizeof(ldb_record_dat_t))
+            exit_function(LDB_ERR_FMT_IDX);
+
+        obj->state.seqnum2 = record_n.seqnum;
+        obj->state.timestamp2 = record_n.timestamp;
+    }
+
+    // case no data
+    if (obj->state.seqnum1 == 0) {
+        obj->dat_end = sizeof(ldb_header_dat_t);
+        return LDB_OK;
+    }
+
+    // read last record (dat)
+    pos = record_n.pos;
+    len = ldb_get_file_size(obj->dat_fp);
+
+    if (ldb_read_record_dat(obj, pos, &record_dat, true) != LDB_OK)
+        exit_function(LDB_ERR_FMT_IDX);
+
+    if (record_dat.seqnum != record_n.seqnum || record_dat.timestamp != record_n.timestamp)
+        exit_function(LDB_ERR_FMT_IDX);
+
+    pos += sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+
+    obj->dat_end = pos;
+
+    // add unflushed dat records (if any)
+    while (pos + sizeof(ldb_record_dat_t) <= len)
+    {
+        ret = ldb_read_record_dat(obj, pos, &record_dat, true);
+
+        if (ret == LDB_ERR_FMT_DAT)
+            break; // truncate
+
+        if (ret != LDB_OK)
+            exit_function(ret);
+
+        if (record_dat.seqnum == 0)
+            break; // truncate
+
+        if (record_dat.seqnum != obj->state.seqnum2 + 1 || record_dat.timestamp < obj->state.timestamp2)
+            exit_function(LDB_ERR_FMT_DAT);
+
+        record_n.seqnum = record_dat.seqnum;
+        record_n.timestamp = record_dat.timestamp;
+        record_n.pos = pos;
+
+        size_t rec_len = sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+        if (pos + rec_len > len)
+            break; // truncate
+
+        pos += rec_len;
+
+        obj->state.seqnum2 = record_dat.seqnum;
+        obj->state.timestamp2 = record_dat.timestamp;
+        obj->dat_end = pos;
+
+        if ((ret = ldb_append_record_idx(obj, &obj->state, &record_n)) != LDB_OK)
+            exit_function(ret);
+
+        assert(obj->dat_end == pos);
+    }
+
+    if (fflush(obj->idx_fp) != 0)
+        exit_function(LDB_ERR_WRITE_IDX);
+
+    if (!ldb_truncate(obj->dat_fp, pos))
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    return LDB_OK;
+
+LDB_OPEN_FILE_IDX_END:
+    if (obj->idx_fp != NULL) fclose(obj->idx_fp);
+    if (obj->idx_fd > STDERR_FILENO) close(obj->idx_fd);
+    obj->idx_fp = NULL;
+    obj->idx_fd = -1;
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_FILE_FIXED_END; } while(0)
+
+/**
+ * Replaces ldb_open_file_idx() when records have a fixed length (no idx file).
+ * The last record is located arithmetically from the dat file length.
+ *
+ * pre-conditions:
+ *   - obj->dat_fp = set
+ *   - obj->dat_fd = set
+ *   - obj->fixed_len > 0
+ *   - obj->first_seqnum = set (0 if no data)
+ *   - obj->first_timestamp = set
+ *   - obj->last_seqnum = set if check (0 if no data)
+ *
+ * post-conditions (OK)
+ *   - obj->last_seqnum = set (0 if no data)
+ *   - obj->last_timestamp = set
+ *   - obj->dat_end = set
+ * 
+ * post-conditions (KO)
+ *   - dat files closed
+ */
+static int ldb_open_file_fixed(ldb_impl_t *obj, bool check)
+{
+    assert(obj);
+    assert(obj->fixed_len > 0);
+    assert(obj->dat_fp != NULL);
+    assert(obj->dat_fd > STDERR_FILENO);
+
+    int ret = LDB_OK;
+    ldb_record_dat_t record = {0};
+    size_t rec_len = sizeof(ldb_record_dat_t) + obj->fixed_len;
+    size_t len = ldb_get_file_size(obj->dat_fp);
+    size_t num = 0;
+
+    obj->dat_end = sizeof(ldb_header_dat_t);
+
+    // case no data (dat file already truncated)
+    if (obj->state.seqnum1 == 0)
+        return LDB_OK;
+
+    if (check)
+    {
+        // records verified by ldb_open_file_dat()
+        num = obj->state.seqnum2 - obj->state.seqnum1 + 1;
+    }
+    else
+    {
+        // first record was verified by ldb_open_file_dat()
+        num = (len - sizeof(ldb_header_dat_t)) / rec_len;
+
+        // an incomplete record at the end is the torn one
+        bool torn = ((len - sizeof(ldb_header_dat_t)) % rec_len != 0);
+
+        // skip a zero-filled tail (preallocated) by bisection
+        if (num > 1 && ldb_read_record_dat(obj, sizeof(ldb_header_dat_t) + (num - 1) * rec_len, &record, false) == LDB_OK && record.seqnum == 0)
+        {
+            size_t lo = 1;
+            size_t hi = num;
+
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+
+                if (ldb_read_record_dat(obj, sizeof(ldb_header_dat_t) + mid * rec_len, &record, false) != LDB_OK)
+                    exit_function(LDB_ERR_READ_DAT);
+
+                if (record.seqnum == 0)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+
+            num = lo;
+            torn = false;
+        }
+
+        // last record must be valid, except a torn one (right header, wrong checksum)
+        // when there is no partial record after it; other contents are not this log
+        while (num > 1)
+        {
+            ret = ldb_read_record_dat(obj, sizeof(ldb_header_dat_t) + (num - 1) * rec_len, &record, true);
+
+            if (ret == LDB_ERR_READ_DAT)
+                exit_function(ret);
+
+            if (record.seqnum != obj->state.seqnum1 + num - 1)
+                exit_function(LDB_ERR_ENTRY_LEN);
+
+            if (ret == LDB_OK && (uint64_t) record.metadata_len + record.data_len != obj->fixed_len)
+                exit_function(LDB_ERR_ENTRY_LEN);
+
+            if (ret == LDB_OK)
+                break;
+
+            if (torn)
+                exit_function(LDB_ERR_FMT_DAT);
+
+            torn = true;
+            num--;
+        }
+
+        ret = LDB_OK;
+
+        if (num == 1)
+            record.timestamp = obj->state.timestamp1;
+
+        if (record.timestamp < obj->state.timestamp1)
+            exit_function(LDB_ERR_FMT_DAT);
+
+        obj->state.seqnum2 = obj->state.seqnum1 + num - 1;
+        obj->state.timestamp2 = record.timestamp;
+    }
+
+    obj->dat_end = sizeof(ldb_header_dat_t) + num * rec_len;
+
+    if (obj->dat_end > len)
+        exit_function(LDB_ERR_FMT_DAT);
+
+    // checked records not ending at the computed position have other lengths
+    if (check && len - obj->dat_end >= sizeof(ldb_record_dat_t))
+        exit_function(LDB_ERR_ENTRY_LEN);
+
+    if (!ldb_truncate(obj->dat_fp, obj->dat_end))
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    return LDB_OK;
+
+LDB_OPEN_FILE_FIXED_END:
+    ldb_close_files(obj);
+    ldb_reset_state(&obj->state);
+    return ret;
+}
+
+#undef exit_function
+
+// Sets the checkpoint status once files are open.
+// Checkpoint can advance only if all records are known to be valid.
+static int ldb_open_checkpoint(ldb_impl_t *obj, bool check)
+{
+    ldb_record_idx_t record = {0};
+
+    if (obj->state.seqnum1 == 0)
+    {
+        if (obj->chk.seqnum != 0)
+            ldb_remove_checkpoint(obj);
+
+        obj->chk_valid = true;
+        return LDB_OK;
+    }
+
+    if (check) {
+        obj->chk_valid = true;
+        return ldb_write_checkpoint(obj, &obj->state);
+    }
+
+    if (obj->chk.seqnum == 0)
+        return LDB_OK;
+
+    // case stale checkpoint
+    if (obj->chk.seqnum < obj->state.seqnum1 || obj->state.seqnum2 < obj->chk.seqnum) {
+        ldb_remove_checkpoint(obj);
+        return LDB_OK;
+    }
+
+    // case clean close
+    if (obj->chk.seqnum == obj->state.seqnum2 &&
+        ldb_read_record_idx(obj, &obj->state, obj->chk.seqnum, &record) == LDB_OK &&
+        record.timestamp == obj->chk.timestamp && record.pos == obj->chk.pos)
+        obj->chk_valid = true;
+
+    return LDB_OK;
+}
+
+const char * ldb_version(void)
+{
+    static char version_str[32] = {0};
+
+    if (version_str[0] == 0) {
+        snprintf(version_str, sizeof(version_str), "%d.%d.%d", 
+                LDB_VERSION_MAJOR, LDB_VERSION_MINOR, LDB_VERSION_PATCH);
+    }
+
+    return version_str;
+}
+
+// Resets the object and initializes the guards
+static void ldb_init(ldb_impl_t *obj, const char *path, const char *name)
+{
+    memset(obj, 0x00, sizeof(ldb_impl_t));
+
+    obj->name = strdup(name);
+    pthread_mutex_init(&obj->mutex_data, NULL);
+    pthread_rwlock_init(&obj->lock_files, NULL);
+    pthread_cond_init(&obj->cond_views, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&obj->cond_state, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_rwlock_init(&obj->lock_cache, NULL);
+    pthread_rwlock_init(&obj->lock_keys, NULL);
+    pthread_mutex_init(&obj->mutex_write, NULL);
+    pthread_mutex_init(&obj->mutex_queue, NULL);
+    pthread_cond_init(&obj->cond_queue, NULL);
+    obj->path = strdup(path);
+    obj->dat_fd = -1;
+    obj->idx_fd = -1;
+    obj->dat_wfd = -1;
+    obj->keys.fd = -1;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_END; } while(0)
+
+static int ldb_open_impl(ldb_impl_t *obj, const char *path, const char *name, uint32_t fixed_len, bool check)
+{
+    if (path == NULL || name == NULL || obj == NULL)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_path(path))
+        return LDB_ERR_PATH;
+
+    if (!ldb_is_valid_name(name))
+        return  LDB_ERR_NAME;
+
+    int ret = LDB_OK;
+    uint64_t time0 = ldb_get_nanos();
+
+    ldb_init(obj, path, name);
+
+    obj->fixed_len = fixed_len;
+    obj->dat_path = ldb_create_filename(path, name, LDB_EXT_DAT);
+    obj->idx_path = ldb_create_filename(path, name, LDB_EXT_IDX);
+    obj->chk_path = ldb_create_filename(path, name, LDB_EXT_CHK);
+    obj->dat_end = sizeof(ldb_header_dat_t);
+
+    if (!obj->name || !obj->path || !obj->dat_path || !obj->idx_path || !obj->chk_path)
+        exit_function(LDB_ERR_MEM);
+
+    // case dat file not exist
+    if (access(obj->dat_path, F_OK) != 0)
+    {
+        remove(obj->idx_path);
+        remove(obj->chk_path);
+
+        if (!ldb_create_file_dat(obj->dat_path, LDB_FORMAT_DEFAULT))
+            exit_function(LDB_ERR_OPEN_DAT);
+    }
+
+    // open data file (sets format)
+    ldb_read_checkpoint(obj);
+
+    if ((ret = ldb_open_file_dat(obj, check)) != LDB_OK)
+        exit_function(ret);
+
+    if (obj->fixed_len != 0)
+    {
+        if ((ret = ldb_open_file_fixed(obj, check)) != LDB_OK)
+            exit_function(ret);
+
+        // an index left by a regular open would be stale after the next changes
+        remove(obj->idx_path);
+        goto LDB_OPEN_CHECKPOINT;
+    }
+
+    // case idx file not exist
+    if (access(obj->idx_path, F_OK) != 0)
+    {
+        if (!ldb_create_file_idx(obj->idx_path, obj->format))
+            exit_function(LDB_ERR_OPEN_IDX);
+    }
+
+    // open index file
+    ret = ldb_open_file_idx(obj, check);
+    switch(ret)
+    {
+        case LDB_OK:
+            break;
+        case LDB_ERR_OPEN_IDX:
+        case LDB_ERR_READ_IDX:
+        case LDB_ERR_WRITE_IDX:
+        case LDB_ERR_FMT_IDX:
+            // try to rebuild the index file
+            remove(obj->idx_path);
+            if (!ldb_create_file_idx(obj->idx_path, obj->format))
+                exit_function(LDB_ERR_OPEN_IDX);
+            if ((ret = ldb_open_file_idx(obj, true)) != LDB_OK)
+                exit_function(ret);
+            break;
+        default:
+            exit_function(ret);
+    }
+
+LDB_OPEN_CHECKPOINT:
+    if ((ret = ldb_open_checkpoint(obj, check)) != LDB_OK)
+        exit_function(ret);
+
+    // the checkpoint was written after syncing the files
+    obj->durable_seqnum = ldb_min(obj->chk.seqnum, obj->state.seqnum2);
+
+    ldb_build_fences(obj);
+
+    obj->metrics.open_ns = ldb_get_nanos() - time0;
+
+    assert(ldb_is_valid_db(obj));
+
+    return LDB_OK;
+
+LDB_OPEN_END:
+    ldb_close(obj);
+    return ret;
+}
+
+#undef exit_function
+
+int ldb_open(ldb_impl_t *obj, const char *path, const char *name, bool check)
+{
+    return ldb_open_impl(obj, path, name, 0, check);
+}
+
+int ldb_open_fixed(ldb_impl_t *obj, const char *path, const char *name, uint32_t record_len, bool check)
+{
+    if (record_len == 0)
+        return LDB_ERR_ARG;
+
+    return ldb_open_impl(obj, path, name, record_len, check);
+}
+
+// Queues entries to be written to dat and idx files (not written nor published).
+static int ldb_append_entries(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    int ret = LDB_OK;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (entries[i].seqnum == 0)
+            entries[i].seqnum = state->seqnum2 + 1;
+
+        if (entries[i].timestamp == 0) 
+            entries[i].timestamp = ldb_max(ldb_get_millis(), state->timestamp2);
+
+        if ((ret = ldb_append_entry_dat(obj, state, &entries[i])) != LDB_OK)
+            break;
+
+        if ((entries[i].seqnum - state->seqnum1) % LDB_FENCE_STEP == 0)
+            ldb_add_fence(obj, state->seqnum1, entries[i].seqnum, entries[i].timestamp);
+
+        (*num)++;
+    }
+
+    return ret;
+}
+
+// Returns the number of the first num entries covered by the state (discarded ones excluded).
+static size_t ldb_count_written(const ldb_state_t *state, const ldb_entry_t *entries, size_t num)
+{
+    while (num > 0 && (state->seqnum1 == 0 || entries[num - 1].seqnum > state->seqnum2))
+        num--;
+
+    return num;
+}
+
+// Waits the writes started by ldb_commit() or ldb_append_async() and publishes the new state.
+// On write error the submitted entries are discarded (state not changed).
+static int ldb_commit_end(ldb_impl_t *obj, ldb_state_t *state)
+{
+    int ret = ldb_wait_entries(obj);
+    bool discarded = (ret != LDB_OK);
+
+    if (discarded)
+        *state = obj->state;
+
+    // periodic checkpoint (bounds the records checked on open)
+    if (ret == LDB_OK && obj->dat_end >= obj->chk.pos + LDB_CHECKPOINT_LEN)
+        ret = ldb_write_checkpoint(obj, state);
+
+    // grow the idx mapping (readers excluded while remapping)
+    if (obj->mmap_idx && state->seqnum1 != 0)
+    {
+        size_t idx_end = ldb_get_pos_idx(state, state->seqnum2) + sizeof(ldb_record_idx_t);
+
+        if (idx_end > obj->idx_map_len) {
+            ldb_wrlock_files(obj);
+            ldb_remap_idx(obj, idx_end);
+            pthread_rwlock_unlock(&obj->lock_files);
+        }
+    }
+
+    ldb_lock_data(obj);
+
+    // segments are notified by ldb_seg_commit()
+    if (obj->seg_owner == NULL)
+        ldb_flusher_notify(obj, ldb_count_appended(&obj->state, state), obj);
+
+    if (ret == LDB_OK && obj->force_fsync)
+        obj->durable_seqnum = state->seqnum2;
+
+    ldb_publish_state(obj, state);
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    if (discarded)
+        ldb_trim_fences(obj);
+
+    return ret;
+}
+
+// Writes queued entries and publishes the new state.
+static int ldb_commit(ldb_impl_t *obj, ldb_state_t *state)
+{
+    ldb_submit_entries(obj, obj->force_fsync);
+    return ldb_commit_end(obj, state);
+}
+
+// Commits the queued entries of a regular, segmented or wal database.
+static int ldb_commit_any(ldb_impl_t *obj, ldb_state_t *state)
+{
+    if (obj->seg_path)
+        return ldb_seg_commit(obj, state);
+    else if (obj->wal)
+        return ldb_wal_commit(obj, state);
+    else
+        return ldb_commit(obj, state);
+}
+
+// Completes the batch submitted by ldb_append_async() (if any).
+// Called by the writers before another write operation.
+static int ldb_complete(ldb_impl_t *obj)
+{
+    if (!obj->wpending)
+        return LDB_OK;
+
+    obj->wpending = false;
+
+    return ldb_commit_end(obj, &obj->wstate);
+}
+
+int ldb_append(ldb_impl_t *obj, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!obj || !entries)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    if (num != NULL)
+        *num = 0;
+
+    if (len == 0)
+        return LDB_OK;
+
+    int ret = LDB_OK;
+    size_t count = 0;
+    ldb_state_t state;
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    if ((ret = ldb_complete(obj)) != LDB_OK) {
+        pthread_mutex_unlock(&obj->mutex_write);
+        return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+    }
+
+    ldb_load_state(obj, &state);
+
+    if (obj->seg_path)
+        ret = ldb_seg_append_entries(obj, &state, entries, len, &count);
+    else if (obj->wal)
+        ret = ldb_wal_append_entries(obj, &state, entries, len, &count);
+    else
+        ret = ldb_append_entries(obj, &state, entries, len, &count);
+
+    if (count > 0) {
+        int rc = ldb_commit_any(obj, &state);
+        ret = (ret == LDB_OK ? rc : ret);
+        count = ldb_count_written(&state, entries, count);
+    }
+
+    pthread_mutex_unlock(&obj->mutex_write);
+
+    if (num != NULL)
+        *num = count;
+
+    return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+}
+
+int ldb_append_async(ldb_impl_t *obj, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!obj || !entries)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    // segments can be started in the middle of a batch
+    // wal logs share the stream writes (done synchronously)
+    if (obj->seg_path || obj->wal)
+        return ldb_append(obj, entries, len, num);
+
+    if (num != NULL)
+        *num = 0;
+
+    if (len == 0)
+        return LDB_OK;
+
+    int ret = LDB_OK;
+    size_t count = 0;
+    ldb_state_t state;
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    if ((ret = ldb_complete(obj)) != LDB_OK) {
+        pthread_mutex_unlock(&obj->mutex_write);
+        return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+    }
+
+    ldb_load_state(obj, &state);
+
+    ret = ldb_append_entries(obj, &state, entries, len, &count);
+
+    if (count > 0) {
+        ldb_submit_entries(obj, obj->force_fsync);
+        obj->wstate = state;
+        obj->wpending = true;
+    }
+
+    pthread_mutex_unlock(&obj->mutex_write);
+
+    if (num != NULL)
+        *num = count;
+
+    return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+}
+
+int ldb_append_wait(ldb_impl_t *obj, uint64_t *seqnum)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = ldb_complete(obj);
+
+    if (seqnum != NULL) {
+        ldb_lock_data(obj);
+        *seqnum = obj->state.seqnum2;
+        pthread_mutex_unlock(&obj->mutex_data);
+    }
+
+    pthread_mutex_unlock(&obj->mutex_write);
+
+    return ret;
+}
+
+// Writes the requests of a group as one batch (one flush, one fdatasync).
+static void ldb_append_group(ldb_impl_t *obj, ldb_append_req_t *group)
+{
+    ldb_append_req_t *req;
+    size_t count = 0;
+    ldb_state_t state;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int rc = ldb_complete(obj);
+
+    ldb_load_state(obj, &state);
+
+    for (req = group; req != NULL; req = req->next)
+    {
+        if (rc != LDB_OK)
+            req->ret = rc;
+        else if (!ldb_is_valid_db(obj))
+            req->ret = LDB_ERR;
+        else if (obj->seg_path)
+            req->ret = ldb_seg_append_entries(obj, &state, req->entries, req->len, &req->num);
+        else if (obj->wal)
+            req->ret = ldb_wal_append_entries(obj, &state, req->entries, req->len, &req->num);
+        else
+            req->ret = ldb_append_entries(obj, &state, req->entries, req->len, &req->num);
+
+        count += req->num;
+    }
+
+    if (count > 0)
+    {
+        rc = ldb_commit_any(obj, &state);
+
+        for (req = group; req != NULL && rc != LDB_OK; req = req->next) {
+            if (req->num > 0 && req->ret == LDB_OK)
+                req->ret = rc;
+            req->num = ldb_count_written(&state, req->entries, req->num);
+        }
+    }
+
+    pthread_mutex_unlock(&obj->mutex_write);
+}
+
+int ldb_append_mt(ldb_impl_t *obj, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!obj || !entries)
+        return LDB_ERR_ARG;
+
+    // full check is done by the group leader (files can change meanwhile)
+    if (!obj->name)
+        return LDB_ERR;
+
+    if (num != NULL)
+        *num = 0;
+
+    if (len == 0)
+        return LDB_OK;
+
+    uint64_t time0 = ldb_get_nanos();
+    ldb_append_req_t req = {
+        .entries = entries,
+        .len = len,
+        .num = 0,
+        .ret = LDB_OK,
+        .done = false,
+        .next = NULL
+    };
+
+    pthread_mutex_lock(&obj->mutex_queue);
+
+    if (obj->queue_tail != NULL)
+        obj->queue_tail->next = &req;
+    else
+        obj->queue_head = &req;
+    obj->queue_tail = &req;
+
+    while (!req.done)
+    {
+        if (obj->queue_leader) {
+            pthread_cond_wait(&obj->cond_queue, &obj->mutex_queue);
+            continue;
+        }
+
+        // this thread becomes the leader and writes all queued requests
+        ldb_append_req_t *group = obj->queue_head;
+        obj->queue_head = NULL;
+        obj->queue_tail = NULL;
+        obj->queue_leader = true;
+        pthread_mutex_unlock(&obj->mutex_queue);
+
+        ldb_append_group(obj, group);
+
+        pthread_mutex_lock(&obj->mutex_queue);
+
+        while (group != NULL) {
+            ldb_append_req_t *next = group->next;
+            group->done = true;
+            group = next;
+        }
+
+        obj->queue_leader = false;
+        pthread_cond_broadcast(&obj->cond_queue);
+    }
+
+    pthread_mutex_unlock(&obj->mutex_queue);
+
+    if (num != NULL)
+        *num = req.num;
+
+    return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, req.ret);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_READ_END; } while(0)
+
+// Reads entries (see ldb_read), memory allocated from the arena if not NULL.
+// Arguments already checked and entries initialized.
+static int ldb_read_entries(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
+{
+    uint64_t time0 = ldb_get_nanos();
+
+    if (obj->seg_path)
+        return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ldb_seg_read(obj, seqnum, entries, len, num, false, arena));
+
+    if (obj->wal)
+        return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ldb_wal_read(obj, seqnum, entries, len, num, arena));
+
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record_dat = {0};
+    uint64_t last = 0;
+    size_t count = 0;
+    size_t pos = 0;
+    size_t end = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    last = (len - 1 < state.seqnum2 - seqnum ? seqnum + len - 1 : state.seqnum2);
+
+    // recently appended entries are served from memory
+    if ((ret = ldb_cache_read(obj, seqnum, last, entries, &count, arena)) != LDB_ERR_NOT_FOUND)
+        goto LDB_READ_COUNT;
+
+    // dat records in range [seqnum, last] are contiguous in [pos, end)
+    if (obj->fixed_len != 0)
+    {
+        // computed (no idx reads), records are checked when read
+        pos = ldb_get_pos_fixed(obj, &state, seqnum);
+        end = ldb_get_pos_fixed(obj, &state, last) + sizeof(ldb_record_dat_t) + obj->fixed_len;
+        goto LDB_READ_DAT;
+    }
+
+    if ((ret = ldb_read_record_idx(obj, &state, seqnum, &record_idx)) != LDB_OK)
+        exit_function(ret);
+
+    pos = record_idx.pos;
+
+    if (last < state.seqnum2)
+    {
+        if ((ret = ldb_read_record_idx(obj, &state, last + 1, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        end = record_idx.pos;
+    }
+    else
+    {
+        if (last != seqnum && (ret = ldb_read_record_idx(obj, &state, last, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        if ((ret = ldb_read_record_dat(obj, record_idx.pos, &record_dat, false)) != LDB_OK)
+            exit_function(ret);
+
+        if (record_dat.seqnum != last)
+            exit_function(LDB_ERR);
+
+        end = record_idx.pos + sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+    }
+
+    if (end < pos + (last - seqnum + 1) * sizeof(ldb_record_dat_t))
+        exit_function(LDB_ERR_FMT_IDX);
+
+LDB_READ_DAT:
+    // uncompressed payloads fit in one block (headers size covers the alignment)
+    if (arena != NULL)
+        ldb_arena_reserve(arena, end - pos);
+
+    ret = ldb_read_entries_dat(obj, pos, end, seqnum, entries, (size_t)(last - seqnum + 1), &count, arena);
+
+LDB_READ_COUNT:
+    if (num != NULL)
+        *num = count;
+    ldb_metrics_read(obj, entries, count);
+
+LDB_READ_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ret);
+}
+
+int ldb_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!obj || !entries || len == 0)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        entries[i].seqnum = 0;
+        entries[i].timestamp = 0;
+    }
+
+    return ldb_read_entries(obj, seqnum, entries, len, num, NULL);
+}
+
+int ldb_read_arena(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
+{
+    if (!obj || !entries || len == 0 || !arena)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    // arena entries don't own memory
+    for (size_t i = 0; i < len; i++)
+        entries[i] = (ldb_entry_t){0};
+
+    ldb_arena_reset(arena);
+
+    return ldb_read_entries(obj, seqnum, entries, len, num, arena);
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_READ_METADATA_END; } while(0)
+
+// Reads the headers and metadata of the entries starting from seqnum into the arena.
+// Each record is read with one read if its metadata fits in LDB_METADATA_READ_LEN.
+static int ldb_read_metadata_entries(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
+{
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_OK;
+    ldb_state_t state;
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record = {0};
+    char buf[LDB_METADATA_READ_LEN];
+    uint64_t bytes = 0;
+    uint64_t last = 0;
+    size_t count = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    last = (len - 1 < state.seqnum2 - seqnum ? seqnum + len - 1 : state.seqnum2);
+
+    while (seqnum + count <= last)
+    {
+        uint64_t sn = seqnum + count;
+        ldb_entry_t *entry = entries + count;
+        char *metadata = NULL;
+
+        // segments hold contiguous ranges
+        if (obj->seg_path)
+        {
+            size_t n = 0;
+
+            ret = ldb_read_metadata_entries(obj->segs[ldb_seg_find(obj, sn)], sn, entry, (size_t)(last - sn + 1), &n, arena);
+            count += n;
+
+            if (ret != LDB_OK)
+                exit_function(ret);
+
+            if (n == 0)
+                exit_function(LDB_ERR);
+
+            continue;
+        }
+
+        if ((ret = ldb_read_record_idx(obj, &state, sn, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        LDB_METRIC_ADD(obj, read_calls, 1);
+        ssize_t rc = ldb_pread(obj->dat_fd, buf, sizeof(buf), record_idx.pos);
+
+        if (rc == -1)
+            exit_function(LDB_ERR_READ_DAT);
+
+        if (rc < (ssize_t) sizeof(ldb_record_dat_t))
+            exit_function(LDB_ERR_FMT_DAT);
+
+        memcpy(&record, buf, sizeof(ldb_record_dat_t));
+
+        if (record.seqnum != sn)
+            exit_function(LDB_ERR_FMT_IDX);
+
+        if (record.metadata_len > 0)
+        {
+            size_t prefix = ldb_min(record.metadata_len, (size_t) rc - sizeof(ldb_record_dat_t));
+
+            if ((metadata = ldb_arena_alloc(arena, record.metadata_len)) == NULL)
+                exit_function(LDB_ERR_MEM);
+
+            memcpy(metadata, buf + sizeof(ldb_record_dat_t), prefix);
+
+            // case big metadata
+            if (prefix < record.metadata_len)
+            {
+                size_t rem = record.metadata_len - prefix;
+
+                LDB_METRIC_ADD(obj, read_calls, 1);
+                rc = ldb_pread(obj->dat_fd, metadata + prefix, rem, record_idx.pos + sizeof(ldb_record_dat_t) + prefix);
+
+                if (rc == -1)
+                    exit_function(LDB_ERR_READ_DAT);
+
+                if (rc != (ssize_t) rem)
+                    exit_function(LDB_ERR_FMT_DAT);
+            }
+        }
+
+        *entry = (ldb_entry_t){
+            .seqnum = record.seqnum,
+            .timestamp = record.timestamp,
+            .metadata_len = record.metadata_len,
+            .data_len = ldb_raw_len(&record, obj->format),
+            .metadata = metadata,
+            .data = NULL
+        };
+
+        bytes += record.metadata_len;
+        count++;
+    }
+
+LDB_READ_METADATA_END:
+    if (num != NULL)
+        *num = count;
+    if (!obj->seg_path) {
+        LDB_METRIC_ADD(obj, read_entries, count);
+        LDB_METRIC_ADD(obj, read_bytes, bytes);
+    }
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+int ldb_read_metadata(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
+{
+    if (!obj || !entries || len == 0 || !arena)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    // arena entries don't own memory
+    for (size_t i = 0; i < len; i++)
+        entries[i] = (ldb_entry_t){0};
+
+    // wal entries are not supported
+    if (obj->wal)
+        return LDB_ERR;
+
+    ldb_arena_reset(arena);
+
+    uint64_t time0 = ldb_get_nanos();
+
+    return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ldb_read_metadata_entries(obj, seqnum, entries, len, num, arena));
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_READ_RANGE_END; } while(0)
+
+// Reads the bytes [offset, offset + len) of the data of the entry seqnum into
+// buf, or verifies the whole record streaming it (verify, buf unused).
+// Returns the number of bytes read, or the error code if negative.
+static long ldb_read_range(ldb_impl_t *obj, uint64_t seqnum, size_t offset, char *buf, size_t len, bool verify)
+{
+    ldb_rdlock_files(obj);
+
+    long ret = LDB_ERR;
+    int rc = LDB_OK;
+    ldb_state_t state;
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record = {0};
+    size_t pos = 0;
+    size_t n = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if (obj->seg_path)
+        exit_function(ldb_read_range(obj->segs[ldb_seg_find(obj, seqnum)], seqnum, offset, buf, len, verify));
+
+    if ((rc = ldb_read_record_idx(obj, &state, seqnum, &record_idx)) != LDB_OK)
+        exit_function(rc);
+
+    pos = record_idx.pos;
+
+    if ((rc = ldb_read_record_dat(obj, pos, &record, verify)) != LDB_OK)
+        exit_function(rc);
+
+    if (record.seqnum != seqnum)
+        exit_function(LDB_ERR_FMT_IDX);
+
+    if (verify)
+        exit_function(LDB_OK);
+
+    // compressed data can not be read by ranges
+    if (ldb_raw_len(&record, obj->format) != record.data_len)
+        exit_function(LDB_ERR_COMPRESSED);
+
+    if (offset >= record.data_len)
+        exit_function(0);
+
+    n = ldb_min(len, record.data_len - offset);
+    pos += sizeof(ldb_record_dat_t) + record.metadata_len;
+
+    LDB_METRIC_ADD(obj, read_calls, 1);
+    ssize_t bytes = ldb_pread_dat(obj->dat_fd, buf, n, pos + offset);
+
+    if (bytes == -1)
+        exit_function(LDB_ERR_READ_DAT);
+
+    if (bytes != (ssize_t) n)
+        exit_function(LDB_ERR_FMT_DAT);
+
+    // whole data read, checksum verified (metadata streamed)
+    if (n == record.data_len)
+    {
+        uint32_t checksum = ldb_checksum_record(&record, obj->format);
+
+        if ((rc = ldb_checksum_dat(obj, pos - record.metadata_len, record.metadata_len, &checksum)) != LDB_OK)
+            exit_function(rc);
+
+        checksum = ldb_checksum(obj->format, buf, n, checksum);
+
+        if (checksum != record.checksum) {
+            LDB_METRIC_ADD(obj, checksum_errors, 1);
+            exit_function(LDB_ERR_CHECKSUM);
+        }
+    }
+
+    LDB_METRIC_ADD(obj, read_bytes, n);
+    ret = (long) n;
+
+LDB_READ_RANGE_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+long ldb_read_data_range(ldb_impl_t *obj, uint64_t seqnum, size_t offset, void *buf, size_t len)
+{
+    if (!obj || (!buf && len > 0))
+        return LDB_ERR_ARG;
+
+    // wal entries are not supported
+    if (obj->wal)
+        return LDB_ERR;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    return ldb_metrics_op(obj, &obj->metrics.read, time0, ldb_read_range(obj, seqnum, offset, (char *) buf, len, false));
+}
+
+int ldb_verify_entry(ldb_impl_t *obj, uint64_t seqnum)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    // wal entries are not supported
+    if (obj->wal)
+        return LDB_ERR;
+
+    return (int) ldb_read_range(obj, seqnum, 0, NULL, 0, true);
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_READ_VIEW_END; } while(0)
+
+int ldb_read_view(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!obj || !entries || len == 0)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    // views don't own memory
+    for (size_t i = 0; i < len; i++)
+        entries[i] = (ldb_entry_t){0};
+
+    uint64_t time0 = ldb_get_nanos();
+
+    if (obj->seg_path)
+        return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ldb_seg_read(obj, seqnum, entries, len, num, true, NULL));
+
+    // wal segments are not mapped
+    if (obj->wal)
+        return LDB_ERR;
+
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record_dat = {0};
+    uint64_t last = 0;
+    size_t end = 0;
+    char *map = NULL;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    last = (len - 1 < state.seqnum2 - seqnum ? seqnum + len - 1 : state.seqnum2);
+
+    // the mapping must cover the last record
+    if ((ret = ldb_read_record_idx(obj, &state, last, &record_idx)) != LDB_OK)
+        exit_function(ret);
+
+    if ((ret = ldb_read_record_dat(obj, record_idx.pos, &record_dat, false)) != LDB_OK)
+        exit_function(ret);
+
+    if (record_dat.seqnum != last)
+        exit_function(LDB_ERR);
+
+    end = record_idx.pos + sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+
+    if ((map = ldb_pin_dat(obj, end)) == NULL)
+        exit_function(LDB_ERR_MEM);
+
+    for (size_t i = 0; seqnum <= last; i++, seqnum++)
+    {
+        ldb_entry_t *entry = entries + i;
+
+        if ((ret = ldb_read_record_idx(obj, &state, seqnum, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        if (record_idx.pos + sizeof(ldb_record_dat_t) > end)
+            exit_function(LDB_ERR_FMT_IDX);
+
+        memcpy(&record_dat, map + record_idx.pos, sizeof(ldb_record_dat_t));
+
+        if (record_dat.seqnum != seqnum)
+            exit_function(LDB_ERR);
+
+        if (record_idx.pos + sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len > end)
+            exit_function(LDB_ERR_FMT_DAT);
+
+        if (ldb_raw_len(&record_dat, obj->format) != record_dat.data_len)
+            exit_function(LDB_ERR_COMPRESSED);
+
+        entry->seqnum = record_dat.seqnum;
+        entry->timestamp = record_dat.timestamp;
+        entry->metadata_len = record_dat.metadata_len;
+        entry->data_len = record_dat.data_len;
+        entry->metadata = (record_dat.metadata_len ? map + record_idx.pos + sizeof(ldb_record_dat_t) : NULL);
+        entry->data = (record_dat.data_len ? map + record_idx.pos + sizeof(ldb_record_dat_t) + record_dat.metadata_len : NULL);
+
+        if (record_dat.checksum != ldb_checksum_entry(entry, obj->format)) {
+            LDB_METRIC_ADD(obj, checksum_errors, 1);
+            exit_function(LDB_ERR_CHECKSUM);
+        }
+
+        if (num != NULL)
+            (*num)++;
+    }
+
+    ret = LDB_OK;
+    ldb_metrics_read(obj, entries, (size_t)(last - entries[0].seqnum + 1));
+
+LDB_READ_VIEW_END:
+    if (ret != LDB_OK && map != NULL)
+        ldb_release_view(obj, entries, len);
+    if (ret != LDB_OK && num != NULL)
+        *num = 0;
+    pthread_rwlock_unlock(&obj->lock_files);
+    return (int) ldb_metrics_op(obj, &obj->metrics.read, time0, ret);
+}
+
+#undef exit_function
+
+void ldb_release_view(ldb_impl_t *obj, ldb_entry_t *entries, size_t len)
+{
+    if (obj != NULL && obj->seg_path) {
+        ldb_seg_release_view(obj, entries, len);
+        return;
+    }
+
+    if (entries != NULL)
+        for (size_t i = 0; i < len; i++)
+            entries[i] = (ldb_entry_t){0};
+
+    if (obj != NULL)
+        ldb_unpin_dat(obj);
+}
+
+// Returns the current monotonic time plus millis.
+static struct timespec ldb_get_deadline(int millis)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    ts.tv_sec += millis / 1000;
+    ts.tv_nsec += (long)(millis % 1000) * 1000000L;
+
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    return ts;
+}
+
+/* -------------------------------------------------------------------------
+ * Flusher
+ * 
+ * Optional thread syncing the dat file in the background. Writers notify it
+ * when entries are published (counters guarded by its own mutex), and it
+ * syncs when a policy limit is reached or a waiter requests it. A sync covers
+ * the entries published when it starts; the durable seqnum is advanced 
+ * holding R, so that rollback and purge can not remove them meanwhile.
+ * ------------------------------------------------------------------------- */
+
+// Returns the number of entries appended from prev to state.
+static uint64_t ldb_count_appended(const ldb_state_t *prev, const ldb_state_t *state)
+{
+    if (state->seqnum1 == 0 || state->seqnum2 <= prev->seqnum2)
+        return 0;
+
+    return state->seqnum2 - ldb_max(prev->seqnum2, state->seqnum1 - 1);
+}
+
+// Lowers the durable seqnum after a rollback or purge (called with mutex_data locked).
+// Seqnums of the removed entries can be appended again.
+static void ldb_clamp_durable(ldb_impl_t *obj)
+{
+    if (obj->state.seqnum1 == 0)
+        obj->durable_seqnum = 0;
+    else
+        obj->durable_seqnum = ldb_min(obj->durable_seqnum, obj->state.seqnum2);
+}
+
+// Checks if a sync must be started (called with flusher->mutex locked).
+static bool ldb_flusher_due(ldb_flusher_t *flusher)
+{
+    ldb_flush_policy_t *policy = &flusher->policy;
+
+    if (flusher->num_entries == 0 && !flusher->requested)
+        return false;
+
+    if (flusher->requested)
+        return true;
+
+    if (policy->interval_ms == 0 && policy->max_bytes == 0 && policy->max_entries == 0)
+        return true;
+
+    if (policy->max_entries > 0 && flusher->num_entries >= policy->max_entries)
+        return true;
+
+    if (policy->max_bytes > 0 && flusher->num_bytes >= policy->max_bytes)
+        return true;
+
+    if (policy->interval_ms > 0)
+    {
+        struct timespec now = ldb_get_deadline(0);
+
+        return (now.tv_sec > flusher->deadline.tv_sec ||
+                (now.tv_sec == flusher->deadline.tv_sec && now.tv_nsec >= flusher->deadline.tv_nsec));
+    }
+
+    return false;
+}
+
+// Notifies the flusher of num published entries written to file (called with mutex_data locked).
+// function accessed only by thread-write
+static void ldb_flusher_notify(ldb_impl_t *obj, uint64_t num, ldb_impl_t *file)
+{
+    ldb_flusher_t *flusher = obj->flusher;
+    size_t bytes = file->flush_bytes;
+
+    file->flush_bytes = 0;
+
+    if (flusher == NULL || num == 0)
+        return;
+
+    pthread_mutex_lock(&flusher->mutex);
+
+    bool first = (flusher->num_entries == 0);
+
+    if (first)
+        flusher->deadline = ldb_get_deadline((int) ldb_min(flusher->policy.interval_ms, INT_MAX));
+
+    flusher->num_entries += num;
+    flusher->num_bytes += bytes;
+
+    // the first entry sets the deadline of a timed wait
+    if (first || ldb_flusher_due(flusher))
+        pthread_cond_signal(&flusher->cond);
+
+    pthread_mutex_unlock(&flusher->mutex);
+}
+
+// Syncs the published entries and advances the durable seqnum.
+// function accessed only by the flusher thread
+static void ldb_flusher_sync(ldb_flusher_t *flusher)
+{
+    ldb_impl_t *obj = flusher->db;
+    uint64_t seqnum2 = 0;
+    int ret = LDB_OK;
+
+    // rollback and purge wait (files can not be replaced)
+    ldb_rdlock_files(obj);
+
+    ldb_lock_data(obj);
+    seqnum2 = (obj->state.seqnum1 == 0 ? 0 : obj->state.seqnum2);
+    ret = flusher->ret;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    if (ret != LDB_OK || seqnum2 == 0) {
+        pthread_rwlock_unlock(&obj->lock_files);
+        return;
+    }
+
+    // sealed segments were synced by their checkpoint
+    ldb_impl_t *file = (obj->seg_path ? obj->segs[obj->num_segs - 1] : obj);
+
+    if (ldb_fdatasync(obj, file->dat_wfd) == -1)
+        ret = LDB_ERR_WRITE_DAT;
+
+    ldb_lock_data(obj);
+    flusher->ret = ret;
+    if (ret == LDB_OK)
+        obj->durable_seqnum = ldb_max(obj->durable_seqnum, seqnum2);
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    pthread_rwlock_unlock(&obj->lock_files);
+}
+
+static void * ldb_flusher_run(void *arg)
+{
+    ldb_flusher_t *flusher = (ldb_flusher_t *) arg;
+
+    pthread_mutex_lock(&flusher->mutex);
+
+    while (!flusher->stop)
+    {
+        if (!ldb_flusher_due(flusher))
+        {
+            if (flusher->num_entries > 0 && flusher->policy.interval_ms > 0)
+                pthread_cond_timedwait(&flusher->cond, &flusher->mutex, &flusher->deadline);
+            else
+                pthread_cond_wait(&flusher->cond, &flusher->mutex);
+
+            continue;
+        }
+
+        // entries published meanwhile are covered by the sync
+        flusher->num_entries = 0;
+        flusher->num_bytes = 0;
+        flusher->requested = false;
+
+        pthread_mutex_unlock(&flusher->mutex);
+        ldb_flusher_sync(flusher);
+        pthread_mutex_lock(&flusher->mutex);
+    }
+
+    pthread_mutex_unlock(&flusher->mutex);
+
+    return NULL;
+}
+
+// Requests an immediate sync (called with mutex_data locked).
+static void ldb_flusher_request(ldb_impl_t *obj)
+{
+    ldb_flusher_t *flusher = obj->flusher;
+
+    if (flusher == NULL || flusher->ret != LDB_OK || obj->durable_seqnum >= obj->state.seqnum2)
+        return;
+
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->requested = true;
+    pthread_cond_signal(&flusher->cond);
+    pthread_mutex_unlock(&flusher->mutex);
+}
+
+// Stops the flusher thread (called by writers or close).
+static void ldb_flusher_stop(ldb_impl_t *obj)
+{
+    ldb_flusher_t *flusher = obj->flusher;
+
+    if (flusher == NULL)
+        return;
+
+    // waiters no longer see it
+    ldb_lock_data(obj);
+    obj->flusher = NULL;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->stop = true;
+    pthread_cond_signal(&flusher->cond);
+    pthread_mutex_unlock(&flusher->mutex);
+
+    pthread_join(flusher->thread, NULL);
+
+    pthread_mutex_destroy(&flusher->mutex);
+    pthread_cond_destroy(&flusher->cond);
+    free(flusher);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_SET_FLUSHER_END; } while(0)
+
+int ldb_set_flusher(ldb_impl_t *obj, const ldb_flush_policy_t *policy)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    // wal logs have their own group commit
+    if (obj->wal)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = LDB_OK;
+    ldb_flusher_t *flusher = NULL;
+    pthread_condattr_t attr;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_flusher_stop(obj);
+
+    if (policy == NULL)
+        exit_function(LDB_OK);
+
+    if ((flusher = (ldb_flusher_t *) calloc(1, sizeof(ldb_flusher_t))) == NULL)
+        exit_function(LDB_ERR_MEM);
+
+    flusher->db = obj;
+    flusher->policy = *policy;
+    pthread_mutex_init(&flusher->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flusher->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // entries appended before are synced by the first trigger
+    ldb_lock_data(obj);
+    flusher->num_entries = (obj->state.seqnum1 == 0 ? 0 : obj->state.seqnum2 - ldb_max(obj->durable_seqnum, obj->state.seqnum1 - 1));
+    flusher->deadline = ldb_get_deadline((int) ldb_min(policy->interval_ms, INT_MAX));
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    if (pthread_create(&flusher->thread, NULL, ldb_flusher_run, flusher) != 0) {
+        pthread_mutex_destroy(&flusher->mutex);
+        pthread_cond_destroy(&flusher->cond);
+        free(flusher);
+        exit_function(LDB_ERR);
+    }
+
+    ldb_lock_data(obj);
+    obj->flusher = flusher;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+LDB_SET_FLUSHER_END:
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#undef exit_function
+
+uint64_t ldb_durable_seqnum(ldb_impl_t *obj)
+{
+    if (!obj)
+        return 0;
+
+    ldb_lock_data(obj);
+    uint64_t ret = (ldb_is_valid_db(obj) ? obj->durable_seqnum : 0);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    return ret;
+}
+
+// Waits until seqnum is appended (or durable).
+static int ldb_wait_state(ldb_impl_t *obj, uint64_t seqnum, int timeout_ms, bool durable)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    struct timespec deadline = ldb_get_deadline(ldb_max(timeout_ms, 0));
+    bool expired = (timeout_ms == 0);
+    int ret = LDB_OK;
+
+    // lock_files excludes rollback/purge updating the state (released while waiting)
+    ldb_rdlock_files(obj);
+    ldb_lock_data(obj);
+
+    if (!ldb_is_valid_db(obj) || obj->closing) {
+        pthread_mutex_unlock(&obj->mutex_data);
+        pthread_rwlock_unlock(&obj->lock_files);
+        return LDB_ERR;
+    }
+
+    uint64_t rollback_id = obj->rollback_id;
+
+    obj->num_waiters++;
+
+    while (true)
+    {
+        if (obj->closing) {
+            ret = LDB_ERR;
+            break;
+        }
+
+        if (obj->rollback_id != rollback_id) {
+            ret = LDB_ERR_ROLLBACK;
+            break;
+        }
+
+        if (!durable && obj->state.seqnum1 != 0 && obj->state.seqnum2 >= seqnum) {
+            ret = LDB_OK;
+            break;
+        }
+
+        if (durable && obj->durable_seqnum != 0 && obj->durable_seqnum >= seqnum) {
+            ret = LDB_OK;
+            break;
+        }
+
+        if (durable && obj->flusher && obj->flusher->ret != LDB_OK) {
+            ret = obj->flusher->ret;
+            break;
+        }
+
+        if (expired) {
+            ret = LDB_ERR_TIMEOUT;
+            break;
+        }
+
+        if (durable)
+            ldb_flusher_request(obj);
+
+        pthread_rwlock_unlock(&obj->lock_files);
+
+        if (timeout_ms < 0)
+            pthread_cond_wait(&obj->cond_state, &obj->mutex_data);
+        else
+            expired = (pthread_cond_timedwait(&obj->cond_state, &obj->mutex_data, &deadline) == ETIMEDOUT);
+
+        // lock order: lock_files > mutex_data
+        pthread_mutex_unlock(&obj->mutex_data);
+        ldb_rdlock_files(obj);
+        ldb_lock_data(obj);
+    }
+
+    // close() can destroy the guards once waiters are gone
+    pthread_rwlock_unlock(&obj->lock_files);
+
+    obj->num_waiters--;
+
+    if (obj->closing && obj->num_waiters == 0)
+        pthread_cond_broadcast(&obj->cond_state);
+
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    return ret;
+}
+
+int ldb_wait(ldb_impl_t *obj, uint64_t seqnum, int timeout_ms)
+{
+    return ldb_wait_state(obj, seqnum, timeout_ms, false);
+}
+
+int ldb_wait_durable(ldb_impl_t *obj, uint64_t seqnum, int timeout_ms)
+{
+    return ldb_wait_state(obj, seqnum, timeout_ms, true);
+}
+
+int ldb_cursor_open(ldb_impl_t *obj, ldb_cursor_t *cursor, uint64_t seqnum)
+{
+    if (!obj || !cursor)
+        return LDB_ERR_ARG;
+
+    memset(cursor, 0x00, sizeof(ldb_cursor_t));
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    if ((cursor->buf = (char *) malloc(LDB_CURSOR_BUFFER_LEN)) == NULL)
+        return LDB_ERR_MEM;
+
+    ldb_lock_data(obj);
+    cursor->rollback_id = obj->rollback_id;
+    cursor->purge_id = obj->purge_id;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    cursor->db = obj;
+    cursor->seqnum = seqnum;
+
+    return LDB_OK;
+}
+
+void ldb_cursor_close(ldb_cursor_t *cursor)
+{
+    if (cursor == NULL)
+        return;
+
+    free(cursor->buf);
+    memset(cursor, 0x00, sizeof(ldb_cursor_t));
+}
+
+// Positions the cursor at cursor->seqnum using the index (db->lock_files locked).
+static int ldb_cursor_seek(ldb_cursor_t *cursor)
+{
+    ldb_impl_t *obj = cursor->db;
+    ldb_impl_t *file = (obj->seg_path ? obj->segs[ldb_seg_find(obj, cursor->seqnum)] : obj);
+    ldb_record_idx_t record = {0};
+    ldb_state_t state;
+    int ret = LDB_OK;
+
+    // segment guards protect its idx mapping
+    if (file != obj)
+        ldb_rdlock_files(file);
+
+    ldb_lock_data(file);
+    state = file->state;
+    pthread_mutex_unlock(&file->mutex_data);
+
+    ret = ldb_read_record_idx(file, &state, cursor->seqnum, &record);
+
+    if (file != obj)
+        pthread_rwlock_unlock(&file->lock_files);
+
+    if (ret != LDB_OK)
+        return ret;
+
+    cursor->file = file;
+    cursor->file_seqnum2 = (file != obj ? state.seqnum2 : UINT64_MAX);
+    cursor->pos = record.pos;
+    cursor->buf_pos = 0;
+    cursor->buf_end = 0;
+
+    return LDB_OK;
+}
+
+// Fills the cursor buffer starting at cursor->pos and requests the kernel
+// to read ahead the next chunk.
+static int ldb_cursor_fill(ldb_cursor_t *cursor, uint64_t seqnum2)
+{
+    int fd = cursor->file->dat_fd;
+
+    LDB_METRIC_ADD(cursor->file, read_calls, 1);
+    ssize_t rc = ldb_pread_dat(fd, cursor->buf, LDB_CURSOR_BUFFER_LEN, cursor->pos);
+
+    if (rc == -1)
+        return LDB_ERR_READ_DAT;
+
+    cursor->buf_pos = cursor->pos;
+    cursor->buf_end = cursor->pos + (size_t) rc;
+    cursor->buf_seqnum2 = seqnum2;
+
+    if (rc == LDB_CURSOR_BUFFER_LEN)
+        posix_fadvise(fd, (off_t) cursor->buf_end, LDB_CURSOR_BUFFER_LEN, POSIX_FADV_WILLNEED);
+
+    return LDB_OK;
+}
+
+// Reads the entry at the cursor position (db->lock_files locked).
+// Records published after the buffer was filled are read again (can be partial).
+static int ldb_cursor_read_entry(ldb_cursor_t *cursor, uint64_t seqnum2, ldb_entry_t *entry)
+{
+    ldb_impl_t *file = cursor->file;
+    ldb_record_dat_t record = {0};
+    int ret = LDB_OK;
+
+    bool stale = (cursor->seqnum > cursor->buf_seqnum2);
+
+    if (stale || cursor->pos < cursor->buf_pos || cursor->pos + sizeof(ldb_record_dat_t) > cursor->buf_end)
+        if ((ret = ldb_cursor_fill(cursor, seqnum2)) != LDB_OK)
+            return ret;
+
+    if (cursor->pos + sizeof(ldb_record_dat_t) > cursor->buf_end)
+        return LDB_ERR_FMT_DAT;
+
+    memcpy(&record, cursor->buf + (cursor->pos - cursor->buf_pos), sizeof(ldb_record_dat_t));
+
+    if (record.seqnum != cursor->seqnum)
+        return LDB_ERR_FMT_DAT;
+
+    size_t rec_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+    // case big record (read directly into entry)
+    if (rec_len > LDB_CURSOR_BUFFER_LEN)
+    {
+        if ((ret = ldb_read_entry_dat(file, cursor->pos, entry, NULL)) != LDB_OK)
+            return ret;
+
+        cursor->pos += rec_len;
+        cursor->seqnum++;
+        return LDB_OK;
+    }
+
+    // case record partially buffered
+    if (cursor->pos + rec_len > cursor->buf_end)
+    {
+        if ((ret = ldb_cursor_fill(cursor, seqnum2)) != LDB_OK)
+            return ret;
+
+        if (cursor->pos + rec_len > cursor->buf_end)
+            return LDB_ERR_FMT_DAT;
+    }
+
+    const char *ptr = cursor->buf + (cursor->pos - cursor->buf_pos) + sizeof(ldb_record_dat_t);
+    uint32_t raw_len = ldb_raw_len(&record, file->format);
+    uint32_t checksum = ldb_checksum_record(&record, file->format);
+
+    if (record.checksum != ldb_checksum(file->format, ptr, record.metadata_len + record.data_len, checksum)) {
+        LDB_METRIC_ADD(file, checksum_errors, 1);
+        return LDB_ERR_CHECKSUM;
+    }
+
+    if (!ldb_alloc_entry(entry, record.metadata_len, raw_len))
+        return LDB_ERR_MEM;
+
+    if (record.metadata_len)
+        memcpy(entry->metadata, ptr, record.metadata_len);
+
+    if (raw_len != record.data_len && !ldb_lz4_decompress(ptr + record.metadata_len, record.data_len, (char *) entry->data, raw_len))
+        return LDB_ERR_FMT_DAT;
+
+    if (raw_len == record.data_len && record.data_len)
+        memcpy(entry->data, ptr + record.metadata_len, record.data_len);
+
+    entry->seqnum = record.seqnum;
+    entry->timestamp = record.timestamp;
+
+    cursor->pos += rec_len;
+    cursor->seqnum++;
+
+    return LDB_OK;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_CURSOR_NEXT_END; } while(0)
+
+int ldb_cursor_next(ldb_cursor_t *cursor, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    if (!cursor || !entries || len == 0)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        entries[i].seqnum = 0;
+        entries[i].timestamp = 0;
+    }
+
+    ldb_impl_t *obj = cursor->db;
+
+    if (obj == NULL)
+        return LDB_ERR;
+
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_OK;
+    ldb_state_t state;
+    uint64_t rollback_id = 0;
+    uint64_t purge_id = 0;
+    uint64_t last = 0;
+    size_t count = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_lock_data(obj);
+    state = obj->state;
+    rollback_id = obj->rollback_id;
+    purge_id = obj->purge_id;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    // records were moved or removed
+    if (rollback_id != cursor->rollback_id || purge_id != cursor->purge_id)
+    {
+        bool rollbacked = (rollback_id != cursor->rollback_id);
+
+        cursor->rollback_id = rollback_id;
+        cursor->purge_id = purge_id;
+        cursor->file = NULL;
+
+        if (rollbacked) {
+            if (cursor->seqnum > state.seqnum2 + 1)
+                cursor->seqnum = state.seqnum2 + 1;
+            exit_function(LDB_ERR_ROLLBACK);
+        }
+    }
+
+    if (state.seqnum1 == 0)
+        exit_function(LDB_OK);
+
+    if (cursor->seqnum == 0)
+        cursor->seqnum = state.seqnum1;
+
+    if (cursor->seqnum < state.seqnum1)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if (cursor->seqnum > state.seqnum2)
+        exit_function(LDB_OK);
+
+    last = (len - 1 < state.seqnum2 - cursor->seqnum ? cursor->seqnum + len - 1 : state.seqnum2);
+
+    // wal logs are read using its in-memory index
+    if (obj->wal) {
+        ret = ldb_wal_read_slots(obj, &state, cursor->seqnum, entries, (size_t)(last - cursor->seqnum + 1), &count, NULL);
+        cursor->seqnum += count;
+        exit_function(ret);
+    }
+
+    while (cursor->seqnum <= last)
+    {
+        // next segment or first read after open, rollback, purge
+        if (cursor->file == NULL || cursor->seqnum > cursor->file_seqnum2) {
+            if ((ret = ldb_cursor_seek(cursor)) != LDB_OK)
+                break;
+        }
+
+        if ((ret = ldb_cursor_read_entry(cursor, state.seqnum2, entries + count)) != LDB_OK)
+            break;
+
+        count++;
+    }
+
+LDB_CURSOR_NEXT_END:
+    if (num != NULL)
+        *num = count;
+    ldb_metrics_read(obj, entries, count);
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+
+// Computes the uncompressed length of the records in the dat range [pos, end).
+static int ldb_raw_data_size(ldb_impl_t *obj, size_t pos, size_t end, size_t *size)
+{
+    ldb_record_dat_t record = {0};
+    int ret = LDB_OK;
+
+    *size = 0;
+
+    while (pos < end)
+    {
+        if ((ret = ldb_read_record_dat(obj, pos, &record, false)) != LDB_OK)
+            return ret;
+
+        *size += sizeof(ldb_record_dat_t) + record.metadata_len + ldb_raw_len(&record, obj->format);
+        pos += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+    }
+
+    return (pos == end ? LDB_OK : LDB_ERR_FMT_DAT);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_STATS_END; } while(0)
+
+int ldb_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats)
+{
+    if (!obj || seqnum2 < seqnum1 || !stats)
+        return LDB_ERR_ARG;
+
+    memset(stats, 0x00, sizeof(ldb_stats_t));
+
+    if (obj->seg_path)
+        return ldb_seg_stats(obj, seqnum1, seqnum2, stats);
+
+    if (obj->wal)
+        return ldb_wal_stats(obj, seqnum1, seqnum2, stats);
+
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_record_idx_t record1 = {0};
+    ldb_record_idx_t record2 = {0};
+    ldb_record_dat_t record_dat = {0};
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (state.seqnum1 == 0 || seqnum2 < state.seqnum1 || state.seqnum2 < seqnum1)
+        exit_function(LDB_OK);
+
+    seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
+    seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
+
+    if ((ret = ldb_read_record_idx(obj, &state, seqnum1, &record1)) != LDB_OK)
+        exit_function(ret);
+
+    if ((ret = ldb_read_record_idx(obj, &state, seqnum2, &record2)) != LDB_OK)
+        exit_function(ret);
+
+    if (record2.pos < record1.pos + (record2.seqnum - record1.seqnum) * sizeof(ldb_record_dat_t))
+        exit_function(LDB_ERR);
+
+    if ((ret = ldb_read_record_dat(obj, record2.pos, &record_dat, false)) != LDB_OK)
+        exit_function(ret);
+
+    if (record_dat.seqnum != seqnum2)
+        exit_function(LDB_ERR);
+
+    stats->min_seqnum = record1.seqnum;
+    stats->min_timestamp = record1.timestamp;
+    stats->max_seqnum = record2.seqnum;
+    stats->max_timestamp = record2.timestamp;
+    stats->num_entries = seqnum2 - seqnum1 + 1;
+    stats->index_size = (obj->fixed_len == 0 ? sizeof(ldb_record_idx_t) * stats->num_entries : 0);
+    stats->data_size = record2.pos - record1.pos + sizeof(ldb_record_dat_t) +
+                       record_dat.metadata_len + record_dat.data_len;
+    stats->raw_data_size = stats->data_size;
+
+    if (obj->format == LDB_FORMAT_3 &&
+        (ret = ldb_raw_data_size(obj, record1.pos, record1.pos + stats->data_size, &stats->raw_data_size)) != LDB_OK) {
+        memset(stats, 0x00, sizeof(ldb_stats_t));
+        exit_function(ret);
+    }
+
+    ret = LDB_OK;
+
+LDB_STATS_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEARCH_END; } while(0)
+
+// Narrows the search range [sn1, sn2] to two consecutive fences (in-memory).
+// Range invariants are preserved: ts1 precedes the searched timestamp and ts2 does not.
+static void ldb_search_fences(ldb_impl_t *obj, ldb_state_t *state, uint64_t timestamp, ldb_search_e mode, 
+                              uint64_t *sn1, uint64_t *ts1, uint64_t *sn2, uint64_t *ts2)
+{
+    size_t lo = 0;
+    size_t hi = 0;
+    size_t num = (size_t)((state->seqnum2 - state->seqnum1) / LDB_FENCE_STEP) + 1;
+
+    ldb_lock_data(obj);
+
+    // fences appended after the state snapshot are ignored
+    num = ldb_min(num, obj->num_fences);
+    hi = num;
+
+    // first fence not preceding the timestamp
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        uint64_t ts = obj->fences[mid];
+
+        if (ts < timestamp || (mode == LDB_SEARCH_UPPER && ts == timestamp))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0) {
+        *sn1 = state->seqnum1 + (lo - 1) * LDB_FENCE_STEP;
+        *ts1 = obj->fences[lo - 1];
+    }
+
+    if (lo < num) {
+        *sn2 = state->seqnum1 + lo * LDB_FENCE_STEP;
+        *ts2 = obj->fences[lo];
+    }
+
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+int ldb_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum)
+{
+    if (!obj || !seqnum || (mode != LDB_SEARCH_LOWER && mode != LDB_SEARCH_UPPER))
+        return LDB_ERR_ARG;
+
+    *seqnum = 0;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    if (obj->seg_path)
+        return (int) ldb_metrics_op(obj, &obj->metrics.search, time0, ldb_seg_search(obj, timestamp, mode, seqnum));
+
+    if (obj->wal)
+        return (int) ldb_metrics_op(obj, &obj->metrics.search, time0, ldb_wal_search(obj, timestamp, mode, seqnum));
+
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_record_idx_t record = {0};
+    uint64_t sn1 = 0;
+    uint64_t sn2 = 0;
+    uint64_t ts1 = 0;
+    uint64_t ts2 = 0;
+    bool bisect = false;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (state.seqnum1 == 0)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if (mode == LDB_SEARCH_LOWER && state.timestamp2 < timestamp)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if (mode == LDB_SEARCH_UPPER && state.timestamp2 <= timestamp)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if (mode == LDB_SEARCH_LOWER && timestamp <= state.timestamp1) {
+        *seqnum = state.seqnum1;
+        exit_function(LDB_OK);
+    }
+
+    if (mode == LDB_SEARCH_UPPER && timestamp < state.timestamp1) {
+        *seqnum = state.seqnum1;
+        exit_function(LDB_OK);
+    }
+
+    sn1 = state.seqnum1;
+    sn2 = state.seqnum2;
+    ts1 = state.timestamp1;
+    ts2 = state.timestamp2;
+
+    ldb_search_fences(obj, &state, timestamp, mode, &sn1, &ts1, &sn2, &ts2);
+
+    assert(ts1 <= timestamp && timestamp <= ts2);
+
+    while (sn1 + 1 < sn2 && ts1 != ts2)
+    {
+        uint64_t sn = (sn1 + sn2) / 2;
+        uint64_t range = sn2 - sn1;
+
+        // interpolation probe (exact when timestamps are uniform)
+        if (!bisect)
+            sn = sn1 + (uint64_t)((double)(timestamp - ts1) / (double)(ts2 - ts1) * (double) range);
+
+        sn = ldb_clamp(sn, sn1 + 1, sn2 - 1);
+
+        if ((ret = ldb_read_record_idx(obj, &state, sn, &record)) != LDB_OK)
+            exit_function(ret);
+
+        uint64_t ts = record.timestamp;
+
+        if (ts < timestamp) {
+            sn1 = sn;
+            ts1 = ts;
+        }
+        else if (timestamp < ts || mode == LDB_SEARCH_LOWER) {
+            sn2 = sn;
+            ts2 = ts;
+        }
+        else {
+            sn1 = sn;
+            ts1 = ts;
+        }
+
+        // bisection step when interpolation does not halve the range
+        bisect = (!bisect && sn2 - sn1 > range / 2);
+    }
+
+    *seqnum = sn2;
+
+    ret = LDB_OK;
+
+LDB_SEARCH_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return (int) ldb_metrics_op(obj, &obj->metrics.search, time0, ret);
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_ROLLBACK_END; } while(0)
+
+long ldb_rollback(ldb_impl_t *obj, uint64_t seqnum)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    if (obj->seg_path)
+        return ldb_metrics_op(obj, &obj->metrics.rollback, time0, ldb_seg_rollback(obj, seqnum));
+
+    if (obj->wal)
+        return ldb_metrics_op(obj, &obj->metrics.rollback, time0, ldb_wal_rollback(obj, seqnum));
+
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_complete(obj);
+    ldb_wrlock_files(obj);
+
+    long ret = LDB_ERR;
+    long removed_entries = 0;
+    bool locked = true;
+    ldb_record_idx_t record_idx = {0};
+    ldb_state_t state = {0};
+    size_t dat_end_new = sizeof(ldb_header_dat_t);
+    size_t idx_end_new = sizeof(ldb_header_idx_t);
+    uint64_t last_timestamp_new = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_wait_views(obj);
+
+    // case nothing to rollback
+    if (obj->state.seqnum2 <= seqnum)
+        exit_function(0);
+
+    removed_entries = (long) obj->state.seqnum2 - (long) ldb_max(seqnum, obj->state.seqnum1 - 1);
+
+    if (seqnum >= obj->state.seqnum1)
+    {
+        if ((ret = ldb_read_record_idx(obj, &obj->state, seqnum, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        last_timestamp_new = record_idx.timestamp;
+
+        if ((ret = ldb_read_record_idx(obj, &obj->state, seqnum + 1, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        dat_end_new = record_idx.pos;
+        idx_end_new = ldb_get_pos_idx(&obj->state, seqnum + 1);
+    }
+
+    // checkpoint covers removed records
+    if (seqnum < obj->chk.seqnum)
+        ldb_remove_checkpoint(obj);
+
+    // update status (waiters are notified)
+    ldb_lock_data(obj);
+    state = obj->state;
+
+    if (seqnum < state.seqnum1) {
+        ldb_reset_state(&state);
+        obj->dat_end = sizeof(ldb_header_dat_t);
+    }
+    else {
+        state.seqnum2 = seqnum;
+        state.timestamp2 = last_timestamp_new;
+        obj->dat_end = dat_end_new;
+    }
+
+    ldb_publish_state(obj, &state);
+
+    ldb_clamp_durable(obj);
+    obj->rollback_id++;
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    pthread_rwlock_wrlock(&obj->lock_cache);
+    ldb_cache_truncate(&obj->cache, seqnum);
+    pthread_rwlock_unlock(&obj->lock_cache);
+
+    ldb_keys_truncate(obj, obj->state.seqnum2);
+    ldb_trim_fences(obj);
+
+    // removed records are no longer reachable by readers,
+    // files are truncated holding only the write mutex
+    pthread_rwlock_unlock(&obj->lock_files);
+    locked = false;
+
+    // remove index entries first (on crash, they are rebuilt from dat)
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+
+    if (obj->fixed_len == 0 && !ldb_truncate(obj->idx_fp, idx_end_new))
+        exit_function(LDB_ERR_WRITE_IDX);
+
+    // remove data entries
+    if (!ldb_truncate(obj->dat_fp, dat_end_new))
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    if (obj->force_fsync && ldb_fdatasync(obj, fileno(obj->dat_fp)) == -1)
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    ret = removed_entries;
+
+LDB_ROLLBACK_END:
+    if (locked)
+        pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ldb_metrics_op(obj, &obj->metrics.rollback, time0, ret);
+}
+
+#undef exit_function
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_PURGE_COPY_END; } while(0)
+
+// Writes the dat and idx files of the database after purging the records less
+// than seqnum (located at pos in the dat file) to dat_path and idx_path, and
+// collects their fence table. Database files are only read (caller holds mutex_write).
+static int ldb_purge_copy(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum, size_t pos, 
+                          const char *dat_path, const char *idx_path, uint64_t **fences, size_t *num_fences)
+{
+    int ret = LDB_OK;
+    FILE *dat_fp = NULL;
+    FILE *idx_fp = NULL;
+    ldb_record_idx_t *records = NULL;
+    size_t max_records = LDB_READ_BUFFER_LEN / sizeof(ldb_record_idx_t);
+    ldb_header_dat_t header = {
+        .magic_number = LDB_MAGIC_NUMBER,
+        .format = obj->format,
+        .text = {0}
+    };
+
+    *fences = NULL;
+    *num_fences = 0;
+
+    remove(dat_path);
+    remove(idx_path);
+
+    if (obj->fixed_len == 0 && !ldb_create_file_idx(idx_path, obj->format))
+        exit_function(LDB_ERR_TMP_FILE);
+
+    if ((dat_fp = fopen(dat_path, "w")) == NULL || (obj->fixed_len == 0 && (idx_fp = fopen(idx_path, "a")) == NULL))
+        exit_function(LDB_ERR_TMP_FILE);
+
+    strncpy(header.text, LDB_TEXT_DAT, sizeof(header.text));
+
+    if (fwrite(&header, sizeof(ldb_header_dat_t), 1, dat_fp) != 1)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    // case purge some entries
+    if (seqnum <= state->seqnum2)
+    {
+        size_t num = (size_t)(state->seqnum2 - seqnum + 1);
+        size_t max = (num - 1) / LDB_FENCE_STEP + 1;
+
+        if (!ldb_copy_file(obj->dat_fp, pos, obj->dat_end, dat_fp, sizeof(ldb_header_dat_t)))
+            exit_function(LDB_ERR_TMP_FILE);
+
+        records = (ldb_record_idx_t *) malloc(max_records * sizeof(ldb_record_idx_t));
+        *fences = (uint64_t *) malloc(max * sizeof(uint64_t));
+
+        if (records == NULL || *fences == NULL)
+            exit_function(LDB_ERR_MEM);
+
+        // fixed-length records, positions are unchanged relative to seqnum1
+        for (size_t i = 0; obj->fixed_len != 0 && i < num; i += LDB_FENCE_STEP)
+        {
+            if ((ret = ldb_read_record_idx(obj, state, seqnum + i, &records[0])) != LDB_OK)
+                exit_function(ret);
+
+            (*fences)[(*num_fences)++] = records[0].timestamp;
+        }
+
+        // idx records are moved (positions relative to the new dat file)
+        for (size_t i = 0; obj->fixed_len == 0 && i < num; )
+        {
+            size_t len = ldb_min(num - i, max_records);
+            size_t bytes = len * sizeof(ldb_record_idx_t);
+
+            if (ldb_pread(obj->idx_fd, records, bytes, ldb_get_pos_idx(state, seqnum + i)) != (ssize_t) bytes)
+                exit_function(LDB_ERR_READ_IDX);
+
+            for (size_t j = 0; j < len; j++, i++)
+            {
+                if (records[j].seqnum != seqnum + i || records[j].pos < pos)
+                    exit_function(LDB_ERR_FMT_IDX);
+
+                records[j].pos = records[j].pos - pos + sizeof(ldb_header_dat_t);
+
+                if (i % LDB_FENCE_STEP == 0)
+                    (*fences)[(*num_fences)++] = records[j].timestamp;
+            }
+
+            if (fwrite(records, sizeof(ldb_record_idx_t), len, idx_fp) != len)
+                exit_function(LDB_ERR_TMP_FILE);
+        }
+    }
+
+    if (fflush(dat_fp) != 0 || (idx_fp && fflush(idx_fp) != 0))
+        exit_function(LDB_ERR_TMP_FILE);
+
+    if ((obj->force_fsync || obj->flusher) && 
+        (ldb_fdatasync(obj, fileno(dat_fp)) == -1 || (idx_fp && ldb_fdatasync(obj, fileno(idx_fp)) == -1)))
+        exit_function(LDB_ERR_TMP_FILE);
+
+LDB_PURGE_COPY_END:
+    if (dat_fp != NULL && fclose(dat_fp) != 0 && ret == LDB_OK)
+        ret = LDB_ERR_TMP_FILE;
+    if (idx_fp != NULL && fclose(idx_fp) != 0 && ret == LDB_OK)
+        ret = LDB_ERR_TMP_FILE;
+    free(records);
+    if (ret != LDB_OK) {
+        free(*fences);
+        *fences = NULL;
+        *num_fences = 0;
+    }
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_PURGE_END; } while(0)
+
+long ldb_purge(ldb_impl_t *obj, uint64_t seqnum)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    uint64_t time0 = ldb_get_nanos();
+
+    if (obj->seg_path)
+        return ldb_metrics_op(obj, &obj->metrics.purge, time0, ldb_seg_purge(obj, seqnum));
+
+    if (obj->wal)
+        return ldb_metrics_op(obj, &obj->metrics.purge, time0, ldb_wal_purge(obj, seqnum));
+
+    // files and state are only modified by writers (excluded by mutex_write),
+    // so the new files are built while readers continue
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_complete(obj);
+
+    int ret = LDB_ERR;
+    long removed_entries = 0;
+    ldb_record_idx_t record_idx = {0};
+    ldb_record_dat_t record_dat = {0};
+    ldb_state_t state = obj->state;
+    char *tmp_dat_path = NULL;
+    char *tmp_idx_path = NULL;
+    uint64_t *fences = NULL;
+    size_t num_fences = 0;
+    size_t pos = 0;
+    int old_dat_fd = -1;
+    int old_idx_fd = -1;
+
+    if (!ldb_is_valid_db(obj)) {
+        pthread_mutex_unlock(&obj->mutex_write);
+        return ldb_metrics_op(obj, &obj->metrics.purge, time0, LDB_ERR);
+    }
+
+    // case no entries to purge
+    if (seqnum <= state.seqnum1 || state.seqnum1 == 0) {
+        pthread_mutex_unlock(&obj->mutex_write);
+        return ldb_metrics_op(obj, &obj->metrics.purge, time0, 0);
+    }
+
+    if (state.seqnum2 < seqnum)
+    {
+        // case purge all entries
+        removed_entries = (long) state.seqnum2 - (long) state.seqnum1 + 1;
+    }
+    else
+    {
+        // case purge some entries
+        removed_entries = (long) seqnum - (long) state.seqnum1;
+
+        if ((ret = ldb_read_record_idx(obj, &state, seqnum, &record_idx)) != LDB_OK)
+            exit_function(ret);
+
+        pos = record_idx.pos;
+
+        if ((ret = ldb_read_record_dat(obj, pos, &record_dat, true)) != LDB_OK)
+            exit_function(ret);
+
+        if (record_dat.seqnum != seqnum)
+            exit_function(LDB_ERR_FMT_IDX);
+    }
+
+    // records are moved (preserved records remain verified)
+    ldb_remove_checkpoint(obj);
+
+    tmp_dat_path = ldb_create_filename(obj->path, obj->name, LDB_EXT_TMP);
+    tmp_idx_path = ldb_create_filename(obj->path, obj->name, LDB_EXT_TMP_IDX);
+
+    if (tmp_dat_path == NULL || tmp_idx_path == NULL)
+        exit_function(LDB_ERR_MEM);
+
+    if ((ret = ldb_purge_copy(obj, &state, seqnum, pos, tmp_dat_path, tmp_idx_path, &fences, &num_fences)) != LDB_OK)
+        exit_function(ret);
+
+    // swap files (short exclusive section, readers drained)
+    ldb_wrlock_files(obj);
+    ldb_wait_views(obj);
+
+    // cursors must seek again
+    ldb_lock_data(obj);
+    obj->purge_id++;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    pthread_rwlock_wrlock(&obj->lock_cache);
+    ldb_cache_trim(&obj->cache, seqnum);
+    pthread_rwlock_unlock(&obj->lock_cache);
+
+    // old files are released after the swap (freeing their blocks can be slow)
+    old_dat_fd = dup(obj->dat_fd);
+    old_idx_fd = (obj->idx_fd > STDERR_FILENO ? dup(obj->idx_fd) : -1);
+
+    if ((ret = ldb_close_files(obj)) != LDB_OK)
+        goto LDB_PURGE_SWAP_ERR;
+
+    ldb_reset_state(&obj->state);
+
+    // on crash, a missing idx file is rebuilt from dat
+    remove(obj->idx_path);
+
+    if (rename(tmp_dat_path, obj->dat_path) != 0 || (obj->fixed_len == 0 && rename(tmp_idx_path, obj->idx_path) != 0)) {
+        ret = LDB_ERR_TMP_FILE;
+        goto LDB_PURGE_SWAP_ERR;
+    }
+
+    if ((ret = ldb_open_file_dat(obj, false)) != LDB_OK)
+        goto LDB_PURGE_SWAP_ERR;
+
+    if (obj->fixed_len != 0)
+        ret = ldb_open_file_fixed(obj, false);
+    else
+        ret = ldb_open_file_idx(obj, false);
+
+    if (ret != LDB_OK)
+        goto LDB_PURGE_SWAP_ERR;
+
+    if (obj->mmap_idx)
+        ldb_remap_idx(obj, ldb_get_file_size(obj->idx_fp));
+
+    ldb_lock_data(obj);
+    free(obj->fences);
+    obj->fences = fences;
+    obj->num_fences = num_fences;
+    obj->max_fences = num_fences;
+
+    // the copied records are synced only with force_fsync or flusher
+    if (!obj->force_fsync && obj->flusher == NULL)
+        obj->durable_seqnum = 0;
+
+    ldb_clamp_durable(obj);
+    pthread_mutex_unlock(&obj->mutex_data);
+    fences = NULL;
+
+    ret = LDB_OK;
+
+LDB_PURGE_SWAP_ERR:
+    if (ret != LDB_OK) {
+        ldb_close_files(obj);
+        ldb_reset_state(&obj->state);
+        ldb_trim_fences(obj);
+    }
+
+    pthread_rwlock_unlock(&obj->lock_files);
+
+    if (old_dat_fd != -1)
+        close(old_dat_fd);
+
+    if (old_idx_fd != -1)
+        close(old_idx_fd);
+
+LDB_PURGE_END:
+    // seqnums of purged entries can be reused
+    if (ret == LDB_OK && state.seqnum2 < seqnum)
+        ldb_keys_truncate(obj, 0);
+    if (tmp_dat_path != NULL)
+        remove(tmp_dat_path);
+    if (tmp_idx_path != NULL)
+        remove(tmp_idx_path);
+    free(tmp_dat_path);
+    free(tmp_idx_path);
+    free(fences);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ldb_metrics_op(obj, &obj->metrics.purge, time0, (ret == LDB_OK ? removed_entries : ret));
+}
+
+#undef exit_function
+
+int ldb_set_mmap_idx(ldb_impl_t *obj, bool enable)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    if (obj->seg_path)
+        return ldb_seg_set_mmap_idx(obj, enable);
+
+    // wal logs and fixed-length databases have no idx file
+    if (obj->wal || obj->fixed_len != 0)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_wrlock_files(obj);
+
+    int ret = LDB_OK;
+
+    if (!ldb_is_valid_db(obj)) {
+        ret = LDB_ERR;
+    }
+    else if (enable && obj->idx_map == NULL) {
+        if (ldb_remap_idx(obj, ldb_get_file_size(obj->idx_fp)))
+            obj->mmap_idx = true;
+        else
+            ret = LDB_ERR_READ_IDX;
+    }
+    else if (!enable) {
+        if (obj->idx_map != NULL)
+            munmap(obj->idx_map, obj->idx_map_len);
+        obj->idx_map = NULL;
+        obj->idx_map_len = 0;
+        obj->mmap_idx = false;
+    }
+
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+// Changes the format of an empty database (dat and idx headers are rewritten and synced).
+// Caller must assure exclusive access (no readers nor writers).
+static int ldb_change_format(ldb_impl_t *obj, uint32_t format)
+{
+    ldb_header_dat_t header_dat = {0};
+    ldb_header_idx_t header_idx = {0};
+
+    if (obj->state.seqnum1 != 0 || obj->dat_end != sizeof(ldb_header_dat_t) || obj->wbuf.num != 0)
+        return LDB_ERR_FMT_DAT;
+
+    if (fflush(obj->dat_fp) != 0 ||
+        ldb_pread(obj->dat_fd, &header_dat, sizeof(ldb_header_dat_t), 0) != sizeof(ldb_header_dat_t))
+        return LDB_ERR_READ_DAT;
+
+    if (obj->idx_fp && (fflush(obj->idx_fp) != 0 ||
+        ldb_pread(obj->idx_fd, &header_idx, sizeof(ldb_header_idx_t), 0) != sizeof(ldb_header_idx_t)))
+        return LDB_ERR_READ_IDX;
+
+    header_dat.format = format;
+    header_idx.format = format;
+
+    // records in the new format must not be appended to a file with the old header
+    if (!ldb_pwrite(fileno(obj->dat_fp), &header_dat, sizeof(ldb_header_dat_t), 0) ||
+        ldb_fdatasync(obj, fileno(obj->dat_fp)) == -1)
+        return LDB_ERR_WRITE_DAT;
+
+    if (obj->idx_fp && (!ldb_pwrite(fileno(obj->idx_fp), &header_idx, sizeof(ldb_header_idx_t), 0) ||
+        ldb_fdatasync(obj, fileno(obj->idx_fp)) == -1))
+        return LDB_ERR_WRITE_IDX;
+
+    ldb_remove_checkpoint(obj);
+    obj->format = format;
+
+    return LDB_OK;
+}
+
+int ldb_set_compression(ldb_impl_t *obj, bool enable)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    if (obj->seg_path)
+        return ldb_seg_set_compression(obj, enable);
+
+    // wal records are not compressed, fixed-length records can not be shortened
+    if (obj->wal || obj->fixed_len != 0)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_complete(obj);
+    ldb_wrlock_files(obj);
+
+    int ret = LDB_OK;
+
+    if (!ldb_is_valid_db(obj))
+        ret = LDB_ERR;
+    else if (enable && obj->format != LDB_FORMAT_3)
+        ret = ldb_change_format(obj, LDB_FORMAT_3);
+
+    if (ret == LDB_OK)
+        obj->compress = enable;
+
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+int ldb_set_cache(ldb_impl_t *obj, size_t max_bytes)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    if (obj->seg_path)
+        return ldb_seg_set_cache(obj, max_bytes);
+
+    // wal logs are not cached
+    if (obj->wal)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+    pthread_rwlock_wrlock(&obj->lock_cache);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    if (ret == LDB_OK)
+    {
+        obj->cache.max_bytes = max_bytes;
+
+        while (obj->cache.num > 0 && obj->cache.bytes > max_bytes)
+            ldb_cache_pop(&obj->cache);
+
+        if (max_bytes == 0) {
+            free(obj->cache.slots);
+            obj->cache = (ldb_cache_t){0};
+        }
+    }
+
+    pthread_rwlock_unlock(&obj->lock_cache);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+int ldb_set_preallocation(ldb_impl_t *obj, size_t len)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+#ifndef __linux__
+    if (len > 0)
+        return LDB_ERR;
+#endif
+
+    if (obj->seg_path)
+        return ldb_seg_set_preallocation(obj, len);
+
+    // wal segments are written sequentially
+    if (obj->wal)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    // the current tails are trimmed on close
+    if (ret == LDB_OK)
+        obj->prealloc_len = len;
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_EXPORT_RECORDS_END; } while(0)
+
+// Writes the records [seqnum1, seqnum2] (clamped to the database state) to fd.
+// The dat header is written first if *format is 0 (then set to the db format),
+// otherwise records are written only if the db format is *format.
+// Returns the number of written records, or error if negative.
+static long ldb_export_records(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, int fd, uint32_t *format)
+{
+    ldb_rdlock_files(obj);
+
+    long ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_record_idx_t record1 = {0};
+    ldb_record_idx_t record2 = {0};
+    ldb_record_dat_t record_dat = {0};
+    size_t pos = 0;
+    size_t len = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (*format == 0)
+    {
+        len = sizeof(ldb_header_dat_t);
+
+        if (ldb_splice(obj->dat_fd, &pos, fd, NULL, len) != (ssize_t) len)
+            exit_function(LDB_ERR_STREAM);
+
+        *format = obj->format;
+    }
+
+    if (state.seqnum1 == 0 || seqnum2 < state.seqnum1 || state.seqnum2 < seqnum1)
+        exit_function(0);
+
+    if (obj->format != *format)
+        exit_function(LDB_ERR_FMT_DAT);
+
+    seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
+    seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
+
+    if ((ret = ldb_read_record_idx(obj, &state, seqnum1, &record1)) != LDB_OK)
+        exit_function(ret);
+
+    if ((ret = ldb_read_record_idx(obj, &state, seqnum2, &record2)) != LDB_OK)
+        exit_function(ret);
+
+    if (record2.pos < record1.pos + (record2.seqnum - record1.seqnum) * sizeof(ldb_record_dat_t))
+        exit_function(LDB_ERR);
+
+    if ((ret = ldb_read_record_dat(obj, record2.pos, &record_dat, false)) != LDB_OK)
+        exit_function(ret);
+
+    if (record_dat.seqnum != seqnum2)
+        exit_function(LDB_ERR);
+
+    // records are contiguous in the dat file
+    pos = record1.pos;
+    len = record2.pos - record1.pos + sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+
+    LDB_METRIC_ADD(obj, read_calls, 1);
+
+    if (ldb_splice(obj->dat_fd, &pos, fd, NULL, len) != (ssize_t) len)
+        exit_function(LDB_ERR_STREAM);
+
+    ret = (long)(seqnum2 - seqnum1 + 1);
+
+LDB_EXPORT_RECORDS_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+
+long ldb_export(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, int fd)
+{
+    uint32_t format = 0;
+
+    if (!obj || seqnum2 < seqnum1 || fd < 0)
+        return LDB_ERR_ARG;
+
+    if (obj->seg_path)
+        return ldb_seg_export(obj, seqnum1, seqnum2, fd);
+
+    // wal records are interleaved with other logs
+    if (obj->wal)
+        return LDB_ERR;
+
+    return ldb_export_records(obj, seqnum1, seqnum2, fd, &format);
+}
+
+// Writes the queued idx records (positions after the state ones).
+static int ldb_write_records_idx(ldb_impl_t *obj, ldb_state_t *state, ldb_record_idx_t *records, size_t *num)
+{
+    if (*num == 0)
+        return LDB_OK;
+
+    // fixed-length records have no idx file
+    if (obj->fixed_len != 0) {
+        *num = 0;
+        return LDB_OK;
+    }
+
+    LDB_METRIC_ADD(obj, write_calls, 1);
+
+    if (!ldb_pwrite(fileno(obj->idx_fp), records, *num * sizeof(ldb_record_idx_t), ldb_get_pos_idx(state, records[0].seqnum)))
+        return LDB_ERR_WRITE_IDX;
+
+    *num = 0;
+    return LDB_OK;
+}
+
+// Adds a record already written at pos to the state and queues its idx record
+// (queue of LDB_WRITE_MAX_ENTRIES records written when full). 
+// Sequence is checked by the caller.
+// function accessed only by thread-write
+static int ldb_index_record(ldb_impl_t *obj, ldb_state_t *state, const ldb_record_dat_t *record, size_t pos, 
+                            ldb_record_idx_t *records, size_t *num)
+{
+    if (obj->fixed_len != 0 && (uint64_t) record->metadata_len + record->data_len != obj->fixed_len)
+        return LDB_ERR_ENTRY_LEN;
+
+    if (state->seqnum1 == 0) {
+        state->seqnum1 = record->seqnum;
+        state->timestamp1 = record->timestamp;
+    }
+
+    state->seqnum2 = record->seqnum;
+    state->timestamp2 = record->timestamp;
+
+    if ((record->seqnum - state->seqnum1) % LDB_FENCE_STEP == 0)
+        ldb_add_fence(obj, state->seqnum1, record->seqnum, record->timestamp);
+
+    records[(*num)++] = (ldb_record_idx_t){ .seqnum = record->seqnum, .timestamp = record->timestamp, .pos = pos };
+
+    return (*num == LDB_WRITE_MAX_ENTRIES ? ldb_write_records_idx(obj, state, records, num) : LDB_OK);
+}
+
+// Verifies the checksum of a record given its metadata and data (payload).
+static bool ldb_verify_record(ldb_impl_t *obj, const ldb_record_dat_t *record, const char *payload)
+{
+    uint32_t checksum = ldb_checksum_record(record, obj->format);
+
+    checksum = ldb_checksum(obj->format, payload, (size_t) record->metadata_len + record->data_len, checksum);
+
+    if (checksum != record->checksum) {
+        LDB_METRIC_ADD(obj, checksum_errors, 1);
+        return false;
+    }
+
+    return true;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_IMPORT_RECORDS_ERR; } while(0)
+
+// Appends the records of a stream written by ldb_export() to the dat file, 
+// then indexes them in one pass (record headers read in big chunks, data only
+// read if check is set). Records must follow prev (the state of the database,
+// or of the segmented database owning it). On error, the files are truncated.
+// function accessed only by thread-write
+static long ldb_import_records(ldb_impl_t *obj, const ldb_state_t *prev, int fd, bool check)
+{
+    long ret = LDB_OK;
+    ldb_header_dat_t header = {0};
+    ldb_state_t state = obj->state;
+    ldb_record_idx_t records[LDB_WRITE_MAX_ENTRIES];
+    size_t num_records = 0;
+    size_t dat_end0 = obj->dat_end;
+    size_t idx_end0 = sizeof(ldb_header_idx_t);
+    size_t end = obj->dat_end;
+    uint64_t seqnum2 = prev->seqnum2;
+    uint64_t timestamp2 = prev->timestamp2;
+    char *buf = NULL;
+    long num = 0;
+    ssize_t rc = 0;
+
+    if (state.seqnum1 != 0)
+        idx_end0 = ldb_get_pos_idx(&state, state.seqnum2) + sizeof(ldb_record_idx_t);
+
+    if ((rc = ldb_read_fd(fd, &header, sizeof(ldb_header_dat_t))) != (ssize_t) sizeof(ldb_header_dat_t))
+        return (rc == -1 ? LDB_ERR_STREAM : LDB_ERR_FMT_DAT);
+
+    if (header.magic_number != LDB_MAGIC_NUMBER || !ldb_is_valid_format(header.format))
+        return LDB_ERR_FMT_DAT;
+
+    // an empty database takes the stream format
+    if (header.format != obj->format)
+    {
+        if (obj->compress)
+            return LDB_ERR_FMT_DAT;
+
+        ldb_wrlock_files(obj);
+        ret = ldb_change_format(obj, header.format);
+        pthread_rwlock_unlock(&obj->lock_files);
+
+        if (ret != LDB_OK)
+            return ret;
+    }
+
+    // records are not visible until the state is published
+    LDB_METRIC_ADD(obj, write_calls, 1);
+
+    if (ldb_splice(fd, NULL, obj->dat_wfd, &end, SIZE_MAX) == -1)
+        exit_function(LDB_ERR_STREAM);
+
+    if ((buf = (char *) malloc(LDB_READ_BUFFER_LEN)) == NULL)
+        exit_function(LDB_ERR_MEM);
+
+    for (size_t pos = dat_end0; pos < end; )
+    {
+        size_t len = ldb_min(end - pos, (size_t) LDB_READ_BUFFER_LEN);
+        size_t off = 0;
+
+        if (len < sizeof(ldb_record_dat_t))
+            exit_function(LDB_ERR_FMT_DAT);
+
+        LDB_METRIC_ADD(obj, read_calls, 1);
+
+        if (ldb_pread(obj->dat_fd, buf, len, pos) != (ssize_t) len)
+            exit_function(LDB_ERR_READ_DAT);
+
+        while (off + sizeof(ldb_record_dat_t) <= len)
+        {
+            ldb_record_dat_t record = {0};
+
+            memcpy(&record, buf + off, sizeof(ldb_record_dat_t));
+
+            size_t record_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+            if (record.seqnum == 0 || (seqnum2 != 0 && record.seqnum != seqnum2 + 1))
+                exit_function(LDB_ERR_ENTRY_SEQNUM);
+
+            if (record.timestamp < timestamp2)
+                exit_function(LDB_ERR_ENTRY_TIMESTAMP);
+
+            // torn stream
+            if (record_len > end - pos - off)
+                exit_function(LDB_ERR_FMT_DAT);
+
+            // record crossing the chunk end is checked on the next chunk
+            if (check && off + record_len > len && off > 0)
+                break;
+
+            if (check && off + record_len <= len) {
+                if (!ldb_verify_record(obj, &record, buf + off + sizeof(ldb_record_dat_t)))
+                    exit_function(LDB_ERR_CHECKSUM);
+            }
+            else if (check && (ret = ldb_read_record_dat(obj, pos + off, &record, true)) != LDB_OK) {
+                // record bigger than the buffer
+                exit_function(ret);
+            }
+
+            if ((ret = ldb_index_record(obj, &state, &record, pos + off, records, &num_records)) != LDB_OK)
+                exit_function(ret);
+
+            seqnum2 = record.seqnum;
+            timestamp2 = record.timestamp;
+            off += record_len;
+            num++;
+        }
+
+        pos += off;
+    }
+
+    if ((ret = ldb_write_records_idx(obj, &state, records, &num_records)) != LDB_OK)
+        exit_function(ret);
+
+    if (obj->force_fsync && ldb_fdatasync(obj, obj->dat_wfd) == -1)
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    free(buf);
+
+    // not verified records can not be covered by a checkpoint
+    if (!check && num > 0)
+        obj->chk_valid = false;
+
+    obj->dat_end = end;
+
+    LDB_METRIC_ADD(obj, appended_entries, num);
+    LDB_METRIC_ADD(obj, appended_bytes, end - dat_end0);
+    obj->flush_bytes += end - dat_end0;
+
+    ret = ldb_commit_end(obj, &state);
+
+    return (ret == LDB_OK ? num : ret);
+
+LDB_IMPORT_RECORDS_ERR:
+    // copied bytes are removed (idx first, on crash they are rebuilt from dat)
+    if (obj->idx_fp)
+        ldb_truncate(obj->idx_fp, idx_end0);
+    ldb_truncate(obj->dat_fp, dat_end0);
+    ldb_trim_fences(obj);
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+    free(buf);
+    return ret;
+}
+
+#undef exit_function
+
+long ldb_import(ldb_impl_t *obj, int fd, bool check)
+{
+    if (!obj || fd < 0)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    if (obj->seg_path)
+        return ldb_seg_import(obj, fd, check);
+
+    if (obj->wal)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    long ret = ldb_complete(obj);
+    ldb_state_t state = obj->state;
+
+    if (ret == LDB_OK)
+        ret = ldb_import_records(obj, &state, fd, check);
+
+    if (ret > 0)
+        ldb_keys_import(obj, obj->state.seqnum2 - (uint64_t) ret + 1);
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_APPEND_RAW_ERR; } while(0)
+
+// Appends the records of buf (dat file layout) following prev (updated): all 
+// headers (and checksums if check) are validated before writing, the buffer is
+// written with one write, then the idx records are built from the headers.
+// On error, the files are truncated.
+// function accessed only by thread-write
+static int ldb_append_raw_records(ldb_impl_t *obj, ldb_state_t *prev, const char *buf, size_t len, bool check, size_t *num)
+{
+    int ret = LDB_OK;
+    ldb_state_t state = obj->state;
+    ldb_record_dat_t record = {0};
+    ldb_record_idx_t records[LDB_WRITE_MAX_ENTRIES];
+    size_t num_records = 0;
+    size_t dat_end0 = obj->dat_end;
+    size_t idx_end0 = sizeof(ldb_header_idx_t);
+    uint64_t seqnum2 = prev->seqnum2;
+    uint64_t timestamp2 = prev->timestamp2;
+    size_t record_len = 0;
+
+    if (state.seqnum1 != 0)
+        idx_end0 = ldb_get_pos_idx(&state, state.seqnum2) + sizeof(ldb_record_idx_t);
+
+    for (size_t off = 0; off < len; off += record_len)
+    {
+        if (len - off < sizeof(ldb_record_dat_t))
+            return LDB_ERR_FMT_DAT;
+
+        memcpy(&record, buf + off, sizeof(ldb_record_dat_t));
+
+        record_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+        if (record_len > len - off)
+            return LDB_ERR_FMT_DAT;
+
+        if (record.seqnum == 0 || (seqnum2 != 0 && record.seqnum != seqnum2 + 1))
+            return LDB_ERR_ENTRY_SEQNUM;
+
+        if (record.timestamp < timestamp2)
+            return LDB_ERR_ENTRY_TIMESTAMP;
+
+        if (obj->fixed_len != 0 && (uint64_t) record.metadata_len + record.data_len != obj->fixed_len)
+            return LDB_ERR_ENTRY_LEN;
+
+        if (check && !ldb_verify_record(obj, &record, buf + off + sizeof(ldb_record_dat_t)))
+            return LDB_ERR_CHECKSUM;
+
+        seqnum2 = record.seqnum;
+        timestamp2 = record.timestamp;
+    }
+
+    // records are not visible until the state is published
+    LDB_METRIC_ADD(obj, write_calls, 1);
+
+    ldb_preallocate(obj, obj->dat_wfd, &obj->dat_alloc, dat_end0, dat_end0 + len);
+
+    if (!ldb_pwrite(obj->dat_wfd, buf, len, dat_end0))
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    for (size_t off = 0; off < len; off += record_len)
+    {
+        memcpy(&record, buf + off, sizeof(ldb_record_dat_t));
+
+        record_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+
+        if ((ret = ldb_index_record(obj, &state, &record, dat_end0 + off, records, &num_records)) != LDB_OK)
+            exit_function(ret);
+
+        (*num)++;
+    }
+
+    if ((ret = ldb_write_records_idx(obj, &state, records, &num_records)) != LDB_OK)
+        exit_function(ret);
+
+    if (obj->force_fsync && ldb_fdatasync(obj, obj->dat_wfd) == -1)
+        exit_function(LDB_ERR_WRITE_DAT);
+
+    // not verified records can not be covered by a checkpoint
+    if (!check)
+        obj->chk_valid = false;
+
+    obj->dat_end = dat_end0 + len;
+
+    if (prev->seqnum1 == 0) {
+        prev->seqnum1 = state.seqnum1;
+        prev->timestamp1 = state.timestamp1;
+    }
+
+    prev->seqnum2 = state.seqnum2;
+    prev->timestamp2 = state.timestamp2;
+
+    ldb_cache_fill_raw(obj, buf, len);
+    ldb_keys_fill_raw(obj, buf, len);
+
+    LDB_METRIC_ADD(obj, appended_entries, *num);
+    LDB_METRIC_ADD(obj, appended_bytes, len);
+    obj->flush_bytes += len;
+
+    return ldb_commit_end(obj, &state);
+
+LDB_APPEND_RAW_ERR:
+    // idx first (on crash, records are rebuilt from dat)
+    if (obj->idx_fp)
+        ldb_truncate(obj->idx_fp, idx_end0);
+    ldb_truncate(obj->dat_fp, dat_end0);
+    ldb_trim_fences(obj);
+    obj->dat_alloc = 0;
+    obj->idx_alloc = 0;
+    *num = 0;
+    return ret;
+}
+
+#undef exit_function
+
+int ldb_append_raw(ldb_impl_t *obj, const void *buf, size_t len, bool check, size_t *num)
+{
+    if (!obj || !buf)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    if (num != NULL)
+        *num = 0;
+
+    if (len == 0)
+        return LDB_OK;
+
+    // wal records have their own layout
+    if (obj->wal)
+        return LDB_ERR;
+
+    int ret = LDB_OK;
+    size_t count = 0;
+    ldb_state_t state;
+    uint64_t time0 = ldb_get_nanos();
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    if ((ret = ldb_complete(obj)) != LDB_OK) {
+        pthread_mutex_unlock(&obj->mutex_write);
+        return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+    }
+
+    ldb_load_state(obj, &state);
+
+    if (obj->seg_path)
+        ret = ldb_seg_append_raw(obj, &state, (const char *) buf, len, check, &count);
+    else
+        ret = ldb_append_raw_records(obj, &state, (const char *) buf, len, check, &count);
+
+    pthread_mutex_unlock(&obj->mutex_write);
+
+    if (num != NULL)
+        *num = count;
+
+    return (int) ldb_metrics_op(obj, &obj->metrics.append, time0, ret);
+}
+
+int ldb_get_metrics(ldb_impl_t *obj, ldb_metrics_t *metrics)
+{
+    if (!obj || !metrics)
+        return LDB_ERR_ARG;
+
+    memset(metrics, 0x00, sizeof(ldb_metrics_t));
+
+#ifdef LDB_NO_METRICS
+    return LDB_ERR;
+#else
+    if (!obj->name)
+        return LDB_ERR;
+
+    // all fields are uint64_t (histograms included)
+    const uint64_t *src = (const uint64_t *) &obj->metrics;
+    uint64_t *dst = (uint64_t *) metrics;
+
+    for (size_t i = 0; i < sizeof(ldb_metrics_t) / sizeof(uint64_t); i++)
+        dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+
+    return LDB_OK;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Key index
+ * 
+ * Optional secondary index mapping a user key (extracted from the metadata)
+ * to seqnums. The run file stores the pairs of the entries up to run_seqnum2
+ * sorted by key, and it is binary searched. Pairs of the entries indexed 
+ * later (tail) are kept in memory in seqnum order, chained by bucket from the
+ * newest one. When the tail exceeds a fraction of the run, both are merged
+ * into a new run file (purged and stale pairs are dropped) that replaces the
+ * old one. Pairs of entries not published yet are filtered by lookups using
+ * the state. Segments use the index of the segmented db.
+ * ------------------------------------------------------------------------- */
+
+static uint32_t ldb_checksum_key(ldb_header_key_t *header)
+{
+    uint32_t checksum = 0;
+
+    checksum = ldb_crc32c((const char *) &header->seqnum2, sizeof(header->seqnum2), checksum);
+    checksum = ldb_crc32c((const char *) &header->num, sizeof(header->num), checksum);
+
+    return checksum;
+}
+
+static int ldb_keys_cmp(const void *a, const void *b)
+{
+    const ldb_key_t *x = (const ldb_key_t *) a;
+    const ldb_key_t *y = (const ldb_key_t *) b;
+
+    if (x->key != y->key)
+        return (x->key < y->key ? -1 : 1);
+
+    return (x->seqnum < y->seqnum ? -1 : (x->seqnum > y->seqnum ? 1 : 0));
+}
+
+static size_t ldb_keys_bucket(const ldb_keys_t *keys, uint64_t key)
+{
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(key ^ (key >> 32)) & (keys->num_heads - 1);
+}
+
+static void ldb_keys_free(ldb_keys_t *keys)
+{
+    if (keys->fd > STDERR_FILENO)
+        close(keys->fd);
+
+    free(keys->path);
+    free(keys->slots);
+    free(keys->heads);
+
+    *keys = (ldb_keys_t){0};
+    keys->fd = -1;
+}
+
+// Removes the run file
+static void ldb_keys_remove(ldb_impl_t *obj)
+{
+    char *path = ldb_create_filename(obj->path, obj->name, LDB_EXT_KEY);
+
+    if (path != NULL)
+        remove(path);
+
+    free(path);
+}
+
+// Disables the index (lookups return LDB_ERR) and removes the run file
+static void ldb_keys_disable(ldb_impl_t *obj)
+{
+    pthread_rwlock_wrlock(&obj->lock_keys);
+    ldb_keys_free(&obj->keys);
+    pthread_rwlock_unlock(&obj->lock_keys);
+
+    ldb_keys_remove(obj);
+}
+
+// Doubles the tail capacity and rebuilds the hash table (keys lock held)
+static bool ldb_keys_grow(ldb_keys_t *keys)
+{
+    size_t max_slots = ldb_max(2 * keys->max_slots, LDB_KEYS_MIN_SLOTS);
+    ldb_key_slot_t *slots = (ldb_key_slot_t *) realloc(keys->slots, max_slots * sizeof(ldb_key_slot_t));
+
+    if (slots == NULL)
+        return false;
+
+    keys->slots = slots;
+
+    size_t *heads = (size_t *) calloc(2 * max_slots, sizeof(size_t));
+
+    if (heads == NULL)
+        return false;
+
+    free(keys->heads);
+    keys->heads = heads;
+    keys->num_heads = 2 * max_slots;
+    keys->max_slots = max_slots;
+
+    for (size_t i = 0; i < keys->num_slots; i++) {
+        size_t bucket = ldb_keys_bucket(keys, slots[i].key);
+        slots[i].prev = heads[bucket];
+        heads[bucket] = i + 1;
+    }
+
+    return true;
+}
+
+// Indexes an entry (keys lock held).
+// Returns false on memory error.
+static bool ldb_keys_add(ldb_keys_t *keys, ldb_key_fn fn, uint64_t seqnum, const void *metadata, uint32_t metadata_len)
+{
+    uint64_t key = 0;
+
+    keys->seqnum2 = seqnum;
+
+    if (!fn(metadata, metadata_len, &key))
+        return true;
+
+    if (keys->num_slots == keys->max_slots && !ldb_keys_grow(keys))
+        return false;
+
+    size_t bucket = ldb_keys_bucket(keys, key);
+
+    keys->slots[keys->num_slots] = (ldb_key_slot_t){
+        .key = key,
+        .seqnum = seqnum,
+        .prev = keys->heads[bucket]
+    };
+
+    keys->heads[bucket] = ++keys->num_slots;
+
+    return true;
+}
+
+// Writes the run header (pairs above seqnum2 become stale)
+static int ldb_keys_write_header(ldb_impl_t *obj, int fd, uint64_t seqnum2, uint64_t num)
+{
+    ldb_header_key_t header;
+
+    memset(&header, 0x00, sizeof(header));
+    header.magic_number = LDB_MAGIC_NUMBER;
+    header.format = LDB_FORMAT_DEFAULT;
+    strncpy(header.text, LDB_TEXT_KEY, sizeof(header.text) - 1);
+    header.seqnum2 = seqnum2;
+    header.num = num;
+    header.checksum = ldb_checksum_key(&header);
+
+    if (!ldb_pwrite(fd, &header, sizeof(header), 0))
+        return LDB_ERR_KEY_FILE;
+
+    if (obj->force_fsync && ldb_fdatasync(obj, fd) == -1)
+        return LDB_ERR_KEY_FILE;
+
+    return LDB_OK;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_KEYS_MERGE_END; } while(0)
+
+// Writes a new run file merging the run and the tail, then swaps them.
+// Lookups continue meanwhile (pairs are only modified by writers).
+// function accessed only by thread-write
+static int ldb_keys_merge(ldb_impl_t *obj)
+{
+    ldb_keys_t *keys = &obj->keys;
+    int ret = LDB_OK;
+    int fd = -1;
+    FILE *fp = NULL;
+    char *tmp_path = NULL;
+    ldb_key_t *tail = NULL;
+    ldb_key_t *run = NULL;
+    size_t max_run = LDB_READ_BUFFER_LEN / sizeof(ldb_key_t);
+    size_t run_len = 0;           // pairs in the run buffer
+    size_t run_pos = 0;           // next pair of the run buffer
+    size_t run_next = 0;          // next pair of the run file
+    size_t num = 0;
+    uint64_t seqnum1 = 0;
+
+    // case run up to date
+    if (keys->num_slots == 0 && keys->fd != -1 && keys->run_seqnum2 == keys->seqnum2)
+        return LDB_OK;
+
+    ldb_lock_data(obj);
+    seqnum1 = obj->state.seqnum1;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    tmp_path = ldb_create_filename(obj->path, obj->name, LDB_EXT_TMP_KEY);
+    tail = (ldb_key_t *) malloc(ldb_max(keys->num_slots, 1) * sizeof(ldb_key_t));
+    run = (ldb_key_t *) malloc(max_run * sizeof(ldb_key_t));
+
+    if (tmp_path == NULL || tail == NULL || run == NULL)
+        exit_function(LDB_ERR_MEM);
+
+    for (size_t i = 0; i < keys->num_slots; i++) {
+        tail[i].key = keys->slots[i].key;
+        tail[i].seqnum = keys->slots[i].seqnum;
+    }
+
+    qsort(tail, keys->num_slots, sizeof(ldb_key_t), ldb_keys_cmp);
+
+    remove(tmp_path);
+
+    if ((fp = fopen(tmp_path, "w")) == NULL || (fd = open(tmp_path, O_RDWR)) == -1)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    // header written at the end
+    if (fseek(fp, sizeof(ldb_header_key_t), SEEK_SET) != 0)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    for (size_t i = 0; ; )
+    {
+        if (run_pos == run_len && run_next < keys->num_run)
+        {
+            run_len = ldb_min(keys->num_run - run_next, max_run);
+            run_pos = 0;
+
+            size_t bytes = run_len * sizeof(ldb_key_t);
+
+            if (ldb_pread(keys->fd, run, bytes, sizeof(ldb_header_key_t) + run_next * sizeof(ldb_key_t)) != (ssize_t) bytes)
+                exit_function(LDB_ERR_KEY_FILE);
+
+            run_next += run_len;
+        }
+
+        const ldb_key_t *pair = NULL;
+
+        if (run_pos < run_len && (i == keys->num_slots || ldb_keys_cmp(&run[run_pos], &tail[i]) < 0)) {
+            pair = &run[run_pos++];
+            if (pair->seqnum > keys->run_seqnum2)
+                continue;
+        }
+        else if (i < keys->num_slots) {
+            pair = &tail[i++];
+        }
+        else {
+            break;
+        }
+
+        // purged pairs are dropped
+        if (pair->seqnum < seqnum1)
+            continue;
+
+        if (fwrite(pair, sizeof(ldb_key_t), 1, fp) != 1)
+            exit_function(LDB_ERR_TMP_FILE);
+
+        num++;
+    }
+
+    if (fflush(fp) != 0)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    if (ldb_keys_write_header(obj, fd, keys->seqnum2, num) != LDB_OK)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        exit_function(LDB_ERR_TMP_FILE);
+    }
+
+    fp = NULL;
+
+    if (rename(tmp_path, keys->path) != 0)
+        exit_function(LDB_ERR_TMP_FILE);
+
+    pthread_rwlock_wrlock(&obj->lock_keys);
+
+    if (keys->fd != -1)
+        close(keys->fd);
+
+    keys->fd = fd;
+    keys->num_run = num;
+    keys->run_seqnum2 = keys->seqnum2;
+    keys->num_slots = 0;
+
+    if (keys->heads != NULL)
+        memset(keys->heads, 0x00, keys->num_heads * sizeof(size_t));
+
+    pthread_rwlock_unlock(&obj->lock_keys);
+
+    fd = -1;
+
+LDB_KEYS_MERGE_END:
+    if (fp != NULL)
+        fclose(fp);
+    if (fd != -1)
+        close(fd);
+    if (ret != LDB_OK && tmp_path != NULL)
+        remove(tmp_path);
+    free(tmp_path);
+    free(tail);
+    free(run);
+    return ret;
+}
+
+#undef exit_function
+
+// Ends an update of the index. A failed one disables the index, and a big
+// tail is merged (on error, it is retried on the next update).
+// function accessed only by thread-write
+static void ldb_keys_end(ldb_impl_t *obj, bool updated)
+{
+    ldb_keys_t *keys = &obj->keys;
+
+    if (!updated)
+        ldb_keys_disable(obj);
+    else if (keys->num_slots >= ldb_clamp(keys->num_run / 8, LDB_KEYS_MERGE_MIN, LDB_KEYS_MERGE_MAX))
+        ldb_keys_merge(obj);
+}
+
+// Indexes the written entries (see ldb_wait_entries).
+// function accessed only by thread-write
+static void ldb_keys_fill(ldb_impl_t *obj)
+{
+    ldb_impl_t *owner = (obj->seg_owner ? obj->seg_owner : obj);
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    bool updated = true;
+
+    if (owner->keys.fn == NULL || wbuf->num_submitted == 0)
+        return;
+
+    pthread_rwlock_wrlock(&owner->lock_keys);
+
+    for (size_t i = 0; updated && i < wbuf->num_submitted; i++)
+        updated = ldb_keys_add(&owner->keys, owner->keys.fn, wbuf->records_dat[i].seqnum, 
+                               wbuf->entries[i]->metadata, wbuf->records_dat[i].metadata_len);
+
+    pthread_rwlock_unlock(&owner->lock_keys);
+
+    ldb_keys_end(owner, updated);
+}
+
+// Indexes the records written by ldb_append_raw().
+// function accessed only by thread-write
+static void ldb_keys_fill_raw(ldb_impl_t *obj, const char *raw, size_t len)
+{
+    ldb_impl_t *owner = (obj->seg_owner ? obj->seg_owner : obj);
+    ldb_record_dat_t record = {0};
+    bool updated = true;
+
+    if (owner->keys.fn == NULL)
+        return;
+
+    pthread_rwlock_wrlock(&owner->lock_keys);
+
+    for (size_t off = 0; updated && off < len; off += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len)
+    {
+        memcpy(&record, raw + off, sizeof(ldb_record_dat_t));
+
+        updated = ldb_keys_add(&owner->keys, owner->keys.fn, record.seqnum, 
+                               raw + off + sizeof(ldb_record_dat_t), record.metadata_len);
+    }
+
+    pthread_rwlock_unlock(&owner->lock_keys);
+
+    ldb_keys_end(owner, updated);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_KEYS_SCAN_END; } while(0)
+
+// Indexes the entries from seqnum to the last one, reading them.
+// function accessed only by thread-write
+static int ldb_keys_scan(ldb_impl_t *obj, ldb_key_fn fn, uint64_t seqnum)
+{
+    ldb_keys_t *keys = &obj->keys;
+    int ret = LDB_OK;
+    ldb_arena_t arena = {0};
+    ldb_entry_t *entries = NULL;
+    uint64_t seqnum2 = obj->state.seqnum2;
+    size_t num = 0;
+
+    if (obj->state.seqnum1 == 0)
+        return LDB_OK;
+
+    seqnum = ldb_max(seqnum, obj->state.seqnum1);
+
+    if (seqnum > seqnum2)
+        return LDB_OK;
+
+    if ((entries = (ldb_entry_t *) malloc(LDB_KEYS_SCAN_LEN * sizeof(ldb_entry_t))) == NULL)
+        return LDB_ERR_MEM;
+
+    while (seqnum <= seqnum2)
+    {
+        if ((ret = ldb_read_arena(obj, seqnum, entries, LDB_KEYS_SCAN_LEN, &num, &arena)) != LDB_OK)
+            exit_function(ret);
+
+        if (num == 0)
+            exit_function(LDB_ERR);
+
+        bool updated = true;
+
+        pthread_rwlock_wrlock(&obj->lock_keys);
+
+        for (size_t i = 0; updated && i < num; i++)
+            updated = ldb_keys_add(keys, fn, entries[i].seqnum, entries[i].metadata, entries[i].metadata_len);
+
+        pthread_rwlock_unlock(&obj->lock_keys);
+
+        if (!updated)
+            exit_function(LDB_ERR_MEM);
+
+        if (keys->num_slots >= ldb_clamp(keys->num_run / 8, LDB_KEYS_MERGE_MIN, LDB_KEYS_MERGE_MAX) && 
+            (ret = ldb_keys_merge(obj)) != LDB_OK)
+            exit_function(ret);
+
+        seqnum += num;
+    }
+
+LDB_KEYS_SCAN_END:
+    ldb_arena_free(&arena);
+    free(entries);
+    return ret;
+}
+
+#undef exit_function
+
+// Indexes the imported entries [seqnum, seqnum2] (disabled on error).
+// function accessed only by thread-write
+static void ldb_keys_import(ldb_impl_t *obj, uint64_t seqnum)
+{
+    if (obj->keys.fn != NULL)
+        ldb_keys_end(obj, ldb_keys_scan(obj, obj->keys.fn, seqnum) == LDB_OK);
+}
+
+// Removes the pairs of the entries greater than seqnum (rollback) and updates
+// the run header. If the index is disabled, the run file is removed (it can
+// cover removed entries).
+// function accessed only by thread-write
+static void ldb_keys_truncate(ldb_impl_t *obj, uint64_t seqnum)
+{
+    ldb_keys_t *keys = &obj->keys;
+    bool stale = false;
+
+    // segments use the index of the segmented db
+    if (obj->seg_owner != NULL || obj->wal != NULL)
+        return;
+
+    if (keys->fn == NULL) {
+        ldb_keys_remove(obj);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&obj->lock_keys);
+
+    // newest pairs are the heads of their buckets
+    while (keys->num_slots > 0 && keys->slots[keys->num_slots - 1].seqnum > seqnum) {
+        const ldb_key_slot_t *slot = &keys->slots[--keys->num_slots];
+        keys->heads[ldb_keys_bucket(keys, slot->key)] = slot->prev;
+    }
+
+    if (keys->seqnum2 > seqnum)
+        keys->seqnum2 = seqnum;
+
+    if (keys->run_seqnum2 > seqnum) {
+        keys->run_seqnum2 = seqnum;
+        stale = (keys->fd != -1);
+    }
+
+    pthread_rwlock_unlock(&obj->lock_keys);
+
+    // a run covering removed entries can not be kept
+    if (stale && ldb_keys_write_header(obj, keys->fd, keys->run_seqnum2, keys->num_run) != LDB_OK)
+        ldb_keys_disable(obj);
+}
+
+// Opens the run file (a missing or invalid one is replaced by an empty run)
+static int ldb_keys_load(ldb_impl_t *obj)
+{
+    ldb_keys_t *keys = &obj->keys;
+    ldb_header_key_t header = {0};
+    struct stat st;
+    int fd = -1;
+
+    if ((keys->path = ldb_create_filename(obj->path, obj->name, LDB_EXT_KEY)) == NULL)
+        return LDB_ERR_MEM;
+
+    if ((fd = open(keys->path, O_RDWR)) == -1)
+        return LDB_OK;
+
+    if (ldb_pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        header.magic_number != LDB_MAGIC_NUMBER ||
+        header.checksum != ldb_checksum_key(&header) ||
+        fstat(fd, &st) != 0 ||
+        (uint64_t) st.st_size != sizeof(header) + header.num * sizeof(ldb_key_t))
+    {
+        close(fd);
+        remove(keys->path);
+        return LDB_OK;
+    }
+
+    keys->fd = fd;
+    keys->num_run = header.num;
+    keys->run_seqnum2 = header.seqnum2;
+
+    // entries lost after the run was written are not covered
+    if (keys->run_seqnum2 > obj->state.seqnum2) {
+        keys->run_seqnum2 = obj->state.seqnum2;
+
+        if (ldb_keys_write_header(obj, fd, keys->run_seqnum2, keys->num_run) != LDB_OK)
+            return LDB_ERR_KEY_FILE;
+    }
+
+    keys->seqnum2 = keys->run_seqnum2;
+
+    return LDB_OK;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_SET_KEY_INDEX_END; } while(0)
+
+int ldb_set_key_index(ldb_impl_t *obj, ldb_key_fn key_fn)
+{
+    if (!obj)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_db(obj) || obj->wal)
+        return LDB_ERR;
+
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = ldb_complete(obj);
+
+    if (ret != LDB_OK || key_fn == obj->keys.fn)
+        exit_function(ret);
+
+    // pairs of another function are dropped
+    if (obj->keys.fn != NULL || key_fn == NULL)
+        ldb_keys_disable(obj);
+
+    if (key_fn == NULL)
+        exit_function(LDB_OK);
+
+    // lookups return LDB_ERR until the function is set
+    if ((ret = ldb_keys_load(obj)) != LDB_OK)
+        exit_function(ret);
+
+    if ((ret = ldb_keys_scan(obj, key_fn, obj->keys.seqnum2 + 1)) != LDB_OK)
+        exit_function(ret);
+
+    pthread_rwlock_wrlock(&obj->lock_keys);
+    obj->keys.fn = key_fn;
+    pthread_rwlock_unlock(&obj->lock_keys);
+
+LDB_SET_KEY_INDEX_END:
+    if (ret != LDB_OK && obj->keys.fn == NULL) {
+        pthread_rwlock_wrlock(&obj->lock_keys);
+        ldb_keys_free(&obj->keys);
+        pthread_rwlock_unlock(&obj->lock_keys);
+    }
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_LOOKUP_KEY_END; } while(0)
+
+int ldb_lookup_key(ldb_impl_t *obj, uint64_t key, uint64_t seqnum, uint64_t *seqnums, size_t len, size_t *num)
+{
+    if (!obj || !seqnums || len == 0)
+        return LDB_ERR_ARG;
+
+    if (num != NULL)
+        *num = 0;
+
+    if (!ldb_is_valid_db(obj))
+        return LDB_ERR;
+
+    int ret = LDB_OK;
+    ldb_keys_t *keys = &obj->keys;
+    ldb_key_t pairs[LDB_WRITE_MAX_ENTRIES];
+    ldb_state_t state;
+    size_t count = 0;
+
+    ldb_lock_data(obj);
+    state = obj->state;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    pthread_rwlock_rdlock(&obj->lock_keys);
+
+    if (keys->fn == NULL)
+        exit_function(LDB_ERR);
+
+    seqnum = ldb_max(seqnum, state.seqnum1);
+
+    if (state.seqnum1 == 0 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    // run: first pair not less than (key, seqnum), then consecutive ones
+    if (keys->num_run > 0 && seqnum <= keys->run_seqnum2)
+    {
+        uint64_t last = (state.seqnum2 < keys->run_seqnum2 ? state.seqnum2 : keys->run_seqnum2);
+        size_t lo = 0;
+        size_t hi = keys->num_run;
+        bool more = true;
+
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (ldb_pread(keys->fd, pairs, sizeof(ldb_key_t), sizeof(ldb_header_key_t) + mid * sizeof(ldb_key_t)) != (ssize_t) sizeof(ldb_key_t))
+                exit_function(LDB_ERR_KEY_FILE);
+
+            if (pairs[0].key < key || (pairs[0].key == key && pairs[0].seqnum < seqnum))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        while (more && count < len && lo < keys->num_run)
+        {
+            size_t n = ldb_min(ldb_min(keys->num_run - lo, len - count), LDB_WRITE_MAX_ENTRIES);
+            size_t bytes = n * sizeof(ldb_key_t);
+
+            if (ldb_pread(keys->fd, pairs, bytes, sizeof(ldb_header_key_t) + lo * sizeof(ldb_key_t)) != (ssize_t) bytes)
+                exit_function(LDB_ERR_KEY_FILE);
+
+            for (size_t i = 0; more && i < n; i++) {
+                more = (pairs[i].key == key && pairs[i].seqnum <= last);
+                if (more)
+                    seqnums[count++] = pairs[i].seqnum;
+            }
+
+            lo += n;
+        }
+    }
+
+    // tail (follows the run): chains go from the newest pair
+    if (count < len && keys->num_slots > 0)
+    {
+        size_t bucket = ldb_keys_bucket(keys, key);
+        size_t matches = 0;
+
+        for (size_t k = keys->heads[bucket]; k != 0 && keys->slots[k - 1].seqnum >= seqnum; k = keys->slots[k - 1].prev)
+            matches += (keys->slots[k - 1].key == key && keys->slots[k - 1].seqnum <= state.seqnum2);
+
+        // the oldest ones are returned
+        for (size_t k = keys->heads[bucket], i = matches; k != 0 && i > 0; k = keys->slots[k - 1].prev)
+        {
+            const ldb_key_slot_t *slot = &keys->slots[k - 1];
+
+            if (slot->key != key || slot->seqnum > state.seqnum2)
+                continue;
+
+            if (--i < len - count)
+                seqnums[count + i] = slot->seqnum;
+        }
+
+        count += ldb_min(matches, len - count);
+    }
+
+    ret = (count > 0 ? LDB_OK : LDB_ERR_NOT_FOUND);
+
+LDB_LOOKUP_KEY_END:
+    pthread_rwlock_unlock(&obj->lock_keys);
+    if (num != NULL)
+        *num = count;
+    return ret;
+}
+
+#undef exit_function
+
+/* -------------------------------------------------------------------------
+ * Segmented mode
+ * 
+ * The database object owns an array of regular databases (segments) 
+ * holding contiguous seqnum ranges. Only the last segment is appended.
+ * The manifest stores the id of the first segment and the first seqnum
+ * (records of the first segment below this value are logically purged).
+ * Segment ids are consecutive starting at first_id, so the manifest is
+ * only rewritten on purge. Segments with id lower than first_id are 
+ * leftovers of an interrupted purge and are removed on open.
+ * 
+ * Lock order: outer lock_files > outer mutex_data > segment guards.
+ * The segments array is modified holding the outer lock_files (W) and 
+ * mutex_data, so release_view() only needs the outer mutex_data.
+ * ------------------------------------------------------------------------- */
+
+static char * ldb_seg_filename(ldb_impl_t *obj, uint64_t id, char *name, size_t len, const char *ext)
+{
+    snprintf(name, len, "%s_%08llu", obj->name, (unsigned long long) id);
+    return (ext ? ldb_create_filename(obj->path, name, ext) : name);
+}
+
+static uint32_t ldb_checksum_seg(ldb_header_seg_t *header)
+{
+    uint32_t checksum = 0;
+
+    checksum = ldb_crc32c((const char *) &header->first_id, sizeof(header->first_id), checksum);
+    checksum = ldb_crc32c((const char *) &header->seqnum1, sizeof(header->seqnum1), checksum);
+
+    return checksum;
+}
+
+// Updates the manifest atomically (tmp file + rename)
+static int ldb_seg_write_manifest(ldb_impl_t *obj, uint64_t first_id, uint64_t seqnum1)
+{
+    int ret = LDB_OK;
+    FILE *fp = NULL;
+    char *tmp_path = ldb_create_filename(obj->path, obj->name, LDB_EXT_SEG LDB_EXT_TMP);
+    ldb_header_seg_t header;
+
+    if (tmp_path == NULL)
+        return LDB_ERR_MEM;
+
+    memset(&header, 0x00, sizeof(header));
+    header.magic_number = LDB_MAGIC_NUMBER;
+    header.format = LDB_FORMAT_DEFAULT;
+    strncpy(header.text, LDB_TEXT_SEG, sizeof(header.text) - 1);
+    header.first_id = first_id;
+    header.seqnum1 = seqnum1;
+    header.checksum = ldb_checksum_seg(&header);
+
+    if ((fp = fopen(tmp_path, "w")) == NULL ||
+        fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fflush(fp) != 0 ||
+        ldb_fdatasync(obj, fileno(fp)) == -1)
+        ret = LDB_ERR_OPEN_SEG;
+
+    if (fp != NULL && fclose(fp) != 0)
+        ret = LDB_ERR_OPEN_SEG;
+
+    if (ret == LDB_OK && rename(tmp_path, obj->seg_path) != 0)
+        ret = LDB_ERR_OPEN_SEG;
+
+    if (ret != LDB_OK)
+        remove(tmp_path);
+
+    free(tmp_path);
+    return ret;
+}
+
+static int ldb_seg_read_manifest(ldb_impl_t *obj, ldb_header_seg_t *header)
+{
+    FILE *fp = fopen(obj->seg_path, "r");
+
+    if (fp == NULL)
+        return LDB_ERR_OPEN_SEG;
+
+    size_t rc = fread(header, sizeof(ldb_header_seg_t), 1, fp);
+    fclose(fp);
+
+    if (rc != 1 ||
+        header->magic_number != LDB_MAGIC_NUMBER ||
+        (header->format != LDB_FORMAT_1 && header->format != LDB_FORMAT_2) ||
+        header->first_id == 0 ||
+        header->checksum != ldb_checksum_seg(header))
+        return LDB_ERR_FMT_SEG;
+
+    return LDB_OK;
+}
+
+// Returns the first seqnum of a segment (0 if empty)
+static uint64_t ldb_seg_seqnum1(ldb_impl_t *seg)
+{
+    ldb_lock_data(seg);
+    uint64_t seqnum1 = seg->state.seqnum1;
+    pthread_mutex_unlock(&seg->mutex_data);
+    return seqnum1;
+}
+
+// Returns the last timestamp of a segment (0 if empty)
+static uint64_t ldb_seg_timestamp2(ldb_impl_t *seg, bool *empty)
+{
+    ldb_lock_data(seg);
+    uint64_t timestamp2 = seg->state.timestamp2;
+    *empty = (seg->state.seqnum1 == 0);
+    pthread_mutex_unlock(&seg->mutex_data);
+    return timestamp2;
+}
+
+// Returns the index of the segment containing seqnum (binary search)
+static size_t ldb_seg_find(ldb_impl_t *obj, uint64_t seqnum)
+{
+    size_t lo = 0;
+    size_t hi = obj->num_segs - 1;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi + 1) / 2;
+        uint64_t seqnum1 = ldb_seg_seqnum1(obj->segs[mid]);
+
+        if (seqnum1 != 0 && seqnum1 <= seqnum)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+// Opens (or creates) the segment with the next id and appends it to the list
+static int ldb_seg_add(ldb_impl_t *obj, bool check)
+{
+    char name[LDB_NAME_MAX_LENGTH + 16] = {0};
+    ldb_impl_t *seg = (ldb_impl_t *) calloc(1, sizeof(ldb_impl_t));
+    ldb_impl_t **segs = NULL;
+    int ret = LDB_OK;
+
+    if (seg == NULL)
+        return LDB_ERR_MEM;
+
+    ldb_seg_filename(obj, obj->seg_first_id + obj->num_segs, name, sizeof(name), NULL);
+
+    if ((ret = ldb_open(seg, obj->path, name, check)) != LDB_OK)
+        goto LDB_SEG_ADD_ERR;
+
+    seg->seg_owner = obj;
+    seg->force_fsync = obj->force_fsync;
+    seg->prealloc_len = obj->prealloc_len;
+
+    if (obj->mmap_idx && (ret = ldb_set_mmap_idx(seg, true)) != LDB_OK)
+        goto LDB_SEG_ADD_ERR;
+
+    // new segments are empty (converted to the compressed format)
+    if (obj->compress && (ret = ldb_set_compression(seg, true)) != LDB_OK)
+        goto LDB_SEG_ADD_ERR;
+
+    if (obj->cache.max_bytes > 0 && (ret = ldb_set_cache(seg, obj->cache.max_bytes)) != LDB_OK)
+        goto LDB_SEG_ADD_ERR;
+
+    // only the last segment is cached (memory budget)
+    if (obj->cache.max_bytes > 0 && obj->num_segs > 0)
+        ldb_set_cache(obj->segs[obj->num_segs - 1], 0);
+
+    ldb_lock_data(obj);
+    segs = (ldb_impl_t **) realloc(obj->segs, (obj->num_segs + 1) * sizeof(ldb_impl_t *));
+    if (segs != NULL) {
+        obj->segs = segs;
+        obj->segs[obj->num_segs++] = seg;
+    }
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    if (segs == NULL) {
+        ret = LDB_ERR_MEM;
+        goto LDB_SEG_ADD_ERR;
+    }
+
+    obj->seg_state = seg->state;
+    return LDB_OK;
+
+LDB_SEG_ADD_ERR:
+    ldb_close(seg);
+    free(seg);
+    return ret;
+}
+
+// Closes the i-th segment, removes its files and removes it from the list
+static void ldb_seg_remove(ldb_impl_t *obj, size_t i)
+{
+    assert(i < obj->num_segs);
+
+    ldb_impl_t *seg = obj->segs[i];
+
+    ldb_wait_views(seg);
+
+    ldb_lock_data(obj);
+    memmove(obj->segs + i, obj->segs + i + 1, (obj->num_segs - i - 1) * sizeof(ldb_impl_t *));
+    obj->num_segs--;
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    remove(seg->dat_path);
+    remove(seg->idx_path);
+    ldb_remove_checkpoint(seg);
+    seg->chk_valid = false;
+    ldb_close(seg);
+    free(seg);
+
+    if (obj->num_segs > 0)
+        obj->seg_state = obj->segs[obj->num_segs - 1]->state;
+}
+
+// Recomputes the database state from the segments states
+static int ldb_seg_update_state(ldb_impl_t *obj)
+{
+    int ret = LDB_OK;
+    ldb_state_t state;
+    ldb_impl_t *first = obj->segs[0];
+    ldb_impl_t *last = obj->segs[obj->num_segs - 1];
+    ldb_record_idx_t record = {0};
+
+    ldb_reset_state(&state);
+
+    if (last->state.seqnum1 == 0 && obj->num_segs > 1)
+        last = obj->segs[obj->num_segs - 2];
+
+    if (first->state.seqnum1 != 0)
+    {
+        state = first->state;
+        state.seqnum2 = last->state.seqnum2;
+        state.timestamp2 = last->state.timestamp2;
+
+        if (obj->seg_seqnum1 > state.seqnum1)
+        {
+            state.seqnum1 = ldb_clamp(obj->seg_seqnum1, first->state.seqnum1, first->state.seqnum2);
+
+            if ((ret = ldb_read_record_idx(first, &first->state, state.seqnum1, &record)) == LDB_OK)
+                state.timestamp1 = record.timestamp;
+        }
+    }
+
+    ldb_lock_data(obj);
+    ldb_publish_state(obj, &state);
+    ldb_clamp_durable(obj);
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    obj->seg_state = obj->segs[obj->num_segs - 1]->state;
+
+    return ret;
+}
+
+static int ldb_seg_close(ldb_impl_t *obj)
+{
+    int ret = LDB_OK;
+
+    for (size_t i = 0; obj->segs && i < obj->num_segs; i++) {
+        int rc = ldb_close(obj->segs[i]);
+        ret = (ret == LDB_OK ? rc : ret);
+        free(obj->segs[i]);
+    }
+
+    free(obj->segs);
+    free(obj->seg_path);
+    obj->segs = NULL;
+    obj->seg_path = NULL;
+    obj->num_segs = 0;
+
+    return ret;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_SEGMENTED_END; } while(0)
+
+int ldb_open_segmented(ldb_impl_t *obj, const char *path, const char *name, size_t segment_len, bool check)
+{
+    if (path == NULL || name == NULL || obj == NULL || segment_len == 0)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_path(path))
+        return LDB_ERR_PATH;
+
+    if (!ldb_is_valid_name(name) || strlen(name) > LDB_SEG_NAME_MAX_LENGTH)
+        return  LDB_ERR_NAME;
+
+    int ret = LDB_OK;
+    char segname[LDB_NAME_MAX_LENGTH + 16] = {0};
+    ldb_header_seg_t header = {0};
+    uint64_t time0 = ldb_get_nanos();
+
+    ldb_init(obj, path, name);
+
+    obj->seg_path = ldb_create_filename(path, name, LDB_EXT_SEG);
+    obj->seg_max_len = segment_len;
+    obj->format = LDB_FORMAT_DEFAULT;
+
+    if (!obj->name || !obj->path || !obj->seg_path)
+        exit_function(LDB_ERR_MEM);
+
+    // case manifest not exist
+    if (access(obj->seg_path, F_OK) != 0)
+    {
+        if ((ret = ldb_seg_write_manifest(obj, 1, 0)) != LDB_OK)
+            exit_function(ret);
+    }
+
+    if ((ret = ldb_seg_read_manifest(obj, &header)) != LDB_OK)
+        exit_function(ret);
+
+    obj->seg_first_id = header.first_id;
+    obj->seg_seqnum1 = header.seqnum1;
+
+    // remove segments dropped by an interrupted purge
+    for (uint64_t id = obj->seg_first_id - 1; id > 0; id--)
+    {
+        char *dat_path = ldb_seg_filename(obj, id, segname, sizeof(segname), LDB_EXT_DAT);
+        char *idx_path = ldb_seg_filename(obj, id, segname, sizeof(segname), LDB_EXT_IDX);
+        char *chk_path = ldb_seg_filename(obj, id, segname, sizeof(segname), LDB_EXT_CHK);
+        bool exists = (dat_path && access(dat_path, F_OK) == 0);
+
+        if (dat_path) remove(dat_path);
+        if (idx_path) remove(idx_path);
+        if (chk_path) remove(chk_path);
+
+        free(dat_path);
+        free(idx_path);
+        free(chk_path);
+
+        if (!exists)
+            break;
+    }
+
+    // open existing segments (at least one)
+    while (true)
+    {
+        char *dat_path = ldb_seg_filename(obj, obj->seg_first_id + obj->num_segs, segname, sizeof(segname), LDB_EXT_DAT);
+        bool exists = (dat_path && access(dat_path, F_OK) == 0);
+
+        free(dat_path);
+
+        if (!exists && obj->num_segs > 0)
+            break;
+
+        if ((ret = ldb_seg_add(obj, check)) != LDB_OK)
+            exit_function(ret);
+    }
+
+    // segments must be contiguous (only the last one can be empty)
+    for (size_t i = 1; i < obj->num_segs; i++)
+    {
+        ldb_state_t *prev = &obj->segs[i - 1]->state;
+        ldb_state_t *curr = &obj->segs[i]->state;
+
+        if (prev->seqnum1 != 0 && 
+            (curr->seqnum1 == 0 || (curr->seqnum1 == prev->seqnum2 + 1 && prev->timestamp2 <= curr->timestamp1)))
+            continue;
+
+        while (obj->num_segs > i)
+            ldb_seg_remove(obj, obj->num_segs - 1);
+    }
+
+    // segments are sealed by a checkpoint (see ldb_open)
+    for (size_t i = 0; i < obj->num_segs; i++)
+        obj->durable_seqnum = ldb_max(obj->durable_seqnum, obj->segs[i]->durable_seqnum);
+
+    if ((ret = ldb_seg_update_state(obj)) != LDB_OK)
+        exit_function(ret);
+
+    obj->metrics.open_ns = ldb_get_nanos() - time0;
+
+    return LDB_OK;
+
+LDB_OPEN_SEGMENTED_END:
+    ldb_close(obj);
+    return ret;
+}
+
+#undef exit_function
+
+static int ldb_seg_append_entries(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    int ret = LDB_OK;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        ldb_entry_t *entry = &entries[i];
+        ldb_impl_t *seg = obj->segs[obj->num_segs - 1];
+        size_t count = 0;
+
+        if (entry->seqnum == 0)
+            entry->seqnum = state->seqnum2 + 1;
+
+        if (entry->timestamp == 0) 
+            entry->timestamp = ldb_max(ldb_get_millis(), state->timestamp2);
+
+        // the segment does not know the previous segments
+        if (state->seqnum2 != 0 && entry->seqnum != state->seqnum2 + 1)
+            return LDB_ERR_ENTRY_SEQNUM;
+
+        if (entry->timestamp < state->timestamp2)
+            return LDB_ERR_ENTRY_TIMESTAMP;
+
+        // start a new segment
+        if (obj->seg_state.seqnum1 != 0 && seg->dat_end >= obj->seg_max_len)
+        {
+            if ((ret = ldb_seg_commit(obj, state)) != LDB_OK)
+                return ret;
+
+            // the segment is sealed
+            if ((ret = ldb_trim_files(seg)) != LDB_OK || (ret = ldb_write_checkpoint(seg, &obj->seg_state)) != LDB_OK)
+                return ret;
+
+            ldb_wrlock_files(obj);
+            ret = ldb_seg_add(obj, false);
+            pthread_rwlock_unlock(&obj->lock_files);
+
+            if (ret != LDB_OK)
+                return ret;
+
+            seg = obj->segs[obj->num_segs - 1];
+        }
+
+        if ((ret = ldb_append_entries(seg, &obj->seg_state, entry, 1, &count)) != LDB_OK)
+            return ret;
+
+        if (state->seqnum1 == 0) {
+            state->seqnum1 = entry->seqnum;
+            state->timestamp1 = entry->timestamp;
+        }
+
+        state->seqnum2 = entry->seqnum;
+        state->timestamp2 = entry->timestamp;
+
+        (*num)++;
+    }
+
+    return ret;
+}
+
+// Commits the last segment and publishes the database state
+static int ldb_seg_commit(ldb_impl_t *obj, ldb_state_t *state)
+{
+    ldb_impl_t *seg = obj->segs[obj->num_segs - 1];
+
+    seg->force_fsync = obj->force_fsync;
+
+    int ret = ldb_commit(seg, &obj->seg_state);
+
+    // entries discarded by the segment (see ldb_commit)
+    if (obj->seg_state.seqnum2 < state->seqnum2)
+    {
+        const ldb_state_t *last = &obj->seg_state;
+
+        if (last->seqnum1 == 0 && obj->num_segs > 1)
+            last = &obj->segs[obj->num_segs - 2]->state;
+
+        if (last->seqnum1 == 0 || last->seqnum2 < state->seqnum1)
+            ldb_reset_state(state);
+        else {
+            state->seqnum2 = last->seqnum2;
+            state->timestamp2 = last->timestamp2;
+        }
+    }
+
+    ldb_lock_data(obj);
+    ldb_flusher_notify(obj, ldb_count_appended(&obj->state, state), seg);
+
+    if (ret == LDB_OK && obj->force_fsync)
+        obj->durable_seqnum = state->seqnum2;
+
+    ldb_publish_state(obj, state);
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
+
+    return ret;
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_READ_END; } while(0)
+
+static int ldb_seg_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, bool view, ldb_arena_t *arena)
+{
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    uint64_t last = 0;
+    size_t count = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    last = (len - 1 < state.seqnum2 - seqnum ? seqnum + len - 1 : state.seqnum2);
+
+    while (seqnum <= last)
+    {
+        ldb_impl_t *seg = obj->segs[ldb_seg_find(obj, seqnum)];
+        size_t n = 0;
+
+        if (view)
+            ret = ldb_read_view(seg, seqnum, entries + count, (size_t)(last - seqnum + 1), &n);
+        else
+            ret = ldb_read_entries(seg, seqnum, entries + count, (size_t)(last - seqnum + 1), &n, arena);
+
+        // entries read before an error are reported (none on views)
+        count += n;
+        seqnum += n;
+
+        if (ret != LDB_OK)
+            exit_function(ret);
+
+        if (n == 0)
+            exit_function(LDB_ERR);
+    }
+
+    ret = LDB_OK;
+
+LDB_SEG_READ_END:
+    if (ret != LDB_OK && view)
+        ldb_seg_release_view(obj, entries, count);
+    if (ret != LDB_OK && view)
+        count = 0;
+    if (num != NULL)
+        *num = count;
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+
+static void ldb_seg_release_view(ldb_impl_t *obj, ldb_entry_t *entries, size_t len)
+{
+    if (entries == NULL)
+        return;
+
+    ldb_lock_data(obj);
+
+    // each segment was pinned once per view
+    for (size_t i = 0; i < len && obj->num_segs > 0; )
+    {
+        if (entries[i].seqnum == 0) {
+            i++;
+            continue;
+        }
+
+        size_t k = ldb_seg_find(obj, entries[i].seqnum);
+        size_t j = i + 1;
+
+        while (j < len && entries[j].seqnum != 0 && ldb_seg_find(obj, entries[j].seqnum) == k)
+            j++;
+
+        ldb_release_view(obj->segs[k], entries + i, j - i);
+        i = j;
+    }
+
+    pthread_mutex_unlock(&obj->mutex_data);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_STATS_END; } while(0)
+
+static int ldb_seg_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats)
+{
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    ldb_stats_t aux = {0};
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (state.seqnum1 == 0 || seqnum2 < state.seqnum1 || state.seqnum2 < seqnum1)
+        exit_function(LDB_OK);
+
+    seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
+    seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
+
+    size_t k1 = ldb_seg_find(obj, seqnum1);
+    size_t k2 = ldb_seg_find(obj, seqnum2);
+
+    for (size_t k = k1; k <= k2; k++)
+    {
+        if ((ret = ldb_stats(obj->segs[k], seqnum1, seqnum2, &aux)) != LDB_OK)
+            exit_function(ret);
+
+        if (k == k1) {
+            stats->min_seqnum = aux.min_seqnum;
+            stats->min_timestamp = aux.min_timestamp;
+        }
+
+        stats->max_seqnum = aux.max_seqnum;
+        stats->max_timestamp = aux.max_timestamp;
+        stats->num_entries += aux.num_entries;
+        stats->data_size += aux.data_size;
+        stats->raw_data_size += aux.raw_data_size;
+        stats->index_size += aux.index_size;
+    }
+
+    ret = LDB_OK;
+
+LDB_SEG_STATS_END:
+    if (ret != LDB_OK)
+        memset(stats, 0x00, sizeof(ldb_stats_t));
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_SEARCH_END; } while(0)
+
+static int ldb_seg_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum)
+{
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    size_t lo = 0;
+    size_t hi = 0;
+    uint64_t sn = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (state.seqnum1 == 0)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    // first segment whose last timestamp fulfills the criteria
+    hi = obj->num_segs;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        bool empty = false;
+        uint64_t ts = ldb_seg_timestamp2(obj->segs[mid], &empty);
+
+        if (!empty && (ts < timestamp || (mode == LDB_SEARCH_UPPER && ts == timestamp)))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == obj->num_segs)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    if ((ret = ldb_search(obj->segs[lo], timestamp, mode, &sn)) != LDB_OK)
+        exit_function(ret);
+
+    // records before seqnum1 are purged (timestamps are non-decreasing)
+    sn = ldb_max(sn, state.seqnum1);
+
+    if (sn > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    *seqnum = sn;
+
+LDB_SEG_SEARCH_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_ROLLBACK_END; } while(0)
+
+static long ldb_seg_rollback(ldb_impl_t *obj, uint64_t seqnum)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_wrlock_files(obj);
+
+    long ret = LDB_ERR;
+    long removed_entries = 0;
+    ldb_state_t state;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    state = obj->state;
+
+    if (state.seqnum1 == 0 || state.seqnum2 <= seqnum)
+        exit_function(0);
+
+    // remove all (including logically purged records)
+    if (seqnum < state.seqnum1)
+        seqnum = 0;
+
+    removed_entries = (long)(state.seqnum2 - ldb_max(seqnum + 1, state.seqnum1) + 1);
+
+    while (obj->num_segs > 1 && (obj->segs[obj->num_segs - 1]->state.seqnum1 == 0 || 
+                                 obj->segs[obj->num_segs - 1]->state.seqnum1 > seqnum))
+        ldb_seg_remove(obj, obj->num_segs - 1);
+
+    obj->segs[obj->num_segs - 1]->force_fsync = obj->force_fsync;
+
+    if ((ret = ldb_rollback(obj->segs[obj->num_segs - 1], seqnum)) < 0)
+        exit_function(ret);
+
+    if (seqnum == 0 && obj->seg_seqnum1 != 0)
+    {
+        if ((ret = ldb_seg_write_manifest(obj, obj->seg_first_id, 0)) != LDB_OK)
+            exit_function(ret);
+
+        obj->seg_seqnum1 = 0;
+    }
+
+    ldb_keys_truncate(obj, seqnum);
+    ret = removed_entries;
+
+LDB_SEG_ROLLBACK_END:
+    // waiters are notified when the state is updated
+    // cursors must seek again if segments were removed
+    if (ret != 0) {
+        ldb_lock_data(obj);
+        obj->rollback_id += (ret > 0 ? 1 : 0);
+        obj->purge_id++;
+        pthread_mutex_unlock(&obj->mutex_data);
+    }
+
+    if (obj->num_segs > 0 && ldb_seg_update_state(obj) != LDB_OK && ret >= 0)
+        ret = LDB_ERR_READ_IDX;
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_PURGE_END; } while(0)
+
+static long ldb_seg_purge(ldb_impl_t *obj, uint64_t seqnum)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_wrlock_files(obj);
+
+    long ret = LDB_ERR;
+    long removed_entries = 0;
+    ldb_state_t state;
+    size_t k = 0;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    state = obj->state;
+
+    if (seqnum <= state.seqnum1 || state.seqnum1 == 0)
+        exit_function(0);
+
+    // case purge all entries
+    if (state.seqnum2 < seqnum)
+    {
+        removed_entries = (long) state.seqnum2 - (long) state.seqnum1 + 1;
+        k = obj->num_segs;
+
+        // new empty segment, then the manifest points to it
+        if ((ret = ldb_seg_add(obj, false)) != LDB_OK)
+            exit_function(ret);
+
+        if ((ret = ldb_seg_write_manifest(obj, obj->seg_first_id + k, 0)) != LDB_OK)
+            exit_function(ret);
+
+        obj->seg_seqnum1 = 0;
+    }
+    else
+    {
+        removed_entries = (long) seqnum - (long) state.seqnum1;
+        k = ldb_seg_find(obj, seqnum);
+
+        if ((ret = ldb_seg_write_manifest(obj, obj->seg_first_id + k, seqnum)) != LDB_OK)
+            exit_function(ret);
+
+        obj->seg_seqnum1 = seqnum;
+    }
+
+    // drop whole segments (data is not copied)
+    for (size_t i = 0; i < k; i++)
+        ldb_seg_remove(obj, 0);
+
+    obj->seg_first_id += k;
+
+    // seqnums of purged entries can be reused
+    if (state.seqnum2 < seqnum)
+        ldb_keys_truncate(obj, 0);
+
+    ret = removed_entries;
+
+LDB_SEG_PURGE_END:
+    // cursors must seek again (segments removed)
+    if (ret != 0) {
+        ldb_lock_data(obj);
+        obj->purge_id++;
+        pthread_mutex_unlock(&obj->mutex_data);
+    }
+
+    if (obj->num_segs > 0 && ldb_seg_update_state(obj) != LDB_OK && ret >= 0)
+        ret = LDB_ERR_READ_IDX;
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+#undef exit_function
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_SEG_EXPORT_END; } while(0)
+
+static long ldb_seg_export(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, int fd)
+{
+    ldb_rdlock_files(obj);
+
+    long ret = LDB_ERR;
+    long num = 0;
+    uint32_t format = 0;
+    ldb_state_t state;
+
+    if (!ldb_is_valid_db(obj))
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (state.seqnum1 != 0 && seqnum1 <= state.seqnum2 && state.seqnum1 <= seqnum2)
+    {
+        seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
+        seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
+
+        for (size_t i = ldb_seg_find(obj, seqnum1); i < obj->num_segs && seqnum1 <= seqnum2; i++)
+        {
+            if ((ret = ldb_export_records(obj->segs[i], seqnum1, seqnum2, fd, &format)) < 0)
+                exit_function(ret);
+
+            seqnum1 += (uint64_t) ret;
+            num += ret;
+        }
+
+        if (seqnum1 <= seqnum2)
+            exit_function(LDB_ERR);
+    }
+
+    // no entries in range (only the header is written)
+    if (format == 0 && (ret = ldb_export_records(obj->segs[obj->num_segs - 1], 1, 0, fd, &format)) < 0)
+        exit_function(ret);
+
+    ret = num;
+
+LDB_SEG_EXPORT_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+
+// Imported entries are appended to the last segment (no rotation)
+static long ldb_seg_import(ldb_impl_t *obj, int fd, bool check)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+
+    long ret = LDB_ERR;
+    ldb_impl_t *seg = obj->segs[obj->num_segs - 1];
+    ldb_state_t state = obj->state;
+
+    seg->force_fsync = obj->force_fsync;
+
+    ret = ldb_import_records(seg, &state, fd, check);
+
+    obj->seg_state = seg->state;
+
+    if (ret > 0) {
+        int rc = ldb_seg_update_state(obj);
+
+        ldb_lock_data(obj);
+        ldb_flusher_notify(obj, (uint64_t) ret, seg);
+        if (rc == LDB_OK && obj->force_fsync)
+            obj->durable_seqnum = obj->state.seqnum2;
+        pthread_mutex_unlock(&obj->mutex_data);
+
+        ret = (rc == LDB_OK ? ret : rc);
+    }
+
+    if (ret > 0)
+        ldb_keys_import(obj, obj->state.seqnum2 - (uint64_t) ret + 1);
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+// Appends the raw records to the last segment (a new one is started if full)
+static int ldb_seg_append_raw(ldb_impl_t *obj, ldb_state_t *state, const char *buf, size_t len, bool check, size_t *num)
+{
+    int ret = LDB_OK;
+    ldb_impl_t *seg = obj->segs[obj->num_segs - 1];
+
+    if (obj->seg_state.seqnum1 != 0 && seg->dat_end >= obj->seg_max_len)
+    {
+        // the segment is sealed
+        if ((ret = ldb_trim_files(seg)) != LDB_OK || (ret = ldb_write_checkpoint(seg, &obj->seg_state)) != LDB_OK)
+            return ret;
+
+        ldb_wrlock_files(obj);
+        ret = ldb_seg_add(obj, false);
+        pthread_rwlock_unlock(&obj->lock_files);
+
+        if (ret != LDB_OK)
+            return ret;
+
+        seg = obj->segs[obj->num_segs - 1];
+    }
+
+    seg->force_fsync = obj->force_fsync;
+
+    ret = ldb_append_raw_records(seg, state, buf, len, check, num);
+
+    obj->seg_state = seg->state;
+
+    if (*num > 0) {
+        ldb_lock_data(obj);
+        ldb_flusher_notify(obj, ldb_count_appended(&obj->state, state), seg);
+
+        if (ret == LDB_OK && obj->force_fsync)
+            obj->durable_seqnum = state->seqnum2;
+
+        ldb_publish_state(obj, state);
+        pthread_cond_broadcast(&obj->cond_state);
+        pthread_mutex_unlock(&obj->mutex_data);
+    }
+
+    return ret;
+}
+
+static int ldb_seg_set_mmap_idx(ldb_impl_t *obj, bool enable)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    for (size_t i = 0; ret == LDB_OK && i < obj->num_segs; i++)
+        ret = ldb_set_mmap_idx(obj->segs[i], enable);
+
+    if (ret == LDB_OK)
+        obj->mmap_idx = enable;
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+static int ldb_seg_set_compression(ldb_impl_t *obj, bool enable)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    // a not empty last segment is not converted (next segments will be)
+    if (ret == LDB_OK) {
+        ret = ldb_set_compression(obj->segs[obj->num_segs - 1], enable);
+        ret = (ret == LDB_ERR_FMT_DAT ? LDB_OK : ret);
+    }
+
+    if (ret == LDB_OK)
+        obj->compress = enable;
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+static int ldb_seg_set_cache(ldb_impl_t *obj, size_t max_bytes)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    if (ret == LDB_OK)
+        ret = ldb_set_cache(obj->segs[obj->num_segs - 1], max_bytes);
+
+    if (ret == LDB_OK)
+        obj->cache.max_bytes = max_bytes;
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+static int ldb_seg_set_preallocation(ldb_impl_t *obj, size_t len)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+
+    int ret = (ldb_is_valid_db(obj) ? LDB_OK : LDB_ERR);
+
+    if (ret == LDB_OK)
+        ret = ldb_set_preallocation(obj->segs[obj->num_segs - 1], len);
+
+    if (ret == LDB_OK)
+        obj->prealloc_len = len;
+
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
+
+/* -------------------------------------------------------------------------
+ * Multi-log mode
+ * 
+ * A wal owns a list of logs (database objects without files) sharing one
+ * append stream. The stream is a series of segment files with consecutive
+ * ids. The segment header stores the stream position of its first record,
+ * so a stream position is mapped to a segment and an offset. Each log keeps 
+ * in memory the slot (timestamp, position, length) of its entries. Rollback
+ * and purge append a marker record and update the slots. On open, records 
+ * (entries and markers) are replayed in stream order. Segments preceding the
+ * first record of all logs are removed oldest first, so the remaining ones
+ * are contiguous after a crash.
+ * 
+ * Lock order: log mutex_write > log lock_files > wal mutex_write >
+ *             wal mutex_logs > wal lock_segs > log mutex_data.
+ * The wal mutex_sync is not held while taking other guards.
+ * The segments array is modified holding the wal mutex_write and lock_segs (W),
+ * so that writers only need mutex_write, and readers and syncers lock_segs (R).
+ * ------------------------------------------------------------------------- */
+
+static char * ldb_wal_filename(ldb_wal_impl_t *wal, uint64_t id)
+{
+    char name[LDB_NAME_MAX_LENGTH + 16] = {0};
+
+    snprintf(name, sizeof(name), "%s_%08llu", wal->name, (unsigned long long) id);
+    return ldb_create_filename(wal->path, name, LDB_EXT_WAL);
+}
+
+static uint32_t ldb_checksum_header_wal(const ldb_header_wal_t *header)
+{
+    return ldb_crc32c((const char *) &header->pos, sizeof(header->pos), 0);
+}
+
+static uint32_t ldb_checksum_record_wal(const ldb_record_wal_t *record, const void *metadata, const void *data)
+{
+    uint32_t checksum = 0;
+
+    checksum = ldb_crc32c((const char *) record, offsetof(ldb_record_wal_t, checksum), checksum);
+    checksum = ldb_crc32c((const char *) metadata, record->metadata_len, checksum);
+    checksum = ldb_crc32c((const char *) data, record->data_len, checksum);
+
+    return checksum;
+}
+
+// Returns the index of the segment containing the stream position (binary search)
+static size_t ldb_wal_find_seg(ldb_wal_impl_t *wal, uint64_t pos)
+{
+    size_t lo = 0;
+    size_t hi = wal->num_segs - 1;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi + 1) / 2;
+
+        if (wal->segs[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+// Returns the index of the log with the given id, or where it must be inserted
+static size_t ldb_wal_find_log(ldb_wal_impl_t *wal, uint64_t id)
+{
+    size_t lo = 0;
+    size_t hi = wal->num_logs;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (wal->logs[mid]->wal_id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Returns the log with the given id, created if not exists (NULL on memory error).
+// Caller holds mutex_logs (or has exclusive access).
+static ldb_impl_t * ldb_wal_get_log(ldb_wal_impl_t *wal, uint64_t id)
+{
+    size_t i = ldb_wal_find_log(wal, id);
+
+    if (i < wal->num_logs && wal->logs[i]->wal_id == id)
+        return wal->logs[i];
+
+    if (wal->num_logs == wal->max_logs)
+    {
+        size_t max = ldb_max(2 * wal->max_logs, 16);
+        ldb_impl_t **logs = (ldb_impl_t **) realloc(wal->logs, max * sizeof(ldb_impl_t *));
+
+        if (logs == NULL)
+            return NULL;
+
+        wal->logs = logs;
+        wal->max_logs = max;
+    }
+
+    ldb_impl_t *obj = (ldb_impl_t *) calloc(1, sizeof(ldb_impl_t));
+
+    if (obj == NULL)
+        return NULL;
 
-    obj->state.seqnum1 = record.seqnum;
-    obj->state.timestamp1 = record.timestamp;
+    ldb_init(obj, wal->path, wal->name);
 
-    if (!check)
-        return LDB_OK;
+    if (!obj->name || !obj->path) {
+        ldb_close(obj);
+        free(obj);
+        return NULL;
+    }
 
-    obj->state.seqnum2 = record.seqnum;
-    obj->state.timestamp2 = record.timestamp;
+    obj->format = LDB_FORMAT_DEFAULT;
+    obj->wal_id = id;
+    obj->wal_pos1 = UINT64_MAX;
+    obj->wal = wal;
 
-    while (pos + sizeof(ldb_record_dat_t) <= len)
+    memmove(wal->logs + i + 1, wal->logs + i, (wal->num_logs - i) * sizeof(ldb_impl_t *));
+    wal->logs[i] = obj;
+    wal->num_logs++;
+
+    return obj;
+}
+
+// Ensures room for num slots from wal_first (the used ones are preserved).
+// Slots are moved to the beginning when its half is free, otherwise they are 
+// reallocated. Readers are excluded meanwhile.
+static bool ldb_wal_reserve(ldb_impl_t *obj, size_t num, size_t used)
+{
+    if (obj->wal_first + num <= obj->wal_max)
+        return true;
+
+    bool ret = true;
+
+    ldb_wrlock_files(obj);
+
+    if (2 * num <= obj->wal_max)
+    {
+        memmove(obj->wal_slots, obj->wal_slots + obj->wal_first, used * sizeof(ldb_wal_slot_t));
+        obj->wal_first = 0;
+    }
+    else
     {
-        ret = ldb_read_record_dat(obj->dat_fd, pos, &record, true);
+        size_t max = ldb_max(2 * num, LDB_WAL_MIN_SLOTS);
+        ldb_wal_slot_t *slots = (ldb_wal_slot_t *) malloc(max * sizeof(ldb_wal_slot_t));
+
+        if (slots != NULL) {
+            if (used > 0)
+                memcpy(slots, obj->wal_slots + obj->wal_first, used * sizeof(ldb_wal_slot_t));
+            free(obj->wal_slots);
+            obj->wal_slots = slots;
+            obj->wal_first = 0;
+            obj->wal_max = max;
+        }
 
-        if (ret == LDB_ERR_FMT_DAT)
-            goto LDB_OPEN_FILE_DAT_ZEROIZE;
+        ret = (slots != NULL);
+    }
 
-        if (ret != LDB_OK)
-            exit_function(ret);
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
 
-        // case record removed (rollback)
-        if (record.seqnum == 0)
-            goto LDB_OPEN_FILE_DAT_ZEROIZE;
+// Removes the entries greater than seqnum from the log state (in-memory)
+static void ldb_wal_truncate(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum)
+{
+    if (state->seqnum1 == 0 || state->seqnum2 <= seqnum)
+        return;
 
-        if (record.seqnum != obj->state.seqnum2 + 1) 
-            exit_function(LDB_ERR_FMT_DAT);
+    if (seqnum < state->seqnum1) {
+        ldb_reset_state(state);
+        obj->wal_first = 0;
+        return;
+    }
 
-        if (record.timestamp < obj->state.timestamp2)
-            exit_function(LDB_ERR_FMT_DAT);
+    state->seqnum2 = seqnum;
+    state->timestamp2 = obj->wal_slots[obj->wal_first + (size_t)(seqnum - state->seqnum1)].timestamp;
+}
 
-        pos += sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+// Removes the entries less than seqnum from the log state (in-memory)
+static void ldb_wal_trim(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum)
+{
+    if (state->seqnum1 == 0 || seqnum <= state->seqnum1)
+        return;
 
-        obj->state.seqnum2 = record.seqnum;
-        obj->state.timestamp2 = record.timestamp;
+    if (state->seqnum2 < seqnum) {
+        ldb_reset_state(state);
+        obj->wal_first = 0;
+        return;
     }
 
-    return LDB_OK;
+    obj->wal_first += (size_t)(seqnum - state->seqnum1);
+    state->seqnum1 = seqnum;
+    state->timestamp1 = obj->wal_slots[obj->wal_first].timestamp;
+}
 
-LDB_OPEN_FILE_DAT_ZEROIZE:
-    if (!ldb_zeroize(obj->dat_fp, pos))
-        exit_function(LDB_ERR_WRITE_DAT);
+// Creates the segment with the next id starting at the current stream position.
+// Caller holds mutex_write (or has exclusive access).
+static int ldb_wal_add_seg(ldb_wal_impl_t *wal)
+{
+    char *filepath = ldb_wal_filename(wal, wal->seg_first_id + wal->num_segs);
+    ldb_wal_seg_t *segs = NULL;
+    ldb_header_wal_t header;
+    int fd = -1;
+
+    if (filepath == NULL)
+        return LDB_ERR_MEM;
+
+    memset(&header, 0x00, sizeof(header));
+    header.magic_number = LDB_MAGIC_NUMBER;
+    header.format = LDB_FORMAT_DEFAULT;
+    strncpy(header.text, LDB_TEXT_WAL, sizeof(header.text) - 1);
+    header.pos = wal->end_pos;
+    header.checksum = ldb_checksum_header_wal(&header);
+
+    if ((fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0666)) == -1 ||
+        !ldb_pwrite(fd, &header, sizeof(header), 0) ||
+        lseek(fd, (off_t) sizeof(header), SEEK_SET) == -1)
+        goto LDB_WAL_ADD_SEG_ERR;
+
+    pthread_rwlock_wrlock(&wal->lock_segs);
+    segs = (ldb_wal_seg_t *) realloc(wal->segs, (wal->num_segs + 1) * sizeof(ldb_wal_seg_t));
+    if (segs != NULL) {
+        wal->segs = segs;
+        wal->segs[wal->num_segs++] = (ldb_wal_seg_t){ .pos = wal->end_pos, .fd = fd };
+    }
+    pthread_rwlock_unlock(&wal->lock_segs);
+
+    if (segs == NULL)
+        goto LDB_WAL_ADD_SEG_ERR;
 
+    free(filepath);
     return LDB_OK;
 
-LDB_OPEN_FILE_DAT_END:
-    ldb_close_files(obj);
-    ldb_reset_state(&obj->state);
-    return ret;
+LDB_WAL_ADD_SEG_ERR:
+    if (fd != -1)
+        close(fd);
+    remove(filepath);
+    free(filepath);
+    return (segs == NULL && fd != -1 ? LDB_ERR_MEM : LDB_ERR_OPEN_WAL);
 }
 
-#undef exit_function
-#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_FILE_IDX_END; } while(0)
-
-/**
- * pre-conditions:
- *   - obj->dat_fp = set
- *   - obj->dat_fd = set
- *   - obj->idx_fp == NULL
- *   - obj->idx_fd == -1
- *   - obj->first_seqnum = set (0 if no data)
- *   - obj->first_timestamp = set
- *   - obj->format = set
- *
- * post-conditions (OK)
- *   - obj->dat_fp = set
- *   - obj->dat_fd = set
- *   - obj->idx_fp = set
- *   - obj->dat_fd = set
- *   - obj->first_seqnum = set (0 if no data)
- *   - obj->first_timestamp = set
- *   - obj->last_seqnum = set (0 if no data)
- *   - obj->last_timestamp = set
- *   - obj->dat_end = set
- * 
- * post-conditions (KO)
- *   - idx files closed
- */
-static int ldb_open_file_idx(ldb_impl_t *obj, bool check)
+// Seals the last segment (synced) and starts a new one.
+// Caller holds mutex_write.
+static int ldb_wal_rotate(ldb_wal_impl_t *wal, ldb_impl_t *obj)
 {
-    assert(obj);
-    assert(obj->idx_fp == NULL);
-    assert(obj->idx_fd == -1);
-    assert(obj->dat_fp != NULL);
-    assert(obj->dat_fd > STDERR_FILENO);
-    assert(!ferror(obj->dat_fp) && !feof(obj->dat_fp));
-
     int ret = LDB_OK;
-    ldb_header_idx_t header = {0};
-    ldb_record_idx_t record_0 = {0};
-    ldb_record_idx_t record_n = {0};
-    ldb_record_dat_t record_dat = {0};
-    size_t pos = 0;
-    size_t len = 0;
 
-    obj->idx_fp = fopen(obj->idx_path, "r+");
+    if (ldb_fdatasync(obj, wal->segs[wal->num_segs - 1].fd) == -1)
+        return LDB_ERR_WRITE_DAT;
 
-    if (obj->idx_fp == NULL)
-        return LDB_ERR_OPEN_IDX;
+    if ((ret = ldb_wal_add_seg(wal)) != LDB_OK)
+        return ret;
 
-    if ((obj->idx_fd = open(obj->idx_path, O_RDONLY)) == -1)
-        return LDB_ERR_OPEN_IDX;
+    // sealed segments are durable
+    pthread_mutex_lock(&wal->mutex_sync);
+    wal->synced_pos = ldb_max(wal->synced_pos, wal->end_pos);
+    pthread_mutex_unlock(&wal->mutex_sync);
 
-    assert(obj->idx_fd > STDERR_FILENO);
+    return LDB_OK;
+}
 
-    len = ldb_get_file_size(obj->idx_fp);
+// Writes len bytes (records of the log) at the end of the stream (one writev).
+// Sets pos to the stream position of the written bytes. The wal_pos1 of the 
+// log is set atomically if first is true (see ldb_wal_reclaim).
+// On error, partial records are removed.
+static int ldb_wal_write_stream(ldb_impl_t *obj, struct iovec *iov, size_t iovcnt, size_t len, bool first, uint64_t *pos)
+{
+    ldb_wal_impl_t *wal = obj->wal;
+    int ret = LDB_OK;
 
-    if (fseek(obj->idx_fp, 0, SEEK_END) == -1)
-        exit_function(LDB_ERR_OPEN_IDX);
+    pthread_mutex_lock(&wal->mutex_write);
 
-    if (lseek(obj->idx_fd, 0, SEEK_SET) != 0)
-        return LDB_ERR_OPEN_IDX;
+    ldb_wal_seg_t seg = wal->segs[wal->num_segs - 1];
 
-    if (read(obj->idx_fd, &header, sizeof(ldb_header_idx_t)) != sizeof(ldb_header_idx_t))
-        exit_function(LDB_ERR_FMT_IDX);
+    // start a new segment
+    if (wal->end_pos - seg.pos >= wal->seg_max_len) {
+        ret = ldb_wal_rotate(wal, obj);
+        seg = wal->segs[wal->num_segs - 1];
+    }
 
-    pos += sizeof(ldb_header_idx_t);
+    *pos = wal->end_pos;
 
-    if (header.magic_number != LDB_MAGIC_NUMBER)
-        exit_function(LDB_ERR_FMT_IDX);
+    LDB_METRIC_ADD(obj, write_calls, (ret == LDB_OK ? 1 : 0));
 
-    if (header.format != LDB_FORMAT_1)
-        exit_function(LDB_ERR_FMT_IDX);
+    if (ret == LDB_OK && !ldb_writev(seg.fd, iov, iovcnt))
+    {
+        off_t off = (off_t)(sizeof(ldb_header_wal_t) + (wal->end_pos - seg.pos));
 
-    if (header.format != obj->format)
-        exit_function(LDB_ERR_FMT_IDX);
+        // next records are written at end_pos
+        if (ftruncate(seg.fd, off) == 0)
+            lseek(seg.fd, off, SEEK_SET);
 
-    if (pos + sizeof(ldb_record_idx_t) <= len)
+        ret = LDB_ERR_WRITE_DAT;
+    }
+
+    if (ret == LDB_OK)
     {
-        // read first entry
-        if (read(obj->idx_fd, &record_0, sizeof(ldb_record_idx_t)) != sizeof(ldb_record_idx_t)) 
-            exit_function(LDB_ERR_READ_IDX);
+        wal->end_pos += len;
 
-        pos += sizeof(ldb_record_idx_t);
+        pthread_mutex_lock(&wal->mutex_sync);
+        wal->written_pos = wal->end_pos;
+        pthread_mutex_unlock(&wal->mutex_sync);
 
-        if (record_0.seqnum != obj->state.seqnum1)
-            exit_function(LDB_ERR_FMT_IDX);
+        if (first) {
+            ldb_lock_data(obj);
+            obj->wal_pos1 = *pos;
+            pthread_mutex_unlock(&obj->mutex_data);
+        }
+    }
 
-        if (record_0.timestamp != obj->state.timestamp1)
-            exit_function(LDB_ERR_FMT_IDX);
+    pthread_mutex_unlock(&wal->mutex_write);
+    return ret;
+}
 
-        if (record_0.seqnum != 0 && record_0.pos != sizeof(ldb_header_dat_t))
-            exit_function(LDB_ERR_FMT_IDX);
-    }
+// Makes durable the stream up to pos (group commit).
+// One thread syncs the last segment on behalf of the waiting ones.
+// Sealed segments were synced when the next one was started.
+static int ldb_wal_sync_to(ldb_wal_impl_t *wal, ldb_impl_t *obj, uint64_t pos)
+{
+    int ret = LDB_OK;
 
-    record_n = record_0;
+    pthread_mutex_lock(&wal->mutex_sync);
 
-    // read last record distinct than 0
-    if (record_0.seqnum == 0)
-    {
-        // do nothing
-    }
-    else if (check)
+    while (wal->synced_pos < pos && ret == LDB_OK)
     {
-        ldb_record_idx_t aux = {0};
-
-        while (pos + sizeof(ldb_record_idx_t) <= len)
-        {
-            if (read(obj->idx_fd, &aux, sizeof(ldb_record_idx_t)) != sizeof(ldb_record_idx_t)) 
-                exit_function(LDB_ERR_READ_IDX);
+        if (wal->syncing) {
+            pthread_cond_wait(&wal->cond_sync, &wal->mutex_sync);
+            continue;
+        }
 
-            if (aux.seqnum == 0)
-                break;
+        uint64_t target = wal->written_pos;
 
-            pos += sizeof(ldb_record_idx_t);
+        wal->syncing = true;
+        pthread_mutex_unlock(&wal->mutex_sync);
 
-            if (aux.seqnum != record_n.seqnum + 1 || aux.timestamp < record_n.timestamp || aux.pos < record_n.pos + sizeof(ldb_record_dat_t))
-                exit_function(LDB_ERR_FMT_IDX);
+        pthread_rwlock_rdlock(&wal->lock_segs);
+        int fd = wal->segs[wal->num_segs - 1].fd;
+        int rc = (obj ? ldb_fdatasync(obj, fd) : fdatasync(fd));
+        pthread_rwlock_unlock(&wal->lock_segs);
 
-            if (ldb_read_record_dat(obj->dat_fd, aux.pos, &record_dat, true) != LDB_OK)
-                exit_function(LDB_ERR_FMT_IDX);
+        pthread_mutex_lock(&wal->mutex_sync);
 
-            if (aux.seqnum != record_dat.seqnum || aux.timestamp != record_dat.timestamp)
-                exit_function(LDB_ERR_FMT_IDX);
+        if (rc == 0)
+            wal->synced_pos = ldb_max(wal->synced_pos, target);
+        else
+            ret = LDB_ERR_WRITE_DAT;
 
-            record_n = aux;
-        }
+        wal->syncing = false;
+        pthread_cond_broadcast(&wal->cond_sync);
     }
-    else
-    {
-        // search last valid position
-        long rem = ((long) len - (long) sizeof(ldb_header_idx_t)) % (int) sizeof(ldb_record_idx_t);
 
-        pos = len - (size_t)(rem);
+    pthread_mutex_unlock(&wal->mutex_sync);
+    return ret;
+}
 
-        if (lseek(obj->idx_fd, (off_t) -rem, SEEK_END) != (off_t) pos)
-            exit_function(LDB_ERR_READ_IDX);
+// Writes the pending records of the log (contiguous in the stream) and fills their slots.
+// state covers the pending entries.
+// function accessed only by thread-write
+static int ldb_wal_write(ldb_impl_t *obj, ldb_state_t *state)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    ldb_state_t *wstate = &obj->wal_wstate;
+    size_t num = wbuf->num;
+    size_t used = (wstate->seqnum1 == 0 ? 0 : (size_t)(wstate->seqnum2 - wstate->seqnum1 + 1));
+    size_t iovcnt = 0;
+    size_t len = 0;
+    uint64_t pos = 0;
+    int ret = LDB_OK;
 
-        // move backwards until last record distinct than 0 (not rolled back)
-        while (pos > sizeof(ldb_header_idx_t))
-        {
-            off_t new_pos = (off_t)(pos - sizeof(ldb_record_idx_t));
+    if (num == 0)
+        return LDB_OK;
 
-            if (lseek(obj->idx_fd, new_pos, SEEK_SET) != new_pos)
-                exit_function(LDB_ERR_READ_IDX);
+    wbuf->num = 0;
 
-            if (read(obj->idx_fd, &record_n, sizeof(ldb_record_idx_t)) != sizeof(ldb_record_idx_t)) 
-                exit_function(LDB_ERR_READ_IDX);
+    if (!ldb_wal_reserve(obj, used + num, used))
+        return LDB_ERR_MEM;
 
-            if (record_n.seqnum != 0)
-                break;
+    for (size_t i = 0; i < num; i++)
+    {
+        const ldb_entry_t *entry = wbuf->entries[i];
 
-            pos -= sizeof(ldb_record_idx_t);
-        }
-    }
+        wbuf->iov[iovcnt++] = (struct iovec){ .iov_base = &obj->wal_records[i], .iov_len = sizeof(ldb_record_wal_t) };
 
-    // at this point pos is just after the last record distinct than 0
-    if (lseek(obj->idx_fd, (off_t) pos, SEEK_SET) != (off_t) pos)
-        exit_function(LDB_ERR_READ_IDX);
+        if (entry->metadata_len)
+            wbuf->iov[iovcnt++] = (struct iovec){ .iov_base = entry->metadata, .iov_len = entry->metadata_len };
 
-    if (!ldb_zeroize(obj->idx_fp, pos))
-        exit_function(LDB_ERR_WRITE_IDX);
+        if (entry->data_len)
+            wbuf->iov[iovcnt++] = (struct iovec){ .iov_base = entry->data, .iov_len = entry->data_len };
 
-    // case idx with no records
-    if (record_0.seqnum == 0)
+        len += sizeof(ldb_record_wal_t) + entry->metadata_len + entry->data_len;
+    }
+
+    if ((ret = ldb_wal_write_stream(obj, wbuf->iov, iovcnt, len, (used == 0), &pos)) != LDB_OK)
+        return ret;
+
+    for (size_t i = 0; i < num; i++)
     {
-        // adding first dat record (if any)
-        if (obj->state.seqnum1 != 0)
-        {
-            record_0.seqnum = obj->state.seqnum1;
-            record_0.timestamp = obj->state.timestamp1;
-            record_0.pos = sizeof(ldb_header_dat_t);
+        const ldb_entry_t *entry = wbuf->entries[i];
+        size_t rec_len = sizeof(ldb_record_wal_t) + entry->metadata_len + entry->data_len;
 
-            obj->state.seqnum2 = obj->state.seqnum1;
-            obj->state.timestamp2 = obj->state.timestamp1;
+        obj->wal_slots[obj->wal_first + used + i] = (ldb_wal_slot_t){
+            .timestamp = entry->timestamp,
+            .pos = pos,
+            .len = rec_len
+        };
 
-            if ((ret = ldb_append_record_idx(obj, &obj->state, &record_0)) != LDB_OK)
-                exit_function(ret);
+        pos += rec_len;
+    }
 
-            record_n = record_0;
+    *wstate = *state;
+
+    LDB_METRIC_ADD(obj, appended_entries, num);
+    LDB_METRIC_ADD(obj, appended_bytes, len);
+
+    return LDB_OK;
+}
+
+// Queues entries to be written to the stream (not written nor published).
+static int ldb_wal_append_entries(ldb_impl_t *obj, ldb_state_t *state, ldb_entry_t *entries, size_t len, size_t *num)
+{
+    ldb_wbuf_t *wbuf = &obj->wbuf;
+    int ret = LDB_OK;
+
+    if (wbuf->iov == NULL)
+    {
+        wbuf->entries = (const ldb_entry_t **) calloc(LDB_WRITE_MAX_ENTRIES, sizeof(ldb_entry_t *));
+        wbuf->iov = (struct iovec *) calloc(3 * LDB_WRITE_MAX_ENTRIES, sizeof(struct iovec));
+        obj->wal_records = (ldb_record_wal_t *) calloc(LDB_WRITE_MAX_ENTRIES, sizeof(ldb_record_wal_t));
+
+        if (!wbuf->entries || !wbuf->iov || !obj->wal_records) {
+            free((void *) wbuf->entries);
+            free(wbuf->iov);
+            free(obj->wal_records);
+            wbuf->entries = NULL;
+            wbuf->iov = NULL;
+            obj->wal_records = NULL;
+            return LDB_ERR_MEM;
         }
     }
-    else
+
+    for (size_t i = 0; i < len; i++)
     {
-        // check record_n content
-        size_t diff = record_n.seqnum - record_0.seqnum;
+        ldb_entry_t *entry = &entries[i];
 
-        if (record_n.seqnum < record_0.seqnum || record_n.timestamp < record_0.timestamp)
-            exit_function(LDB_ERR_FMT_IDX);
+        if (entry->seqnum == 0)
+            entry->seqnum = state->seqnum2 + 1;
 
-        if (pos != sizeof(ldb_header_idx_t) + (diff + 1) * sizeof(ldb_record_idx_t))
-            exit_function(LDB_ERR_FMT_IDX);
+        if (entry->timestamp == 0) 
+            entry->timestamp = ldb_max(ldb_get_millis(), state->timestamp2);
 
-        if (record_n.pos < sizeof(ldb_header_dat_t) + diff * sizeof(ldb_record_dat_t))
-            exit_function(LDB_ERR_FMT_IDX);
+        if (entry->metadata_len != 0 && entry->metadata == NULL)
+            return LDB_ERR_ENTRY_METADATA;
 
-        obj->state.seqnum2 = record_n.seqnum;
-        obj->state.timestamp2 = record_n.timestamp;
-    }
+        if (entry->data_len != 0 && entry->data == NULL)
+            return LDB_ERR_ENTRY_DATA;
 
-    // case no data
-    if (obj->state.seqnum1 == 0) {
-        obj->dat_end = sizeof(ldb_header_dat_t);
-        return LDB_OK;
-    }
+        if (state->seqnum2 != 0 && entry->seqnum != state->seqnum2 + 1)
+            return LDB_ERR_ENTRY_SEQNUM;
 
-    // read last record (dat)
-    pos = record_n.pos;
-    len = ldb_get_file_size(obj->dat_fp);
+        if (entry->timestamp < state->timestamp2)
+            return LDB_ERR_ENTRY_TIMESTAMP;
 
-    if (ldb_read_record_dat(obj->dat_fd, pos, &record_dat, true) != LDB_OK)
-        exit_function(LDB_ERR_FMT_IDX);
+        // stream shared by the logs (written in chunks to not hold it too long)
+        if (wbuf->num == LDB_WRITE_MAX_ENTRIES && (ret = ldb_wal_write(obj, state)) != LDB_OK)
+            return ret;
 
-    if (record_dat.seqnum != record_n.seqnum || record_dat.timestamp != record_n.timestamp)
-        exit_function(LDB_ERR_FMT_IDX);
+        ldb_record_wal_t *record = &obj->wal_records[wbuf->num];
 
-    pos += sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
+        *record = (ldb_record_wal_t){
+            .log_id = obj->wal_id,
+            .seqnum = entry->seqnum,
+            .timestamp = entry->timestamp,
+            .metadata_len = entry->metadata_len,
+            .data_len = entry->data_len,
+            .type = LDB_WAL_ENTRY
+        };
 
-    obj->dat_end = pos;
+        record->checksum = ldb_checksum_record_wal(record, entry->metadata, entry->data);
+
+        wbuf->entries[wbuf->num++] = entry;
+
+        if (state->seqnum1 == 0) {
+            state->seqnum1 = entry->seqnum;
+            state->timestamp1 = entry->timestamp;
+        }
+
+        state->seqnum2 = entry->seqnum;
+        state->timestamp2 = entry->timestamp;
+
+        (*num)++;
+    }
 
-    // add unflushed dat records (if any)
-    while (pos + sizeof(ldb_record_dat_t) <= len)
-    {
-        ret = ldb_read_record_dat(obj->dat_fd, pos, &record_dat, true);
+    return ret;
+}
 
-        if (ret == LDB_ERR_FMT_DAT)
-            break; // zeroize
+// Writes the queued records, waits the group sync (if force_fsync) and 
+// publishes the state covering the written records.
+static int ldb_wal_commit(ldb_impl_t *obj, ldb_state_t *state)
+{
+    ldb_state_t *wstate = &obj->wal_wstate;
+    int ret = ldb_wal_write(obj, state);
+    int rc = LDB_OK;
 
-        if (ret != LDB_OK)
-            exit_function(ret);
+    if (obj->force_fsync && wstate->seqnum1 != 0)
+    {
+        ldb_wal_slot_t *slot = &obj->wal_slots[obj->wal_first + (size_t)(wstate->seqnum2 - wstate->seqnum1)];
 
-        if (record_dat.seqnum == 0)
-            break; // zeroize
+        rc = ldb_wal_sync_to(obj->wal, obj, slot->pos + slot->len);
+    }
 
-        if (record_dat.seqnum != obj->state.seqnum2 + 1 || record_dat.timestamp < obj->state.timestamp2)
-            exit_function(LDB_ERR_FMT_DAT);
+    ldb_lock_data(obj);
 
-        record_n.seqnum = record_dat.seqnum;
-        record_n.timestamp = record_dat.timestamp;
-        record_n.pos = pos;
+    if (ret == LDB_OK && rc == LDB_OK && obj->force_fsync)
+        obj->durable_seqnum = wstate->seqnum2;
 
-        size_t rec_len = sizeof(ldb_record_dat_t) + record_dat.metadata_len + record_dat.data_len;
-        if (pos + rec_len > len)
-            break; // zeroize
+    ldb_publish_state(obj, wstate);
+    pthread_cond_broadcast(&obj->cond_state);
+    pthread_mutex_unlock(&obj->mutex_data);
 
-        pos += rec_len;
+    return (ret == LDB_OK ? rc : ret);
+}
 
-        obj->state.seqnum2 = record_dat.seqnum;
-        obj->state.timestamp2 = record_dat.timestamp;
-        obj->dat_end = pos;
+// Appends a rollback or purge marker of the log to the stream (synced if force_fsync).
+static int ldb_wal_write_marker(ldb_impl_t *obj, uint32_t type, uint64_t seqnum)
+{
+    uint64_t pos = 0;
+    int ret = LDB_OK;
 
-        if ((ret = ldb_append_record_idx(obj, &obj->state, &record_n)) != LDB_OK)
-            exit_function(ret);
+    ldb_record_wal_t record = {
+        .log_id = obj->wal_id,
+        .seqnum = seqnum,
+        .type = type
+    };
 
-        assert(obj->dat_end == pos);
-    }
+    record.checksum = ldb_checksum_record_wal(&record, NULL, NULL);
 
-    if (fflush(obj->idx_fp) != 0)
-        exit_function(LDB_ERR_WRITE_IDX);
+    struct iovec iov = { .iov_base = &record, .iov_len = sizeof(record) };
 
-    if (!ldb_zeroize(obj->dat_fp, pos))
-        exit_function(LDB_ERR_WRITE_DAT);
+    if ((ret = ldb_wal_write_stream(obj, &iov, 1, sizeof(record), false, &pos)) != LDB_OK)
+        return ret;
 
-    return LDB_OK;
+    if (obj->force_fsync)
+        ret = ldb_wal_sync_to(obj->wal, obj, pos + sizeof(record));
 
-LDB_OPEN_FILE_IDX_END:
-    if (obj->idx_fp != NULL) fclose(obj->idx_fp);
-    if (obj->idx_fd > STDERR_FILENO) close(obj->idx_fd);
-    obj->idx_fp = NULL;
-    obj->idx_fd = -1;
     return ret;
 }
 
-#undef exit_function
-
-const char * ldb_version(void)
+// Reads len entries starting at seqnum (in the state range) using the log slots.
+// Records contiguous in the stream are fetched with one read (up to 
+// LDB_READ_BUFFER_LEN bytes). Caller holds the file lock of the log (R).
+// Updates num with the number of entries read.
+static int ldb_wal_read_slots(ldb_impl_t *obj, ldb_state_t *state, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
 {
-    static char version_str[32] = {0};
+    ldb_wal_impl_t *wal = obj->wal;
+    const ldb_wal_slot_t *slots = obj->wal_slots + obj->wal_first + (size_t)(seqnum - state->seqnum1);
+    ldb_record_wal_t record = {0};
+    size_t buf_max = 0;
+    char *buf = NULL;
+    int ret = LDB_OK;
 
-    if (version_str[0] == 0) {
-        snprintf(version_str, sizeof(version_str), "%d.%d.%d", 
-                LDB_VERSION_MAJOR, LDB_VERSION_MINOR, LDB_VERSION_PATCH);
+    // uncompressed payloads fit in one block (headers size covers the alignment)
+    if (arena != NULL) {
+        size_t total = 0;
+        for (size_t i = 0; i < len; i++)
+            total += slots[i].len;
+        ldb_arena_reserve(arena, total);
     }
 
-    return version_str;
-}
+    pthread_rwlock_rdlock(&wal->lock_segs);
 
-#define exit_function(errnum) do { ret = errnum; goto LDB_OPEN_END; } while(0)
+    for (size_t i = 0; i < len && ret == LDB_OK; )
+    {
+        size_t k = ldb_wal_find_seg(wal, slots[i].pos);
+        ldb_wal_seg_t *seg = &wal->segs[k];
+        uint64_t seg_end = (k + 1 < wal->num_segs ? wal->segs[k + 1].pos : UINT64_MAX);
+        size_t read_len = slots[i].len;
+        size_t j = i + 1;
+
+        // records contiguous in the same segment
+        while (j < len && slots[j].pos == slots[j - 1].pos + slots[j - 1].len &&
+               slots[j].pos < seg_end && read_len + slots[j].len <= LDB_READ_BUFFER_LEN)
+            read_len += slots[j++].len;
+
+        if (read_len > buf_max)
+        {
+            char *ptr = (char *) realloc(buf, read_len);
 
-int ldb_open(ldb_impl_t *obj, const char *path, const char *name, bool check)
-{
-    if (path == NULL || name == NULL || obj == NULL)
-        return LDB_ERR_ARG;
+            if (ptr == NULL) {
+                ret = LDB_ERR_MEM;
+                break;
+            }
 
-    if (!ldb_is_valid_path(path))
-        return LDB_ERR_PATH;
+            buf = ptr;
+            buf_max = read_len;
+        }
 
-    if (!ldb_is_valid_name(name))
-        return  LDB_ERR_NAME;
+        LDB_METRIC_ADD(obj, read_calls, 1);
 
-    int ret = LDB_OK;
+        if (ldb_pread(seg->fd, buf, read_len, sizeof(ldb_header_wal_t) + (size_t)(slots[i].pos - seg->pos)) != (ssize_t) read_len) {
+            ret = LDB_ERR_READ_DAT;
+            break;
+        }
 
-    memset(obj, 0x00, sizeof(ldb_impl_t));
+        for (const char *ptr = buf; i < j; ptr += slots[i].len, i++)
+        {
+            ldb_entry_t *entry = entries + i;
 
-    obj->name = strdup(name);
-    pthread_mutex_init(&obj->mutex_data, NULL);
-    pthread_mutex_init(&obj->mutex_files, NULL);
-    obj->path = strdup(path);
-    obj->dat_path = ldb_create_filename(path, name, LDB_EXT_DAT);
-    obj->idx_path = ldb_create_filename(path, name, LDB_EXT_IDX);
-    obj->dat_end = sizeof(ldb_header_dat_t);
-    obj->dat_fd = -1;
-    obj->idx_fd = -1;
+            memcpy(&record, ptr, sizeof(ldb_record_wal_t));
 
-    if (!obj->name || !obj->path || !obj->dat_path || !obj->idx_path)
-        exit_function(LDB_ERR_MEM);
+            if (record.type != LDB_WAL_ENTRY || record.log_id != obj->wal_id || record.seqnum != seqnum + i ||
+                sizeof(ldb_record_wal_t) + record.metadata_len + record.data_len != slots[i].len) {
+                ret = LDB_ERR_FMT_WAL;
+                break;
+            }
 
-    // case dat file not exist
-    if (access(obj->dat_path, F_OK) != 0)
-    {
-        remove(obj->idx_path);
+            const char *metadata = ptr + sizeof(ldb_record_wal_t);
+            const char *data = metadata + record.metadata_len;
 
-        if (!ldb_create_file_dat(obj->dat_path))
-            exit_function(LDB_ERR_OPEN_DAT);
-    }
+            if (record.checksum != ldb_checksum_record_wal(&record, metadata, data)) {
+                LDB_METRIC_ADD(obj, checksum_errors, 1);
+                ret = LDB_ERR_CHECKSUM;
+                break;
+            }
 
-    // case idx file not exist
-    if (access(obj->idx_path, F_OK) != 0)
-    {
-        if (!ldb_create_file_idx(obj->idx_path))
-            exit_function(LDB_ERR_OPEN_IDX);
-    }
+            if (!ldb_alloc_entry_from(entry, record.metadata_len, record.data_len, arena)) {
+                ret = LDB_ERR_MEM;
+                break;
+            }
 
-    // open data file
-    if ((ret = ldb_open_file_dat(obj, check)) != LDB_OK)
-        exit_function(ret);
+            if (record.metadata_len)
+                memcpy(entry->metadata, metadata, record.metadata_len);
 
-    // open index file
-    ret = ldb_open_file_idx(obj, check);
-    switch(ret)
-    {
-        case LDB_OK:
-            break;
-        case LDB_ERR_OPEN_IDX:
-        case LDB_ERR_READ_IDX:
-        case LDB_ERR_WRITE_IDX:
-        case LDB_ERR_FMT_IDX:
-            // try to rebuild the index file
-            remove(obj->idx_path);
-            if (!ldb_create_file_idx(obj->idx_path))
-                exit_function(LDB_ERR_OPEN_IDX);
-            if ((ret = ldb_open_file_idx(obj, true)) != LDB_OK)
-                exit_function(ret);
-            break;
-        default:
-            exit_function(ret);
-    }
+            if (record.data_len)
+                memcpy(entry->data, data, record.data_len);
 
-    assert(!feof(obj->dat_fp));
-    assert(!feof(obj->idx_fp));
-    assert(!ferror(obj->dat_fp));
-    assert(!ferror(obj->idx_fp));
-    assert(obj->dat_fd > STDERR_FILENO);
-    assert(obj->idx_fd > STDERR_FILENO);
+            entry->seqnum = record.seqnum;
+            entry->timestamp = record.timestamp;
 
-    return LDB_OK;
+            (*num)++;
+        }
+    }
 
-LDB_OPEN_END:
-    ldb_close(obj);
+    pthread_rwlock_unlock(&wal->lock_segs);
+
+    free(buf);
     return ret;
 }
 
-#undef exit_function
+#define exit_function(errnum) do { ret = errnum; goto LDB_WAL_READ_END; } while(0)
 
-int ldb_append(ldb_impl_t *obj, ldb_entry_t *entries, size_t len, size_t *num)
+static int ldb_wal_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num, ldb_arena_t *arena)
 {
-    if (!obj || !entries)
-        return LDB_ERR_ARG;
+    ldb_rdlock_files(obj);
+
+    int ret = LDB_ERR;
+    ldb_state_t state;
+    uint64_t last = 0;
+    size_t count = 0;
 
     if (!ldb_is_valid_db(obj))
-        return LDB_ERR;
+        exit_function(LDB_ERR);
+
+    ldb_load_state(obj, &state);
+
+    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
+        exit_function(LDB_ERR_NOT_FOUND);
+
+    last = (len - 1 < state.seqnum2 - seqnum ? seqnum + len - 1 : state.seqnum2);
+
+    ret = ldb_wal_read_slots(obj, &state, seqnum, entries, (size_t)(last - seqnum + 1), &count, arena);
 
     if (num != NULL)
-        *num = 0;
+        *num = count;
+    ldb_metrics_read(obj, entries, count);
 
-    if (len == 0)
-        return LDB_OK;
+LDB_WAL_READ_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    return ret;
+}
+
+#undef exit_function
+
+static int ldb_wal_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats)
+{
+    ldb_rdlock_files(obj);
 
-    size_t i;
-    int ret = LDB_OK;
     ldb_state_t state;
 
-    pthread_mutex_lock(&obj->mutex_data);
-    state = obj->state;
-    pthread_mutex_unlock(&obj->mutex_data);
+    ldb_load_state(obj, &state);
 
-    for (i = 0; i < len; i++)
+    if (state.seqnum1 != 0 && seqnum1 <= state.seqnum2 && state.seqnum1 <= seqnum2)
     {
-        if (entries[i].seqnum == 0)
-            entries[i].seqnum = state.seqnum2 + 1;
-
-        if (entries[i].timestamp == 0) 
-            entries[i].timestamp = ldb_max(ldb_get_millis(), state.timestamp2);
+        seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
+        seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
 
-        ldb_record_idx_t record_idx = {
-            .seqnum = entries[i].seqnum,
-            .timestamp = entries[i].timestamp,
-            .pos = obj->dat_end
-        };
+        const ldb_wal_slot_t *slots = obj->wal_slots + obj->wal_first + (size_t)(seqnum1 - state.seqnum1);
+        size_t num = (size_t)(seqnum2 - seqnum1 + 1);
 
-        if ((ret = ldb_append_entry_dat(obj, &state, &entries[i])) != LDB_OK)
-            break;
+        stats->min_seqnum = seqnum1;
+        stats->min_timestamp = slots[0].timestamp;
+        stats->max_seqnum = seqnum2;
+        stats->max_timestamp = slots[num - 1].timestamp;
+        stats->num_entries = num;
+        stats->index_size = num * sizeof(ldb_wal_slot_t);
 
-        if ((ret = ldb_append_record_idx(obj, &state, &record_idx)) != LDB_OK)
-            break;
+        for (size_t i = 0; i < num; i++)
+            stats->data_size += slots[i].len;
 
-        if (num != NULL)
-            (*num)++;
+        stats->raw_data_size = stats->data_size;
     }
 
-    if (i == 0)
-        return ret;
+    pthread_rwlock_unlock(&obj->lock_files);
+    return LDB_OK;
+}
 
-    if (fflush(obj->dat_fp) != 0)
-        ret = (ret == LDB_OK ? LDB_ERR_WRITE_DAT : ret);
+static int ldb_wal_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum)
+{
+    ldb_rdlock_files(obj);
 
-    if (fflush(obj->idx_fp) != 0)
-        ret = (ret == LDB_OK ? LDB_ERR_WRITE_IDX : ret);
+    int ret = LDB_ERR_NOT_FOUND;
+    ldb_state_t state;
 
-    if (obj->force_fsync && fdatasync(fileno(obj->dat_fp)) == -1)
-        ret = (ret == LDB_OK ? LDB_ERR_WRITE_DAT : ret);
+    ldb_load_state(obj, &state);
 
-    pthread_mutex_lock(&obj->mutex_data);
-    obj->state = state;
-    pthread_mutex_unlock(&obj->mutex_data);
+    if (state.seqnum1 != 0)
+    {
+        const ldb_wal_slot_t *slots = obj->wal_slots + obj->wal_first;
+        size_t num = (size_t)(state.seqnum2 - state.seqnum1 + 1);
+        size_t lo = 0;
+        size_t hi = num;
+
+        // first entry fulfilling the criteria (in-memory)
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            uint64_t ts = slots[mid].timestamp;
+
+            if (ts < timestamp || (mode == LDB_SEARCH_UPPER && ts == timestamp))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
 
+        if (lo < num) {
+            *seqnum = state.seqnum1 + lo;
+            ret = LDB_OK;
+        }
+    }
+
+    pthread_rwlock_unlock(&obj->lock_files);
     return ret;
 }
 
-#define exit_function(errnum) do { ret = errnum; goto LDB_READ_END; } while(0)
+#define exit_function(errnum) do { ret = errnum; goto LDB_WAL_ROLLBACK_END; } while(0)
 
-int ldb_read(ldb_impl_t *obj, uint64_t seqnum, ldb_entry_t *entries, size_t len, size_t *num)
+static long ldb_wal_rollback(ldb_impl_t *obj, uint64_t seqnum)
 {
-    if (!obj || !entries || len == 0)
-        return LDB_ERR_ARG;
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_wrlock_files(obj);
 
-    if (num != NULL)
-        *num = 0;
+    long ret = LDB_ERR;
+    long removed_entries = 0;
+    ldb_state_t state = obj->state;
 
-    for (size_t i = 0; i < len; i++) {
-        entries[i].seqnum = 0;
-        entries[i].timestamp = 0;
-    }
+    if (state.seqnum1 == 0 || state.seqnum2 <= seqnum)
+        exit_function(0);
 
-    pthread_mutex_lock(&obj->mutex_files);
+    // remove all
+    if (seqnum < state.seqnum1)
+        seqnum = 0;
 
-    int ret = LDB_ERR;
-    ldb_state_t state;
-    ldb_record_idx_t record_idx = {0};
+    removed_entries = (long)(state.seqnum2 - ldb_max(seqnum + 1, state.seqnum1) + 1);
 
-    if (!ldb_is_valid_db(obj))
-        exit_function(LDB_ERR);
+    if ((ret = ldb_wal_write_marker(obj, LDB_WAL_ROLLBACK, seqnum)) != LDB_OK)
+        exit_function(ret);
 
-    pthread_mutex_lock(&obj->mutex_data);
-    state = obj->state;
+    ldb_wal_truncate(obj, &state, seqnum);
+    obj->wal_wstate = state;
+
+    // update status (waiters are notified)
+    ldb_lock_data(obj);
+    ldb_publish_state(obj, &state);
+    obj->wal_pos1 = (state.seqnum1 == 0 ? UINT64_MAX : obj->wal_pos1);
+    ldb_clamp_durable(obj);
+    obj->rollback_id++;
+    pthread_cond_broadcast(&obj->cond_state);
     pthread_mutex_unlock(&obj->mutex_data);
 
-    if (seqnum == 0 || seqnum < state.seqnum1 || seqnum > state.seqnum2)
-        exit_function(LDB_ERR_NOT_FOUND);
+    ret = removed_entries;
 
-    for (size_t i = 0; i < len && seqnum <= state.seqnum2; i++)
-    {
-        if ((ret = ldb_read_record_idx(obj->idx_fd, &state, seqnum, &record_idx)) != LDB_OK)
-            exit_function(ret);
+LDB_WAL_ROLLBACK_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+    return ret;
+}
 
-        if ((ret = ldb_read_entry_dat(obj->dat_fd, record_idx.pos, entries + i)) != LDB_OK)
-            exit_function(ret);
+#undef exit_function
 
-        if (entries[i].seqnum != seqnum)
-            exit_function(LDB_ERR);
+// Removes the segments preceding the first record of all logs (oldest first)
+static void ldb_wal_reclaim(ldb_wal_impl_t *wal)
+{
+    pthread_mutex_lock(&wal->mutex_write);
 
-        seqnum++;
+    uint64_t pos1 = wal->end_pos;
+    size_t k = 0;
 
-        if (num != NULL)
-            (*num)++;
+    pthread_mutex_lock(&wal->mutex_logs);
+
+    for (size_t i = 0; i < wal->num_logs; i++) {
+        ldb_lock_data(wal->logs[i]);
+        pos1 = ldb_min(pos1, wal->logs[i]->wal_pos1);
+        pthread_mutex_unlock(&wal->logs[i]->mutex_data);
     }
 
-    ret = LDB_OK;
+    pthread_mutex_unlock(&wal->mutex_logs);
 
-LDB_READ_END:
-    pthread_mutex_unlock(&obj->mutex_files);
-    return ret;
-}
+    while (k + 1 < wal->num_segs && wal->segs[k + 1].pos <= pos1)
+        k++;
 
-#undef exit_function
-#define exit_function(errnum) do { ret = errnum; goto LDB_STATS_END; } while(0)
+    if (k > 0)
+    {
+        pthread_rwlock_wrlock(&wal->lock_segs);
 
-int ldb_stats(ldb_impl_t *obj, uint64_t seqnum1, uint64_t seqnum2, ldb_stats_t *stats)
-{
-    if (!obj || seqnum2 < seqnum1 || !stats)
-        return LDB_ERR_ARG;
+        for (size_t i = 0; i < k; i++)
+        {
+            char *filepath = ldb_wal_filename(wal, wal->seg_first_id + i);
 
-    memset(stats, 0x00, sizeof(ldb_stats_t));
+            close(wal->segs[i].fd);
 
-    pthread_mutex_lock(&obj->mutex_files);
+            if (filepath != NULL)
+                remove(filepath);
 
-    int ret = LDB_ERR;
-    ldb_state_t state;
-    ldb_record_idx_t record1 = {0};
-    ldb_record_idx_t record2 = {0};
-    ldb_record_dat_t record_dat = {0};
+            free(filepath);
+        }
 
-    if (!ldb_is_valid_db(obj))
-        exit_function(LDB_ERR);
+        memmove(wal->segs, wal->segs + k, (wal->num_segs - k) * sizeof(ldb_wal_seg_t));
+        wal->num_segs -= k;
+        wal->seg_first_id += k;
 
-    pthread_mutex_lock(&obj->mutex_data);
-    state = obj->state;
-    pthread_mutex_unlock(&obj->mutex_data);
+        pthread_rwlock_unlock(&wal->lock_segs);
+    }
 
-    if (state.seqnum1 == 0 || seqnum2 < state.seqnum1 || state.seqnum2 < seqnum1)
-        exit_function(LDB_OK);
+    pthread_mutex_unlock(&wal->mutex_write);
+}
 
-    seqnum1 = ldb_clamp(seqnum1, state.seqnum1, state.seqnum2);
-    seqnum2 = ldb_clamp(seqnum2, state.seqnum1, state.seqnum2);
+#define exit_function(errnum) do { ret = errnum; goto LDB_WAL_PURGE_END; } while(0)
 
-    if ((ret = ldb_read_record_idx(obj->idx_fd, &state, seqnum1, &record1)) != LDB_OK)
-        exit_function(ret);
+static long ldb_wal_purge(ldb_impl_t *obj, uint64_t seqnum)
+{
+    pthread_mutex_lock(&obj->mutex_write);
+    ldb_wrlock_files(obj);
 
-    if ((ret = ldb_read_record_idx(obj->idx_fd, &state, seqnum2, &record2)) != LDB_OK)
-        exit_function(ret);
+    long ret = LDB_ERR;
+    long removed_entries = 0;
+    ldb_state_t state = obj->state;
 
-    if (record2.pos < record1.pos + (record2.seqnum - record1.seqnum) * sizeof(ldb_record_dat_t))
-        exit_function(LDB_ERR);
+    if (seqnum <= state.seqnum1 || state.seqnum1 == 0)
+        exit_function(0);
+
+    if (state.seqnum2 < seqnum)
+        removed_entries = (long) state.seqnum2 - (long) state.seqnum1 + 1;
+    else
+        removed_entries = (long) seqnum - (long) state.seqnum1;
 
-    if ((ret = ldb_read_record_dat(obj->dat_fd, record2.pos, &record_dat, false)) != LDB_OK)
+    if ((ret = ldb_wal_write_marker(obj, LDB_WAL_PURGE, seqnum)) != LDB_OK)
         exit_function(ret);
 
-    if (record_dat.seqnum != seqnum2)
-        exit_function(LDB_ERR);
+    ldb_wal_trim(obj, &state, seqnum);
+    obj->wal_wstate = state;
 
-    stats->min_seqnum = record1.seqnum;
-    stats->min_timestamp = record1.timestamp;
-    stats->max_seqnum = record2.seqnum;
-    stats->max_timestamp = record2.timestamp;
-    stats->num_entries = seqnum2 - seqnum1 + 1;
-    stats->index_size = sizeof(ldb_record_idx_t) * stats->num_entries;
-    stats->data_size = record2.pos - record1.pos + sizeof(ldb_record_dat_t) +
-                       record_dat.metadata_len + record_dat.data_len;
+    // cursors must seek again
+    ldb_lock_data(obj);
+    ldb_publish_state(obj, &state);
+    obj->wal_pos1 = (state.seqnum1 == 0 ? UINT64_MAX : obj->wal_slots[obj->wal_first].pos);
+    ldb_clamp_durable(obj);
+    obj->purge_id++;
+    pthread_mutex_unlock(&obj->mutex_data);
 
-    ret = LDB_OK;
+    ret = removed_entries;
+
+LDB_WAL_PURGE_END:
+    pthread_rwlock_unlock(&obj->lock_files);
+    pthread_mutex_unlock(&obj->mutex_write);
+
+    if (ret > 0)
+        ldb_wal_reclaim(obj->wal);
 
-LDB_STATS_END:
-    pthread_mutex_unlock(&obj->mutex_files);
     return ret;
 }
 
 #undef exit_function
-#define exit_function(errnum) do { ret = errnum; goto LDB_SEARCH_END; } while(0)
 
-int ldb_search(ldb_impl_t *obj, uint64_t timestamp, ldb_search_e mode, uint64_t *seqnum)
+// Applies a record read on open to its log
+static int ldb_wal_apply(ldb_wal_impl_t *wal, const ldb_record_wal_t *record, uint64_t pos, size_t len)
 {
-    if (!obj || !seqnum || (mode != LDB_SEARCH_LOWER && mode != LDB_SEARCH_UPPER))
-        return LDB_ERR_ARG;
+    ldb_impl_t *obj = NULL;
+    size_t i = ldb_wal_find_log(wal, record->log_id);
 
-    *seqnum = 0;
+    if (i < wal->num_logs && wal->logs[i]->wal_id == record->log_id)
+        obj = wal->logs[i];
 
-    pthread_mutex_lock(&obj->mutex_files);
+    // markers of logs without entries
+    if (obj == NULL && record->type != LDB_WAL_ENTRY)
+        return LDB_OK;
 
-    int ret = LDB_ERR;
-    ldb_state_t state;
-    ldb_record_idx_t record = {0};
-    uint64_t sn1 = 0;
-    uint64_t sn2 = 0;
-    uint64_t ts1 = 0;
-    uint64_t ts2 = 0;
+    if (obj == NULL && (obj = ldb_wal_get_log(wal, record->log_id)) == NULL)
+        return LDB_ERR_MEM;
 
-    if (!ldb_is_valid_db(obj))
-        exit_function(LDB_ERR);
+    ldb_state_t *state = &obj->state;
 
-    pthread_mutex_lock(&obj->mutex_data);
-    state = obj->state;
-    pthread_mutex_unlock(&obj->mutex_data);
+    if (record->type == LDB_WAL_ROLLBACK) {
+        ldb_wal_truncate(obj, state, record->seqnum);
+        return LDB_OK;
+    }
 
-    if (state.seqnum1 == 0)
-        exit_function(LDB_ERR_NOT_FOUND);
+    if (record->type == LDB_WAL_PURGE) {
+        ldb_wal_trim(obj, state, record->seqnum);
+        return LDB_OK;
+    }
 
-    if (mode == LDB_SEARCH_LOWER && state.timestamp2 < timestamp)
-        exit_function(LDB_ERR_NOT_FOUND);
+    if (record->seqnum == 0 || 
+        (state->seqnum1 != 0 && (record->seqnum != state->seqnum2 + 1 || record->timestamp < state->timestamp2)))
+        return LDB_ERR_FMT_WAL;
 
-    if (mode == LDB_SEARCH_UPPER && state.timestamp2 <= timestamp)
-        exit_function(LDB_ERR_NOT_FOUND);
+    size_t used = (state->seqnum1 == 0 ? 0 : (size_t)(state->seqnum2 - state->seqnum1 + 1));
 
-    if (mode == LDB_SEARCH_LOWER && timestamp <= state.timestamp1) {
-        *seqnum = state.seqnum1;
-        exit_function(LDB_OK);
-    }
+    if (!ldb_wal_reserve(obj, used + 1, used))
+        return LDB_ERR_MEM;
 
-    if (mode == LDB_SEARCH_UPPER && timestamp < state.timestamp1) {
-        *seqnum = state.seqnum1;
-        exit_function(LDB_OK);
+    obj->wal_slots[obj->wal_first + used] = (ldb_wal_slot_t){
+        .timestamp = record->timestamp,
+        .pos = pos,
+        .len = len
+    };
+
+    if (state->seqnum1 == 0) {
+        state->seqnum1 = record->seqnum;
+        state->timestamp1 = record->timestamp;
     }
 
-    sn1 = state.seqnum1;
-    sn2 = state.seqnum2;
-    ts1 = state.timestamp1;
-    ts2 = state.timestamp2;
+    state->seqnum2 = record->seqnum;
+    state->timestamp2 = record->timestamp;
 
-    assert(ts1 <= timestamp && timestamp <= ts2);
+    return LDB_OK;
+}
 
-    while (sn1 + 1 < sn2 && ts1 != ts2)
+// Returns a pointer to the file bytes [off, off + len), refilling the buffer from off if 
+// required (len <= LDB_WAL_SCAN_LEN). Returns NULL on read error or eof.
+static const char * ldb_wal_fetch(int fd, char *buf, size_t *buf_pos, size_t *buf_end, size_t off, size_t len)
+{
+    if (off < *buf_pos || off + len > *buf_end)
     {
-        uint64_t sn = (sn1 + sn2) / 2;
-
-        if ((ret = ldb_read_record_idx(obj->idx_fd, &state, sn, &record)) != LDB_OK)
-            exit_function(ret);
+        ssize_t rc = ldb_pread(fd, buf, LDB_WAL_SCAN_LEN, off);
 
-        uint64_t ts = record.timestamp;
+        if (rc == -1)
+            return NULL;
 
-        if (ts < timestamp) {
-            sn1 = sn;
-            ts1 = ts;
-        }
-        else if (timestamp < ts || mode == LDB_SEARCH_LOWER) {
-            sn2 = sn;
-            ts2 = ts;
-        }
-        else {
-            sn1 = sn;
-            ts1 = ts;
-        }
+        *buf_pos = off;
+        *buf_end = off + (size_t) rc;
     }
 
-    *seqnum = sn2;
-
-    ret = LDB_OK;
-
-LDB_SEARCH_END:
-    pthread_mutex_unlock(&obj->mutex_files);
-    return ret;
+    return (off + len <= *buf_end ? buf + (off - *buf_pos) : NULL);
 }
 
-#undef exit_function
-#define exit_function(errnum) do { ret = errnum; goto LDB_ROLLBACK_END; } while(0)
+#define exit_function(errnum) do { ret = errnum; goto LDB_WAL_SCAN_END; } while(0)
 
-long ldb_rollback(ldb_impl_t *obj, uint64_t seqnum)
+// Replays the records of the i-th segment and updates end_pos.
+// Checksums are verified if check is set or if it is the last segment.
+// A torn or corrupted tail of the last segment is truncated.
+static int ldb_wal_scan(ldb_wal_impl_t *wal, size_t i, bool check)
 {
-    if (!obj)
-        return LDB_ERR_ARG;
-
-    pthread_mutex_lock(&obj->mutex_files);
+    ldb_wal_seg_t *seg = &wal->segs[i];
+    bool last = (i + 1 == wal->num_segs);
+    size_t off = sizeof(ldb_header_wal_t);
+    size_t buf_pos = off;
+    size_t buf_end = off;
+    struct stat st = {0};
+    ldb_record_wal_t record = {0};
+    char *buf = NULL;
+    char *big = NULL;
+    bool torn = false;
+    int ret = LDB_OK;
 
-    long ret = LDB_ERR;
-    long removed_entries = 0;
-    uint64_t csn = 0;
-    ldb_record_idx_t record_idx = {0};
-    size_t dat_end_new = sizeof(ldb_header_dat_t);
-    uint64_t last_timestamp_new = 0;
+    // segments are contiguous
+    if (i > 0 && seg->pos != wal->end_pos)
+        exit_function(LDB_ERR_FMT_WAL);
 
-    if (!ldb_is_valid_db(obj))
-        exit_function(LDB_ERR);
+    if (fstat(seg->fd, &st) != 0)
+        exit_function(LDB_ERR_READ_DAT);
 
-    // case nothing to rollback
-    if (obj->state.seqnum2 <= seqnum)
-        exit_function(0);
+    if ((buf = (char *) malloc(LDB_WAL_SCAN_LEN)) == NULL)
+        exit_function(LDB_ERR_MEM);
 
-    removed_entries = (long) obj->state.seqnum2 - (long) ldb_max(seqnum, obj->state.seqnum1 - 1);
-    csn = obj->state.seqnum2;
+    size_t file_len = (size_t) st.st_size;
 
-    if (seqnum >= obj->state.seqnum1)
+    while (off < file_len)
     {
-        if ((ret = ldb_read_record_idx(obj->idx_fd, &obj->state, seqnum, &record_idx)) != LDB_OK)
-            exit_function(ret);
+        const char *ptr = NULL;
 
-        last_timestamp_new = record_idx.timestamp;
+        if (off + sizeof(ldb_record_wal_t) > file_len) {
+            torn = true;
+            break;
+        }
 
-        if ((ret = ldb_read_record_idx(obj->idx_fd, &obj->state, seqnum + 1, &record_idx)) != LDB_OK)
-            exit_function(ret);
+        if ((ptr = ldb_wal_fetch(seg->fd, buf, &buf_pos, &buf_end, off, sizeof(ldb_record_wal_t))) == NULL)
+            exit_function(LDB_ERR_READ_DAT);
 
-        dat_end_new = record_idx.pos;
-    }
+        memcpy(&record, ptr, sizeof(ldb_record_wal_t));
 
-    memset(&record_idx, 0x00, sizeof(ldb_record_idx_t));
+        size_t rec_len = sizeof(ldb_record_wal_t) + record.metadata_len + record.data_len;
 
-    // set index entries to 0 (from top to down)
-    while (seqnum < csn && obj->state.seqnum1 <= csn)
-    {
-        size_t pos = ldb_get_pos_idx(&obj->state, csn);
+        if (record.type < LDB_WAL_ENTRY || record.type > LDB_WAL_PURGE || off + rec_len > file_len ||
+            (record.type != LDB_WAL_ENTRY && rec_len != sizeof(ldb_record_wal_t))) {
+            torn = true;
+            break;
+        }
 
-        if (fseek(obj->idx_fp, (long) pos, SEEK_SET) != 0)
-            exit_function(LDB_ERR_READ_IDX);
+        if (check || last)
+        {
+            // case big record (read directly)
+            if (rec_len > LDB_WAL_SCAN_LEN)
+            {
+                if ((big = (char *) malloc(rec_len)) == NULL)
+                    exit_function(LDB_ERR_MEM);
 
-        if (fwrite(&record_idx, sizeof(ldb_record_idx_t), 1, obj->idx_fp) != 1)
-            exit_function(LDB_ERR_WRITE_IDX);
+                if (ldb_pread(seg->fd, big, rec_len, off) != (ssize_t) rec_len)
+                    exit_function(LDB_ERR_READ_DAT);
 
-        csn--;
-    }
+                ptr = big;
+            }
+            else if ((ptr = ldb_wal_fetch(seg->fd, buf, &buf_pos, &buf_end, off, rec_len)) == NULL)
+                exit_function(LDB_ERR_READ_DAT);
 
-    if (fflush(obj->idx_fp) != 0)
-        exit_function(LDB_ERR_WRITE_IDX);
+            const char *metadata = ptr + sizeof(ldb_record_wal_t);
+            uint32_t checksum = ldb_checksum_record_wal(&record, metadata, metadata + record.metadata_len);
 
-    // update status
-    if (seqnum < obj->state.seqnum1) {
-        obj->state.seqnum1 = 0;
-        obj->state.timestamp1 = 0;
-        obj->state.seqnum2 = 0;
-        obj->state.timestamp2 = 0;
-        obj->dat_end = sizeof(ldb_header_dat_t);
-    }
-    else {
-        obj->state.seqnum2 = seqnum;
-        obj->state.timestamp2 = last_timestamp_new;
-        obj->dat_end = dat_end_new;
+            free(big);
+            big = NULL;
+
+            if (record.checksum != checksum) {
+                torn = true;
+                break;
+            }
+        }
+
+        if ((ret = ldb_wal_apply(wal, &record, seg->pos + (off - sizeof(ldb_header_wal_t)), rec_len)) != LDB_OK)
+            exit_function(ret);
+
+        off += rec_len;
     }
 
-    // set data entries to 0 (from down to top)
-    if (!ldb_zeroize(obj->dat_fp, dat_end_new))
-        exit_function(LDB_ERR_WRITE_DAT);
+    if (torn && !last)
+        exit_function(LDB_ERR_FMT_WAL);
 
-    if (fflush(obj->dat_fp) != 0)
+    if (torn && ftruncate(seg->fd, (off_t) off) != 0)
         exit_function(LDB_ERR_WRITE_DAT);
 
-    if (obj->force_fsync && fdatasync(fileno(obj->dat_fp)) == -1)
+    if (last && lseek(seg->fd, (off_t) off, SEEK_SET) == -1)
         exit_function(LDB_ERR_WRITE_DAT);
 
-    ret = removed_entries;
+    wal->end_pos = seg->pos + (off - sizeof(ldb_header_wal_t));
 
-LDB_ROLLBACK_END:
-    pthread_mutex_unlock(&obj->mutex_files);
+LDB_WAL_SCAN_END:
+    free(big);
+    free(buf);
     return ret;
 }
 
 #undef exit_function
-#define exit_function(errnum) do { ret = errnum; goto LDB_PURGE_END; } while(0)
 
-long ldb_purge(ldb_impl_t *obj, uint64_t seqnum)
+// Opens the existing segment with the given id and appends it to the list.
+// An invalid header is only accepted in the last segment (interrupted creation),
+// its file is removed.
+static int ldb_wal_open_seg(ldb_wal_impl_t *wal, uint64_t id, bool last)
 {
-    if (!obj)
-        return LDB_ERR_ARG;
+    char *filepath = ldb_wal_filename(wal, id);
+    ldb_header_wal_t header = {0};
+    ldb_wal_seg_t *segs = NULL;
+    int ret = LDB_OK;
+    int fd = -1;
 
-    pthread_mutex_lock(&obj->mutex_files);
+    if (filepath == NULL)
+        return LDB_ERR_MEM;
 
-    int ret = LDB_ERR;
-    long removed_entries = 0;
-    ldb_record_idx_t record_idx = {0};
-    ldb_record_dat_t record_dat = {0};
-    char *tmp_path = NULL;
-    FILE *tmp_fp = NULL;
-    size_t pos = 0;
-    ldb_header_dat_t header = {
-        .magic_number = LDB_MAGIC_NUMBER,
-        .format = LDB_FORMAT_1,
-        .text = {0}
-    };
+    if ((fd = open(filepath, O_RDWR)) == -1) {
+        free(filepath);
+        return LDB_ERR_OPEN_WAL;
+    }
 
-    if (!ldb_is_valid_db(obj))
-        exit_function(LDB_ERR);
+    if (ldb_pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic_number != LDB_MAGIC_NUMBER ||
+        header.format != LDB_FORMAT_DEFAULT ||
+        header.checksum != ldb_checksum_header_wal(&header))
+    {
+        close(fd);
+        fd = -1;
+        ret = LDB_ERR_FMT_WAL;
 
-    // case no entries to purge
-    if (seqnum <= obj->state.seqnum1 || obj->state.seqnum1 == 0) {
-        pthread_mutex_unlock(&obj->mutex_files);
-        return 0;
+        if (last) {
+            remove(filepath);
+            ret = LDB_OK;
+        }
     }
 
-    // case purge all entries
-    if (obj->state.seqnum2 < seqnum)
-    {
-        removed_entries = (long) obj->state.seqnum2 - (long) obj->state.seqnum1 + 1;
+    free(filepath);
 
-        ldb_close_files(obj);
-        ldb_reset_state(&obj->state);
+    if (fd == -1)
+        return ret;
 
-        remove(obj->dat_path);
-        remove(obj->idx_path);
+    if ((segs = (ldb_wal_seg_t *) realloc(wal->segs, (wal->num_segs + 1) * sizeof(ldb_wal_seg_t))) == NULL) {
+        close(fd);
+        return LDB_ERR_MEM;
+    }
 
-        if (!ldb_create_file_dat(obj->dat_path))
-            exit_function(LDB_ERR_OPEN_DAT);
+    wal->segs = segs;
+    wal->segs[wal->num_segs++] = (ldb_wal_seg_t){ .pos = header.pos, .fd = fd };
 
-        if (!ldb_create_file_idx(obj->idx_path))
-            exit_function(LDB_ERR_OPEN_IDX);
+    return LDB_OK;
+}
 
-        if ((ret = ldb_open_file_dat(obj, false)) != LDB_OK)
-            exit_function(ret);
+// Finds the ids of the existing segments (they must be consecutive).
+// Sets id1 = 0 if there are no segments.
+static int ldb_wal_list(ldb_wal_impl_t *wal, uint64_t *id1, uint64_t *id2)
+{
+    DIR *dir = opendir(*wal->path == 0 ? "." : wal->path);
+    size_t len = strlen(wal->name);
+    struct dirent *ent = NULL;
+    uint64_t num = 0;
 
-        if ((ret = ldb_open_file_idx(obj, false)) != LDB_OK)
-            exit_function(ret);
+    *id1 = 0;
+    *id2 = 0;
+
+    if (dir == NULL)
+        return LDB_ERR_PATH;
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+        const char *str = ent->d_name;
+        char *end = NULL;
+
+        if (strncmp(str, wal->name, len) != 0 || str[len] != '_' || !isdigit((unsigned char) str[len + 1]))
+            continue;
+
+        uint64_t id = (uint64_t) strtoull(str + len + 1, &end, 10);
+
+        if (id == 0 || strcmp(end, LDB_EXT_WAL) != 0)
+            continue;
 
-        pthread_mutex_unlock(&obj->mutex_files);
-        return removed_entries;
+        *id1 = (*id1 == 0 ? id : (id < *id1 ? id : *id1));
+        *id2 = ldb_max(*id2, id);
+        num++;
     }
 
-    // case purge some entries
+    closedir(dir);
+
+    return (num == 0 || *id2 - *id1 + 1 == num ? LDB_OK : LDB_ERR_FMT_WAL);
+}
+
+#define exit_function(errnum) do { ret = errnum; goto LDB_WAL_OPEN_END; } while(0)
+
+int ldb_wal_open(ldb_wal_impl_t *wal, const char *path, const char *name, size_t segment_len, bool check)
+{
+    if (path == NULL || name == NULL || wal == NULL || segment_len == 0)
+        return LDB_ERR_ARG;
+
+    if (!ldb_is_valid_path(path))
+        return LDB_ERR_PATH;
+
+    if (!ldb_is_valid_name(name) || strlen(name) > LDB_SEG_NAME_MAX_LENGTH)
+        return  LDB_ERR_NAME;
+
+    int ret = LDB_OK;
+    uint64_t id1 = 0;
+    uint64_t id2 = 0;
+
+    memset(wal, 0x00, sizeof(ldb_wal_impl_t));
+
+    pthread_mutex_init(&wal->mutex_logs, NULL);
+    pthread_mutex_init(&wal->mutex_write, NULL);
+    pthread_rwlock_init(&wal->lock_segs, NULL);
+    pthread_mutex_init(&wal->mutex_sync, NULL);
+    pthread_cond_init(&wal->cond_sync, NULL);
+    wal->name = strdup(name);
+    wal->path = strdup(path);
+    wal->seg_max_len = segment_len;
 
-    removed_entries = (long) seqnum - (long) obj->state.seqnum1;
+    if (!wal->name || !wal->path)
+        exit_function(LDB_ERR_MEM);
 
-    if ((ret = ldb_read_record_idx(obj->idx_fd, &obj->state, seqnum, &record_idx)) != LDB_OK)
+    if ((ret = ldb_wal_list(wal, &id1, &id2)) != LDB_OK)
         exit_function(ret);
 
-    pos = record_idx.pos;
+    wal->seg_first_id = (id1 == 0 ? 1 : id1);
+
+    for (uint64_t id = id1; id1 != 0 && id <= id2; id++)
+    {
+        if ((ret = ldb_wal_open_seg(wal, id, id == id2)) != LDB_OK)
+            exit_function(ret);
+    }
+
+    for (size_t i = 0; i < wal->num_segs; i++)
+    {
+        if ((ret = ldb_wal_scan(wal, i, check)) != LDB_OK)
+            exit_function(ret);
+    }
 
-    if ((ret = ldb_read_record_dat(obj->dat_fd, pos, &record_dat, true)) != LDB_OK)
+    // case new wal (or interrupted creation of the first segment)
+    if (wal->num_segs == 0 && (ret = ldb_wal_add_seg(wal)) != LDB_OK)
         exit_function(ret);
 
-    if (record_dat.seqnum != seqnum)
-        exit_function(LDB_ERR_FMT_IDX);
+    for (size_t i = 0; i < wal->num_logs; i++)
+    {
+        ldb_impl_t *obj = wal->logs[i];
 
-    if ((tmp_path = ldb_create_filename(obj->path, obj->name, LDB_EXT_TMP)) == NULL)
-        exit_function(LDB_ERR_MEM);
+        obj->wal_wstate = obj->state;
+        obj->wal_pos1 = (obj->state.seqnum1 == 0 ? UINT64_MAX : obj->wal_slots[obj->wal_first].pos);
+    }
 
-    if ((tmp_fp = fopen(tmp_path, "w")) == NULL)
-        exit_function(LDB_ERR_TMP_FILE);
+    wal->written_pos = wal->end_pos;
+    wal->synced_pos = wal->end_pos;
 
-    strncpy(header.text, LDB_TEXT_DAT, sizeof(header.text));
+    return LDB_OK;
 
-    if (fwrite(&header, sizeof(ldb_header_dat_t), 1, tmp_fp) != 1)
-        exit_function(LDB_ERR_TMP_FILE);
+LDB_WAL_OPEN_END:
+    ldb_wal_close(wal);
+    return ret;
+}
 
-    if (!ldb_copy_file(obj->dat_fp, pos, obj->dat_end, tmp_fp, sizeof(ldb_header_dat_t)))
-        exit_function(LDB_ERR_TMP_FILE);
+#undef exit_function
 
-    if (fclose(tmp_fp) != 0)
-        exit_function(LDB_ERR_TMP_FILE);
+ldb_db_t * ldb_wal_log(ldb_wal_impl_t *wal, uint64_t id)
+{
+    if (wal == NULL || wal->name == NULL)
+        return NULL;
 
-    tmp_fp = NULL;
+    pthread_mutex_lock(&wal->mutex_logs);
+    ldb_impl_t *obj = ldb_wal_get_log(wal, id);
+    pthread_mutex_unlock(&wal->mutex_logs);
 
-    if ((ret = ldb_close_files(obj)) != LDB_OK)
-        exit_function(ret);
+    return obj;
+}
 
-    ldb_reset_state(&obj->state);
+int ldb_wal_sync(ldb_wal_impl_t *wal)
+{
+    if (wal == NULL)
+        return LDB_ERR_ARG;
 
-    remove(obj->idx_path);
+    if (wal->name == NULL)
+        return LDB_ERR;
 
-    if (rename(tmp_path, obj->dat_path) != 0)
-        exit_function(LDB_ERR_TMP_FILE);
+    pthread_mutex_lock(&wal->mutex_sync);
+    uint64_t pos = wal->written_pos;
+    pthread_mutex_unlock(&wal->mutex_sync);
 
-    free(tmp_path);
-    tmp_path = NULL;
+    return ldb_wal_sync_to(wal, NULL, pos);
+}
 
-    if (!ldb_create_file_idx(obj->idx_path))
-        exit_function(LDB_ERR_OPEN_IDX);
+int ldb_wal_close(ldb_wal_impl_t *wal)
+{
+    if (wal == NULL)
+        return LDB_OK;
 
-    if ((ret = ldb_open_file_dat(obj, false)) != LDB_OK)
-        exit_function(ret);
+    int ret = LDB_OK;
 
-    if ((ret = ldb_open_file_idx(obj, false)) != LDB_OK)
-        exit_function(ret);
+    for (size_t i = 0; i < wal->num_logs; i++) {
+        wal->logs[i]->wal = NULL;
+        ldb_close(wal->logs[i]);
+        free(wal->logs[i]);
+    }
 
-    pthread_mutex_unlock(&obj->mutex_files);
-    return removed_entries;
+    for (size_t i = 0; i < wal->num_segs; i++) {
+        if (close(wal->segs[i].fd) == -1)
+            ret = LDB_ERR_WRITE_DAT;
+    }
+
+    if (wal->name) {
+        pthread_mutex_destroy(&wal->mutex_logs);
+        pthread_mutex_destroy(&wal->mutex_write);
+        pthread_rwlock_destroy(&wal->lock_segs);
+        pthread_mutex_destroy(&wal->mutex_sync);
+        pthread_cond_destroy(&wal->cond_sync);
+    }
+
+    free(wal->logs);
+    free(wal->segs);
+    free(wal->name);
+    free(wal->path);
+    memset(wal, 0x00, sizeof(ldb_wal_impl_t));
 
-LDB_PURGE_END:
-    free(tmp_path);
-    if (tmp_fp != NULL) fclose(tmp_fp);
-    ldb_close_files(obj);
-    ldb_reset_state(&obj->state);
-    pthread_mutex_unlock(&obj->mutex_files);
     return ret;
 }
 
-#undef exit_function
+ldb_wal_t * ldb_wal_alloc(void) {
+    return (ldb_wal_t *) calloc(1, sizeof(ldb_wal_impl_t));
+}
+
+void ldb_wal_free(ldb_wal_t *wal) {
+    free(wal);
+}
 
 ldb_db_t * ldb_alloc(void) {
     return (ldb_db_t *) calloc(1, sizeof(ldb_impl_t));
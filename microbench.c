@@ -0,0 +1,734 @@
+#include <getopt.h>
+
+#define LDB_IMPL
+#include "logdb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAS_TSC
+#endif
+
+#define MB_NAME             "microbench"
+#define MAX_CASES           128
+#define NUM_KEYS            4096      // Random seqnums/timestamps per case
+#define WARM_WINDOW         64        // Entries touched by warm idx cases
+#define BATCH_NANOS         10000000  // Target duration of a measured batch (10ms)
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV
+} format_e;
+
+typedef struct {
+    const char *filter;           // Substring of kernel names to run (NULL = all)
+    size_t cold_size;             // Working set of cold cases (exceeds CPU caches)
+    size_t num_entries;           // Entries of the idx/search database
+    size_t copy_size;             // Bytes copied by ldb_copy_file()
+    size_t repeat;                // Measured batches per case (median reported)
+    format_e format;
+} params_t;
+
+// Kernel operation (iters calls), returns a value to avoid dead code elimination
+typedef uint64_t (*run_fn)(void *ctx, size_t iters);
+
+// Called before run() untimed (NULL = none)
+typedef void (*prepare_fn)(void *ctx);
+
+typedef struct {
+    const char *kernel;
+    const char *variant;
+    size_t size;                  // Case size (block length, entry length, db entries)
+    size_t bytes;                 // Bytes processed per op (0 = not applicable)
+    bool cold;
+    run_fn run;
+    prepare_fn setup;             // Called once before measuring
+    prepare_fn prepare;           // Called before each op (implies 1 op per batch)
+    void *ctx;
+} case_t;
+
+typedef struct {
+    const case_t *test;
+    double ns_per_op;             // Median of batches
+    double cycles_per_op;         // Median of batches (0 if no cycle counter)
+} result_t;
+
+// Data block of a buffer (warm = same block, cold = rotating over the whole buffer)
+typedef struct {
+    char *buf;
+    size_t buf_len;
+    size_t len;
+    size_t pos;
+    bool cold;
+    uint32_t format;
+} buf_ctx_t;
+
+typedef struct {
+    ldb_entry_t entry;
+    uint32_t data_len;
+    bool cold;
+} alloc_ctx_t;
+
+typedef struct {
+    ldb_db_t *db;
+    uint64_t keys[NUM_KEYS];      // Seqnums or timestamps
+    size_t pos;
+    bool mmap;
+} idx_ctx_t;
+
+typedef struct {
+    FILE *fp1;
+    FILE *fp2;
+    size_t len;
+    bool cold;
+} copy_ctx_t;
+
+static volatile uint64_t sink = 0;
+
+static uint64_t get_nanos(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t get_cycles(void)
+{
+#ifdef HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void fail(const char *msg)
+{
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* -------------------------------------------------------------------------- */
+/* checksums                                                                   */
+/* -------------------------------------------------------------------------- */
+
+static const char * next_block(buf_ctx_t *ctx)
+{
+    if (!ctx->cold)
+        return ctx->buf;
+
+    // stride of whole pages, so that consecutive blocks do not share cache lines
+    ctx->pos += (ctx->len + 4095) / 4096 * 4096;
+
+    if (ctx->pos + ctx->len > ctx->buf_len)
+        ctx->pos = 0;
+
+    return ctx->buf + ctx->pos;
+}
+
+static uint64_t run_crc32(void *arg, size_t iters)
+{
+    buf_ctx_t *ctx = (buf_ctx_t *) arg;
+    uint32_t checksum = 0;
+
+    for (size_t i = 0; i < iters; i++)
+        checksum = ldb_crc32(next_block(ctx), ctx->len, checksum);
+
+    return checksum;
+}
+
+static uint64_t run_crc32c_sw(void *arg, size_t iters)
+{
+    buf_ctx_t *ctx = (buf_ctx_t *) arg;
+    uint32_t checksum = 0;
+
+    for (size_t i = 0; i < iters; i++)
+        checksum = ldb_crc32c_sw(next_block(ctx), ctx->len, checksum);
+
+    return checksum;
+}
+
+static uint64_t run_crc32c(void *arg, size_t iters)
+{
+    buf_ctx_t *ctx = (buf_ctx_t *) arg;
+    uint32_t checksum = 0;
+
+    for (size_t i = 0; i < iters; i++)
+        checksum = ldb_crc32c(next_block(ctx), ctx->len, checksum);
+
+    return checksum;
+}
+
+static uint64_t run_checksum_entry(void *arg, size_t iters)
+{
+    buf_ctx_t *ctx = (buf_ctx_t *) arg;
+    uint32_t checksum = 0;
+
+    for (size_t i = 0; i < iters; i++)
+    {
+        char *ptr = (char *) next_block(ctx);
+
+        ldb_entry_t entry = {
+            .seqnum = i,
+            .timestamp = i,
+            .metadata_len = 16,
+            .metadata = ptr,
+            .data_len = (uint32_t)(ctx->len - 16),
+            .data = ptr + 16
+        };
+
+        checksum ^= ldb_checksum_entry(&entry, ctx->format);
+    }
+
+    return checksum;
+}
+
+/* -------------------------------------------------------------------------- */
+/* ldb_alloc_entry                                                            */
+/* -------------------------------------------------------------------------- */
+
+// warm = memory reused (alternating lengths), cold = allocation on each call
+static uint64_t run_alloc_entry(void *arg, size_t iters)
+{
+    alloc_ctx_t *ctx = (alloc_ctx_t *) arg;
+    uint64_t ret = 0;
+
+    for (size_t i = 0; i < iters; i++)
+    {
+        if (ctx->cold)
+            ldb_free_entry(&ctx->entry);
+
+        if (!ldb_alloc_entry(&ctx->entry, 16, ctx->data_len - (uint32_t)(i & 1)))
+            fail("out of memory");
+
+        ret += (uintptr_t) ctx->entry.data;
+    }
+
+    return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+/* ldb_read_record_idx, ldb_search                                            */
+/* -------------------------------------------------------------------------- */
+
+static void setup_idx(void *arg)
+{
+    idx_ctx_t *ctx = (idx_ctx_t *) arg;
+
+    if (ldb_set_mmap_idx(ctx->db, ctx->mmap) != LDB_OK)
+        fail("error setting the mmap index mode");
+}
+
+static uint64_t run_read_record_idx(void *arg, size_t iters)
+{
+    idx_ctx_t *ctx = (idx_ctx_t *) arg;
+    ldb_record_idx_t record = {0};
+    uint64_t ret = 0;
+
+    for (size_t i = 0; i < iters; i++)
+    {
+        uint64_t seqnum = ctx->keys[ctx->pos++ % NUM_KEYS];
+
+        if (ldb_read_record_idx(ctx->db, &ctx->db->state, seqnum, &record) != LDB_OK)
+            fail("error reading idx record");
+
+        ret += record.pos;
+    }
+
+    return ret;
+}
+
+static uint64_t run_search(void *arg, size_t iters)
+{
+    idx_ctx_t *ctx = (idx_ctx_t *) arg;
+    uint64_t ret = 0;
+
+    for (size_t i = 0; i < iters; i++)
+    {
+        uint64_t timestamp = ctx->keys[ctx->pos++ % NUM_KEYS];
+        uint64_t seqnum = 0;
+
+        if (ldb_search(ctx->db, timestamp, LDB_SEARCH_LOWER, &seqnum) != LDB_OK)
+            fail("error searching timestamp");
+
+        ret += seqnum;
+    }
+
+    return ret;
+}
+
+// warm = keys in a small window, cold = keys spread over the whole db
+static void init_keys(idx_ctx_t *ctx, bool timestamps, bool cold, unsigned int seed)
+{
+    ldb_state_t *state = &ctx->db->state;
+    uint64_t range = (timestamps ? state->timestamp2 - state->timestamp1 : state->seqnum2 - state->seqnum1);
+    uint64_t first = (timestamps ? state->timestamp1 : state->seqnum1 + 1);
+    uint64_t base = (cold ? 0 : range / 2);
+
+    range = (cold ? range : ldb_min(range, WARM_WINDOW));
+
+    for (size_t i = 0; i < NUM_KEYS; i++) {
+        uint64_t rnd = ((uint64_t) rand_r(&seed) << 31) ^ (uint64_t) rand_r(&seed);
+        ctx->keys[i] = first + base + rnd % range;
+    }
+}
+
+static void create_db(ldb_db_t *db, size_t num_entries)
+{
+    ldb_entry_t entries[1000] = {{0}};
+    unsigned int seed = 1;
+    uint64_t timestamp = 1;
+    char data[8] = {0};
+
+    remove(MB_NAME ".dat");
+    remove(MB_NAME ".idx");
+    remove(MB_NAME ".chk");
+
+    if (ldb_open(db, "", MB_NAME, false) != LDB_OK)
+        fail("error creating database");
+
+    for (size_t num = 0; num < num_entries; )
+    {
+        size_t len = ldb_min(1000, num_entries - num);
+
+        for (size_t i = 0; i < len; i++) {
+            timestamp += (uint64_t)(rand_r(&seed) % 4);
+            entries[i] = (ldb_entry_t){ .timestamp = timestamp, .data_len = sizeof(data), .data = data };
+        }
+
+        if (ldb_append(db, entries, len, NULL) != LDB_OK)
+            fail("error appending entries");
+
+        num += len;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* ldb_copy_file                                                              */
+/* -------------------------------------------------------------------------- */
+
+// cold = source dropped from the page cache before each copy
+static void prepare_copy(void *arg)
+{
+    copy_ctx_t *ctx = (copy_ctx_t *) arg;
+
+    fflush(ctx->fp2);
+    fdatasync(fileno(ctx->fp2));
+    posix_fadvise(fileno(ctx->fp2), 0, 0, POSIX_FADV_DONTNEED);
+
+    if (ctx->cold)
+        posix_fadvise(fileno(ctx->fp1), 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static uint64_t run_copy_file(void *arg, size_t iters)
+{
+    copy_ctx_t *ctx = (copy_ctx_t *) arg;
+
+    for (size_t i = 0; i < iters; i++)
+        if (!ldb_copy_file(ctx->fp1, 0, ctx->len, ctx->fp2, 0))
+            fail("error copying file");
+
+    return iters;
+}
+
+/* -------------------------------------------------------------------------- */
+/* harness                                                                    */
+/* -------------------------------------------------------------------------- */
+
+// Runs batches of the case, returns the median ns and cycles per op
+static result_t measure(const case_t *test, const params_t *params)
+{
+    result_t result = { .test = test };
+    double *ns = (double *) calloc(params->repeat, sizeof(double));
+    double *cycles = (double *) calloc(params->repeat, sizeof(double));
+    size_t iters = 1;
+
+    if (ns == NULL || cycles == NULL)
+        fail("out of memory");
+
+    if (test->setup)
+        test->setup(test->ctx);
+
+    // calibration (batch of ~BATCH_NANOS), also warms the cache
+    while (test->prepare == NULL)
+    {
+        uint64_t time0 = get_nanos();
+        sink += test->run(test->ctx, iters);
+        uint64_t elapsed = get_nanos() - time0;
+
+        if (elapsed >= BATCH_NANOS / 10) {
+            iters = ldb_max((size_t)((double) iters * BATCH_NANOS / (double) elapsed), 1);
+            break;
+        }
+
+        iters *= 2;
+    }
+
+    for (size_t i = 0; i < params->repeat; i++)
+    {
+        if (test->prepare)
+            test->prepare(test->ctx);
+
+        uint64_t time0 = get_nanos();
+        uint64_t cycles0 = get_cycles();
+        sink += test->run(test->ctx, iters);
+        uint64_t cycles1 = get_cycles();
+        uint64_t time1 = get_nanos();
+
+        ns[i] = (double)(time1 - time0) / (double) iters;
+        cycles[i] = (double)(cycles1 - cycles0) / (double) iters;
+    }
+
+    qsort(ns, params->repeat, sizeof(double), compare_double);
+    qsort(cycles, params->repeat, sizeof(double), compare_double);
+
+    result.ns_per_op = ns[params->repeat / 2];
+    result.cycles_per_op = cycles[params->repeat / 2];
+
+    free(cycles);
+    free(ns);
+    return result;
+}
+
+static void print_header(const params_t *params)
+{
+    if (params->format == FORMAT_CSV)
+        printf("kernel,variant,size,cache,ns_per_op,cycles_per_op,cycles_per_byte,gb_per_sec\n");
+    else if (params->format == FORMAT_JSON)
+        printf("{\n  \"version\": \"%s\",\n  \"tsc\": %s,\n  \"results\": [\n", ldb_version(),
+#ifdef HAS_TSC
+               "true"
+#else
+               "false"
+#endif
+               );
+    else
+        printf("%-16s %-8s %9s %-5s %12s %14s %12s %10s\n",
+               "kernel", "variant", "size", "cache", "ns/op", "cycles/op", "cycles/byte", "GB/s");
+}
+
+static void print_result(const result_t *res, const params_t *params, bool last)
+{
+    const case_t *test = res->test;
+    double bytes = (double) test->bytes;
+    double cycles_per_byte = (bytes > 0 ? res->cycles_per_op / bytes : 0);
+    double gb_per_sec = (bytes > 0 && res->ns_per_op > 0 ? bytes / res->ns_per_op : 0);
+    const char *cache = (test->cold ? "cold" : "warm");
+
+    if (params->format == FORMAT_CSV)
+        printf("%s,%s,%zu,%s,%.3f,%.1f,%.4f,%.3f\n", test->kernel, test->variant, test->size, cache,
+               res->ns_per_op, res->cycles_per_op, cycles_per_byte, gb_per_sec);
+    else if (params->format == FORMAT_JSON)
+        printf("    { \"kernel\": \"%s\", \"variant\": \"%s\", \"size\": %zu, \"cache\": \"%s\", "
+               "\"ns_per_op\": %.3f, \"cycles_per_op\": %.1f, \"cycles_per_byte\": %.4f, \"gb_per_sec\": %.3f }%s\n",
+               test->kernel, test->variant, test->size, cache, res->ns_per_op, res->cycles_per_op,
+               cycles_per_byte, gb_per_sec, (last ? "" : ","));
+    else if (bytes > 0)
+        printf("%-16s %-8s %9zu %-5s %12.1f %14.1f %12.3f %10.3f\n", test->kernel, test->variant,
+               test->size, cache, res->ns_per_op, res->cycles_per_op, cycles_per_byte, gb_per_sec);
+    else
+        printf("%-16s %-8s %9zu %-5s %12.1f %14.1f %12s %10s\n", test->kernel, test->variant,
+               test->size, cache, res->ns_per_op, res->cycles_per_op, "-", "-");
+
+    fflush(stdout);
+}
+
+static void help(void)
+{
+    const char *msg = \
+        "usage: microbench [OPTION]..." "\n" \
+        "\n" \
+        "Microbenchmarks of the logdb internal hot functions:" "\n" \
+        "   crc32, crc32c (sw = slice-by-8, hw = runtime selected), checksum_entry," "\n" \
+        "   alloc_entry, read_record_idx, search and copy_file." "\n" \
+        "\n" \
+        "Each case reports the median of the measured batches, in ns/op and cycles" "\n" \
+        "(time stamp counter, x86 only). Warm cases reuse the same data; cold cases" "\n" \
+        "rotate over a working set bigger than the CPU caches (copy_file drops the" "\n" \
+        "source file from the page cache, alloc_entry allocates on each call)." "\n" \
+        "\n" \
+        "Arguments:" "\n" \
+        "   -h, --help                Display this help and quit." "\n" \
+        "   --filter                  Run kernels whose name contains this string." "\n" \
+        "   --cold-size               Working set of cold cases (default=256MB)." "\n" \
+        "   --entries                 Entries of the read_record_idx/search db (default=1000000)." "\n" \
+        "   --copy-size               Bytes copied by copy_file (default=16MB)." "\n" \
+        "   --repeat                  Measured batches per case (default=11)." "\n" \
+        "   --format                  Output format: text, json, csv (default=text)." "\n" \
+        "\n" \
+        "Byte values accept suffixes: B, KB, MB, GB." "\n" \
+        "\n" \
+        "Examples:" "\n" \
+        "   microbench --filter=crc" "\n" \
+        "   microbench --format=csv > before.csv" "\n" \
+        "\n";
+
+    printf("%s", msg);
+}
+
+static size_t parse_size(const char *str, const char *arg, bool bytes)
+{
+    char *endptr = NULL;
+    long val = strtol(str, &endptr, 10);
+    size_t mult = 1;
+
+    if (bytes && strcmp(endptr, "KB") == 0)
+        mult = 1000;
+    else if (bytes && strcmp(endptr, "MB") == 0)
+        mult = 1000000;
+    else if (bytes && strcmp(endptr, "GB") == 0)
+        mult = 1000000000;
+    else if (*endptr != 0 && !(bytes && strcmp(endptr, "B") == 0))
+        val = -1;
+
+    if (!isdigit(*str) || errno == ERANGE || str == endptr || val <= 0) {
+        fprintf(stderr, "Error: argument '%s' has an invalid value (%s)\n", arg, str);
+        exit(EXIT_FAILURE);
+    }
+
+    return (size_t) val * mult;
+}
+
+static void parse_args(int argc, char *argv[], params_t *params)
+{
+    const char* const options1 = "h" ;
+    const struct option options2[] = {
+        { "help",                     0,  NULL,  'h' },
+        { "filter",                   1,  NULL,  301 },
+        { "cold-size",                1,  NULL,  302 },
+        { "entries",                  1,  NULL,  303 },
+        { "copy-size",                1,  NULL,  304 },
+        { "repeat",                   1,  NULL,  305 },
+        { "format",                   1,  NULL,  306 },
+        { NULL,                       0,  NULL,   0  }
+    };
+
+    *params = (params_t){
+        .filter = NULL,
+        .cold_size = 256000000,
+        .num_entries = 1000000,
+        .copy_size = 16000000,
+        .repeat = 11,
+        .format = FORMAT_TEXT
+    };
+
+    while (true)
+    {
+        int curropt = getopt_long(argc, argv, options1, options2, NULL);
+
+        if (curropt == -1)
+            break;
+
+        switch(curropt)
+        {
+            case '?': // invalid option
+                fprintf(stderr, "use --help option for more information\n");
+                exit(EXIT_FAILURE);
+            case 'h':
+                help();
+                exit(EXIT_SUCCESS);
+            case 301:
+                params->filter = optarg;
+                break;
+            case 302:
+                params->cold_size = parse_size(optarg, "cold-size", true);
+                break;
+            case 303:
+                params->num_entries = parse_size(optarg, "entries", false);
+                break;
+            case 304:
+                params->copy_size = parse_size(optarg, "copy-size", true);
+                break;
+            case 305:
+                params->repeat = parse_size(optarg, "repeat", false);
+                break;
+            case 306:
+                if (strcmp(optarg, "text") == 0)
+                    params->format = FORMAT_TEXT;
+                else if (strcmp(optarg, "json") == 0)
+                    params->format = FORMAT_JSON;
+                else if (strcmp(optarg, "csv") == 0)
+                    params->format = FORMAT_CSV;
+                else {
+                    fprintf(stderr, "Error: argument 'format' has an invalid value (%s)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Unexpected error\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (params->cold_size < 2 * 1048576 || params->num_entries < 2 * WARM_WINDOW) {
+        fprintf(stderr, "Error: cold-size must be at least 2MB and entries at least %d\n", 2 * WARM_WINDOW);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool is_selected(const params_t *params, const char *kernel)
+{
+    return (params->filter == NULL || strstr(kernel, params->filter) != NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t crc_sizes[] = { 64, 1024, 65536, 1048576 };
+    static const size_t entry_sizes[] = { 64, 1024, 65536 };
+    static const size_t alloc_sizes[] = { 1024, 65536 };
+    #define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
+
+    params_t params = {0};
+    case_t cases[MAX_CASES] = {{0}};
+    buf_ctx_t bufs[MAX_CASES] = {{0}};
+    alloc_ctx_t allocs[4] = {0};
+    idx_ctx_t *idxs = NULL;
+    copy_ctx_t copies[2] = {{0}};
+    ldb_db_t db = {0};
+    size_t num_cases = 0;
+    size_t num_bufs = 0;
+    char *buf = NULL;
+    bool use_db = false;
+    bool use_copy = false;
+
+    parse_args(argc, argv, &params);
+
+    // random content (allocated up front, so page faults are out of the measures)
+    if ((buf = (char *) malloc(params.cold_size)) == NULL)
+        fail("out of memory");
+
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < params.cold_size; i++)
+        buf[i] = (char) rand_r(&seed);
+
+    // ensures crc32c tables are initialized before calling ldb_crc32c_sw()
+    sink += ldb_crc32c(buf, 1, 0);
+
+    const char *hw = (ldb_crc32c_func == ldb_crc32c_sw ? "sw" : "hw");
+
+    for (int cold = 0; cold < 2; cold++)
+    {
+        for (size_t i = 0; i < NUM_ELEMS(crc_sizes); i++)
+        {
+            const char *names[] = { "crc32", "crc32c", "crc32c" };
+            const char *variants[] = { "format1", "sw", hw };
+            run_fn funcs[] = { run_crc32, run_crc32c_sw, run_crc32c };
+
+            for (size_t j = 0; j < 3; j++) {
+                bufs[num_bufs] = (buf_ctx_t){ .buf = buf, .buf_len = params.cold_size, .len = crc_sizes[i], .cold = cold };
+                cases[num_cases++] = (case_t){ .kernel = names[j], .variant = variants[j], .size = crc_sizes[i], .bytes = crc_sizes[i],
+                                               .cold = cold, .run = funcs[j], .ctx = &bufs[num_bufs++] };
+            }
+        }
+
+        for (size_t i = 0; i < NUM_ELEMS(entry_sizes); i++) {
+            bufs[num_bufs] = (buf_ctx_t){ .buf = buf, .buf_len = params.cold_size, .len = entry_sizes[i], .cold = cold, .format = LDB_FORMAT_2 };
+            cases[num_cases++] = (case_t){ .kernel = "checksum_entry", .variant = "format2", .size = entry_sizes[i], .bytes = entry_sizes[i],
+                                           .cold = cold, .run = run_checksum_entry, .ctx = &bufs[num_bufs++] };
+        }
+
+        for (size_t i = 0; i < NUM_ELEMS(alloc_sizes); i++) {
+            alloc_ctx_t *ctx = &allocs[2 * cold + i];
+            ctx->data_len = (uint32_t) alloc_sizes[i];
+            ctx->cold = cold;
+            cases[num_cases++] = (case_t){ .kernel = "alloc_entry", .variant = (cold ? "alloc" : "reuse"),
+                                           .size = alloc_sizes[i], .cold = cold, .run = run_alloc_entry, .ctx = ctx };
+        }
+    }
+
+    if (is_selected(&params, "read_record_idx") || is_selected(&params, "search"))
+    {
+        if ((idxs = (idx_ctx_t *) calloc(8, sizeof(idx_ctx_t))) == NULL)
+            fail("out of memory");
+
+        fprintf(stderr, "creating db (%zu entries) ...\n", params.num_entries);
+        create_db(&db, params.num_entries);
+        use_db = true;
+
+        for (int k = 0; k < 8; k++)
+        {
+            idx_ctx_t *ctx = &idxs[k];
+            bool search = (k & 4);
+            bool cold = (k & 2);
+
+            ctx->db = &db;
+            ctx->mmap = (k & 1);
+            init_keys(ctx, search, cold, (unsigned int)(k + 1));
+
+            cases[num_cases++] = (case_t){ .kernel = (search ? "search" : "read_record_idx"),
+                                           .variant = (ctx->mmap ? "mmap" : "pread"), .size = params.num_entries, .cold = cold,
+                                           .run = (search ? run_search : run_read_record_idx),
+                                           .setup = setup_idx, .ctx = ctx };
+        }
+    }
+
+    if (is_selected(&params, "copy_file"))
+    {
+        FILE *fp1 = fopen(MB_NAME ".src", "w+");
+        FILE *fp2 = fopen(MB_NAME ".dst", "w+");
+
+        if (fp1 == NULL || fp2 == NULL)
+            fail("error creating copy files");
+
+        for (size_t pos = 0; pos < params.copy_size; pos += params.cold_size)
+            fwrite(buf, ldb_min(params.cold_size, params.copy_size - pos), 1, fp1);
+
+        fflush(fp1);
+        fdatasync(fileno(fp1));
+        use_copy = true;
+
+        for (int cold = 0; cold < 2; cold++) {
+            copies[cold] = (copy_ctx_t){ .fp1 = fp1, .fp2 = fp2, .len = params.copy_size, .cold = cold };
+            cases[num_cases++] = (case_t){ .kernel = "copy_file", .variant = "stdio", .size = params.copy_size, .bytes = params.copy_size,
+                                           .cold = cold, .run = run_copy_file, .prepare = prepare_copy,
+                                           .ctx = &copies[cold] };
+        }
+    }
+
+    assert(num_cases <= MAX_CASES);
+
+    print_header(&params);
+
+    size_t num_selected = 0;
+    for (size_t i = 0; i < num_cases; i++)
+        num_selected += (is_selected(&params, cases[i].kernel) ? 1 : 0);
+
+    for (size_t i = 0, num = 0; i < num_cases; i++)
+    {
+        if (!is_selected(&params, cases[i].kernel))
+            continue;
+
+        result_t result = measure(&cases[i], &params);
+        print_result(&result, &params, ++num == num_selected);
+    }
+
+    if (params.format == FORMAT_JSON)
+        printf("  ]\n}\n");
+
+    for (size_t i = 0; i < NUM_ELEMS(allocs); i++)
+        ldb_free_entry(&allocs[i].entry);
+
+    if (use_db) {
+        ldb_close(&db);
+        remove(MB_NAME ".dat");
+        remove(MB_NAME ".idx");
+        remove(MB_NAME ".chk");
+    }
+
+    if (use_copy) {
+        fclose(copies[0].fp1);
+        fclose(copies[0].fp2);
+        remove(MB_NAME ".src");
+        remove(MB_NAME ".dst");
+    }
+
+    free(idxs);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@ typedef struct {
 } params_db_t;
 
 typedef struct {
+    size_t num_threads;
     size_t bytes_per_record;
     size_t records_per_commit;
     size_t records_per_second;
@@ -34,6 +35,7 @@ typedef struct {
 } args_write_t;
 
 typedef struct {
+    size_t num_threads;
     size_t records_per_second;
     size_t records_per_query;
     size_t max_seconds;
@@ -52,6 +54,7 @@ typedef struct {
 
 typedef struct {
     ldb_db_t *db;
+    unsigned int seed;
     params_read_t params;
     results_read_t results;
 } args_read_t;
@@ -100,9 +103,10 @@ static int msleep(long msec)
     return res;
 }
 
-static void print_results_write(results_write_t *results)
+static void print_results_write(results_write_t *results, size_t num_threads)
 {
     double seconds = (double) results->time_ms / 1000.0;
+    printf("write - threads        = %zu\n", num_threads);
     printf("write - result         = %s\n", ldb_strerror(results->rc));
     printf("write - total time     = %.2lf seconds\n", seconds);
     printf("write - idle time      = %.2lf seconds\n", (double) results->idle_ms / 1000.0);
@@ -115,9 +119,52 @@ static void print_results_write(results_write_t *results)
     printf("write - idle time (%%)  = %d%%\n", (int)(100.0 * (double) results->idle_ms / (double) results->time_ms));
 }
 
-static void print_results_read(results_read_t *results)
+// Merge results of multiple writer threads
+// elapsed time is the maximum, idle time is the average
+static void merge_results_write(results_write_t *results, const args_write_t *args, size_t num_threads)
+{
+    *results = (results_write_t){0};
+    results->rc = LDB_OK;
+
+    for (size_t i = 0; i < num_threads; i++) {
+        const results_write_t *res = &args[i].results;
+        results->time_ms = ldb_max(results->time_ms, res->time_ms);
+        results->idle_ms += res->idle_ms;
+        results->num_records += res->num_records;
+        results->num_bytes += res->num_bytes;
+        results->num_commits += res->num_commits;
+        results->rc = (results->rc == LDB_OK ? res->rc : results->rc);
+    }
+
+    if (num_threads > 0)
+        results->idle_ms /= num_threads;
+}
+
+// Merge results of multiple reader threads
+// elapsed time is the maximum, idle time is the average
+static void merge_results_read(results_read_t *results, const args_read_t *args, size_t num_threads)
+{
+    *results = (results_read_t){0};
+    results->rc = LDB_OK;
+
+    for (size_t i = 0; i < num_threads; i++) {
+        const results_read_t *res = &args[i].results;
+        results->time_ms = ldb_max(results->time_ms, res->time_ms);
+        results->idle_ms += res->idle_ms;
+        results->num_records += res->num_records;
+        results->num_bytes += res->num_bytes;
+        results->num_queries += res->num_queries;
+        results->rc = (results->rc == LDB_OK ? res->rc : results->rc);
+    }
+
+    if (num_threads > 0)
+        results->idle_ms /= num_threads;
+}
+
+static void print_results_read(results_read_t *results, size_t num_threads)
 {
     double seconds = results->time_ms / 1000.0;
+    printf("read  - threads        = %zu\n", num_threads);
     printf("read  - result         = %s\n", ldb_strerror(results->rc));
     printf("read  - total time     = %.2lf seconds\n", seconds);
     printf("read  - idle time      = %.2lf seconds\n", (double) results->idle_ms / 1000.0);
@@ -138,18 +185,19 @@ static void * run_write(void *args)
 
     char *data = calloc(params->bytes_per_record, 1);
     size_t num_entries = ldb_min(params->records_per_commit, params->records_per_second);
-    ldb_entry_t *entries = calloc(num_entries, sizeof(ldb_entry_t));
+    ldb_entry_t *buffers = calloc(2 * num_entries, sizeof(ldb_entry_t));
+    ldb_entry_t *entries = buffers;
     uint64_t time0 = ldb_get_millis();
     size_t num = 0;
 
     // Logdb supports records of variable length.
     // In this case we use fixed-length records filled with 0's
     // to avoid to deal with memory alloc and fill it with random content.
-    for (size_t i = 0; i < num_entries; i++) {
-        entries[i].metadata_len = 0;
-        entries[i].metadata = NULL;
-        entries[i].data_len = params->bytes_per_record;
-        entries[i].data = data;
+    for (size_t i = 0; i < 2 * num_entries; i++) {
+        buffers[i].metadata_len = 0;
+        buffers[i].metadata = NULL;
+        buffers[i].data_len = params->bytes_per_record;
+        buffers[i].data = data;
     }
 
     *results = (results_write_t){0};
@@ -166,7 +214,16 @@ static void * run_write(void *args)
             entries[i].timestamp = 0;
         }
 
-        if ((results->rc = ldb_append(db, entries, num_entries, &num)) != LDB_OK)
+        // multiple writers use the thread-safe group commit
+        // single writer prepares the next batch while the previous one is written
+        if (params->num_threads > 1)
+            results->rc = ldb_append_mt(db, entries, num_entries, &num);
+        else
+            results->rc = ldb_append_async(db, entries, num_entries, &num);
+
+        entries = (entries == buffers ? buffers + num_entries : buffers);
+
+        if (results->rc != LDB_OK)
             break;
 
         results->num_commits += (num > 0 ? 1 : 0);
@@ -188,7 +245,10 @@ static void * run_write(void *args)
         };
     }
 
-    free(entries);
+    if (params->num_threads <= 1 && results->rc == LDB_OK)
+        results->rc = ldb_append_wait(db, NULL);
+
+    free(buffers);
     free(data);
     return NULL;
 }
@@ -220,7 +280,7 @@ static void * run_read(void *args)
 
         if (stats.num_entries)
         {
-            seqnum = stats.min_seqnum + rand() % stats.num_entries;
+            seqnum = stats.min_seqnum + rand_r(&((args_read_t *) args)->seed) % stats.num_entries;
 
             if ((results->rc = ldb_read(db, seqnum, entries, num_entries, &num)) != LDB_OK)
                 break;
@@ -273,7 +333,9 @@ static void help(void)
         "   --mbw, --max-bytes-write            Maximum number of bytes (allowed suffixes: B, KB, MB, GB, TB)." "\n" \
         "   --mbr, --max-bytes-read             Maximum number of bytes (allowed suffixes: B, KB, MB, GB, TB)." "\n" \
         "   --rpsw, --records-per-second-write  Records per second writing." "\n" \
-        "   --rpsr, --records-per-second-read   Records per second reading." "\n" \
+        "   --rpsr, --records-per-second-read   Records per second reading (per thread)." "\n" \
+        "   --rt, --reader-threads              Number of reader threads (default=1)." "\n" \
+        "   --wt, --writer-threads              Number of writer threads (default=1, write limits apply per thread)." "\n" \
         "\n" \
         "Examples:" "\n" \
         "   # record size = 10KB" "\n" \
@@ -290,6 +352,16 @@ static void help(void)
         "   # writing 10000 records/sec for 10 seconds" "\n" \
         "   # reading 6000 records/sec for 10 seconds" "\n" \
         "   performance --msw=10 --bpr=10KB --rpsw=10000 --rpc=40 --msr=10 --rpsr=6000 --rpq=100" "\n" \
+        "\n" \
+        "   # record size = 10KB" "\n" \
+        "   # writing 1GB at full speed" "\n" \
+        "   # 8 threads reading at full speed for 10 seconds" "\n" \
+        "   performance --bpr=10KB --mbw=1GB --rpc=40 --msr=10 --rpq=100 --rt=8" "\n" \
+        "\n" \
+        "   # record size = 100B, fsync enabled" "\n" \
+        "   # 16 threads writing 1 record per commit for 10 seconds (group commit)" "\n" \
+        "   # reading at full speed for 10 seconds" "\n" \
+        "   performance -s --bpr=100 --msw=10 --rpc=1 --wt=16 --msr=10 --rpq=100" "\n" \
         "\n";
 
     printf("%s", msg);
@@ -360,6 +432,10 @@ static void parse_args(int argc, char *argv[], params_db_t *params_db, params_wr
         { "rpsw",                     1,  NULL,  310 },
         { "records-per-second-read",  1,  NULL,  311 },
         { "rpsr",                     1,  NULL,  311 },
+        { "reader-threads",           1,  NULL,  312 },
+        { "rt",                       1,  NULL,  312 },
+        { "writer-threads",           1,  NULL,  313 },
+        { "wt",                       1,  NULL,  313 },
         { NULL,                       0,  NULL,   0  }
     };
 
@@ -369,6 +445,7 @@ static void parse_args(int argc, char *argv[], params_db_t *params_db, params_wr
     };
 
     *params_write = (params_write_t){
+        .num_threads = 1,
         .bytes_per_record = 0,
         .records_per_commit = 0,
         .records_per_second = SIZE_MAX,
@@ -378,6 +455,7 @@ static void parse_args(int argc, char *argv[], params_db_t *params_db, params_wr
     };
 
     *params_read = (params_read_t){
+        .num_threads = 1,
         .records_per_query = 0,
         .records_per_second = SIZE_MAX,
         .max_seconds = SIZE_MAX,
@@ -439,6 +517,12 @@ static void parse_args(int argc, char *argv[], params_db_t *params_db, params_wr
             case 311:
                 params_read->records_per_second = parse_int(optarg, "records-per-second-read");
                 break;
+            case 312:
+                params_read->num_threads = parse_int(optarg, "reader-threads");
+                break;
+            case 313:
+                params_write->num_threads = parse_int(optarg, "writer-threads");
+                break;
             default:
                 fprintf(stderr, "Unexpected error\n");
                 exit(EXIT_FAILURE);
@@ -479,6 +563,16 @@ static void parse_args(int argc, char *argv[], params_db_t *params_db, params_wr
         fprintf(stderr, "Error: records-per-query not set\n");
         exit(EXIT_FAILURE);
     }
+
+    if (params_write->num_threads == 0) {
+        fprintf(stderr, "Error: writer-threads must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (params_read->num_threads == 0) {
+        fprintf(stderr, "Error: reader-threads must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 int main(int argc, char *argv[])
@@ -505,20 +599,53 @@ int main(int argc, char *argv[])
 
     db.force_fsync = params_db.force_sync;
 
-    pthread_t thread_write;
-    args_write_t args_write = { .db = &db, .params = params_write };
-    pthread_create(&thread_write, NULL, run_write, &args_write); 
+    size_t num_writers = params_write.num_threads;
+    pthread_t *threads_write = calloc(num_writers, sizeof(pthread_t));
+    args_write_t *args_write = calloc(num_writers, sizeof(args_write_t));
+
+    if (!threads_write || !args_write) {
+        fprintf(stderr, "error allocating writer threads\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < num_writers; i++) {
+        args_write[i] = (args_write_t){ .db = &db, .params = params_write };
+        pthread_create(&threads_write[i], NULL, run_write, &args_write[i]);
+    }
+
+    size_t num_readers = params_read.num_threads;
+    pthread_t *threads_read = calloc(num_readers, sizeof(pthread_t));
+    args_read_t *args_read = calloc(num_readers, sizeof(args_read_t));
+
+    if (!threads_read || !args_read) {
+        fprintf(stderr, "error allocating reader threads\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < num_readers; i++) {
+        args_read[i] = (args_read_t){ .db = &db, .seed = (unsigned int) rand(), .params = params_read };
+        pthread_create(&threads_read[i], NULL, run_read, &args_read[i]);
+    }
+
+    for (size_t i = 0; i < num_writers; i++)
+        pthread_join(threads_write[i], NULL);
+
+    for (size_t i = 0; i < num_readers; i++)
+        pthread_join(threads_read[i], NULL);
 
-    pthread_t thread_read;
-    args_read_t args_read = { .db = &db, .params = params_read };
-    pthread_create(&thread_read, NULL, run_read, &args_read); 
+    results_write_t results_write = {0};
+    merge_results_write(&results_write, args_write, num_writers);
 
-    pthread_join(thread_write, NULL);
-    pthread_join(thread_read, NULL);
+    results_read_t results_read = {0};
+    merge_results_read(&results_read, args_read, num_readers);
 
-    print_results_write(&args_write.results);
-    print_results_read(&args_read.results);
+    print_results_write(&results_write, num_writers);
+    print_results_read(&results_read, num_readers);
 
+    free(args_read);
+    free(threads_read);
+    free(args_write);
+    free(threads_write);
     ldb_close(&db);
     return EXIT_SUCCESS;
 }
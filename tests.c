@@ -3,6 +3,9 @@
 #define LDB_IMPL
 #include "logdb.h"
 
+#include <signal.h>
+#include <sys/resource.h>
+
 void append_entries(ldb_db_t *db, uint64_t seqnum1, uint64_t seqnum2)
 {
     char metadata[128] = {0};
@@ -66,11 +69,11 @@ void test_strerror(void)
     const char *unknown_error = ldb_strerror(-999);
     TEST_ASSERT(unknown_error != NULL);
 
-    for (int i = 0; i < 21; i++) {
+    for (int i = 0; i < 31; i++) {
         TEST_ASSERT(ldb_strerror(-i) != NULL);
         TEST_ASSERT(strcmp(ldb_strerror(-i), unknown_error) != 0);
     }
-    for (int i = 21; i < 32; i++) {
+    for (int i = 31; i < 32; i++) {
         TEST_ASSERT(ldb_strerror(-i) != NULL);
         TEST_ASSERT(strcmp(ldb_strerror(-i), unknown_error) == 0);
     }
@@ -100,6 +103,36 @@ void test_crc32(void)
     TEST_ASSERT(checksum == 0x0D4A1185);
 }
 
+// Results validated using https://crccalc.com/ (CRC-32C)
+void test_crc32c(void)
+{
+    // abnormal cases
+    TEST_ASSERT(ldb_crc32c(NULL, 0, 42) == 42);
+    TEST_ASSERT(ldb_crc32c(NULL, 10, 42) == 42);
+    TEST_ASSERT(ldb_crc32c("", 0, 42) == 42);
+
+    // basic case
+    const char str1[] = "hello world";
+    TEST_ASSERT(ldb_crc32c(str1, strlen(str1), 0) == 0xC99465AA);
+    TEST_ASSERT(ldb_crc32c("123456789", 9, 0) == 0xE3069283);
+
+    // composability
+    const char str11[] = "hello ";
+    const char str12[] = "world";
+    uint32_t checksum = ldb_crc32c(str11, strlen(str11), 0);
+    checksum = ldb_crc32c(str12, strlen(str12), checksum);
+    TEST_ASSERT(checksum == 0xC99465AA);
+
+    // software and selected implementations agree (unaligned offsets and lengths)
+    char buf[1280] = {0};
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)(i % 256);
+    TEST_ASSERT(ldb_crc32c(buf, sizeof(buf), 0) == 0x23B62C98);
+    TEST_ASSERT(ldb_crc32c_sw(buf, sizeof(buf), 0) == 0x23B62C98);
+    for (size_t i = 0; i < 16; i++)
+        TEST_ASSERT(ldb_crc32c(buf + i, sizeof(buf) - 3*i, 7) == ldb_crc32c_sw(buf + i, sizeof(buf) - 3*i, 7));
+}
+
 void test_get_millis(void)
 {
     uint64_t t0 = 1713331281361; // 17-apr-2024 05:21:21.361 (UTC)
@@ -238,7 +271,7 @@ void test_open_empty_db(void)
     remove("test.idx");
 
     // create db
-    ldb_create_file_dat("test.dat");
+    ldb_create_file_dat("test.dat", LDB_FORMAT_DEFAULT);
 
     // open empty db
     TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
@@ -284,7 +317,7 @@ void test_open_invl_dat_header(void)
     // invalid file format
     fp = fopen("test.dat", "w");
     header.magic_number = LDB_MAGIC_NUMBER;
-    header.format = LDB_FORMAT_1 + 1;
+    header.format = LDB_FORMAT_3 + 1;
     fwrite(&header, sizeof(ldb_header_dat_t), 1, fp);
     fclose(fp);
     TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_ERR_FMT_DAT);
@@ -501,8 +534,8 @@ void _test_open_rollbacked_ok(bool check)
         record_dat.timestamp = 1000 + i;
         record_dat.metadata_len = 6;
         record_dat.data_len = 20 + i;
-        checksum = ldb_checksum_record(&record_dat);
-        record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+        checksum = ldb_checksum_record(&record_dat, db.format);
+        record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
 
         record_idx.seqnum = record_dat.seqnum;
         record_idx.timestamp = record_dat.timestamp;
@@ -555,8 +588,8 @@ void test_open_dat_check_fails(void)
     record_dat.timestamp = 10;
     record_dat.metadata_len = 6;
     record_dat.data_len = 20;
-    checksum = ldb_checksum_record(&record_dat);
-    record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+    checksum = ldb_checksum_record(&record_dat, db.format);
+    record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
     fwrite(&record_dat, sizeof(ldb_record_dat_t), 1, db.dat_fp);
     fwrite(data, record_dat.metadata_len + record_dat.data_len, 1, db.dat_fp);
 
@@ -565,8 +598,8 @@ void test_open_dat_check_fails(void)
     record_dat.timestamp = 10;
     record_dat.metadata_len = 6;
     record_dat.data_len = 20;
-    checksum = ldb_checksum_record(&record_dat);
-    record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+    checksum = ldb_checksum_record(&record_dat, db.format);
+    record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
     fwrite(&record_dat, sizeof(ldb_record_dat_t), 1, db.dat_fp);
     fwrite(data, record_dat.metadata_len + record_dat.data_len, 1, db.dat_fp);
 
@@ -594,8 +627,8 @@ void test_open_dat_corrupted(void)
     record_dat.timestamp = 10;
     record_dat.metadata_len = 6;
     record_dat.data_len = 20;
-    checksum = ldb_checksum_record(&record_dat);
-    record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+    checksum = ldb_checksum_record(&record_dat, db.format);
+    record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
     fwrite(&record_dat, sizeof(ldb_record_dat_t), 1, db.dat_fp);
     fwrite(data, record_dat.metadata_len + record_dat.data_len, 1, db.dat_fp);
 
@@ -604,8 +637,8 @@ void test_open_dat_corrupted(void)
     record_dat.timestamp = 11;
     record_dat.metadata_len = 6;
     record_dat.data_len = 20;
-    checksum = ldb_checksum_record(&record_dat);
-    record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum) + 999;
+    checksum = ldb_checksum_record(&record_dat, db.format);
+    record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum) + 999;
     fwrite(&record_dat, sizeof(ldb_record_dat_t), 1, db.dat_fp);
     fwrite(data, record_dat.metadata_len + record_dat.data_len, 1, db.dat_fp);
 
@@ -636,8 +669,8 @@ void test_open_idx_check_fails_1(void)
         record_dat.timestamp = 1000 + i;
         record_dat.metadata_len = 6;
         record_dat.data_len = 20 + i;
-        checksum = ldb_checksum_record(&record_dat);
-        record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+        checksum = ldb_checksum_record(&record_dat, db.format);
+        record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
 
         record_idx.seqnum = record_dat.seqnum + (i == 12 ? 5 : 0); // seqnum mismatch
         record_idx.timestamp = record_dat.timestamp;
@@ -680,8 +713,8 @@ void test_open_idx_check_fails_2(void)
         record_dat.timestamp = 1000 + i;
         record_dat.metadata_len = 6;
         record_dat.data_len = 20 + i;
-        checksum = ldb_checksum_record(&record_dat);
-        record_dat.checksum = ldb_crc32(data, record_dat.metadata_len + record_dat.data_len, checksum);
+        checksum = ldb_checksum_record(&record_dat, db.format);
+        record_dat.checksum = ldb_checksum(db.format, data, record_dat.metadata_len + record_dat.data_len, checksum);
 
         record_idx.seqnum = record_dat.seqnum;
         record_idx.timestamp = record_dat.timestamp;
@@ -990,6 +1023,199 @@ void test_append_lack_of_data(void)
     ldb_close(&db);
 }
 
+void test_append_batch(void)
+{
+    ldb_db_t db = {0};
+    const size_t len = 3 * LDB_WRITE_MAX_ENTRIES + 7;
+    ldb_entry_t *wentries = (ldb_entry_t *) calloc(len, sizeof(ldb_entry_t));
+    ldb_entry_t rentries[10] = {{0}};
+    char data[512] = {0};
+    size_t num = 0;
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i % 251);
+
+    for (size_t i = 0; i < len; i++)
+        wentries[i] = (ldb_entry_t){ .seqnum = i + 1, .timestamp = 100, .metadata_len = (uint32_t)(i % 4), .metadata = data, .data_len = (uint32_t)(i % sizeof(data)), .data = data };
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+
+    // batch written with several writev (more than LDB_IOV_MAX vectors)
+    TEST_ASSERT(ldb_append(&db, wentries, len, &num) == LDB_OK);
+    TEST_ASSERT(num == len);
+    TEST_ASSERT(db.state.seqnum2 == len);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == db.dat_end);
+
+    // rewrite after rollback (append offset moved back)
+    TEST_ASSERT(ldb_rollback(&db, 300) == (long)(len - 300));
+    TEST_ASSERT(ldb_append(&db, wentries + 300, len - 300, &num) == LDB_OK);
+    TEST_ASSERT(num == len - 300);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == db.dat_end);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 1);
+    TEST_ASSERT(db.state.seqnum2 == len);
+
+    for (size_t i = 0; i < len; i += 10)
+    {
+        TEST_ASSERT(ldb_read(&db, i + 1, rentries, 10, &num) == LDB_OK);
+
+        for (size_t j = 0; j < num; j++) {
+            TEST_ASSERT(rentries[j].seqnum == i + j + 1);
+            TEST_ASSERT(rentries[j].metadata_len == wentries[i + j].metadata_len);
+            TEST_ASSERT(rentries[j].data_len == wentries[i + j].data_len);
+            TEST_ASSERT(rentries[j].data_len == 0 || memcmp(rentries[j].data, data, rentries[j].data_len) == 0);
+            ldb_free_entry(&rentries[j]);
+        }
+    }
+
+    ldb_close(&db);
+    free(wentries);
+}
+
+void test_append_write_error(void)
+{
+    ldb_db_t db = {0};
+    const size_t len = 2 * LDB_WRITE_MAX_ENTRIES + 7;
+    const size_t rec_len = sizeof(ldb_record_dat_t) + 16;
+    ldb_entry_t *wentries = (ldb_entry_t *) calloc(len, sizeof(ldb_entry_t));
+    struct rlimit limit0 = {0};
+    struct rlimit limit = {0};
+    char data[16] = {0};
+    size_t dat_len = 0;
+    size_t num = 0;
+
+    for (size_t i = 0; i < len; i++)
+        wentries[i] = (ldb_entry_t){ .seqnum = i + 100, .timestamp = i + 100, .data_len = sizeof(data), .data = data };
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 10, 99);
+    dat_len = ldb_get_file_size(db.dat_fp);
+
+    // writes exceeding the file size limit fail (EFBIG) after a partial write
+    signal(SIGXFSZ, SIG_IGN);
+    TEST_ASSERT(getrlimit(RLIMIT_FSIZE, &limit0) == 0);
+    limit = limit0;
+
+    // whole batch discarded
+    limit.rlim_cur = (rlim_t)(dat_len + LDB_WRITE_MAX_ENTRIES * rec_len + 100);
+    TEST_ASSERT(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    TEST_ASSERT(ldb_append(&db, wentries, len, &num) == LDB_ERR_WRITE_DAT);
+    TEST_ASSERT(num == 0);
+    TEST_ASSERT(db.state.seqnum2 == 99);
+    TEST_ASSERT(db.dat_end == dat_len);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == dat_len);
+
+    TEST_ASSERT(setrlimit(RLIMIT_FSIZE, &limit0) == 0);
+    signal(SIGXFSZ, SIG_DFL);
+
+    // discarded entries can be appended again
+    TEST_ASSERT(ldb_append(&db, wentries, len, &num) == LDB_OK);
+    TEST_ASSERT(num == len);
+    TEST_ASSERT(db.state.seqnum2 == 99 + len);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 10);
+    TEST_ASSERT(db.state.seqnum2 == 99 + len);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == dat_len + len * rec_len);
+    ldb_close(&db);
+
+    free(wentries);
+}
+
+void test_append_async(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t wentries[2][LDB_WRITE_MAX_ENTRIES + 10] = {{{0}}};
+    ldb_entry_t rentries[3] = {{0}};
+    char data[64] = "hello world";
+    const size_t len = LDB_WRITE_MAX_ENTRIES + 10;
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    db.force_fsync = true;
+
+    TEST_ASSERT(ldb_append_async(NULL, wentries[0], len, &num) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_async(&db, NULL, len, &num) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_wait(NULL, &seqnum) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_wait(&db, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 0);
+
+    // double buffering (previous batch is completed by the next call)
+    for (size_t k = 0; k < 6; k++)
+    {
+        ldb_entry_t *entries = wentries[k % 2];
+
+        for (size_t i = 0; i < len; i++)
+            entries[i] = (ldb_entry_t){ .seqnum = 0, .timestamp = 0, .metadata_len = 0, .metadata = NULL, .data_len = (uint32_t)(i % sizeof(data)), .data = data };
+
+        TEST_ASSERT(ldb_append_async(&db, entries, len, &num) == LDB_OK);
+        TEST_ASSERT(num == len);
+    }
+
+    TEST_ASSERT(ldb_append_wait(&db, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 6 * len);
+    TEST_ASSERT(db.state.seqnum2 == 6 * len);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == db.dat_end);
+
+#ifdef LDB_IO_URING
+    TEST_ASSERT(db.uring != NULL);
+    TEST_ASSERT(db.uring->num_inflight == 0);
+#endif
+
+    for (size_t i = 0; i < 3; i++) {
+        wentries[0][i].seqnum = wentries[1][i].seqnum = 0;
+        wentries[0][i].timestamp = wentries[1][i].timestamp = 0;
+    }
+
+    // pending batch is completed by rollback
+    TEST_ASSERT(ldb_append_async(&db, wentries[0], 3, &num) == LDB_OK);
+    TEST_ASSERT(wentries[0][0].seqnum == 6 * len + 1);
+    TEST_ASSERT(ldb_rollback(&db, 6 * len + 1) == 2);
+    TEST_ASSERT(db.state.seqnum2 == 6 * len + 1);
+
+    // pending batch is completed by close
+    TEST_ASSERT(ldb_append_async(&db, wentries[1], 2, &num) == LDB_OK);
+    TEST_ASSERT(ldb_close(&db) == LDB_OK);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 1);
+    TEST_ASSERT(db.state.seqnum2 == 6 * len + 3);
+
+    TEST_ASSERT(ldb_read(&db, 6 * len + 1, rentries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(rentries[0].data_len == 0);
+    TEST_ASSERT(rentries[1].seqnum == 6 * len + 2);
+    TEST_ASSERT(rentries[1].data_len == 0);
+    TEST_ASSERT(rentries[2].data_len == 1);
+    TEST_ASSERT(memcmp(rentries[2].data, data, 1) == 0);
+
+    ldb_free_entries(rentries, 3);
+    ldb_close(&db);
+}
+
+void test_append_mt_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entry = {0};
+
+    TEST_ASSERT(ldb_append_mt(NULL, &entry, 1, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_mt(&db, NULL, 1, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_mt(&db, &entry, 1, NULL) == LDB_ERR);
+}
+
 bool check_entry(ldb_entry_t *entry, uint64_t seqnum, const char *metadata, const char *data)
 {
     return (entry && 
@@ -1000,6 +1226,21 @@ bool check_entry(ldb_entry_t *entry, uint64_t seqnum, const char *metadata, cons
             (entry->metadata == metadata || (entry->metadata != NULL && metadata != NULL && strcmp(entry->metadata, metadata) == 0)));
 }
 
+static bool check_entries(ldb_entry_t *entries, size_t num, uint64_t seqnum)
+{
+    for (size_t i = 0; i < num; i++, seqnum++)
+    {
+        char metadata[32], data[32];
+        snprintf(metadata, sizeof(metadata), "metadata-%d", (int) seqnum);
+        snprintf(data, sizeof(data), "data-%d", (int) seqnum);
+
+        if (!check_entry(&entries[i], seqnum, metadata, data))
+            return false;
+    }
+
+    return true;
+}
+
 void test_read_invalid_args(void)
 {
     ldb_db_t db = {0};
@@ -1075,6 +1316,289 @@ void test_read_nominal_case(void)
     ldb_close(&db);
 }
 
+void test_open_format_1(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    // new databases use the default format
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_DEFAULT);
+    ldb_close(&db);
+
+    remove("test.dat");
+    remove("test.idx");
+
+    // databases using format 1 remain usable
+    TEST_ASSERT(ldb_create_file_dat("test.dat", LDB_FORMAT_1));
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_1);
+    append_entries(&db, 20, 40);
+    TEST_ASSERT(ldb_purge(&db, 25) == 5);
+    ldb_close(&db);
+
+    // idx rebuilt using format 1
+    remove("test.idx");
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_1);
+    TEST_ASSERT(db.state.seqnum1 == 25);
+    TEST_ASSERT(db.state.seqnum2 == 40);
+    TEST_ASSERT(ldb_read(&db, 30, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[0], 30, "metadata-30", "data-30"));
+    ldb_close(&db);
+
+    ldb_free_entries(entries, 3);
+}
+
+void test_read_mixed_sizes(void)
+{
+    ldb_db_t db = {0};
+    const size_t len = 12;
+    const size_t sizes[] = {0, 10, 100000, 7, 300000, 2000000, 3, 0, 50000, 250000, 11, 1};
+    ldb_entry_t wentry = {0};
+    ldb_entry_t entries[12] = {{0}};
+    char *data = (char *) malloc(2000000 + len);
+    size_t num = 0;
+
+    // entry i uses data + i
+    for (size_t i = 0; i < 2000000 + len; i++)
+        data[i] = (char)(i % 251);
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+
+    for (size_t i = 0; i < len; i++) {
+        wentry = (ldb_entry_t){ .seqnum = i + 1, .timestamp = 1, .metadata_len = (uint32_t) (i % 3), .metadata = data + i, .data_len = (uint32_t) sizes[i], .data = data + i };
+        TEST_ASSERT(ldb_append(&db, &wentry, 1, NULL) == LDB_OK);
+    }
+
+    // reading all entries in a row (small records coalesced, big ones read directly)
+    for (size_t first = 1; first <= 3; first++)
+    {
+        TEST_ASSERT(ldb_read(&db, first, entries, len, &num) == LDB_OK);
+        TEST_ASSERT(num == len - first + 1);
+
+        for (size_t i = 0; i < num; i++) {
+            size_t j = first - 1 + i;
+            TEST_ASSERT(entries[i].seqnum == j + 1);
+            TEST_ASSERT(entries[i].metadata_len == j % 3);
+            TEST_ASSERT(entries[i].data_len == sizes[j]);
+            TEST_ASSERT(j % 3 == 0 || memcmp(entries[i].metadata, data + j, j % 3) == 0);
+            TEST_ASSERT(sizes[j] == 0 || memcmp(entries[i].data, data + j, sizes[j]) == 0);
+        }
+    }
+
+    // reading a range in the middle
+    TEST_ASSERT(ldb_read(&db, 4, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(entries[2].seqnum == 6);
+    TEST_ASSERT(entries[2].data_len == sizes[5]);
+    TEST_ASSERT(memcmp(entries[2].data, data + 5, sizes[5]) == 0);
+
+    ldb_free_entries(entries, len);
+    ldb_close(&db);
+    free(data);
+}
+
+void test_read_view_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+
+    TEST_ASSERT(ldb_read_view(NULL, 1, entries, 3, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_view(&db, 1, NULL, 3, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_view(&db, 1, entries, 0, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_view(&db, 1, entries, 3, NULL) == LDB_ERR);
+    ldb_release_view(NULL, NULL, 0);
+}
+
+void test_read_view_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_entry_t entries2[3] = {{0}};
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 314);
+
+    TEST_ASSERT(ldb_read_view(&db, 0, entries, 3, &num) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(num == 0);
+    TEST_ASSERT(ldb_read_view(&db, 400, entries, 3, &num) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(num == 0);
+    TEST_ASSERT(db.num_views == 0);
+
+    TEST_ASSERT(ldb_read_view(&db, 20, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(db.num_views == 1);
+    TEST_ASSERT(check_entry(&entries[0], 20, "metadata-20", "data-20"));
+    TEST_ASSERT(check_entry(&entries[1], 21, "metadata-21", "data-21"));
+    TEST_ASSERT(check_entry(&entries[2], 22, "metadata-22", "data-22"));
+    TEST_ASSERT((char *) entries[0].metadata >= db.dat_map);
+    TEST_ASSERT((char *) entries[0].metadata < db.dat_map + db.dat_map_len);
+
+    // views are valid after appending new entries
+    append_entries(&db, 315, 320);
+    TEST_ASSERT(ldb_read_view(&db, 313, entries2, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(db.num_views == 2);
+    TEST_ASSERT(check_entry(&entries2[0], 313, "metadata-313", "data-313"));
+    TEST_ASSERT(check_entry(&entries2[2], 315, "metadata-315", "data-315"));
+    TEST_ASSERT(check_entry(&entries[2], 22, "metadata-22", "data-22"));
+
+    ldb_release_view(&db, entries, 3);
+    TEST_ASSERT(entries[0].metadata == NULL);
+    TEST_ASSERT(entries[0].data_len == 0);
+    ldb_release_view(&db, entries2, 3);
+    TEST_ASSERT(db.num_views == 0);
+
+    TEST_ASSERT(ldb_read_view(&db, 318, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[2], 320, "metadata-320", "data-320"));
+    TEST_ASSERT(entries[3].seqnum == 0);
+    ldb_release_view(&db, entries, 10);
+
+    TEST_ASSERT(ldb_rollback(&db, 300) == 20);
+    TEST_ASSERT(ldb_purge(&db, 100) == 80);
+    TEST_ASSERT(ldb_read_view(&db, 100, entries, 2, &num) == LDB_OK);
+    TEST_ASSERT(num == 2);
+    TEST_ASSERT(check_entry(&entries[1], 101, "metadata-101", "data-101"));
+    ldb_release_view(&db, entries, 2);
+
+    ldb_close(&db);
+}
+
+static void * run_rollback(void *args)
+{
+    ldb_db_t *db = (ldb_db_t *) args;
+    ldb_rollback(db, 100);
+    return NULL;
+}
+
+void test_read_view_pinned(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+    pthread_t thread;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 314);
+
+    TEST_ASSERT(ldb_read_view(&db, 200, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+
+    // rollback waits until view is released
+    pthread_create(&thread, NULL, run_rollback, &db);
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 50000000 }, NULL);
+    TEST_ASSERT(check_entry(&entries[0], 200, "metadata-200", "data-200"));
+    TEST_ASSERT(check_entry(&entries[2], 202, "metadata-202", "data-202"));
+    ldb_release_view(&db, entries, 3);
+    pthread_join(thread, NULL);
+
+    TEST_ASSERT(db.state.seqnum2 == 100);
+    ldb_close(&db);
+}
+
+typedef struct producer_t {
+    ldb_db_t *db;
+    int id;
+    int num;
+    int ret;
+} producer_t;
+
+static void * run_producer(void *args)
+{
+    producer_t *producer = (producer_t *) args;
+    char metadata[32] = {0};
+    char data[32] = {0};
+    size_t num = 0;
+
+    snprintf(metadata, sizeof(metadata), "producer-%d", producer->id);
+
+    for (int i = 0; i < producer->num; i++)
+    {
+        snprintf(data, sizeof(data), "%d", i);
+
+        ldb_entry_t entry = {
+            .metadata_len = strlen(metadata) + 1,
+            .metadata = metadata,
+            .data_len = strlen(data) + 1,
+            .data = data
+        };
+
+        if ((producer->ret = ldb_append_mt(producer->db, &entry, 1, &num)) != LDB_OK || num != 1)
+            break;
+    }
+
+    return NULL;
+}
+
+void test_append_mt_concurrent(void)
+{
+    ldb_db_t db = {0};
+    const int num_producers = 4;
+    const int num_entries = 100;
+    producer_t producers[num_producers];
+    pthread_t threads[num_producers];
+    int counters[num_producers];
+    ldb_entry_t entries[10] = {{0}};
+    uint64_t seqnum = 1;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    db.force_fsync = true;
+
+    for (int i = 0; i < num_producers; i++) {
+        producers[i] = (producer_t){ .db = &db, .id = i, .num = num_entries, .ret = LDB_OK };
+        counters[i] = 0;
+        pthread_create(&threads[i], NULL, run_producer, &producers[i]);
+    }
+
+    for (int i = 0; i < num_producers; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(producers[i].ret == LDB_OK);
+    }
+
+    TEST_ASSERT(db.state.seqnum1 == 1);
+    TEST_ASSERT(db.state.seqnum2 == (uint64_t) (num_producers * num_entries));
+
+    // seqnums are consecutive and each producer entries keep their order
+    while (ldb_read(&db, seqnum, entries, 10, &num) == LDB_OK && num > 0)
+    {
+        for (size_t j = 0; j < num; j++, seqnum++)
+        {
+            int id = -1;
+            TEST_ASSERT(entries[j].seqnum == seqnum);
+            TEST_ASSERT(sscanf(entries[j].metadata, "producer-%d", &id) == 1);
+            TEST_ASSERT(id >= 0 && id < num_producers);
+            TEST_ASSERT(atoi(entries[j].data) == counters[id]);
+            counters[id]++;
+        }
+    }
+
+    TEST_ASSERT(seqnum == (uint64_t) (num_producers * num_entries) + 1);
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+}
+
 void test_stats_invalid_args(void)
 {
     ldb_db_t db = {0};
@@ -1199,18 +1723,170 @@ void test_search_nominal_case(void)
     ldb_close(&db);
 }
 
-void test_rollback_invalid_args(void)
+// skewed timestamps (non uniform, with duplicates)
+static uint64_t skewed_timestamp(uint64_t seqnum)
 {
-    ldb_db_t db = {0};
-
-    TEST_ASSERT(ldb_rollback(NULL, 1) == LDB_ERR_ARG);
-    TEST_ASSERT(ldb_rollback(&db, 1) == LDB_ERR);
+    return 1 + seqnum * seqnum / 2000;
 }
 
-void test_rollback_nominal_case(void)
+// compares ldb_search() against a linear search over [seqnum1, seqnum2]
+void check_search(ldb_db_t *db, uint64_t seqnum1, uint64_t seqnum2)
 {
-    ldb_db_t db = {0};
-    size_t end = 0;
+    uint64_t seqnum = 0;
+    uint64_t step = 1 + skewed_timestamp(seqnum2) / 3000;
+
+    for (uint64_t ts = 0; ts <= skewed_timestamp(seqnum2) + 1; ts += step)
+    {
+        uint64_t lower = seqnum1;
+        uint64_t upper = seqnum1;
+
+        while (lower <= seqnum2 && skewed_timestamp(lower) < ts)
+            lower++;
+
+        while (upper <= seqnum2 && skewed_timestamp(upper) <= ts)
+            upper++;
+
+        if (lower > seqnum2)
+            TEST_ASSERT(ldb_search(db, ts, LDB_SEARCH_LOWER, &seqnum) == LDB_ERR_NOT_FOUND);
+        else
+            TEST_ASSERT(ldb_search(db, ts, LDB_SEARCH_LOWER, &seqnum) == LDB_OK && seqnum == lower);
+
+        if (upper > seqnum2)
+            TEST_ASSERT(ldb_search(db, ts, LDB_SEARCH_UPPER, &seqnum) == LDB_ERR_NOT_FOUND);
+        else
+            TEST_ASSERT(ldb_search(db, ts, LDB_SEARCH_UPPER, &seqnum) == LDB_OK && seqnum == upper);
+    }
+}
+
+void test_search_fences(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entry = {0};
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+
+    for (uint64_t sn = 1; sn <= 5000; sn++) {
+        entry = (ldb_entry_t){ .seqnum = sn, .timestamp = skewed_timestamp(sn) };
+        TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_OK);
+    }
+
+    // fences added on append
+    TEST_ASSERT(db.num_fences == 5);
+    TEST_ASSERT(db.fences[1] == skewed_timestamp(1 + LDB_FENCE_STEP));
+    check_search(&db, 1, 5000);
+    ldb_close(&db);
+
+    // fences built on open
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.num_fences == 5);
+    TEST_ASSERT(db.fences[4] == skewed_timestamp(1 + 4 * LDB_FENCE_STEP));
+    check_search(&db, 1, 5000);
+
+    TEST_ASSERT(ldb_set_mmap_idx(&db, true) == LDB_OK);
+    check_search(&db, 1, 5000);
+    TEST_ASSERT(ldb_set_mmap_idx(&db, false) == LDB_OK);
+
+    // fences trimmed on rollback
+    TEST_ASSERT(ldb_rollback(&db, 3000) == 2000);
+    TEST_ASSERT(db.num_fences == 3);
+    check_search(&db, 1, 3000);
+
+    // fences rebuilt on purge
+    TEST_ASSERT(ldb_purge(&db, 1500) == 1499);
+    TEST_ASSERT(db.num_fences == 2);
+    TEST_ASSERT(db.fences[1] == skewed_timestamp(1500 + LDB_FENCE_STEP));
+    check_search(&db, 1500, 3000);
+
+    TEST_ASSERT(ldb_purge(&db, 9999) == 1501);
+    TEST_ASSERT(db.num_fences == 0);
+    ldb_close(&db);
+}
+
+typedef struct reader_t {
+    ldb_db_t *db;
+    int id;
+    int num;
+    int errors;
+} reader_t;
+
+// Reads and searches entries 20..1999 (see test_read_concurrent)
+void * run_reader(void *arg)
+{
+    reader_t *reader = (reader_t *) arg;
+    ldb_entry_t entries[10] = {{0}};
+    char data[128] = {0};
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    for (int i = 0; i < reader->num; i++)
+    {
+        uint64_t sn = 20 + (uint64_t)((i * 7 + reader->id * 13) % 1980);
+        int rc = ldb_read(reader->db, sn, entries, 10, &num);
+
+        if (rc == LDB_OK) {
+            for (size_t j = 0; j < num; j++) {
+                snprintf(data, sizeof(data), "data-%d", (int)(sn + j));
+                if (entries[j].seqnum != sn + j || strcmp(entries[j].data, data) != 0)
+                    reader->errors++;
+            }
+        }
+        else if (rc != LDB_ERR_NOT_FOUND)
+            reader->errors++;
+
+        rc = ldb_search(reader->db, sn - (sn % 10), LDB_SEARCH_LOWER, &seqnum);
+
+        if ((rc == LDB_OK && seqnum != sn - (sn % 10)) || (rc != LDB_OK && rc != LDB_ERR_NOT_FOUND))
+            reader->errors++;
+    }
+
+    ldb_free_entries(entries, 10);
+    return NULL;
+}
+
+void test_read_concurrent(void)
+{
+    ldb_db_t db = {0};
+    const int num_readers = 4;
+    reader_t readers[num_readers];
+    pthread_t threads[num_readers];
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 99);
+
+    for (int i = 0; i < num_readers; i++) {
+        readers[i] = (reader_t){ .db = &db, .id = i, .num = 2000, .errors = 0 };
+        pthread_create(&threads[i], NULL, run_reader, &readers[i]);
+    }
+
+    // readers run while entries are appended
+    append_entries(&db, 100, 1999);
+
+    for (int i = 0; i < num_readers; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(readers[i].errors == 0);
+    }
+
+    ldb_close(&db);
+}
+
+void test_rollback_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_rollback(NULL, 1) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_rollback(&db, 1) == LDB_ERR);
+}
+
+void test_rollback_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    size_t end = 0;
 
     remove("test.dat");
     remove("test.idx");
@@ -1243,6 +1919,8 @@ void test_rollback_nominal_case(void)
     TEST_ASSERT(db.state.seqnum1 == 20);
     TEST_ASSERT(db.state.seqnum2 == 100);
     TEST_ASSERT(db.dat_end < end);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == db.dat_end);
+    TEST_ASSERT(ldb_get_file_size(db.idx_fp) == sizeof(ldb_header_idx_t) + 81 * sizeof(ldb_record_idx_t));
     end = db.dat_end;
 
     TEST_ASSERT(ldb_rollback(&db, 20) == 80);
@@ -1259,6 +1937,37 @@ void test_rollback_nominal_case(void)
     ldb_close(&db);
 }
 
+void test_rollback_interrupted(void)
+{
+    ldb_db_t db = {0};
+    ldb_record_idx_t record = {0};
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 314);
+
+    // crash after truncating the index file (data file not truncated)
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 101, &record) == LDB_OK);
+    TEST_ASSERT(ldb_truncate(db.idx_fp, ldb_get_pos_idx(&db.state, 101)));
+    db.chk_valid = false;
+    ldb_close(&db);
+
+    // rollback not done, index rebuilt from data
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+    TEST_ASSERT(ldb_rollback(&db, 100) == 214);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 100);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == record.pos);
+    ldb_close(&db);
+}
+
 void test_purge_invalid_args(void)
 {
     ldb_db_t db = {0};
@@ -1352,8 +2061,3022 @@ void test_purge_all(void)
     ldb_close(&db);
 }
 
+typedef struct online_reader_t {
+    ldb_db_t *db;
+    uint64_t seqnum;
+    int stop;
+    int ret;
+    int num_reads;
+} online_reader_t;
+
+static void * run_online_reader(void *args)
+{
+    online_reader_t *reader = (online_reader_t *) args;
+    ldb_entry_t entries[10] = {{0}};
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE) && reader->ret == LDB_OK)
+    {
+        uint64_t sn = reader->seqnum + (uint64_t)(reader->num_reads % 100);
+
+        if ((reader->ret = ldb_read(reader->db, sn, entries, 10, &num)) != LDB_OK)
+            break;
+
+        if (num != 10 || !check_entries(entries, num, sn)) {
+            reader->ret = LDB_ERR;
+            break;
+        }
+
+        if ((reader->ret = ldb_search(reader->db, sn - (sn % 10), LDB_SEARCH_LOWER, &seqnum)) != LDB_OK)
+            break;
+
+        if (seqnum != sn - (sn % 10)) {
+            reader->ret = LDB_ERR;
+            break;
+        }
+
+        reader->num_reads++;
+    }
+
+    ldb_free_entries(entries, 10);
+    return NULL;
+}
+
+void test_purge_online(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entry = {0};
+    uint64_t seqnum = 0;
+    pthread_t thread;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 5000);
+
+    online_reader_t reader = { .db = &db, .seqnum = 4000, .stop = 0, .ret = LDB_OK };
+    pthread_create(&thread, NULL, run_online_reader, &reader);
+
+    // readers are not disturbed by purges and rollbacks of other entries
+    for (uint64_t sn = 100; sn <= 3000; sn += 100) {
+        TEST_ASSERT(ldb_purge(&db, sn) == 100 - (sn == 100 ? 20 : 0));
+        TEST_ASSERT(ldb_rollback(&db, 5000 - sn / 100) == 1);
+    }
+
+    __atomic_store_n(&reader.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    TEST_ASSERT(reader.ret == LDB_OK);
+
+    TEST_ASSERT(db.state.seqnum1 == 3000 && db.state.seqnum2 == 4970);
+    TEST_ASSERT(db.num_fences == (4970 - 3000) / LDB_FENCE_STEP + 1);
+    TEST_ASSERT(db.fences[1] == 4020);
+    TEST_ASSERT(access("test.tmp", F_OK) != 0 && access("test.idx.tmp", F_OK) != 0);
+    TEST_ASSERT(ldb_search(&db, 4500, LDB_SEARCH_UPPER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 4510);
+    ldb_close(&db);
+
+    // idx file was moved (not rebuilt)
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 3000 && db.state.seqnum2 == 4970);
+    TEST_ASSERT(ldb_read(&db, 3000, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(check_entry(&entry, 3000, "metadata-3000", "data-3000"));
+    ldb_close(&db);
+
+    ldb_free_entry(&entry);
+}
+
+// Checks that the state snapshots are consistent (never torn) while appending.
+static void * run_state_reader(void *args)
+{
+    online_reader_t *reader = (online_reader_t *) args;
+    ldb_stats_t stats = {0};
+    uint64_t seqnum2 = 0;
+
+    while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE))
+    {
+        if ((reader->ret = ldb_stats(reader->db, 0, UINT64_MAX, &stats)) != LDB_OK)
+            break;
+
+        if (stats.min_seqnum != 10 || stats.max_seqnum < seqnum2 ||
+            stats.max_timestamp != stats.max_seqnum - (stats.max_seqnum % 10) ||
+            stats.num_entries != stats.max_seqnum - stats.min_seqnum + 1) {
+            reader->ret = LDB_ERR;
+            break;
+        }
+
+        seqnum2 = stats.max_seqnum;
+        reader->num_reads++;
+    }
+
+    return NULL;
+}
+
+void test_state_snapshot(void)
+{
+    ldb_db_t db = {0};
+    online_reader_t readers[4] = {{0}};
+    pthread_t threads[4];
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 10, 20);
+
+    for (int i = 0; i < 4; i++) {
+        readers[i] = (online_reader_t){ .db = &db, .ret = LDB_OK };
+        pthread_create(&threads[i], NULL, run_state_reader, &readers[i]);
+    }
+
+    append_entries(&db, 21, 3000);
+
+    for (int i = 0; i < 4; i++) {
+        __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELEASE);
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(readers[i].ret == LDB_OK);
+    }
+
+    TEST_ASSERT(db.state_seq % 2 == 0);
+    TEST_ASSERT(db.state.seqnum2 == 3000);
+    ldb_close(&db);
+}
+
+void test_mmap_idx_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_set_mmap_idx(NULL, true) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_mmap_idx(&db, true) == LDB_ERR);
+}
+
+void test_mmap_idx_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+    ldb_stats_t stats = {0};
+    uint64_t seqnum = 0;
+    size_t map_len = 0;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_mmap_idx(&db, true) == LDB_OK);
+    TEST_ASSERT(db.idx_map != NULL);
+    map_len = db.idx_map_len;
+
+    append_entries(&db, 20, 314);
+
+    TEST_ASSERT(ldb_read(&db, 40, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[0], 40, "metadata-40", "data-40"));
+    TEST_ASSERT(check_entry(&entries[2], 42, "metadata-42", "data-42"));
+
+    TEST_ASSERT(ldb_stats(&db, 100, 200, &stats) == LDB_OK);
+    TEST_ASSERT(stats.min_seqnum == 100);
+    TEST_ASSERT(stats.max_seqnum == 200);
+    TEST_ASSERT(stats.num_entries == 101);
+
+    TEST_ASSERT(ldb_search(&db, 25, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 30);
+    TEST_ASSERT(ldb_search(&db, 300, LDB_SEARCH_UPPER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 310);
+
+    // append until the mapping grows
+    ldb_entry_t entry = {0};
+    while (db.idx_map_len == map_len) {
+        entry.seqnum = 0;
+        entry.timestamp = 0;
+        TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_OK);
+    }
+    TEST_ASSERT(db.idx_map_len > map_len);
+    TEST_ASSERT(ldb_read(&db, db.state.seqnum2, entries, 1, &num) == LDB_OK);
+    TEST_ASSERT(num == 1);
+
+    TEST_ASSERT(ldb_rollback(&db, 300) > 0);
+    TEST_ASSERT(ldb_read(&db, 300, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 1);
+    TEST_ASSERT(check_entry(&entries[0], 300, "metadata-300", "data-300"));
+
+    TEST_ASSERT(ldb_purge(&db, 100) == 80);
+    TEST_ASSERT(db.idx_map != NULL);
+    TEST_ASSERT(ldb_read(&db, 150, entries, 3, &num) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[0], 150, "metadata-150", "data-150"));
+
+    TEST_ASSERT(ldb_set_mmap_idx(&db, false) == LDB_OK);
+    TEST_ASSERT(db.idx_map == NULL);
+    TEST_ASSERT(ldb_read(&db, 151, entries, 1, &num) == LDB_OK);
+    TEST_ASSERT(check_entry(&entries[0], 151, "metadata-151", "data-151"));
+
+    ldb_free_entries(entries, 3);
+    ldb_close(&db);
+}
+
+void remove_segments(const char *name)
+{
+    char filename[128] = {0};
+
+    snprintf(filename, sizeof(filename), "%s.seg", name);
+    remove(filename);
+
+    for (int id = 1; id < 100; id++) {
+        snprintf(filename, sizeof(filename), "%s_%08d.dat", name, id);
+        remove(filename);
+        snprintf(filename, sizeof(filename), "%s_%08d.idx", name, id);
+        remove(filename);
+    }
+}
+
+bool exists_segment(const char *name, int id)
+{
+    char filename[128] = {0};
+    snprintf(filename, sizeof(filename), "%s_%08d.dat", name, id);
+    return (access(filename, F_OK) == 0);
+}
+
+void test_segmented_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_open_segmented(NULL, "", "test", 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_segmented(&db, NULL, "test", 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_segmented(&db, "", NULL, 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 0, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_segmented(&db, "/non-existent-dir/", "test", 1024, false) == LDB_ERR_PATH);
+    TEST_ASSERT(ldb_open_segmented(&db, "", "invalid-name", 1024, false) == LDB_ERR_NAME);
+    TEST_ASSERT(ldb_open_segmented(&db, "", "name_too_long_for_segments", 1024, false) == LDB_ERR_NAME);
+}
+
+void test_segmented_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[30] = {{0}};
+    ldb_stats_t stats = {0};
+    uint64_t seqnum = 0;
+    size_t num_segs = 0;
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(db.num_segs == 1);
+    TEST_ASSERT(db.state.seqnum1 == 0);
+    TEST_ASSERT(access("test.seg", F_OK) == 0 && exists_segment("test", 1));
+
+    append_entries(&db, 20, 314);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+    TEST_ASSERT(db.num_segs > 5);
+    num_segs = db.num_segs;
+
+    for (size_t i = 0; i < db.num_segs; i++)
+        TEST_ASSERT(db.segs[i]->dat_end < 1024 + 64);
+
+    // read crossing segments
+    TEST_ASSERT(ldb_read(&db, 20, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 30);
+    for (size_t i = 0; i < num; i++) {
+        char metadata[32], data[32];
+        snprintf(metadata, sizeof(metadata), "metadata-%d", (int)(20 + i));
+        snprintf(data, sizeof(data), "data-%d", (int)(20 + i));
+        TEST_ASSERT(check_entry(&entries[i], 20 + i, metadata, data));
+    }
+
+    TEST_ASSERT(ldb_read(&db, 300, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 15);
+    TEST_ASSERT(check_entry(&entries[14], 314, "metadata-314", "data-314"));
+    TEST_ASSERT(entries[15].seqnum == 0);
+    TEST_ASSERT(ldb_read(&db, 315, entries, 1, &num) == LDB_ERR_NOT_FOUND);
+
+    // views crossing segments
+    ldb_free_entries(entries, 30);
+    TEST_ASSERT(ldb_read_view(&db, 40, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 30);
+    TEST_ASSERT(check_entry(&entries[0], 40, "metadata-40", "data-40"));
+    TEST_ASSERT(check_entry(&entries[29], 69, "metadata-69", "data-69"));
+    ldb_release_view(&db, entries, 30);
+    for (size_t i = 0; i < db.num_segs; i++)
+        TEST_ASSERT(db.segs[i]->num_views == 0);
+
+    TEST_ASSERT(ldb_stats(&db, 0, 1000, &stats) == LDB_OK);
+    TEST_ASSERT(stats.min_seqnum == 20);
+    TEST_ASSERT(stats.max_seqnum == 314);
+    TEST_ASSERT(stats.min_timestamp == 20);
+    TEST_ASSERT(stats.max_timestamp == 310);
+    TEST_ASSERT(stats.num_entries == 295);
+    TEST_ASSERT(stats.index_size == 295 * sizeof(ldb_record_idx_t));
+
+    TEST_ASSERT(ldb_search(&db, 0, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 20);
+    TEST_ASSERT(ldb_search(&db, 125, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 130);
+    TEST_ASSERT(ldb_search(&db, 200, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 200);
+    TEST_ASSERT(ldb_search(&db, 200, LDB_SEARCH_UPPER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 210);
+    TEST_ASSERT(ldb_search(&db, 310, LDB_SEARCH_UPPER, &seqnum) == LDB_ERR_NOT_FOUND);
+
+    ldb_free_entries(entries, 30);
+    ldb_close(&db);
+
+    // reopen
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(db.num_segs == num_segs);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+    TEST_ASSERT(db.state.timestamp1 == 20);
+    TEST_ASSERT(db.state.timestamp2 == 310);
+    append_entries(&db, 315, 320);
+    TEST_ASSERT(db.state.seqnum2 == 320);
+    ldb_close(&db);
+}
+
+void test_segmented_purge(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entry = {0};
+    uint64_t seqnum = 0;
+    size_t num_segs = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 314);
+    num_segs = db.num_segs;
+
+    TEST_ASSERT(ldb_purge(&db, 10) == 0);
+    TEST_ASSERT(ldb_purge(&db, 150) == 130);
+    TEST_ASSERT(db.state.seqnum1 == 150);
+    TEST_ASSERT(db.state.timestamp1 == 150);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+    TEST_ASSERT(db.num_segs < num_segs);
+    TEST_ASSERT(!exists_segment("test", 1));
+    TEST_ASSERT(db.segs[0]->state.seqnum1 <= 150);
+    TEST_ASSERT(ldb_read(&db, 149, &entry, 1, NULL) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(ldb_read(&db, 150, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(check_entry(&entry, 150, "metadata-150", "data-150"));
+    TEST_ASSERT(ldb_search(&db, 100, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 150);
+    ldb_close(&db);
+
+    // reopen keeps the logical trim
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 150);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+    TEST_ASSERT(ldb_read(&db, 149, &entry, 1, NULL) == LDB_ERR_NOT_FOUND);
+
+    // purge all
+    TEST_ASSERT(ldb_purge(&db, 1000) == 165);
+    TEST_ASSERT(db.num_segs == 1);
+    TEST_ASSERT(db.state.seqnum1 == 0);
+    TEST_ASSERT(db.state.seqnum2 == 0);
+    append_entries(&db, 2000, 2010);
+    TEST_ASSERT(db.state.seqnum1 == 2000);
+    TEST_ASSERT(db.state.seqnum2 == 2010);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 2000);
+    TEST_ASSERT(db.state.seqnum2 == 2010);
+    ldb_close(&db);
+
+    ldb_free_entry(&entry);
+}
+
+void test_segmented_rollback(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entry = {0};
+    size_t num_segs = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 314);
+    num_segs = db.num_segs;
+
+    TEST_ASSERT(ldb_rollback(&db, 400) == 0);
+    TEST_ASSERT(ldb_rollback(&db, 100) == 214);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 100);
+    TEST_ASSERT(db.num_segs < num_segs);
+    TEST_ASSERT(!exists_segment("test", (int) num_segs));
+    TEST_ASSERT(ldb_read(&db, 101, &entry, 1, NULL) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(ldb_read(&db, 100, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(check_entry(&entry, 100, "metadata-100", "data-100"));
+
+    append_entries(&db, 101, 314);
+    TEST_ASSERT(db.num_segs == num_segs);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 314);
+
+    // rollback below the logical first seqnum removes all
+    TEST_ASSERT(ldb_purge(&db, 150) == 130);
+    TEST_ASSERT(ldb_rollback(&db, 120) == 165);
+    TEST_ASSERT(db.num_segs == 1);
+    TEST_ASSERT(db.state.seqnum1 == 0);
+    TEST_ASSERT(db.state.seqnum2 == 0);
+    append_entries(&db, 500, 510);
+    TEST_ASSERT(db.state.seqnum1 == 500);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 500);
+    TEST_ASSERT(db.state.seqnum2 == 510);
+    ldb_close(&db);
+
+    ldb_free_entry(&entry);
+}
+
+// overwrites len bytes of the file at pos
+void overwrite_file(const char *filename, size_t pos, const void *bytes, size_t len)
+{
+    FILE *fp = fopen(filename, "r+");
+
+    TEST_ASSERT(fp != NULL);
+    TEST_ASSERT(fseek(fp, (long) pos, SEEK_SET) == 0);
+    TEST_ASSERT(fwrite(bytes, len, 1, fp) == 1);
+    TEST_ASSERT(fclose(fp) == 0);
+}
+
+// returns the seqnum of the checkpoint file (0 if not exist)
+uint64_t read_checkpoint(const char *filename)
+{
+    ldb_checkpoint_t chk = {0};
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL)
+        return 0;
+
+    TEST_ASSERT(fread(&chk, sizeof(chk), 1, fp) == 1);
+    fclose(fp);
+
+    return chk.seqnum;
+}
+
+void test_export_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_export(NULL, 1, 10, STDOUT_FILENO) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_export(&db, 10, 1, STDOUT_FILENO) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_export(&db, 1, 10, -1) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_export(&db, 1, 10, STDOUT_FILENO) == LDB_ERR);
+
+    TEST_ASSERT(ldb_import(NULL, STDIN_FILENO, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_import(&db, -1, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_import(&db, STDIN_FILENO, false) == LDB_ERR);
+}
+
+// exports a range of db to the file test.exp (truncated)
+long export_file(ldb_db_t *db, uint64_t seqnum1, uint64_t seqnum2)
+{
+    int fd = open("test.exp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT(fd != -1);
+    long ret = ldb_export(db, seqnum1, seqnum2, fd);
+    close(fd);
+    return ret;
+}
+
+// imports the file test.exp into db
+long import_file(ldb_db_t *db, bool check)
+{
+    int fd = open("test.exp", O_RDONLY);
+    TEST_ASSERT(fd != -1);
+    long ret = ldb_import(db, fd, check);
+    close(fd);
+    return ret;
+}
+
+void test_export_nominal_case(void)
+{
+    ldb_db_t db1 = {0};
+    ldb_db_t db2 = {0};
+    ldb_entry_t entries[120] = {{0}};
+    ldb_stats_t stats1 = {0};
+    ldb_stats_t stats2 = {0};
+    uint64_t seqnum = 0;
+    size_t num = 0;
+    char byte = 'x';
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test2.dat");
+    remove("test2.idx");
+    remove("test2.chk");
+
+    TEST_ASSERT(ldb_open(&db1, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_open(&db2, "", "test2", false) == LDB_OK);
+    append_entries(&db1, 20, 314);
+
+    // empty range (only the header)
+    TEST_ASSERT(export_file(&db1, 400, 500) == 0);
+    TEST_ASSERT(import_file(&db2, true) == 0);
+    TEST_ASSERT(db2.state.seqnum1 == 0);
+
+    // import into an empty db
+    TEST_ASSERT(export_file(&db1, 1, 200) == 181);
+    TEST_ASSERT(import_file(&db2, true) == 181);
+    TEST_ASSERT(db2.state.seqnum1 == 20);
+    TEST_ASSERT(db2.state.seqnum2 == 200);
+    TEST_ASSERT(ldb_read(&db2, 20, entries, 120, &num) == LDB_OK);
+    TEST_ASSERT(num == 120);
+    TEST_ASSERT(check_entries(entries, num, 20));
+
+    // stream must follow the db
+    TEST_ASSERT(export_file(&db1, 100, 300) == 201);
+    TEST_ASSERT(import_file(&db2, false) == LDB_ERR_ENTRY_SEQNUM);
+    TEST_ASSERT(db2.state.seqnum2 == 200);
+    TEST_ASSERT(db2.dat_end == ldb_get_file_size(db2.dat_fp));
+
+    // continue (index built from the stream)
+    TEST_ASSERT(export_file(&db1, 201, 1000) == 114);
+    TEST_ASSERT(import_file(&db2, false) == 114);
+    TEST_ASSERT(db2.state.seqnum2 == 314);
+    TEST_ASSERT(db2.state.timestamp2 == 310);
+    TEST_ASSERT(ldb_stats(&db1, 0, 1000, &stats1) == LDB_OK);
+    TEST_ASSERT(ldb_stats(&db2, 0, 1000, &stats2) == LDB_OK);
+    TEST_ASSERT(memcmp(&stats1, &stats2, sizeof(ldb_stats_t)) == 0);
+    TEST_ASSERT(ldb_search(&db2, 250, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 250);
+    TEST_ASSERT(ldb_read(&db2, 250, entries, 120, &num) == LDB_OK);
+    TEST_ASSERT(num == 65);
+    TEST_ASSERT(check_entries(entries, num, 250));
+    append_entries(&db2, 315, 320);
+    ldb_close(&db2);
+
+    // files are coherent
+    TEST_ASSERT(ldb_open(&db2, "", "test2", true) == LDB_OK);
+    TEST_ASSERT(db2.state.seqnum1 == 20);
+    TEST_ASSERT(db2.state.seqnum2 == 320);
+    TEST_ASSERT(ldb_rollback(&db2, 0) == 301);
+
+    // corrupted stream is rejected (db unchanged)
+    TEST_ASSERT(export_file(&db1, 20, 314) == 295);
+    overwrite_file("test.exp", ldb_get_file_size(db1.dat_fp) - 5, &byte, 1);
+    TEST_ASSERT(import_file(&db2, true) == LDB_ERR_CHECKSUM);
+    TEST_ASSERT(db2.state.seqnum1 == 0);
+    TEST_ASSERT(ldb_get_file_size(db2.dat_fp) == sizeof(ldb_header_dat_t));
+    TEST_ASSERT(ldb_get_file_size(db2.idx_fp) == sizeof(ldb_header_idx_t));
+
+    // torn stream is rejected (db unchanged)
+    TEST_ASSERT(export_file(&db1, 20, 314) == 295);
+    TEST_ASSERT(truncate("test.exp", (off_t)(ldb_get_file_size(db1.dat_fp) - 5)) == 0);
+    TEST_ASSERT(import_file(&db2, false) == LDB_ERR_FMT_DAT);
+    TEST_ASSERT(db2.state.seqnum1 == 0);
+    TEST_ASSERT(ldb_get_file_size(db2.dat_fp) == sizeof(ldb_header_dat_t));
+    TEST_ASSERT(ldb_get_file_size(db2.idx_fp) == sizeof(ldb_header_idx_t));
+    TEST_ASSERT(db2.num_fences == 0);
+
+    ldb_free_entries(entries, 120);
+    ldb_close(&db1);
+    ldb_close(&db2);
+    remove("test.exp");
+}
+
+void test_export_pipe(void)
+{
+    ldb_db_t db1 = {0};
+    ldb_db_t db2 = {0};
+    ldb_entry_t entries[10] = {{0}};
+    size_t num = 0;
+    int fds[2] = {-1, -1};
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test2.dat");
+    remove("test2.idx");
+    remove("test2.chk");
+
+    TEST_ASSERT(ldb_open(&db1, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_open(&db2, "", "test2", false) == LDB_OK);
+    append_entries(&db1, 20, 314);
+
+    // stream fits in the pipe buffer (copied through user space on import)
+    TEST_ASSERT(pipe(fds) == 0);
+    TEST_ASSERT(ldb_export(&db1, 50, 250, fds[1]) == 201);
+    close(fds[1]);
+    TEST_ASSERT(ldb_import(&db2, fds[0], true) == 201);
+    close(fds[0]);
+
+    TEST_ASSERT(db2.state.seqnum1 == 50);
+    TEST_ASSERT(db2.state.seqnum2 == 250);
+    TEST_ASSERT(ldb_read(&db2, 241, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 241));
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db1);
+    ldb_close(&db2);
+}
+
+void test_export_segmented(void)
+{
+    ldb_db_t db1 = {0};
+    ldb_db_t db2 = {0};
+    ldb_entry_t entries[100] = {{0}};
+    size_t num = 0;
+
+    remove_segments("test");
+    remove("test2.dat");
+    remove("test2.idx");
+    remove("test2.chk");
+
+    TEST_ASSERT(ldb_open_segmented(&db1, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_open(&db2, "", "test2", false) == LDB_OK);
+    append_entries(&db1, 20, 314);
+    TEST_ASSERT(db1.num_segs > 2);
+
+    // spans several segments (logically purged records excluded)
+    TEST_ASSERT(ldb_purge(&db1, 30) == 10);
+    TEST_ASSERT(export_file(&db1, 0, 300) == 271);
+    TEST_ASSERT(import_file(&db2, true) == 271);
+    TEST_ASSERT(db2.state.seqnum1 == 30);
+    TEST_ASSERT(db2.state.seqnum2 == 300);
+    TEST_ASSERT(ldb_read(&db2, 30, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 100);
+    TEST_ASSERT(check_entries(entries, num, 30));
+
+    // into the last segment of an emptied segmented db
+    TEST_ASSERT(ldb_rollback(&db1, 0) == 285);
+    TEST_ASSERT(export_file(&db2, 100, 300) == 201);
+    TEST_ASSERT(import_file(&db1, true) == 201);
+    TEST_ASSERT(db1.state.seqnum1 == 100);
+    TEST_ASSERT(db1.state.seqnum2 == 300);
+    TEST_ASSERT(ldb_read(&db1, 201, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 100);
+    TEST_ASSERT(check_entries(entries, num, 201));
+
+    // next append starts a new segment
+    num = db1.num_segs;
+    append_entries(&db1, 301, 310);
+    TEST_ASSERT(db1.num_segs == num + 1);
+    ldb_close(&db1);
+
+    TEST_ASSERT(ldb_open_segmented(&db1, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(db1.state.seqnum1 == 100);
+    TEST_ASSERT(db1.state.seqnum2 == 310);
+
+    ldb_free_entries(entries, 100);
+    ldb_close(&db1);
+    ldb_close(&db2);
+}
+
+void test_append_raw_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    char buf[64] = {0};
+
+    TEST_ASSERT(ldb_append_raw(NULL, buf, sizeof(buf), true, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_raw(&db, NULL, sizeof(buf), true, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_append_raw(&db, buf, sizeof(buf), true, NULL) == LDB_ERR);
+}
+
+// returns the records exported to test.exp (header excluded)
+char * read_exported_records(size_t *len)
+{
+    FILE *fp = fopen("test.exp", "r");
+    TEST_ASSERT(fp != NULL);
+    *len = ldb_get_file_size(fp) - sizeof(ldb_header_dat_t);
+    char *buf = (char *) malloc(*len);
+    TEST_ASSERT(buf != NULL);
+    TEST_ASSERT(fseek(fp, sizeof(ldb_header_dat_t), SEEK_SET) == 0);
+    TEST_ASSERT(fread(buf, 1, *len, fp) == *len);
+    fclose(fp);
+    return buf;
+}
+
+void test_append_raw_nominal_case(void)
+{
+    ldb_db_t db1 = {0};
+    ldb_db_t db2 = {0};
+    ldb_entry_t entries[100] = {{0}};
+#ifndef LDB_NO_METRICS
+    ldb_metrics_t metrics = {0};
+#endif
+    ldb_record_dat_t record = {0};
+    size_t first_len = 0;
+    size_t num = 0;
+    size_t len = 0;
+    char *buf = NULL;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove_segments("test2");
+
+    TEST_ASSERT(ldb_open(&db1, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_open_segmented(&db2, "", "test2", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_cache(&db2, 1024 * 1024) == LDB_OK);
+    append_entries(&db1, 20, 314);
+    append_entries(&db2, 10, 19);
+
+    TEST_ASSERT(export_file(&db1, 20, 99) == 80);
+    buf = read_exported_records(&len);
+
+    // torn buffer, broken sequence, corrupted record (nothing appended)
+    TEST_ASSERT(ldb_append_raw(&db2, buf, len - 1, true, &num) == LDB_ERR_FMT_DAT);
+    memcpy(&record, buf, sizeof(ldb_record_dat_t));
+    first_len = sizeof(ldb_record_dat_t) + record.metadata_len + record.data_len;
+    TEST_ASSERT(ldb_append_raw(&db2, buf + first_len, len - first_len, true, &num) == LDB_ERR_ENTRY_SEQNUM);
+    buf[len - 2] ^= 1;
+    TEST_ASSERT(ldb_append_raw(&db2, buf, len, true, &num) == LDB_ERR_CHECKSUM);
+    TEST_ASSERT(num == 0);
+    TEST_ASSERT(db2.state.seqnum2 == 19);
+    buf[len - 2] ^= 1;
+
+    // appended to the segments (and cached)
+    TEST_ASSERT(ldb_append_raw(&db2, buf, len, true, &num) == LDB_OK);
+    TEST_ASSERT(num == 80);
+    TEST_ASSERT(db2.state.seqnum1 == 10);
+    TEST_ASSERT(db2.state.seqnum2 == 99);
+    TEST_ASSERT(db2.state.timestamp2 == 90);
+    free(buf);
+
+    TEST_ASSERT(export_file(&db1, 100, 314) == 215);
+    buf = read_exported_records(&len);
+    TEST_ASSERT(ldb_append_raw(&db2, buf, len, false, &num) == LDB_OK);
+    TEST_ASSERT(num == 215);
+    TEST_ASSERT(db2.num_segs == 2);
+    free(buf);
+
+    TEST_ASSERT(ldb_read(&db2, 215, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 100);
+    TEST_ASSERT(check_entries(entries, num, 215));
+#ifndef LDB_NO_METRICS
+    TEST_ASSERT(ldb_get_metrics(&db2, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.cache_hits == 100);
+    TEST_ASSERT(metrics.appended_entries == 10 + 80 + 215);
+#endif
+    append_entries(&db2, 315, 320);
+    ldb_close(&db2);
+
+    // not verified records are verified on open
+    TEST_ASSERT(ldb_open_segmented(&db2, "", "test2", 1024, true) == LDB_OK);
+    TEST_ASSERT(db2.state.seqnum1 == 10);
+    TEST_ASSERT(db2.state.seqnum2 == 320);
+    TEST_ASSERT(ldb_read(&db2, 20, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(check_entries(entries, num, 20));
+
+    ldb_free_entries(entries, 100);
+    ldb_close(&db1);
+    ldb_close(&db2);
+}
+
+// key = label % 7, labels multiple of 5 have no key (label = number after "metadata-")
+static bool label_key(const void *metadata, uint32_t metadata_len, uint64_t *key)
+{
+    if (metadata_len < 10 || strncmp((const char *) metadata, "metadata-", 9) != 0)
+        return false;
+
+    int label = atoi((const char *) metadata + 9);
+
+    if (label % 5 == 0)
+        return false;
+
+    *key = (uint64_t)(label % 7);
+    return true;
+}
+
+// appends an entry having metadata "metadata-{label}"
+void append_labeled(ldb_db_t *db, uint64_t seqnum, int label)
+{
+    char metadata[32] = {0};
+
+    snprintf(metadata, sizeof(metadata), "metadata-%d", label);
+
+    ldb_entry_t entry = {
+        .seqnum = seqnum,
+        .timestamp = seqnum,
+        .metadata_len = (uint32_t) strlen(metadata) + 1,
+        .data_len = 4,
+        .metadata = metadata,
+        .data = "data"
+    };
+
+    TEST_ASSERT(ldb_append(db, &entry, 1, NULL) == LDB_OK);
+}
+
+// checks the lookups of all keys (labels[seqnum] is the label of the entry, seqnums in [seqnum1, seqnum2])
+static bool check_lookups(ldb_db_t *db, const int *labels, uint64_t seqnum1, uint64_t seqnum2)
+{
+    uint64_t seqnums[512] = {0};
+    uint64_t page[3] = {0};
+    size_t num = 0;
+
+    for (uint64_t key = 0; key < 7; key++)
+    {
+        size_t count = 0;
+        int rc = ldb_lookup_key(db, key, 0, seqnums, 512, &num);
+
+        for (uint64_t seqnum = seqnum1; seqnum <= seqnum2; seqnum++)
+            if (labels[seqnum] % 5 != 0 && (uint64_t)(labels[seqnum] % 7) == key && (count >= num || seqnums[count++] != seqnum))
+                return false;
+
+        if (count != num || rc != (num > 0 ? LDB_OK : LDB_ERR_NOT_FOUND))
+            return false;
+
+        // paginated
+        for (size_t i = 0; i < count; i += num) {
+            if (ldb_lookup_key(db, key, (i == 0 ? 0 : seqnums[i - 1] + 1), page, 3, &num) != LDB_OK)
+                return false;
+            for (size_t j = 0; j < num; j++)
+                if (page[j] != seqnums[i + j])
+                    return false;
+        }
+    }
+
+    return true;
+}
+
+void test_key_index_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    uint64_t seqnums[10] = {0};
+    size_t num = 1;
+
+    TEST_ASSERT(ldb_set_key_index(NULL, label_key) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_ERR);
+    TEST_ASSERT(ldb_lookup_key(NULL, 1, 0, seqnums, 10, &num) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_lookup_key(&db, 1, 0, NULL, 10, &num) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_lookup_key(&db, 1, 0, seqnums, 0, &num) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_lookup_key(&db, 1, 0, seqnums, 10, &num) == LDB_ERR);
+    TEST_ASSERT(num == 0);
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.key");
+
+    // index not enabled
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 10, 20);
+    TEST_ASSERT(ldb_lookup_key(&db, 1, 0, seqnums, 10, &num) == LDB_ERR);
+    TEST_ASSERT(ldb_set_key_index(&db, NULL) == LDB_OK);
+    ldb_close(&db);
+}
+
+void test_key_index_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    int labels[512] = {0};
+    uint64_t seqnums[10] = {0};
+    size_t num = 0;
+
+    for (int i = 0; i < 512; i++)
+        labels[i] = i;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.key");
+
+    // existing entries are indexed on enable
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 10, 300);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 300));
+    TEST_ASSERT(ldb_lookup_key(&db, 3, 0, seqnums, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(seqnums[0] == 17 && seqnums[1] == 24 && seqnums[2] == 31);
+    TEST_ASSERT(ldb_lookup_key(&db, 99, 0, seqnums, 10, &num) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(num == 0);
+
+    // appended and rolled back entries (tail)
+    append_entries(&db, 301, 400);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 400));
+    TEST_ASSERT(ldb_rollback(&db, 350) == 50);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 350));
+    append_entries(&db, 351, 360);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 360));
+
+    // run file written on close
+    ldb_close(&db);
+    TEST_ASSERT(access("test.key", F_OK) == 0);
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(db.keys.num_slots == 0);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 360));
+    append_entries(&db, 361, 380);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 380));
+
+    // entries removed from the run are replaced
+    TEST_ASSERT(ldb_rollback(&db, 200) == 180);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 200));
+    for (int i = 201; i <= 210; i++) {
+        labels[i] = 1000 + i;
+        append_labeled(&db, i, labels[i]);
+    }
+    TEST_ASSERT(check_lookups(&db, labels, 10, 210));
+    ldb_close(&db);
+
+    // run stale pairs not visible after open
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 210));
+
+    // purged entries are filtered
+    TEST_ASSERT(ldb_purge(&db, 100) == 90);
+    TEST_ASSERT(check_lookups(&db, labels, 100, 210));
+    TEST_ASSERT(ldb_lookup_key(&db, 3, 0, seqnums, 10, &num) == LDB_OK);
+    TEST_ASSERT(seqnums[0] == 101);
+
+    // purged pairs dropped by the next merge
+    append_entries(&db, 211, 215);
+    ldb_close(&db);
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(db.keys.num_run < 100);
+    TEST_ASSERT(check_lookups(&db, labels, 100, 215));
+
+    // seqnums reused after purging all entries
+    TEST_ASSERT(ldb_purge(&db, 1000) == 116);
+    TEST_ASSERT(ldb_lookup_key(&db, 3, 0, seqnums, 10, &num) == LDB_ERR_NOT_FOUND);
+    for (int i = 50; i <= 60; i++) {
+        labels[i] = 2000 + i;
+        append_labeled(&db, i, labels[i]);
+    }
+    TEST_ASSERT(check_lookups(&db, labels, 50, 60));
+    ldb_close(&db);
+
+    // rollback done with the index disabled
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_rollback(&db, 55) == 5);
+    TEST_ASSERT(access("test.key", F_OK) != 0);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(check_lookups(&db, labels, 50, 55));
+
+    // disabled index
+    TEST_ASSERT(ldb_set_key_index(&db, NULL) == LDB_OK);
+    TEST_ASSERT(ldb_lookup_key(&db, 3, 0, seqnums, 10, &num) == LDB_ERR);
+    ldb_close(&db);
+    TEST_ASSERT(access("test.key", F_OK) != 0);
+}
+
+void test_key_index_segmented(void)
+{
+    ldb_db_t db = {0};
+    int labels[512] = {0};
+
+    for (int i = 0; i < 512; i++)
+        labels[i] = i;
+
+    remove_segments("test2");
+    remove("test2.key");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test2", 1024, false) == LDB_OK);
+    append_entries(&db, 10, 100);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    append_entries(&db, 101, 300);
+    TEST_ASSERT(db.num_segs > 2);
+    TEST_ASSERT(check_lookups(&db, labels, 10, 300));
+
+    // imported entries
+    TEST_ASSERT(ldb_rollback(&db, 250) == 50);
+    TEST_ASSERT(export_file(&db, 150, 250) == 101);
+    TEST_ASSERT(ldb_purge(&db, 151) == 141);
+    TEST_ASSERT(ldb_rollback(&db, 0) == 100);
+    TEST_ASSERT(import_file(&db, true) == 101);
+    TEST_ASSERT(check_lookups(&db, labels, 150, 250));
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test2", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_key_index(&db, label_key) == LDB_OK);
+    TEST_ASSERT(check_lookups(&db, labels, 150, 250));
+    ldb_close(&db);
+}
+
+void test_cursor_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_cursor_t cursor = {0};
+    ldb_entry_t entry = {0};
+
+    TEST_ASSERT(ldb_cursor_open(NULL, &cursor, 1) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_cursor_open(&db, NULL, 1) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 1) == LDB_ERR);
+    TEST_ASSERT(ldb_cursor_next(NULL, &entry, 1, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_cursor_next(&cursor, NULL, 1, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_cursor_next(&cursor, &entry, 0, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_cursor_next(&cursor, &entry, 1, NULL) == LDB_ERR);
+    ldb_cursor_close(&cursor);
+    ldb_cursor_close(NULL);
+}
+
+void test_cursor_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_cursor_t cursor = {0};
+    ldb_entry_t entries[100] = {{0}};
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+
+    // empty db
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 0) == LDB_OK);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 0);
+
+    // first entry appended later
+    append_entries(&db, 20, 50000);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 100);
+    TEST_ASSERT(check_entries(entries, num, 20));
+
+    // several buffer refills
+    for (uint64_t seqnum = 120; seqnum <= 50000; seqnum += num) {
+        TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+        TEST_ASSERT(num == ldb_min(100, 50000 - seqnum + 1));
+        TEST_ASSERT(check_entries(entries, num, seqnum));
+    }
+
+    // end reached, then follows appended entries
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 0);
+    append_entries(&db, 50001, 50010);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 50001));
+    ldb_cursor_close(&cursor);
+
+    // purge is transparent
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 1000) == LDB_OK);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(check_entries(entries, num, 1000));
+    TEST_ASSERT(ldb_purge(&db, 1005) == 985);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 1010));
+    TEST_ASSERT(ldb_purge(&db, 2000) == 995);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 10, &num) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(num == 0);
+    ldb_cursor_close(&cursor);
+
+    // rollback behind the cursor
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 40000) == LDB_OK);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(ldb_rollback(&db, 40049) > 0);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_ERR_ROLLBACK);
+    TEST_ASSERT(num == 0);
+    append_entries(&db, 40050, 40060);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 11);
+    TEST_ASSERT(check_entries(entries, num, 40050));
+
+    // rollback ahead of the cursor (reported, position kept)
+    append_entries(&db, 40061, 40100);
+    TEST_ASSERT(ldb_rollback(&db, 40080) == 20);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_ERR_ROLLBACK);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 100, &num) == LDB_OK);
+    TEST_ASSERT(num == 20);
+    TEST_ASSERT(check_entries(entries, num, 40061));
+    ldb_cursor_close(&cursor);
+
+    ldb_free_entries(entries, 100);
+    ldb_close(&db);
+}
+
+void test_cursor_big_records(void)
+{
+    ldb_db_t db = {0};
+    ldb_cursor_t cursor = {0};
+    ldb_entry_t entries[3] = {{0}};
+    size_t big_len = LDB_CURSOR_BUFFER_LEN + 1000;
+    char *big = (char *) malloc(big_len);
+    size_t num = 0;
+
+    for (size_t i = 0; i < big_len; i++)
+        big[i] = (char)(i * 7 % 253);
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_OK);
+
+    // big (uncompressible), partially buffered, compressed
+    for (size_t i = 0; i < 6; i++) {
+        ldb_entry_t entry = { .metadata_len = 3, .metadata = "abc", .data_len = (uint32_t)(i % 2 ? big_len : big_len / 3), .data = big };
+        TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_OK);
+    }
+
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 0) == LDB_OK);
+
+    for (size_t i = 0; i < 6; i += 3) {
+        TEST_ASSERT(ldb_cursor_next(&cursor, entries, 3, &num) == LDB_OK);
+        TEST_ASSERT(num == 3);
+
+        for (size_t j = 0; j < num; j++) {
+            TEST_ASSERT(entries[j].seqnum == i + j + 1);
+            TEST_ASSERT(entries[j].metadata_len == 3);
+            TEST_ASSERT(entries[j].data_len == ((i + j) % 2 ? big_len : big_len / 3));
+            TEST_ASSERT(memcmp(entries[j].data, big, entries[j].data_len) == 0);
+        }
+    }
+
+    ldb_cursor_close(&cursor);
+    ldb_free_entries(entries, 3);
+    ldb_close(&db);
+    free(big);
+}
+
+void test_cursor_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_cursor_t cursor = {0};
+    ldb_entry_t entries[7] = {{0}};
+    uint64_t seqnum = 20;
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 200);
+    TEST_ASSERT(db.num_segs > 5);
+
+    // crossing segments
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 0) == LDB_OK);
+    while (seqnum <= 200) {
+        TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+        TEST_ASSERT(num > 0);
+        TEST_ASSERT(check_entries(entries, num, seqnum));
+        seqnum += num;
+    }
+
+    // new segments appended
+    append_entries(&db, 201, 300);
+    while (seqnum <= 300) {
+        TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+        TEST_ASSERT(num > 0);
+        TEST_ASSERT(check_entries(entries, num, seqnum));
+        seqnum += num;
+    }
+
+    // segments removed
+    ldb_cursor_close(&cursor);
+    TEST_ASSERT(ldb_cursor_open(&db, &cursor, 100) == LDB_OK);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+    TEST_ASSERT(ldb_purge(&db, 105) > 0);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+    TEST_ASSERT(num == 7);
+    TEST_ASSERT(check_entries(entries, num, 107));
+
+    TEST_ASSERT(ldb_rollback(&db, 110) > 0);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_ERR_ROLLBACK);
+    append_entries(&db, 111, 120);
+    TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+    TEST_ASSERT(num == 7);
+    TEST_ASSERT(check_entries(entries, num, 111));
+
+    ldb_cursor_close(&cursor);
+    ldb_free_entries(entries, 7);
+    ldb_close(&db);
+}
+
+void test_cache_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_set_cache(NULL, 1000) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_cache(&db, 1000) == LDB_ERR);
+}
+
+void test_cache_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_record_idx_t record = {0};
+    size_t entry_len = sizeof(ldb_cache_entry_t) + sizeof("metadata-100") + sizeof("data-100");
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_cache(&db, 50 * entry_len) == LDB_OK);
+
+    append_entries(&db, 100, 999);
+    TEST_ASSERT(db.cache.num == 50);
+    TEST_ASSERT(db.cache.seqnum1 == 950);
+    TEST_ASSERT(db.cache.bytes <= db.cache.max_bytes);
+
+    // cached entries are not read from file (dat contents modified)
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 990, &record) == LDB_OK);
+    TEST_ASSERT(ldb_pwrite(fileno(db.dat_fp), "xxxx", 4, record.pos + sizeof(ldb_record_dat_t)) == true);
+
+    TEST_ASSERT(ldb_read(&db, 990, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entry(&entries[0], 990, "metadata-990", "data-990"));
+    TEST_ASSERT(check_entry(&entries[9], 999, "metadata-999", "data-999"));
+
+    // partially cached range read from file
+    TEST_ASSERT(ldb_read(&db, 945, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entry(&entries[0], 945, "metadata-945", "data-945"));
+    TEST_ASSERT(check_entry(&entries[9], 954, "metadata-954", "data-954"));
+
+    // rollback removes cached entries
+    TEST_ASSERT(ldb_rollback(&db, 985) == 14);
+    TEST_ASSERT(db.cache.num == 36);
+    ldb_entry_t entry = { .seqnum = 986, .timestamp = 985, .metadata_len = 4, .metadata = "meta", .data_len = 4, .data = "data" };
+    TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(db.cache.num == 37);
+    TEST_ASSERT(ldb_read(&db, 986, entries, 1, &num) == LDB_OK);
+    TEST_ASSERT(num == 1 && entries[0].data_len == 4 && memcmp(entries[0].data, "data", 4) == 0);
+
+    // purge trims the cache
+    TEST_ASSERT(ldb_purge(&db, 960) == 860);
+    TEST_ASSERT(db.cache.seqnum1 == 960);
+    TEST_ASSERT(db.cache.num == 27);
+    TEST_ASSERT(ldb_read(&db, 960, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(check_entry(&entries[0], 960, "metadata-960", "data-960"));
+
+    // budget reduced, then disabled
+    TEST_ASSERT(ldb_set_cache(&db, 5 * entry_len) == LDB_OK);
+    TEST_ASSERT(db.cache.num == 5);
+    TEST_ASSERT(db.cache.seqnum1 == 982);
+    TEST_ASSERT(ldb_set_cache(&db, 0) == LDB_OK);
+    TEST_ASSERT(db.cache.num == 0 && db.cache.slots == NULL);
+    TEST_ASSERT(ldb_read(&db, 985, entries, 1, &num) == LDB_OK);
+    TEST_ASSERT(check_entry(&entries[0], 985, "metadata-985", "data-985"));
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+}
+
+void test_cache_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_cache(&db, 100000) == LDB_OK);
+    append_entries(&db, 20, 314);
+    TEST_ASSERT(db.num_segs > 5);
+
+    for (size_t i = 0; i + 1 < db.num_segs; i++)
+        TEST_ASSERT(db.segs[i]->cache.num == 0);
+
+    ldb_impl_t *last = db.segs[db.num_segs - 1];
+    TEST_ASSERT(last->cache.num == last->state.seqnum2 - last->state.seqnum1 + 1);
+
+    TEST_ASSERT(ldb_read(&db, 300, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entry(&entries[9], 309, "metadata-309", "data-309"));
+
+    TEST_ASSERT(ldb_rollback(&db, 310) == 4);
+    TEST_ASSERT(ldb_read(&db, 305, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 6);
+    TEST_ASSERT(check_entry(&entries[5], 310, "metadata-310", "data-310"));
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+}
+
+static size_t num_test_allocs = 0;
+
+static void * test_malloc(size_t size)
+{
+    num_test_allocs++;
+    return malloc(size);
+}
+
+static void test_free(void *ptr)
+{
+    num_test_allocs--;
+    free(ptr);
+}
+
+void test_allocator(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_arena_t arena = {0};
+    size_t num = 0;
+
+    TEST_ASSERT(ldb_set_allocator(test_malloc, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_allocator(NULL, test_free) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_allocator(test_malloc, test_free) == LDB_OK);
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 100);
+
+    TEST_ASSERT(ldb_read(&db, 20, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(num_test_allocs == 10);
+    TEST_ASSERT(check_entry(&entries[9], 29, "metadata-29", "data-29"));
+
+    // memory reused
+    TEST_ASSERT(ldb_read(&db, 50, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num_test_allocs == 10);
+    ldb_free_entries(entries, 10);
+    TEST_ASSERT(num_test_allocs == 0);
+
+    // arena blocks
+    TEST_ASSERT(ldb_read_arena(&db, 20, entries, 10, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num_test_allocs == 1);
+    ldb_arena_free(&arena);
+    TEST_ASSERT(num_test_allocs == 0);
+
+    TEST_ASSERT(ldb_set_allocator(NULL, NULL) == LDB_OK);
+    TEST_ASSERT(ldb_malloc_func == malloc);
+    TEST_ASSERT(ldb_free_func == free);
+
+    ldb_close(&db);
+}
+
+void test_read_arena_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+    ldb_arena_t arena = {0};
+
+    TEST_ASSERT(ldb_read_arena(NULL, 1, entries, 3, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_arena(&db, 1, NULL, 3, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_arena(&db, 1, entries, 0, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_arena(&db, 1, entries, 3, NULL, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_arena(&db, 1, entries, 3, NULL, &arena) == LDB_ERR);
+    ldb_arena_init(NULL, NULL, 0);
+    ldb_arena_free(NULL);
+    ldb_arena_free(&arena);
+}
+
+void test_read_arena_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[20] = {{0}};
+    ldb_entry_t big = {0};
+    ldb_arena_t arena = {0};
+    char buf[200];
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 314);
+
+    TEST_ASSERT(ldb_read_arena(&db, 400, entries, 3, &num, &arena) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(num == 0);
+
+    // pooled arena, entries are contiguous
+    TEST_ASSERT(ldb_read_arena(&db, 20, entries, 20, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 20);
+    TEST_ASSERT(arena.buf != NULL && !arena.external);
+    TEST_ASSERT(arena.max == LDB_ARENA_MIN_LEN);
+    TEST_ASSERT(arena.retired == NULL);
+
+    for (size_t i = 0; i < num; i++) {
+        char metadata[32], data[32];
+        snprintf(metadata, sizeof(metadata), "metadata-%d", (int)(20 + i));
+        snprintf(data, sizeof(data), "data-%d", (int)(20 + i));
+        TEST_ASSERT(check_entry(&entries[i], 20 + i, metadata, data));
+        TEST_ASSERT((char *) entries[i].metadata >= arena.buf);
+        TEST_ASSERT((char *) entries[i].data + entries[i].data_len <= arena.buf + arena.len);
+        TEST_ASSERT((uintptr_t) entries[i].metadata % sizeof(intptr_t) == 0);
+        TEST_ASSERT((uintptr_t) entries[i].data % sizeof(intptr_t) == 0);
+        TEST_ASSERT(i == 0 || entries[i].metadata > entries[i - 1].data);
+    }
+
+    // arena reset on each read
+    size_t len = arena.len;
+    TEST_ASSERT(ldb_read_arena(&db, 310, entries, 20, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 5);
+    TEST_ASSERT(arena.len < len);
+    TEST_ASSERT(entries[0].metadata == arena.buf);
+    TEST_ASSERT(check_entry(&entries[4], 314, "metadata-314", "data-314"));
+    TEST_ASSERT(entries[5].seqnum == 0 && entries[5].metadata == NULL);
+
+    // records bigger than the read buffer and the arena block
+    char *data = (char *) malloc(2 * LDB_READ_BUFFER_LEN);
+    memset(data, 'x', 2 * LDB_READ_BUFFER_LEN);
+    big = (ldb_entry_t){ .seqnum = 315, .timestamp = 310, .metadata_len = 4, .metadata = "meta", .data_len = 2 * LDB_READ_BUFFER_LEN, .data = data };
+    TEST_ASSERT(ldb_append(&db, &big, 1, NULL) == LDB_OK);
+    append_entries(&db, 316, 320);
+
+    TEST_ASSERT(ldb_read_arena(&db, 313, entries, 20, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 8);
+    TEST_ASSERT(check_entry(&entries[1], 314, "metadata-314", "data-314"));
+    TEST_ASSERT(entries[2].seqnum == 315);
+    TEST_ASSERT(entries[2].data_len == 2 * LDB_READ_BUFFER_LEN);
+    TEST_ASSERT(memcmp(entries[2].data, data, 2 * LDB_READ_BUFFER_LEN) == 0);
+    TEST_ASSERT(check_entry(&entries[7], 320, "metadata-320", "data-320"));
+    TEST_ASSERT(arena.max >= 2 * LDB_READ_BUFFER_LEN);
+    TEST_ASSERT((char *) entries[7].data < arena.buf + arena.max);
+    free(data);
+
+    // entries served from the cache
+    TEST_ASSERT(ldb_set_cache(&db, 100000) == LDB_OK);
+    append_entries(&db, 321, 330);
+    TEST_ASSERT(ldb_read_arena(&db, 325, entries, 3, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[2], 327, "metadata-327", "data-327"));
+    TEST_ASSERT((char *) entries[0].metadata >= arena.buf && (char *) entries[0].metadata < arena.buf + arena.max);
+    ldb_arena_free(&arena);
+    TEST_ASSERT(arena.buf == NULL && arena.max == 0);
+
+    // caller-supplied buffer (partial read when exhausted)
+    ldb_arena_init(&arena, buf, sizeof(buf));
+    TEST_ASSERT(arena.external);
+    TEST_ASSERT(ldb_read_arena(&db, 20, entries, 3, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(check_entry(&entries[2], 22, "metadata-22", "data-22"));
+    TEST_ASSERT((char *) entries[2].data + entries[2].data_len <= buf + sizeof(buf));
+
+    TEST_ASSERT(ldb_read_arena(&db, 20, entries, 20, &num, &arena) == LDB_ERR_MEM);
+    TEST_ASSERT(num > 0 && num < 20);
+    TEST_ASSERT(entries[num - 1].seqnum == 20 + num - 1);
+    TEST_ASSERT(arena.buf == buf && arena.max == sizeof(buf));
+    ldb_arena_free(&arena);
+    TEST_ASSERT(arena.buf == buf);
+
+    ldb_close(&db);
+}
+
+void test_read_arena_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[30] = {{0}};
+    ldb_arena_t arena = {0};
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 314);
+    TEST_ASSERT(db.num_segs > 5);
+
+    // read crossing segments
+    TEST_ASSERT(ldb_read_arena(&db, 20, entries, 30, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 30);
+
+    for (size_t i = 0; i < num; i++) {
+        char metadata[32], data[32];
+        snprintf(metadata, sizeof(metadata), "metadata-%d", (int)(20 + i));
+        snprintf(data, sizeof(data), "data-%d", (int)(20 + i));
+        TEST_ASSERT(check_entry(&entries[i], 20 + i, metadata, data));
+        TEST_ASSERT((char *) entries[i].metadata >= arena.buf && (char *) entries[i].metadata < arena.buf + arena.max);
+    }
+
+    ldb_arena_free(&arena);
+    ldb_close(&db);
+}
+
+void test_read_partial_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[3] = {{0}};
+    ldb_arena_t arena = {0};
+    char buf[16] = {0};
+
+    TEST_ASSERT(ldb_read_metadata(NULL, 1, entries, 3, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_metadata(&db, 1, NULL, 3, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_metadata(&db, 1, entries, 0, NULL, &arena) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_metadata(&db, 1, entries, 3, NULL, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_metadata(&db, 1, entries, 3, NULL, &arena) == LDB_ERR);
+    TEST_ASSERT(ldb_read_data_range(NULL, 1, 0, buf, sizeof(buf)) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_data_range(&db, 1, 0, NULL, sizeof(buf)) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_read_data_range(&db, 1, 0, buf, sizeof(buf)) == LDB_ERR);
+    TEST_ASSERT(ldb_verify_entry(NULL, 1) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_verify_entry(&db, 1) == LDB_ERR);
+    ldb_arena_free(&arena);
+}
+
+void test_read_partial_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_arena_t arena = {0};
+    size_t metadata_len = 6000;
+    size_t data_len = 300000;
+    char *metadata = (char *) malloc(metadata_len);
+    char *data = (char *) malloc(data_len);
+    char *buf = (char *) malloc(data_len);
+    size_t num = 0;
+
+    TEST_ASSERT(metadata != NULL && data != NULL && buf != NULL);
+
+    for (size_t i = 0; i < metadata_len; i++)
+        metadata[i] = (char)('a' + i % 26);
+    for (size_t i = 0; i < data_len; i++)
+        data[i] = (char)(i % 251);
+
+    ldb_entry_t blob = {
+        .seqnum = 10,
+        .timestamp = 10,
+        .metadata_len = (uint32_t) metadata_len,
+        .data_len = (uint32_t) data_len,
+        .metadata = metadata,
+        .data = data
+    };
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_append(&db, &blob, 1, NULL) == LDB_OK);
+    append_entries(&db, 11, 40);
+
+    // headers and metadata (long metadata read twice)
+    TEST_ASSERT(ldb_read_metadata(&db, 5, entries, 10, &num, &arena) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(ldb_read_metadata(&db, 10, entries, 10, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(entries[0].seqnum == 10);
+    TEST_ASSERT(entries[0].metadata_len == metadata_len);
+    TEST_ASSERT(memcmp(entries[0].metadata, metadata, metadata_len) == 0);
+    TEST_ASSERT(entries[0].data_len == data_len);
+    TEST_ASSERT(entries[0].data == NULL);
+    TEST_ASSERT(entries[5].seqnum == 15);
+    TEST_ASSERT(strcmp((char *) entries[5].metadata, "metadata-15") == 0);
+    TEST_ASSERT(entries[5].data_len == strlen("data-15") + 1);
+    TEST_ASSERT(entries[5].data == NULL);
+    TEST_ASSERT(ldb_read_metadata(&db, 38, entries, 10, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 3);
+    TEST_ASSERT(entries[3].seqnum == 0);
+
+    // byte ranges
+    TEST_ASSERT(ldb_read_data_range(&db, 5, 0, buf, 10) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(ldb_read_data_range(&db, 10, 1000, buf, 500) == 500);
+    TEST_ASSERT(memcmp(buf, data + 1000, 500) == 0);
+    TEST_ASSERT(ldb_read_data_range(&db, 10, data_len - 100, buf, 500) == 100);
+    TEST_ASSERT(memcmp(buf, data + data_len - 100, 100) == 0);
+    TEST_ASSERT(ldb_read_data_range(&db, 10, data_len, buf, 500) == 0);
+    TEST_ASSERT(ldb_read_data_range(&db, 10, 0, buf, data_len) == (long) data_len);
+    TEST_ASSERT(memcmp(buf, data, data_len) == 0);
+    TEST_ASSERT(ldb_read_data_range(&db, 15, 5, buf, 100) == 3);
+    TEST_ASSERT(strcmp(buf, "15") == 0);
+    TEST_ASSERT(ldb_verify_entry(&db, 10) == LDB_OK);
+    TEST_ASSERT(ldb_verify_entry(&db, 41) == LDB_ERR_NOT_FOUND);
+
+    // corrupted data byte
+    FILE *fp = fopen("test.dat", "r+");
+    TEST_ASSERT(fp != NULL);
+    TEST_ASSERT(fseek(fp, sizeof(ldb_header_dat_t) + sizeof(ldb_record_dat_t) + metadata_len + 200000, SEEK_SET) == 0);
+    TEST_ASSERT(fputc(data[200000] ^ 1, fp) != EOF);
+    fclose(fp);
+
+    TEST_ASSERT(ldb_read_data_range(&db, 10, 1000, buf, 500) == 500);
+    TEST_ASSERT(ldb_read_data_range(&db, 10, 0, buf, data_len) == LDB_ERR_CHECKSUM);
+    TEST_ASSERT(ldb_verify_entry(&db, 10) == LDB_ERR_CHECKSUM);
+    TEST_ASSERT(ldb_verify_entry(&db, 11) == LDB_OK);
+
+    ldb_arena_free(&arena);
+    ldb_close(&db);
+    free(metadata);
+    free(data);
+    free(buf);
+}
+
+void test_read_partial_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[30] = {{0}};
+    ldb_arena_t arena = {0};
+    char buf[32] = {0};
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 314);
+    TEST_ASSERT(db.num_segs > 5);
+
+    // read crossing segments
+    TEST_ASSERT(ldb_read_metadata(&db, 20, entries, 30, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 30);
+
+    for (size_t i = 0; i < num; i++) {
+        char metadata[32];
+        snprintf(metadata, sizeof(metadata), "metadata-%d", (int)(20 + i));
+        TEST_ASSERT(entries[i].seqnum == 20 + i);
+        TEST_ASSERT(strcmp((char *) entries[i].metadata, metadata) == 0);
+        TEST_ASSERT(entries[i].data == NULL);
+    }
+
+    TEST_ASSERT(ldb_read_data_range(&db, 300, 0, buf, sizeof(buf)) == (long) strlen("data-300") + 1);
+    TEST_ASSERT(strcmp(buf, "data-300") == 0);
+    TEST_ASSERT(ldb_verify_entry(&db, 300) == LDB_OK);
+    TEST_ASSERT(ldb_verify_entry(&db, 315) == LDB_ERR_NOT_FOUND);
+
+    ldb_arena_free(&arena);
+    ldb_close(&db);
+}
+
+void remove_wal(const char *name)
+{
+    char filename[128] = {0};
+
+    for (int id = 1; id < 100; id++) {
+        snprintf(filename, sizeof(filename), "%s_%08d.wal", name, id);
+        remove(filename);
+    }
+}
+
+bool exists_wal_segment(const char *name, int id)
+{
+    char filename[128] = {0};
+    snprintf(filename, sizeof(filename), "%s_%08d.wal", name, id);
+    return (access(filename, F_OK) == 0);
+}
+
+void test_wal_invalid_args(void)
+{
+    ldb_wal_t wal = {0};
+    ldb_db_t *log = NULL;
+
+    TEST_ASSERT(ldb_wal_open(NULL, "", "test", 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_wal_open(&wal, NULL, "test", 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_wal_open(&wal, "", NULL, 1024, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 0, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_wal_open(&wal, "/non_existent_path/", "test", 1024, false) == LDB_ERR_PATH);
+    TEST_ASSERT(ldb_wal_open(&wal, "", "invalid/name", 1024, false) == LDB_ERR_NAME);
+    TEST_ASSERT(ldb_wal_open(&wal, "", "name_longer_than_22_chars", 1024, false) == LDB_ERR_NAME);
+    TEST_ASSERT(ldb_wal_log(NULL, 1) == NULL);
+    TEST_ASSERT(ldb_wal_log(&wal, 1) == NULL);
+    TEST_ASSERT(ldb_wal_sync(NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_wal_sync(&wal) == LDB_ERR);
+    TEST_ASSERT(ldb_wal_close(NULL) == LDB_OK);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    remove_wal("test");
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(exists_wal_segment("test", 1));
+    TEST_ASSERT((log = ldb_wal_log(&wal, 1)) != NULL);
+    TEST_ASSERT(ldb_wal_log(&wal, 1) == log);
+    TEST_ASSERT(ldb_wal_sync(&wal) == LDB_OK);
+
+    // unsupported functions
+    TEST_ASSERT(ldb_set_mmap_idx(log, true) == LDB_ERR);
+    TEST_ASSERT(ldb_set_compression(log, true) == LDB_ERR);
+    TEST_ASSERT(ldb_set_cache(log, 1024) == LDB_ERR);
+    TEST_ASSERT(ldb_close(log) == LDB_ERR);
+
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+    TEST_ASSERT(wal.name == NULL && wal.num_logs == 0);
+}
+
+void test_wal_nominal_case(void)
+{
+    ldb_wal_t *wal = ldb_wal_alloc();
+    ldb_entry_t entries[30] = {{0}};
+    ldb_cursor_t cursor = {0};
+    ldb_arena_t arena = {0};
+    ldb_stats_t stats = {0};
+    ldb_db_t *log1 = NULL;
+    ldb_db_t *log2 = NULL;
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    remove_wal("test");
+
+    TEST_ASSERT(wal != NULL);
+    TEST_ASSERT(ldb_wal_open(wal, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT((log2 = ldb_wal_log(wal, 2)) != NULL);
+    TEST_ASSERT((log1 = ldb_wal_log(wal, 1)) != NULL);
+    TEST_ASSERT(wal->num_logs == 2 && wal->logs[0] == log1);
+
+    // interleaved records
+    for (uint64_t i = 20; i < 200; i += 10) {
+        append_entries(log1, i, i + 9);
+        append_entries(log2, 1000 + i, 1000 + i + 9);
+    }
+
+    TEST_ASSERT(log1->state.seqnum1 == 20 && log1->state.seqnum2 == 199);
+    TEST_ASSERT(log2->state.seqnum1 == 1020 && log2->state.seqnum2 == 1199);
+    TEST_ASSERT(wal->num_segs > 5);
+
+    TEST_ASSERT(ldb_read(log1, 20, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 30);
+    TEST_ASSERT(check_entries(entries, num, 20));
+    TEST_ASSERT(ldb_read(log2, 1190, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 1190));
+    TEST_ASSERT(ldb_read(log1, 200, entries, 1, &num) == LDB_ERR_NOT_FOUND);
+    ldb_free_entries(entries, 30);
+    TEST_ASSERT(ldb_read_view(log1, 20, entries, 1, &num) == LDB_ERR);
+    TEST_ASSERT(ldb_read_arena(log1, 100, entries, 30, &num, &arena) == LDB_OK);
+    TEST_ASSERT(num == 30);
+    TEST_ASSERT(check_entries(entries, num, 100));
+    TEST_ASSERT((char *) entries[29].metadata >= arena.buf && (char *) entries[29].metadata < arena.buf + arena.max);
+    ldb_arena_free(&arena);
+    memset(entries, 0x00, sizeof(entries));
+
+    TEST_ASSERT(ldb_stats(log1, 0, 1000, &stats) == LDB_OK);
+    TEST_ASSERT(stats.min_seqnum == 20 && stats.max_seqnum == 199);
+    TEST_ASSERT(stats.min_timestamp == 20 && stats.max_timestamp == 190);
+    TEST_ASSERT(stats.num_entries == 180);
+    TEST_ASSERT(stats.index_size == 180 * sizeof(ldb_wal_slot_t));
+    TEST_ASSERT(stats.data_size > 180 * sizeof(ldb_record_wal_t));
+
+    TEST_ASSERT(ldb_search(log1, 0, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 20);
+    TEST_ASSERT(ldb_search(log1, 125, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 130);
+    TEST_ASSERT(ldb_search(log2, 1100, LDB_SEARCH_UPPER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 1110);
+    TEST_ASSERT(ldb_search(log1, 190, LDB_SEARCH_UPPER, &seqnum) == LDB_ERR_NOT_FOUND);
+
+    // cursor crossing segments
+    TEST_ASSERT(ldb_cursor_open(log2, &cursor, 0) == LDB_OK);
+    for (seqnum = 1020; seqnum <= 1199; seqnum += num) {
+        TEST_ASSERT(ldb_cursor_next(&cursor, entries, 7, &num) == LDB_OK);
+        TEST_ASSERT(num > 0);
+        TEST_ASSERT(check_entries(entries, num, seqnum));
+    }
+    ldb_cursor_close(&cursor);
+
+    TEST_ASSERT(ldb_rollback(log1, 300) == 0);
+    TEST_ASSERT(ldb_rollback(log1, 149) == 50);
+    TEST_ASSERT(log1->state.seqnum2 == 149 && log1->state.timestamp2 == 140);
+    TEST_ASSERT(ldb_read(log1, 150, entries, 1, &num) == LDB_ERR_NOT_FOUND);
+    TEST_ASSERT(ldb_purge(log2, 1000) == 0);
+    TEST_ASSERT(ldb_purge(log2, 1050) == 30);
+    TEST_ASSERT(log2->state.seqnum1 == 1050 && log2->state.timestamp1 == 1050);
+    append_entries(log1, 150, 155);
+
+    TEST_ASSERT(ldb_wal_close(wal) == LDB_OK);
+
+    // reopen (replays entries and markers)
+    TEST_ASSERT(ldb_wal_open(wal, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(wal->num_logs == 2);
+    log1 = ldb_wal_log(wal, 1);
+    log2 = ldb_wal_log(wal, 2);
+    TEST_ASSERT(log1->state.seqnum1 == 20 && log1->state.seqnum2 == 155);
+    TEST_ASSERT(log1->state.timestamp1 == 20 && log1->state.timestamp2 == 150);
+    TEST_ASSERT(log2->state.seqnum1 == 1050 && log2->state.seqnum2 == 1199);
+    TEST_ASSERT(ldb_read(log1, 140, entries, 30, &num) == LDB_OK);
+    TEST_ASSERT(num == 16);
+    TEST_ASSERT(check_entries(entries, num, 140));
+    TEST_ASSERT(ldb_read(log2, 1049, entries, 1, &num) == LDB_ERR_NOT_FOUND);
+
+    // rollback all
+    TEST_ASSERT(ldb_rollback(log1, 0) == 136);
+    TEST_ASSERT(log1->state.seqnum1 == 0 && log1->state.seqnum2 == 0);
+    append_entries(log1, 500, 505);
+    TEST_ASSERT(ldb_wal_close(wal) == LDB_OK);
+
+    TEST_ASSERT(ldb_wal_open(wal, "", "test", 1024, false) == LDB_OK);
+    log1 = ldb_wal_log(wal, 1);
+    TEST_ASSERT(log1->state.seqnum1 == 500 && log1->state.seqnum2 == 505);
+
+    // logs without entries are not persisted
+    TEST_ASSERT(ldb_wal_log(wal, 3) != NULL);
+    TEST_ASSERT(wal->num_logs == 3);
+    TEST_ASSERT(ldb_wal_close(wal) == LDB_OK);
+    TEST_ASSERT(ldb_wal_open(wal, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(wal->num_logs == 2);
+    TEST_ASSERT(ldb_wal_close(wal) == LDB_OK);
+
+    ldb_free_entries(entries, 30);
+    ldb_wal_free(wal);
+}
+
+void test_wal_recovery(void)
+{
+    ldb_wal_t wal = {0};
+    ldb_entry_t entry = {0};
+    ldb_db_t *log = NULL;
+    struct stat st = {0};
+    char garbage[100] = {0};
+    FILE *fp = NULL;
+    off_t len = 0;
+
+    remove_wal("test");
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024 * 1024, false) == LDB_OK);
+    log = ldb_wal_log(&wal, 7);
+    append_entries(log, 20, 50);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+    TEST_ASSERT(stat("test_00000001.wal", &st) == 0);
+    len = st.st_size;
+
+    // torn record at tail
+    fp = fopen("test_00000001.wal", "a");
+    TEST_ASSERT(fp != NULL);
+    fwrite(garbage, 1, 20, fp);
+    fclose(fp);
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024 * 1024, false) == LDB_OK);
+    TEST_ASSERT(stat("test_00000001.wal", &st) == 0 && st.st_size == len);
+    log = ldb_wal_log(&wal, 7);
+    TEST_ASSERT(log->state.seqnum1 == 20 && log->state.seqnum2 == 50);
+    append_entries(log, 51, 52);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    // corrupted last record (checksum) is truncated
+    TEST_ASSERT(stat("test_00000001.wal", &st) == 0);
+    TEST_ASSERT(truncate("test_00000001.wal", st.st_size - 3) == 0);
+    fp = fopen("test_00000001.wal", "a");
+    fwrite("xxx", 1, 3, fp);
+    fclose(fp);
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024 * 1024, false) == LDB_OK);
+    log = ldb_wal_log(&wal, 7);
+    TEST_ASSERT(log->state.seqnum1 == 20 && log->state.seqnum2 == 51);
+    TEST_ASSERT(ldb_read(log, 51, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(check_entry(&entry, 51, "metadata-51", "data-51"));
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    // invalid header of a new segment
+    fp = fopen("test_00000002.wal", "w");
+    fwrite(garbage, 1, 10, fp);
+    fclose(fp);
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024 * 1024, false) == LDB_OK);
+    TEST_ASSERT(!exists_wal_segment("test", 2));
+    TEST_ASSERT(ldb_wal_log(&wal, 7)->state.seqnum2 == 51);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    // non-consecutive segments
+    fp = fopen("test_00000003.wal", "w");
+    fclose(fp);
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024 * 1024, false) == LDB_ERR_FMT_WAL);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+    remove("test_00000003.wal");
+
+    ldb_free_entry(&entry);
+}
+
+typedef struct wal_producer_t {
+    ldb_db_t *log;
+    int num;
+    int ret;
+} wal_producer_t;
+
+static void * run_wal_producer(void *args)
+{
+    wal_producer_t *producer = (wal_producer_t *) args;
+    char data[32] = {0};
+
+    for (int i = 0; i < producer->num && producer->ret == LDB_OK; i++)
+    {
+        snprintf(data, sizeof(data), "%d", i);
+
+        ldb_entry_t entry = {
+            .data_len = (uint32_t) strlen(data) + 1,
+            .data = data
+        };
+
+        producer->ret = ldb_append(producer->log, &entry, 1, NULL);
+    }
+
+    return NULL;
+}
+
+void test_wal_concurrent(void)
+{
+    ldb_wal_t wal = {0};
+    const int num_producers = 4;
+    const int num_entries = 50;
+    wal_producer_t producers[num_producers];
+    pthread_t threads[num_producers];
+    ldb_entry_t entries[10] = {{0}};
+    size_t num = 0;
+
+    remove_wal("test");
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 4096, false) == LDB_OK);
+
+    for (int i = 0; i < num_producers; i++) {
+        producers[i] = (wal_producer_t){ .log = ldb_wal_log(&wal, (uint64_t) i), .num = num_entries, .ret = LDB_OK };
+        producers[i].log->force_fsync = true;
+        pthread_create(&threads[i], NULL, run_wal_producer, &producers[i]);
+    }
+
+    for (int i = 0; i < num_producers; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT(producers[i].ret == LDB_OK);
+    }
+
+    TEST_ASSERT(wal.synced_pos == wal.end_pos);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    // each log keeps its entries in order
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 4096, true) == LDB_OK);
+    TEST_ASSERT(wal.num_logs == (size_t) num_producers);
+
+    for (int i = 0; i < num_producers; i++)
+    {
+        ldb_db_t *log = ldb_wal_log(&wal, (uint64_t) i);
+        int counter = 0;
+
+        TEST_ASSERT(log->state.seqnum1 == 1);
+        TEST_ASSERT(log->state.seqnum2 == (uint64_t) num_entries);
+
+        for (uint64_t seqnum = 1; ldb_read(log, seqnum, entries, 10, &num) == LDB_OK; seqnum += num) {
+            for (size_t j = 0; j < num; j++, counter++)
+                TEST_ASSERT(atoi(entries[j].data) == counter);
+        }
+
+        TEST_ASSERT(counter == num_entries);
+    }
+
+    ldb_free_entries(entries, 10);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+}
+
+void test_wal_reclaim(void)
+{
+    ldb_wal_t wal = {0};
+    ldb_entry_t entry = {0};
+    ldb_db_t *log1 = NULL;
+    ldb_db_t *log2 = NULL;
+    size_t num_segs = 0;
+
+    remove_wal("test");
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024, false) == LDB_OK);
+    log1 = ldb_wal_log(&wal, 1);
+    log2 = ldb_wal_log(&wal, 2);
+    append_entries(log2, 10, 12);
+    append_entries(log1, 20, 314);
+    num_segs = wal.num_segs;
+    TEST_ASSERT(num_segs > 5);
+
+    // first segment is retained by log2
+    TEST_ASSERT(ldb_purge(log1, 200) == 180);
+    TEST_ASSERT(wal.num_segs == num_segs && exists_wal_segment("test", 1));
+
+    TEST_ASSERT(ldb_purge(log2, 100) == 3);
+    TEST_ASSERT(log2->state.seqnum1 == 0);
+    TEST_ASSERT(wal.num_segs < num_segs);
+    TEST_ASSERT(wal.seg_first_id > 1);
+    TEST_ASSERT(!exists_wal_segment("test", 1));
+    TEST_ASSERT(ldb_read(log1, 200, &entry, 1, NULL) == LDB_OK);
+    TEST_ASSERT(check_entry(&entry, 200, "metadata-200", "data-200"));
+    num_segs = wal.num_segs;
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(wal.num_segs == num_segs);
+    log1 = ldb_wal_log(&wal, 1);
+    TEST_ASSERT(log1->state.seqnum1 == 200 && log1->state.seqnum2 == 314);
+    TEST_ASSERT(ldb_wal_log(&wal, 2)->state.seqnum1 == 0);
+
+    // purge all keeps the last segment
+    TEST_ASSERT(ldb_purge(log1, 1000) == 115);
+    TEST_ASSERT(wal.num_segs == 1);
+    append_entries(log1, 2000, 2010);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    TEST_ASSERT(ldb_wal_open(&wal, "", "test", 1024, false) == LDB_OK);
+    log1 = ldb_wal_log(&wal, 1);
+    TEST_ASSERT(log1->state.seqnum1 == 2000 && log1->state.seqnum2 == 2010);
+    TEST_ASSERT(ldb_wal_close(&wal) == LDB_OK);
+
+    ldb_free_entry(&entry);
+}
+
+void test_metrics_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_metrics_t metrics = { .appended_entries = 1 };
+
+    TEST_ASSERT(ldb_get_metrics(NULL, &metrics) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_get_metrics(&db, NULL) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_ERR);
+    TEST_ASSERT(metrics.appended_entries == 0);
+}
+
+#ifndef LDB_NO_METRICS
+
+static bool check_histogram(const ldb_histogram_t *hist, uint64_t count)
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < LDB_METRICS_BUCKETS; i++)
+        total += hist->buckets[i];
+
+    return (hist->count == count && total == count && hist->max_ns <= hist->sum_ns);
+}
+
+void test_metrics_histogram(void)
+{
+    ldb_histogram_t hist = {0};
+
+    ldb_histogram_add(&hist, 999);
+    ldb_histogram_add(&hist, 1000);
+    ldb_histogram_add(&hist, 1999);
+    ldb_histogram_add(&hist, 2000);
+    ldb_histogram_add(&hist, 5000000);
+    ldb_histogram_add(&hist, UINT64_MAX / 2);
+
+    TEST_ASSERT(check_histogram(&hist, 6));
+    TEST_ASSERT(hist.buckets[0] == 1);
+    TEST_ASSERT(hist.buckets[1] == 2);
+    TEST_ASSERT(hist.buckets[2] == 1);
+    TEST_ASSERT(hist.buckets[13] == 1);  // 5000us in [4096, 8192)
+    TEST_ASSERT(hist.buckets[LDB_METRICS_BUCKETS - 1] == 1);
+    TEST_ASSERT(hist.max_ns == UINT64_MAX / 2);
+}
+
+void test_metrics_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_metrics_t metrics = {0};
+    ldb_stats_t stats = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_record_idx_t record = {0};
+    pthread_t thread;
+    uint64_t seqnum = 0;
+    uint64_t bytes = 0;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.open_ns > 0);
+    TEST_ASSERT(metrics.appended_entries == 0);
+    TEST_ASSERT(check_histogram(&metrics.append, 0));
+
+    // append
+    append_entries(&db, 10, 109);
+    TEST_ASSERT(ldb_stats(&db, 10, 109, &stats) == LDB_OK);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.appended_entries == 100);
+    TEST_ASSERT(metrics.appended_bytes == stats.data_size);
+    TEST_ASSERT(metrics.write_calls == 200);
+    TEST_ASSERT(metrics.fsync_calls == 0);
+    TEST_ASSERT(check_histogram(&metrics.append, 100));
+
+    db.force_fsync = true;
+    append_entries(&db, 110, 110);
+    db.force_fsync = false;
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.fsync_calls == 1);
+#ifndef LDB_IO_URING
+    TEST_ASSERT(check_histogram(&metrics.fsync, 1));
+#endif
+
+    // read
+    TEST_ASSERT(ldb_read(&db, 50, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    for (size_t i = 0; i < num; i++)
+        bytes += entries[i].metadata_len + entries[i].data_len;
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.read_entries == 10);
+    TEST_ASSERT(metrics.read_bytes == bytes);
+    TEST_ASSERT(metrics.read_calls > 0);
+    TEST_ASSERT(metrics.cache_hits == 0);
+    TEST_ASSERT(check_histogram(&metrics.read, 1));
+
+    // search
+    TEST_ASSERT(ldb_search(&db, 50, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(check_histogram(&metrics.search, 1));
+
+    // checksum error
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 105, &record) == LDB_OK);
+    TEST_ASSERT(ldb_pwrite(fileno(db.dat_fp), "xxxx", 4, record.pos + sizeof(ldb_record_dat_t)) == true);
+    TEST_ASSERT(ldb_read(&db, 105, entries, 1, &num) == LDB_ERR_CHECKSUM);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.checksum_errors == 1);
+    TEST_ASSERT(check_histogram(&metrics.read, 2));
+
+    // rollback (waits for the file lock)
+    pthread_rwlock_wrlock(&db.lock_files);
+    pthread_create(&thread, NULL, run_rollback, &db);
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 20000000 }, NULL);
+    pthread_rwlock_unlock(&db.lock_files);
+    pthread_join(thread, NULL);
+    TEST_ASSERT(db.state.seqnum2 == 100);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.lock_files_waits == 1);
+    TEST_ASSERT(metrics.lock_files_wait_ns >= 10000000);
+    TEST_ASSERT(check_histogram(&metrics.rollback, 1));
+    TEST_ASSERT(metrics.rollback.max_ns >= metrics.lock_files_wait_ns);
+
+    // purge
+    TEST_ASSERT(ldb_purge(&db, 20) == 10);
+    TEST_ASSERT(ldb_purge(&db, 20) == 0);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(check_histogram(&metrics.purge, 2));
+
+    // cache
+    TEST_ASSERT(ldb_set_cache(&db, 100000) == LDB_OK);
+    append_entries(&db, 101, 120);
+    TEST_ASSERT(ldb_read(&db, 111, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.cache_hits == 10);
+    TEST_ASSERT(metrics.read_entries == 20);
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_ERR);
+}
+
+void test_metrics_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_metrics_t metrics = {0};
+    ldb_entry_t entries[10] = {{0}};
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 20, 314);
+    TEST_ASSERT(db.num_segs > 5);
+
+    TEST_ASSERT(ldb_read(&db, 300, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(ldb_search(&db, 100, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(ldb_rollback(&db, 310) == 4);
+    TEST_ASSERT(ldb_purge(&db, 100) == 80);
+
+    // segments metrics are aggregated, calls are recorded once
+    TEST_ASSERT(ldb_get_metrics(&db, &metrics) == LDB_OK);
+    TEST_ASSERT(metrics.open_ns > 0);
+    TEST_ASSERT(metrics.appended_entries == 295);
+    TEST_ASSERT(metrics.write_calls == 590);
+    TEST_ASSERT(metrics.read_entries == 10);
+    TEST_ASSERT(check_histogram(&metrics.append, 295));
+    TEST_ASSERT(check_histogram(&metrics.read, 1));
+    TEST_ASSERT(check_histogram(&metrics.search, 1));
+    TEST_ASSERT(check_histogram(&metrics.rollback, 1));
+    TEST_ASSERT(check_histogram(&metrics.purge, 1));
+
+    ldb_impl_t *last = db.segs[db.num_segs - 1];
+    TEST_ASSERT(last->metrics.appended_entries == 0);
+    TEST_ASSERT(check_histogram(&last->metrics.append, 0));
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+}
+
+#endif
+
+void test_lz4_roundtrip(void)
+{
+    const size_t len = 100000;
+    char *src = (char *) malloc(len);
+    char *dst = (char *) malloc(len);
+    char *out = (char *) malloc(len);
+    uint32_t seed = 12345;
+    size_t zlen = 0;
+
+    // highly compressible
+    for (size_t i = 0; i < len; i++)
+        src[i] = "abcdefgh"[(i / 10) % 8];
+
+    zlen = ldb_lz4_compress(src, len, dst, len);
+    TEST_ASSERT(zlen > 0 && zlen < len / 10);
+    TEST_ASSERT(ldb_lz4_decompress(dst, zlen, out, len));
+    TEST_ASSERT(memcmp(src, out, len) == 0);
+
+    // wrong decompressed length
+    TEST_ASSERT(!ldb_lz4_decompress(dst, zlen, out, len - 1));
+    TEST_ASSERT(!ldb_lz4_decompress(dst, zlen - 1, out, len));
+
+    // incompressible
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (char)(seed >> 16);
+    }
+
+    TEST_ASSERT(ldb_lz4_compress(src, len, dst, len - 1) == 0);
+
+    // half random, half repeated
+    memset(src + len / 2, 'x', len / 2);
+    zlen = ldb_lz4_compress(src, len, dst, len - 1);
+    TEST_ASSERT(zlen > len / 2 && zlen < len);
+    TEST_ASSERT(ldb_lz4_decompress(dst, zlen, out, len));
+    TEST_ASSERT(memcmp(src, out, len) == 0);
+
+    free(src);
+    free(dst);
+    free(out);
+}
+
+void test_compression_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_set_compression(NULL, true) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_ERR);
+}
+
+void test_compression_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t wentries[4] = {{0}};
+    ldb_entry_t rentries[4] = {{0}};
+    ldb_stats_t stats = {0};
+    const size_t big_len = 3 * LDB_READ_BUFFER_LEN;
+    char *big = (char *) malloc(big_len);
+    char text[1000] = {0};
+    char noise[1000] = {0};
+    uint32_t seed = 777;
+    size_t num = 0;
+
+    for (size_t i = 0; i < sizeof(text); i++)
+        text[i] = "lorem ipsum dolor sit amet "[i % 27];
+
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = (char)(seed >> 16);
+    }
+
+    // stored length greater than the read buffer
+    for (size_t i = 0; i < big_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        big[i] = (i < big_len / 2 ? (char)(seed >> 16) : 'z');
+    }
+
+    wentries[0] = (ldb_entry_t){ .metadata_len = 4, .metadata = "meta", .data_len = sizeof(text), .data = text };
+    wentries[1] = (ldb_entry_t){ .metadata_len = 4, .metadata = "meta", .data_len = sizeof(noise), .data = noise };
+    wentries[2] = (ldb_entry_t){ .metadata_len = 0, .metadata = NULL, .data_len = 10, .data = text };
+    wentries[3] = (ldb_entry_t){ .metadata_len = 0, .metadata = NULL, .data_len = (uint32_t) big_len, .data = big };
+
+    remove("test.dat");
+    remove("test.idx");
+
+    // not empty database is not converted
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_2);
+    TEST_ASSERT(ldb_set_compression(&db, false) == LDB_OK);
+    append_entries(&db, 1, 3);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_ERR_FMT_DAT);
+    TEST_ASSERT(db.format == LDB_FORMAT_2);
+    ldb_close(&db);
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_3);
+    TEST_ASSERT(ldb_append(&db, wentries, 4, &num) == LDB_OK);
+    TEST_ASSERT(num == 4);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == db.dat_end);
+
+    TEST_ASSERT(ldb_stats(&db, 0, 10, &stats) == LDB_OK);
+    TEST_ASSERT(stats.num_entries == 4);
+    TEST_ASSERT(stats.raw_data_size == 4 * sizeof(ldb_record_dat_t) + 8 + sizeof(text) + sizeof(noise) + 10 + big_len);
+    TEST_ASSERT(stats.data_size < stats.raw_data_size);
+    TEST_ASSERT(stats.data_size + sizeof(ldb_header_dat_t) == db.dat_end);
+
+    // compressed records can not be viewed
+    TEST_ASSERT(ldb_read_view(&db, 1, rentries, 4, &num) == LDB_ERR_COMPRESSED);
+    TEST_ASSERT(ldb_read_view(&db, 2, rentries, 2, &num) == LDB_OK);
+    TEST_ASSERT(num == 2);
+    TEST_ASSERT(rentries[0].data_len == sizeof(noise));
+    TEST_ASSERT(memcmp(rentries[0].data, noise, sizeof(noise)) == 0);
+    ldb_release_view(&db, rentries, 4);
+    ldb_close(&db);
+
+    // format persisted and records checked
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.format == LDB_FORMAT_3);
+    TEST_ASSERT(db.state.seqnum2 == 4);
+    TEST_ASSERT(ldb_read(&db, 1, rentries, 4, &num) == LDB_OK);
+    TEST_ASSERT(num == 4);
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT(rentries[i].seqnum == i + 1);
+        TEST_ASSERT(rentries[i].metadata_len == wentries[i].metadata_len);
+        TEST_ASSERT(rentries[i].data_len == wentries[i].data_len);
+        TEST_ASSERT(memcmp(rentries[i].data, wentries[i].data, wentries[i].data_len) == 0);
+    }
+
+    // compression disabled, format kept
+    ldb_free_entries(rentries, 4);
+    TEST_ASSERT(ldb_set_compression(&db, false) == LDB_OK);
+    wentries[0].seqnum = 0;
+    wentries[0].timestamp = 0;
+    TEST_ASSERT(ldb_append(&db, wentries, 1, &num) == LDB_OK);
+    TEST_ASSERT(ldb_read_view(&db, 5, rentries, 1, &num) == LDB_OK);
+    TEST_ASSERT(num == 1);
+    TEST_ASSERT(memcmp(rentries[0].data, text, sizeof(text)) == 0);
+    ldb_release_view(&db, rentries, 1);
+
+    ldb_close(&db);
+    free(big);
+}
+
+void test_compression_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_stats_t stats = {0};
+    char data[200] = {0};
+    size_t num = 0;
+
+    memset(data, 'a', sizeof(data));
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_OK);
+    TEST_ASSERT(db.segs[0]->format == LDB_FORMAT_3);
+
+    for (size_t i = 0; i < 100; i++) {
+        ldb_entry_t entry = { .metadata_len = 0, .metadata = NULL, .data_len = sizeof(data), .data = data };
+        TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_OK);
+    }
+    TEST_ASSERT(db.num_segs > 1);
+
+    for (size_t i = 0; i < db.num_segs; i++)
+        TEST_ASSERT(db.segs[i]->format == LDB_FORMAT_3);
+
+    TEST_ASSERT(ldb_stats(&db, 0, 1000, &stats) == LDB_OK);
+    TEST_ASSERT(stats.num_entries == 100);
+    TEST_ASSERT(stats.raw_data_size == 100 * (sizeof(ldb_record_dat_t) + sizeof(data)));
+    TEST_ASSERT(stats.data_size < stats.raw_data_size);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(ldb_read(&db, 45, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT(entries[i].seqnum == 45 + i);
+        TEST_ASSERT(entries[i].data_len == sizeof(data));
+        TEST_ASSERT(memcmp(entries[i].data, data, sizeof(data)) == 0);
+    }
+
+    ldb_free_entries(entries, 10);
+    ldb_close(&db);
+}
+
+void test_wait_invalid_args(void)
+{
+    TEST_ASSERT(ldb_wait(NULL, 1, 0) == LDB_ERR_ARG);
+}
+
+typedef struct wait_args_t {
+    ldb_db_t *db;
+    uint64_t seqnum;
+    int timeout_ms;
+    bool durable;
+    int ret;
+} wait_args_t;
+
+static void * run_wait(void *args)
+{
+    wait_args_t *wargs = (wait_args_t *) args;
+    if (wargs->durable)
+        wargs->ret = ldb_wait_durable(wargs->db, wargs->seqnum, wargs->timeout_ms);
+    else
+        wargs->ret = ldb_wait(wargs->db, wargs->seqnum, wargs->timeout_ms);
+    return NULL;
+}
+
+static int wait_for_any(ldb_db_t *db, uint64_t seqnum, bool durable, void (*action)(ldb_db_t *))
+{
+    pthread_t thread;
+    wait_args_t args = { .db = db, .seqnum = seqnum, .timeout_ms = 10000, .durable = durable, .ret = LDB_OK };
+
+    pthread_create(&thread, NULL, run_wait, &args);
+
+    // give time to block (result is the same otherwise)
+    nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 20000000 }, NULL);
+    action(db);
+
+    pthread_join(thread, NULL);
+    return args.ret;
+}
+
+static int wait_for(ldb_db_t *db, uint64_t seqnum, void (*action)(ldb_db_t *))
+{
+    return wait_for_any(db, seqnum, false, action);
+}
+
+static void append_1_entry(ldb_db_t *db) {
+    ldb_entry_t entry = {0};
+    TEST_ASSERT(ldb_append(db, &entry, 1, NULL) == LDB_OK);
+}
+
+static void rollback_1_entry(ldb_db_t *db) {
+    TEST_ASSERT(ldb_rollback(db, db->state.seqnum2 - 1) == 1);
+}
+
+static void append_next_entry(ldb_db_t *db) {
+    append_entries(db, db->state.seqnum2 + 1, db->state.seqnum2 + 1);
+}
+
+static void close_db(ldb_db_t *db) {
+    TEST_ASSERT(ldb_close(db) == LDB_OK);
+}
+
+void test_wait_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    uint64_t time0 = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+
+    TEST_ASSERT(ldb_wait(&db, 1, 0) == LDB_ERR);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_wait(&db, 0, 0) == LDB_ERR_TIMEOUT);
+
+    append_entries(&db, 20, 30);
+    TEST_ASSERT(ldb_wait(&db, 0, 0) == LDB_OK);
+    TEST_ASSERT(ldb_wait(&db, 30, 0) == LDB_OK);
+    TEST_ASSERT(ldb_wait(&db, 31, 0) == LDB_ERR_TIMEOUT);
+
+    time0 = ldb_get_millis();
+    TEST_ASSERT(ldb_wait(&db, 31, 50) == LDB_ERR_TIMEOUT);
+    TEST_ASSERT(ldb_get_millis() - time0 >= 50);
+
+    // woken by append, rollback and close
+    TEST_ASSERT(wait_for(&db, 31, append_1_entry) == LDB_OK);
+    TEST_ASSERT(wait_for(&db, 32, rollback_1_entry) == LDB_ERR_ROLLBACK);
+    TEST_ASSERT(db.state.seqnum2 == 30);
+    TEST_ASSERT(wait_for(&db, 40, close_db) == LDB_ERR);
+}
+
+void test_wait_segmented(void)
+{
+    ldb_db_t db = {0};
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    append_entries(&db, 10, 100);
+    TEST_ASSERT(db.num_segs > 1);
+    TEST_ASSERT(ldb_wait(&db, 100, 0) == LDB_OK);
+    TEST_ASSERT(ldb_wait(&db, 101, 10) == LDB_ERR_TIMEOUT);
+
+    TEST_ASSERT(wait_for(&db, 101, append_1_entry) == LDB_OK);
+    TEST_ASSERT(wait_for(&db, 102, rollback_1_entry) == LDB_ERR_ROLLBACK);
+    TEST_ASSERT(wait_for(&db, 102, close_db) == LDB_ERR);
+}
+
+void test_flusher_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    ldb_flush_policy_t policy = {0};
+
+    TEST_ASSERT(ldb_set_flusher(NULL, &policy) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_durable_seqnum(NULL) == 0);
+    TEST_ASSERT(ldb_wait_durable(NULL, 1, 0) == LDB_ERR_ARG);
+
+    // db not opened
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_ERR);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+    TEST_ASSERT(ldb_wait_durable(&db, 1, 0) == LDB_ERR);
+}
+
+// Waits until the flusher syncs seqnum without waiters (false on timeout).
+static bool poll_durable(ldb_db_t *db, uint64_t seqnum)
+{
+    for (int i = 0; i < 500 && ldb_durable_seqnum(db) < seqnum; i++)
+        nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 10000000 }, NULL);
+
+    return (ldb_durable_seqnum(db) >= seqnum);
+}
+
+void test_flusher_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_flush_policy_t policy = {0};
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+
+    // no durability signal without flusher nor force_fsync
+    append_entries(&db, 20, 30);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+    TEST_ASSERT(ldb_wait_durable(&db, 30, 10) == LDB_ERR_TIMEOUT);
+
+    db.force_fsync = true;
+    append_entries(&db, 31, 31);
+    db.force_fsync = false;
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 31);
+    TEST_ASSERT(ldb_wait_durable(&db, 31, 0) == LDB_OK);
+
+    // limits not reached, the waiter requests the sync
+    policy.max_entries = 1000;
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_OK);
+    append_entries(&db, 32, 40);
+    TEST_ASSERT(ldb_wait_durable(&db, 40, 10000) == LDB_OK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 40);
+    TEST_ASSERT(wait_for_any(&db, 41, true, append_next_entry) == LDB_OK);
+
+    // synced by the interval and by the number of entries
+    policy = (ldb_flush_policy_t){ .interval_ms = 10 };
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_OK);
+    append_entries(&db, 42, 50);
+    TEST_ASSERT(poll_durable(&db, 50));
+
+    policy = (ldb_flush_policy_t){ .max_entries = 5 };
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_OK);
+    append_entries(&db, 51, 60);
+    TEST_ASSERT(poll_durable(&db, 55));
+
+    // rollback lowers it
+    TEST_ASSERT(ldb_wait_durable(&db, 60, 10000) == LDB_OK);
+    TEST_ASSERT(ldb_rollback(&db, 45) == 15);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 45);
+    TEST_ASSERT(wait_for_any(&db, 46, true, rollback_1_entry) == LDB_ERR_ROLLBACK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 44);
+
+    // purge with flusher syncs the copied records
+    TEST_ASSERT(ldb_purge(&db, 30) == 10);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 44);
+
+    TEST_ASSERT(ldb_set_flusher(&db, NULL) == LDB_OK);
+    TEST_ASSERT(ldb_set_flusher(&db, NULL) == LDB_OK);
+    TEST_ASSERT(ldb_purge(&db, 35) == 5);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+
+    // waiters leave on close
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_OK);
+    TEST_ASSERT(wait_for_any(&db, 100, true, close_db) == LDB_ERR);
+
+    // checkpoint written on close
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 44);
+    TEST_ASSERT(ldb_purge(&db, 1000) == 10);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+    ldb_close(&db);
+}
+
+void test_flusher_segmented(void)
+{
+    ldb_db_t db = {0};
+    ldb_flush_policy_t policy = {0};
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_flusher(&db, &policy) == LDB_OK);
+    append_entries(&db, 10, 100);
+    TEST_ASSERT(db.num_segs > 1);
+    TEST_ASSERT(ldb_wait_durable(&db, 100, 10000) == LDB_OK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 100);
+
+    TEST_ASSERT(ldb_rollback(&db, 90) == 10);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 90);
+    TEST_ASSERT(wait_for_any(&db, 91, true, append_next_entry) == LDB_OK);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 91);
+    TEST_ASSERT(ldb_purge(&db, 1000) == 82);
+    TEST_ASSERT(ldb_durable_seqnum(&db) == 0);
+    ldb_close(&db);
+}
+
+static size_t file_len(const char *path)
+{
+    struct stat st = {0};
+    return (stat(path, &st) == 0 ? (size_t) st.st_size : 0);
+}
+
+void test_prealloc_invalid_args(void)
+{
+    ldb_db_t db = {0};
+
+    TEST_ASSERT(ldb_set_preallocation(NULL, 4096) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_set_preallocation(&db, 4096) == LDB_ERR);
+}
+
+void test_prealloc_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    size_t idx_end = 0;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_set_preallocation(&db, 65536) == LDB_OK);
+    append_entries(&db, 10, 100);
+
+    // files extended ahead of the written data
+    idx_end = sizeof(ldb_header_idx_t) + 91 * sizeof(ldb_record_idx_t);
+    TEST_ASSERT(file_len("test.dat") == 65536);
+    TEST_ASSERT(file_len("test.idx") == 65536);
+    TEST_ASSERT(db.dat_end < 65536);
+    TEST_ASSERT(ldb_read(&db, 95, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 6);
+    TEST_ASSERT(entries[5].seqnum == 100);
+
+    // rollback trims the files
+    TEST_ASSERT(ldb_rollback(&db, 90) == 10);
+    TEST_ASSERT(file_len("test.dat") == db.dat_end);
+    append_entries(&db, 91, 100);
+    TEST_ASSERT(file_len("test.dat") == 65536);
+    ldb_close(&db);
+
+    // close trims the files
+    TEST_ASSERT(file_len("test.idx") == idx_end);
+    TEST_ASSERT(file_len("test.dat") < 65536);
+
+    // zero-filled tails (crash with preallocated files) are removed on open
+    for (int i = 0; i < 2; i++)
+    {
+        bool check = (i == 1);
+
+        TEST_ASSERT(truncate("test.dat", 1 << 20) == 0);
+        TEST_ASSERT(truncate("test.idx", 1 << 20) == 0);
+        TEST_ASSERT(ldb_open(&db, "", "test", check) == LDB_OK);
+        TEST_ASSERT(db.state.seqnum1 == 10);
+        TEST_ASSERT(db.state.seqnum2 == 100);
+        TEST_ASSERT(file_len("test.idx") == idx_end);
+        TEST_ASSERT(file_len("test.dat") == db.dat_end);
+        ldb_close(&db);
+    }
+
+    ldb_free_entries(entries, 10);
+}
+
+void test_prealloc_segmented(void)
+{
+    ldb_db_t db = {0};
+
+    remove_segments("test");
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, false) == LDB_OK);
+    TEST_ASSERT(ldb_set_preallocation(&db, 8192) == LDB_OK);
+    append_entries(&db, 10, 100);
+    TEST_ASSERT(db.num_segs > 2);
+
+    // sealed segments are trimmed
+    for (size_t i = 0; i + 1 < db.num_segs; i++) {
+        ldb_impl_t *seg = db.segs[i];
+        TEST_ASSERT(file_len(seg->dat_path) == seg->dat_end);
+    }
+
+    TEST_ASSERT(file_len(db.segs[db.num_segs - 1]->dat_path) == 8192);
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open_segmented(&db, "", "test", 1024, true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum2 == 100);
+    TEST_ASSERT(file_len(db.segs[db.num_segs - 1]->dat_path) == db.segs[db.num_segs - 1]->dat_end);
+    ldb_close(&db);
+}
+
+// records 100-999 of append_entries() are 22 bytes long (metadata + data)
+#define FIXED_LEN 22
+
+void test_fixed_invalid_args(void)
+{
+    ldb_db_t db = {0};
+    char buf[FIXED_LEN + 1] = {0};
+    ldb_entry_t entry = { .seqnum = 100, .timestamp = 100, .metadata_len = FIXED_LEN + 1, .metadata = buf };
+
+    TEST_ASSERT(ldb_open_fixed(NULL, "", "test", FIXED_LEN, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_fixed(&db, NULL, "test", FIXED_LEN, false) == LDB_ERR_ARG);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", 0, false) == LDB_ERR_ARG);
+
+    // records of another length
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 10, 20);
+    ldb_close(&db);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, true) == LDB_ERR_ENTRY_LEN);
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_OK);
+    TEST_ASSERT(ldb_append(&db, &entry, 1, NULL) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(db.state.seqnum2 == 0);
+    TEST_ASSERT(ldb_set_mmap_idx(&db, true) == LDB_ERR);
+    TEST_ASSERT(ldb_set_compression(&db, true) == LDB_ERR);
+    ldb_close(&db);
+}
+
+void test_fixed_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_entry_t entries[10] = {{0}};
+    ldb_stats_t stats = {0};
+    uint64_t seqnum = 0;
+    size_t num = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_OK);
+    append_entries(&db, 100, 999);
+    TEST_ASSERT(access("test.idx", F_OK) != 0);
+    TEST_ASSERT(db.dat_end == sizeof(ldb_header_dat_t) + 900 * (sizeof(ldb_record_dat_t) + FIXED_LEN));
+
+    TEST_ASSERT(ldb_read(&db, 500, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 500));
+    TEST_ASSERT(ldb_read(&db, 995, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 5);
+    TEST_ASSERT(check_entries(entries, num, 995));
+
+    TEST_ASSERT(ldb_search(&db, 555, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 560);
+    TEST_ASSERT(ldb_search(&db, 550, LDB_SEARCH_UPPER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 560);
+    TEST_ASSERT(ldb_search(&db, 550, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 550);
+
+    TEST_ASSERT(ldb_stats(&db, 0, 10000, &stats) == LDB_OK);
+    TEST_ASSERT(stats.num_entries == 900);
+    TEST_ASSERT(stats.index_size == 0);
+    TEST_ASSERT(stats.data_size == 900 * (sizeof(ldb_record_dat_t) + FIXED_LEN));
+
+    TEST_ASSERT(ldb_rollback(&db, 900) == 99);
+    TEST_ASSERT(db.state.seqnum2 == 900);
+    TEST_ASSERT(ldb_purge(&db, 200) == 100);
+    TEST_ASSERT(db.state.seqnum1 == 200);
+    TEST_ASSERT(ldb_read(&db, 200, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(num == 10);
+    TEST_ASSERT(check_entries(entries, num, 200));
+    TEST_ASSERT(ldb_search(&db, 700, LDB_SEARCH_LOWER, &seqnum) == LDB_OK);
+    TEST_ASSERT(seqnum == 700);
+    append_entries(&db, 901, 999);
+    ldb_close(&db);
+
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, (i == 1)) == LDB_OK);
+        TEST_ASSERT(db.state.seqnum1 == 200);
+        TEST_ASSERT(db.state.seqnum2 == 999);
+        TEST_ASSERT(db.state.timestamp2 == 990);
+        TEST_ASSERT(ldb_read(&db, 990, entries, 10, &num) == LDB_OK);
+        TEST_ASSERT(check_entries(entries, num, 990));
+        ldb_close(&db);
+    }
+
+    // same dat file format (index rebuilt by a regular open, removed by a fixed one)
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 200);
+    TEST_ASSERT(db.state.seqnum2 == 999);
+    TEST_ASSERT(ldb_read(&db, 300, entries, 10, &num) == LDB_OK);
+    TEST_ASSERT(check_entries(entries, num, 300));
+    ldb_close(&db);
+    TEST_ASSERT(access("test.idx", F_OK) == 0);
+
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_OK);
+    TEST_ASSERT(access("test.idx", F_OK) != 0);
+    ldb_close(&db);
+
+    ldb_free_entries(entries, 10);
+}
+
+void test_fixed_recovery(void)
+{
+    ldb_db_t db = {0};
+    size_t rec_len = sizeof(ldb_record_dat_t) + FIXED_LEN;
+    size_t len = sizeof(ldb_header_dat_t) + 900 * rec_len;
+    char c = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        bool check = (i == 1);
+
+        remove("test.dat");
+        remove("test.idx");
+        remove("test.chk");
+
+        TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_OK);
+        append_entries(&db, 100, 999);
+        ldb_close(&db);
+        remove("test.chk");
+
+        // incomplete last record
+        TEST_ASSERT(truncate("test.dat", (off_t)(len - 5)) == 0);
+        TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, check) == LDB_OK);
+        TEST_ASSERT(db.state.seqnum2 == 998);
+        TEST_ASSERT(file_len("test.dat") == len - rec_len);
+        ldb_close(&db);
+        remove("test.chk");
+
+        // zero-filled tail (preallocated)
+        TEST_ASSERT(truncate("test.dat", 1 << 20) == 0);
+        TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, check) == LDB_OK);
+        TEST_ASSERT(db.state.seqnum2 == 998);
+        TEST_ASSERT(file_len("test.dat") == len - rec_len);
+        ldb_close(&db);
+        remove("test.chk");
+
+        // corrupted last record
+        FILE *fp = fopen("test.dat", "r+");
+        TEST_ASSERT(fp != NULL);
+        TEST_ASSERT(fseek(fp, (long)(len - rec_len - 1), SEEK_SET) == 0);
+        TEST_ASSERT(fread(&c, 1, 1, fp) == 1);
+        c = (char) ~c;
+        TEST_ASSERT(fseek(fp, (long)(len - rec_len - 1), SEEK_SET) == 0);
+        TEST_ASSERT(fwrite(&c, 1, 1, fp) == 1);
+        fclose(fp);
+
+        if (check) {
+            TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, check) == LDB_ERR_CHECKSUM);
+            continue;
+        }
+
+        TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, check) == LDB_OK);
+        TEST_ASSERT(db.state.seqnum2 == 997);
+        TEST_ASSERT(file_len("test.dat") == len - 2 * rec_len);
+        ldb_close(&db);
+    }
+}
+
+void test_fixed_variable_db(void)
+{
+    ldb_db_t db = {0};
+    size_t len_dat = 0;
+    size_t len_idx = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    // record lengths are 22 (seqnum < 1000) and 24
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 100, 1009);
+    ldb_close(&db);
+
+    len_dat = file_len("test.dat");
+    len_idx = file_len("test.idx");
+
+    // nothing is truncated nor removed
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, false) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", FIXED_LEN, true) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", 20, false) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(ldb_open_fixed(&db, "", "test", 20, true) == LDB_ERR_ENTRY_LEN);
+    TEST_ASSERT(file_len("test.dat") == len_dat);
+    TEST_ASSERT(file_len("test.idx") == len_idx);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 100);
+    TEST_ASSERT(db.state.seqnum2 == 1009);
+    ldb_close(&db);
+}
+
+void test_checkpoint_nominal_case(void)
+{
+    ldb_db_t db = {0};
+    ldb_record_idx_t record = {0};
+    size_t pos1 = 0;
+    size_t pos2 = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 1000);
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 100, &record) == LDB_OK);
+    pos1 = record.pos + sizeof(ldb_record_dat_t);
+    TEST_ASSERT(read_checkpoint("test.chk") == 0);
+    ldb_close(&db);
+
+    // clean close writes the checkpoint
+    TEST_ASSERT(read_checkpoint("test.chk") == 1000);
+
+    // records before the checkpoint are not verified
+    overwrite_file("test.dat", pos1, "X", 1);
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 1000);
+    TEST_ASSERT(db.chk.seqnum == 1000);
+
+    append_entries(&db, 1001, 1100);
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 1050, &record) == LDB_OK);
+    pos2 = record.pos + sizeof(ldb_record_dat_t);
+
+    // emulates a crash (no checkpoint written)
+    db.chk_valid = false;
+    ldb_close(&db);
+    TEST_ASSERT(read_checkpoint("test.chk") == 1000);
+
+    // records after the checkpoint are verified
+    overwrite_file("test.dat", pos2, "X", 1);
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_ERR_CHECKSUM);
+    ldb_close(&db);
+
+    // no-check open does not advance an outdated checkpoint
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum2 == 1100);
+    TEST_ASSERT(!db.chk_valid);
+    ldb_close(&db);
+    TEST_ASSERT(read_checkpoint("test.chk") == 1000);
+}
+
+void test_checkpoint_rollback_purge(void)
+{
+    ldb_db_t db = {0};
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 300);
+    ldb_close(&db);
+    TEST_ASSERT(read_checkpoint("test.chk") == 300);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(db.chk_valid);
+    TEST_ASSERT(ldb_rollback(&db, 200) == 100);
+    TEST_ASSERT(access("test.chk", F_OK) != 0);
+    TEST_ASSERT(db.chk.seqnum == 0);
+    ldb_close(&db);
+    TEST_ASSERT(read_checkpoint("test.chk") == 200);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    TEST_ASSERT(ldb_purge(&db, 100) == 80);
+    TEST_ASSERT(access("test.chk", F_OK) != 0);
+    ldb_close(&db);
+    TEST_ASSERT(read_checkpoint("test.chk") == 200);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 100);
+    TEST_ASSERT(db.state.seqnum2 == 200);
+    ldb_close(&db);
+}
+
+void test_check_dat_parallel(void)
+{
+    ldb_db_t db = {0};
+    ldb_check_chunk_t chunks[LDB_CHECK_MAX_THREADS];
+    ldb_record_idx_t record = {0};
+    uint64_t zero = 0;
+    size_t pos = 0;
+    size_t pos1 = 0;
+    size_t pos2 = 0;
+    size_t len = 0;
+
+    remove("test.dat");
+    remove("test.idx");
+    remove("test.chk");
+
+    TEST_ASSERT(ldb_open(&db, "", "test", false) == LDB_OK);
+    append_entries(&db, 20, 2000);
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 21, &record) == LDB_OK);
+    pos = record.pos;
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 1200, &record) == LDB_OK);
+    pos1 = record.pos;
+    TEST_ASSERT(ldb_read_record_idx(&db, &db.state, 1500, &record) == LDB_OK);
+    pos2 = record.pos + sizeof(ldb_record_dat_t);
+    len = ldb_get_file_size(db.dat_fp);
+
+    // nominal case
+    db.state.seqnum2 = 20;
+    db.state.timestamp2 = 20;
+    TEST_ASSERT(ldb_check_split_dat(&db, pos, len, chunks, 4) == 4);
+    TEST_ASSERT(ldb_check_dat(&db, pos, len, 4) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum2 == 2000);
+    TEST_ASSERT(db.state.timestamp2 == 2000);
+
+    // corrupted record
+    overwrite_file("test.dat", pos2, "X", 1);
+    db.state.seqnum2 = 20;
+    db.state.timestamp2 = 20;
+    TEST_ASSERT(ldb_check_dat(&db, pos, len, 4) == LDB_ERR_CHECKSUM);
+
+    // removed record before the corrupted one (truncated)
+    overwrite_file("test.dat", pos1, &zero, sizeof(zero));
+    db.state.seqnum2 = 20;
+    db.state.timestamp2 = 20;
+    TEST_ASSERT(ldb_check_dat(&db, pos, len, 4) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum2 == 1199);
+    TEST_ASSERT(ldb_get_file_size(db.dat_fp) == pos1);
+    db.chk_valid = false;
+    ldb_close(&db);
+
+    TEST_ASSERT(ldb_open(&db, "", "test", true) == LDB_OK);
+    TEST_ASSERT(db.state.seqnum1 == 20);
+    TEST_ASSERT(db.state.seqnum2 == 1199);
+    ldb_close(&db);
+}
+
 TEST_LIST = {
     { "crc32()",                      test_crc32 },
+    { "crc32c()",                     test_crc32c },
     { "version()",                    test_version },
     { "strerror()",                   test_strerror },
     { "get_millis()",                 test_get_millis },
@@ -1380,25 +5103,100 @@ TEST_LIST = {
     { "open() dat corrupted",         test_open_dat_corrupted },
     { "open() idx check fails (I)",   test_open_idx_check_fails_1 },
     { "open() idx check fails (II)",  test_open_idx_check_fails_2 },
+    { "open() format 1",              test_open_format_1 },
     { "append() invalid args",        test_append_invalid_args },
     { "append() nothing",             test_append_nothing },
     { "append() auto",                test_append_auto },
     { "append() nominal case",        test_append_nominal_case },
     { "append() broken sequence",     test_append_broken_sequence },
     { "append() lack of data",        test_append_lack_of_data },
+    { "append() batch",               test_append_batch },
+    { "append() write error",         test_append_write_error },
+    { "append_async()",               test_append_async },
+    { "append_mt() invalid args",     test_append_mt_invalid_args },
     { "read() invalid args",          test_read_invalid_args },
     { "read() empty db",              test_read_empty_db },
     { "read() nominal case",          test_read_nominal_case },
+    { "read() mixed sizes",           test_read_mixed_sizes },
+    { "read_view() invalid args",     test_read_view_invalid_args },
+    { "read_view() nominal case",     test_read_view_nominal_case },
+    { "read_view() pinned",           test_read_view_pinned },
+    { "append_mt() concurrent",       test_append_mt_concurrent },
     { "stats() invalid args",         test_stats_invalid_args },
     { "stats() nominal case",         test_stats_nominal_case },
     { "search() invalid args",        test_search_invalid_args },
     { "search() nominal case",        test_search_nominal_case },
+    { "search() fences",              test_search_fences },
+    { "read()/search() concurrent",   test_read_concurrent },
     { "rollback() invalid args",      test_rollback_invalid_args },
     { "rollback() nominal case",      test_rollback_nominal_case },
+    { "rollback() interrupted",       test_rollback_interrupted },
     { "purge() invalid args",         test_purge_invalid_args },
     { "purge() empty db",             test_purge_empty_db },
     { "purge() nothing",              test_purge_nothing },
     { "purge() nominal case",         test_purge_nominal_case },
     { "purge() all",                  test_purge_all },
+    { "purge() online",               test_purge_online },
+    { "state snapshot",               test_state_snapshot },
+    { "set_mmap_idx() invalid args",  test_mmap_idx_invalid_args },
+    { "set_mmap_idx() nominal case",  test_mmap_idx_nominal_case },
+    { "segmented invalid args",       test_segmented_invalid_args },
+    { "segmented nominal case",       test_segmented_nominal_case },
+    { "segmented purge",              test_segmented_purge },
+    { "segmented rollback",           test_segmented_rollback },
+    { "export() invalid args",        test_export_invalid_args },
+    { "export() nominal case",        test_export_nominal_case },
+    { "export() pipe",                test_export_pipe },
+    { "export() segmented",           test_export_segmented },
+    { "append_raw() invalid args",    test_append_raw_invalid_args },
+    { "append_raw() nominal case",    test_append_raw_nominal_case },
+    { "key index invalid args",       test_key_index_invalid_args },
+    { "key index nominal case",       test_key_index_nominal_case },
+    { "key index segmented",          test_key_index_segmented },
+    { "wait() invalid args",          test_wait_invalid_args },
+    { "wait() nominal case",          test_wait_nominal_case },
+    { "wait() segmented",             test_wait_segmented },
+    { "flusher invalid args",         test_flusher_invalid_args },
+    { "flusher nominal case",         test_flusher_nominal_case },
+    { "flusher segmented",            test_flusher_segmented },
+    { "preallocation invalid args",   test_prealloc_invalid_args },
+    { "preallocation nominal case",   test_prealloc_nominal_case },
+    { "preallocation segmented",      test_prealloc_segmented },
+    { "fixed-length invalid args",    test_fixed_invalid_args },
+    { "fixed-length nominal case",    test_fixed_nominal_case },
+    { "fixed-length recovery",        test_fixed_recovery },
+    { "fixed-length variable db",     test_fixed_variable_db },
+    { "cursor invalid args",          test_cursor_invalid_args },
+    { "cursor nominal case",          test_cursor_nominal_case },
+    { "cursor big records",           test_cursor_big_records },
+    { "cursor segmented",             test_cursor_segmented },
+    { "set_cache() invalid args",     test_cache_invalid_args },
+    { "set_cache() nominal case",     test_cache_nominal_case },
+    { "cache segmented",              test_cache_segmented },
+    { "set_allocator()",              test_allocator },
+    { "read_arena() invalid args",    test_read_arena_invalid_args },
+    { "read_arena() nominal case",    test_read_arena_nominal_case },
+    { "read_arena() segmented",       test_read_arena_segmented },
+    { "partial read invalid args",    test_read_partial_invalid_args },
+    { "partial read nominal case",    test_read_partial_nominal_case },
+    { "partial read segmented",       test_read_partial_segmented },
+    { "wal invalid args",             test_wal_invalid_args },
+    { "wal nominal case",             test_wal_nominal_case },
+    { "wal recovery",                 test_wal_recovery },
+    { "wal concurrent",               test_wal_concurrent },
+    { "wal reclaim",                  test_wal_reclaim },
+    { "get_metrics() invalid args",   test_metrics_invalid_args },
+#ifndef LDB_NO_METRICS
+    { "metrics histogram",            test_metrics_histogram },
+    { "get_metrics() nominal case",   test_metrics_nominal_case },
+    { "metrics segmented",            test_metrics_segmented },
+#endif
+    { "lz4 roundtrip",                test_lz4_roundtrip },
+    { "set_compression() invalid args", test_compression_invalid_args },
+    { "set_compression() nominal case", test_compression_nominal_case },
+    { "compression segmented",        test_compression_segmented },
+    { "checkpoint nominal case",      test_checkpoint_nominal_case },
+    { "checkpoint rollback/purge",    test_checkpoint_rollback_purge },
+    { "check dat in parallel",        test_check_dat_parallel },
     { NULL, NULL }
 };